@@ -0,0 +1,288 @@
+/*-------------------------------------------------------------------------
+ *
+ * pg_check_bench.c
+ *	  Microbenchmarks of the check kernels.
+ *
+ * The pages of a table are copied into memory first, and then fed to the
+ * check kernels (page header checks, tuple checks, bitmap functions) in
+ * a loop, measuring the time of each kernel. The checks run in the quiet
+ * mode, so that the results are not affected by reporting (the pages are
+ * expected to be correct anyway).
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "catalog/pg_class.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "portability/instr_time.h"
+#include "storage/bufmgr.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+
+#include "common.h"
+#include "heap.h"
+#include "item-bitmap.h"
+
+#ifdef PG_MODULE_MAGIC
+PG_MODULE_MAGIC;
+#endif
+
+/* number of columns returned by pg_check_bench_kernels */
+#define BENCH_COLUMNS	7
+
+/* kernels to benchmark */
+typedef enum
+{
+	BENCH_PAGE_HEADER,
+	BENCH_HEAP_TUPLES,
+	BENCH_BITMAP_ADD,
+	BENCH_BITMAP_COUNT,
+	BENCH_BITMAP_COMPARE,
+	BENCH_KERNELS
+} BenchKernel;
+
+static const char *bench_kernel_names[] = {
+	"check_page_header",
+	"check_heap_tuples",
+	"bitmap_add_heap_items",
+	"bitmap_count",
+	"bitmap_compare"
+};
+
+Datum		pg_check_bench_kernels(PG_FUNCTION_ARGS);
+
+static double	bench_kernel(BenchKernel kernel, Relation rel, char *pages,
+							 BlockNumber npages, int loops);
+static item_bitmap *bench_bitmap(char *pages, BlockNumber npages);
+
+/*
+ * pg_check_bench_kernels
+ *
+ * Runs the kernels on the pages of the table, returns one row per kernel.
+ */
+PG_FUNCTION_INFO_V1(pg_check_bench_kernels);
+
+Datum
+pg_check_bench_kernels(PG_FUNCTION_ARGS)
+{
+	Oid				relid = PG_GETARG_OID(0);
+	int				loops = PG_GETARG_INT32(1);
+	ReturnSetInfo  *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext	oldcontext;
+	TupleDesc		tupdesc;
+	Tuplestorestate *tupstore;
+	Relation		rel;
+	BlockNumber		npages;
+	BlockNumber		blkno;
+	BufferAccessStrategy strategy;
+	char		   *pages;
+	int64			ntuples = 0;
+	int				kernel;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 (errmsg("must be superuser to use pg_check functions"))));
+
+	if (loops <= 0)
+		ereport(ERROR,
+				(errmsg("invalid number of loops %d", loops)));
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	rel = relation_open(relid, AccessShareLock);
+
+	if (rel->rd_rel->relkind != RELKIND_RELATION)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("object \"%s\" is not a table",
+						RelationGetRelationName(rel))));
+
+	npages = RelationGetNumberOfBlocks(rel);
+
+	if (npages == 0)
+		ereport(ERROR,
+				(errmsg("table \"%s\" is empty", RelationGetRelationName(rel))));
+
+	if ((Size) npages > MaxAllocSize / BLCKSZ)
+		ereport(ERROR,
+				(errmsg("table \"%s\" is too large for the benchmark (%u pages)",
+						RelationGetRelationName(rel), npages)));
+
+	/* copy the pages into memory, so that the kernels don't do any I/O */
+	pages = (char *) palloc((Size) npages * BLCKSZ);
+	strategy = GetAccessStrategy(BAS_BULKREAD);
+
+	for (blkno = 0; blkno < npages; blkno++)
+	{
+		Buffer	buf = ReadBufferExtended(rel, MAIN_FORKNUM, blkno, RBM_NORMAL, strategy);
+
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		memcpy(pages + (Size) blkno * BLCKSZ, BufferGetPage(buf), BLCKSZ);
+		UnlockReleaseBuffer(buf);
+
+		ntuples += PageGetMaxOffsetNumber(pages + (Size) blkno * BLCKSZ);
+	}
+
+	FreeAccessStrategy(strategy);
+
+	for (kernel = 0; kernel < BENCH_KERNELS; kernel++)
+	{
+		Datum	values[BENCH_COLUMNS];
+		bool	nulls[BENCH_COLUMNS];
+		double	seconds;
+
+		seconds = bench_kernel((BenchKernel) kernel, rel, pages, npages, loops);
+
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = CStringGetTextDatum(bench_kernel_names[kernel]);
+		values[1] = Int32GetDatum(loops);
+		values[2] = Int64GetDatum((int64) npages);
+		values[3] = Int64GetDatum(ntuples);
+		values[4] = Float8GetDatum(seconds);
+		values[5] = Float8GetDatum((seconds > 0) ? (double) npages * loops / seconds : 0);
+		values[6] = Float8GetDatum((ntuples > 0) ? seconds * 1e9 / ((double) ntuples * loops) : 0);
+		nulls[5] = (seconds <= 0);
+		nulls[6] = (seconds <= 0) || (ntuples == 0);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	pfree(pages);
+
+	relation_close(rel, AccessShareLock);
+
+	return (Datum) 0;
+}
+
+/*
+ * run the kernel on all the pages, 'loops' times, return the duration
+ * (in seconds) - the setup (e.g. building the bitmaps) is not included
+ */
+static double
+bench_kernel(BenchKernel kernel, Relation rel, char *pages, BlockNumber npages,
+			 int loops)
+{
+	instr_time	start;
+	instr_time	duration;
+	heap_layout *layout = NULL;
+	item_bitmap *bitmap_a = NULL;
+	item_bitmap *bitmap_b = NULL;
+	BlockNumber	blkno;
+	int			loop;
+	uint64		result = 0;	/* so that the calls are not optimized out */
+
+	/* the setup for the kernel */
+	if (kernel == BENCH_HEAP_TUPLES)
+		layout = heap_layout_build(rel);
+
+	if ((kernel == BENCH_BITMAP_COUNT) || (kernel == BENCH_BITMAP_COMPARE))
+		bitmap_a = bench_bitmap(pages, npages);
+
+	if (kernel == BENCH_BITMAP_COMPARE)
+		bitmap_b = bench_bitmap(pages, npages);
+
+	/* only count the issues, don't report them */
+	pgcheck_quiet = true;
+
+	INSTR_TIME_SET_CURRENT(start);
+
+	for (loop = 0; loop < loops; loop++)
+	{
+		switch (kernel)
+		{
+			case BENCH_PAGE_HEADER:
+				for (blkno = 0; blkno < npages; blkno++)
+					result += check_page_header((PageHeader) (pages + (Size) blkno * BLCKSZ), blkno);
+				break;
+
+			case BENCH_HEAP_TUPLES:
+				for (blkno = 0; blkno < npages; blkno++)
+				{
+					char   *page = pages + (Size) blkno * BLCKSZ;
+
+					result += check_heap_tuples(rel, layout, (PageHeader) page, page, blkno);
+				}
+				break;
+
+			case BENCH_BITMAP_ADD:
+				bitmap_free(bench_bitmap(pages, npages));
+				break;
+
+			case BENCH_BITMAP_COUNT:
+				result += bitmap_count(bitmap_a);
+				break;
+
+			case BENCH_BITMAP_COMPARE:
+				result += bitmap_compare(bitmap_a, bitmap_b, NULL, NULL);
+				break;
+
+			default:
+				elog(ERROR, "unknown kernel %d", kernel);
+		}
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, start);
+
+	pgcheck_quiet = false;
+
+	elog(DEBUG1, "kernel %s result " UINT64_FORMAT, bench_kernel_names[kernel], result);
+
+	if (layout != NULL)
+		heap_layout_free(layout);
+
+	if (bitmap_a != NULL)
+		bitmap_free(bitmap_a);
+
+	if (bitmap_b != NULL)
+		bitmap_free(bitmap_b);
+
+	return INSTR_TIME_GET_DOUBLE(duration);
+}
+
+/*
+ * build a bitmap with items from all the pages
+ */
+static item_bitmap *
+bench_bitmap(char *pages, BlockNumber npages)
+{
+	item_bitmap *bitmap = bitmap_init(npages);
+	BlockNumber	blkno;
+
+	for (blkno = 0; blkno < npages; blkno++)
+	{
+		char   *page = pages + (Size) blkno * BLCKSZ;
+
+		bitmap_add_heap_items(bitmap, (PageHeader) page, page, blkno);
+	}
+
+	return bitmap;
+}
@@ -0,0 +1,56 @@
+#!/bin/sh
+#
+# Runs the pg_check benchmarks against the database specified by the usual
+# libpq environment variables (PGDATABASE, PGHOST, ...). The pg_check
+# extension needs to be created in the database, and the pg_check_bench
+# library installed (make -C bench install).
+#
+# The parameters of the tables may be overridden using environment
+# variables (each is a space-separated list of values):
+#
+#   BENCH_ROWS, BENCH_WIDTH, BENCH_HOT, BENCH_INDEXES, BENCH_FILLFACTOR
+#
+# BENCH_RUNS is the number of runs of each check (pgbench transactions),
+# BENCH_LOOPS the number of loops for the kernel microbenchmarks.
+#
+
+set -e
+
+cd "$(dirname "$0")"
+
+ROWS=${BENCH_ROWS:-"100000 1000000"}
+WIDTH=${BENCH_WIDTH:-"16 256"}
+HOT=${BENCH_HOT:-"0 50"}
+INDEXES=${BENCH_INDEXES:-"1 4"}
+FILLFACTOR=${BENCH_FILLFACTOR:-"90"}
+RUNS=${BENCH_RUNS:-5}
+LOOPS=${BENCH_LOOPS:-10}
+
+PSQL="psql -X -q -v ON_ERROR_STOP=1"
+
+for rows in $ROWS; do
+for width in $WIDTH; do
+for hot in $HOT; do
+for indexes in $INDEXES; do
+for fillfactor in $FILLFACTOR; do
+
+	echo "=== rows=$rows width=$width hot=$hot% indexes=$indexes fillfactor=$fillfactor"
+
+	$PSQL -v rows=$rows -v width=$width -v hot=$hot -v indexes=$indexes \
+		  -v fillfactor=$fillfactor -f sql/setup.sql
+
+	for check in check-table check-indexes cross-check; do
+		echo "--- $check"
+		pgbench -n -t $RUNS -f sql/$check.sql 2>&1 | grep -E "latency average|tps"
+	done
+
+	echo "--- kernels"
+	$PSQL -v loops=$LOOPS -f sql/kernels.sql
+
+done
+done
+done
+done
+done
+
+$PSQL -c "DROP TABLE bench_table"
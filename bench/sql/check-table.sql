@@ -0,0 +1 @@
+SELECT pg_check_table('bench_table', false, false);
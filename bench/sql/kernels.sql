@@ -0,0 +1,18 @@
+--
+-- Microbenchmarks of the check kernels on pages of the bench_table (needs
+-- the pg_check_bench library, see bench/Makefile).
+--
+
+CREATE OR REPLACE FUNCTION pg_temp.pg_check_bench_kernels(table_relation regclass, nloops int4,
+                                                          OUT kernel text, OUT loops int4,
+                                                          OUT pages bigint, OUT tuples bigint,
+                                                          OUT seconds float8, OUT pages_per_sec float8,
+                                                          OUT ns_per_tuple float8)
+RETURNS SETOF record
+AS '$libdir/pg_check_bench', 'pg_check_bench_kernels'
+LANGUAGE C STRICT;
+
+SELECT kernel, loops, pages, tuples, round(seconds::numeric, 3) AS seconds,
+       round(pages_per_sec::numeric) AS pages_per_sec,
+       round(ns_per_tuple::numeric, 1) AS ns_per_tuple
+  FROM pg_temp.pg_check_bench_kernels('bench_table', :loops);
@@ -0,0 +1,31 @@
+--
+-- Builds the table for the benchmark, with parameters passed as psql variables:
+--
+--   rows       - number of rows
+--   width      - width of the text column (bytes)
+--   hot        - percentage of rows updated (HOT updates, creating HOT chains)
+--   indexes    - number of indexes
+--   fillfactor - fillfactor of the table (space for the HOT updates)
+--
+
+DROP TABLE IF EXISTS bench_table;
+
+CREATE TABLE bench_table (
+    id      INT,
+    upd     INT,
+    val     TEXT
+) WITH (fillfactor = :fillfactor);
+
+INSERT INTO bench_table SELECT i, 0, repeat('x', :width) FROM generate_series(1, :rows) s(i);
+
+-- the indexes are on 'id' only, so updates of 'upd' are HOT
+SELECT format('CREATE INDEX bench_table_idx_%s ON bench_table (id)', i)
+  FROM generate_series(1, :indexes) s(i) \gexec
+
+UPDATE bench_table SET upd = upd + 1 WHERE id % 100 < :hot;
+
+VACUUM ANALYZE bench_table;
+
+SELECT relpages, reltuples,
+       (SELECT count(*) FROM pg_index WHERE indrelid = 'bench_table'::regclass) AS indexes
+  FROM pg_class WHERE relname = 'bench_table';
@@ -0,0 +1,119 @@
+/*-------------------------------------------------------------------------
+ *
+ * fe-compat.c
+ *	  Backend symbols needed by the checks when built as a frontend program.
+ *
+ * The checks only use ereport (errstart / errmsg / errfinish), palloc
+ * (provided by libpgcommon) and a few global variables, so this is all
+ * that's needed to link them into pg_check_offline.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <pthread.h>
+
+#include "fe-compat.h"
+#include "stats.h"
+
+/* GUCs read when building the tuple layout (not used offline) */
+int			log_min_messages = WARNING;
+int			client_min_messages = NOTICE;
+
+/* the counters of each thread (summed at the end) */
+__thread check_stats pgcheck_stats;
+bool		pgcheck_track_timing = false;
+
+int			offline_min_messages = WARNING;
+
+/* held from errstart to errfinish, so the messages are not interleaved */
+static pthread_mutex_t message_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* file checked by the thread */
+static pthread_key_t message_file;
+
+/* the message being built (protected by message_lock) */
+static int	message_level;
+static char	message_text[2048];
+
+static const char *message_level_name(int elevel);
+
+void
+offline_messages_init(void)
+{
+	if (pthread_key_create(&message_file, NULL) != 0)
+	{
+		fprintf(stderr, "could not create thread-specific data key\n");
+		exit(2);
+	}
+}
+
+void
+offline_set_file(const char *path)
+{
+	pthread_setspecific(message_file, path);
+}
+
+bool
+errstart(int elevel, const char *filename, int lineno,
+		 const char *funcname, const char *domain)
+{
+	/* errors are always reported (and terminate the program) */
+	if (elevel < offline_min_messages && elevel < ERROR)
+		return false;
+
+	pthread_mutex_lock(&message_lock);
+
+	message_level = elevel;
+	message_text[0] = '\0';
+
+	return true;
+}
+
+int
+errmsg(const char *fmt,...)
+{
+	va_list		args;
+
+	va_start(args, fmt);
+	vsnprintf(message_text, sizeof(message_text), fmt, args);
+	va_end(args);
+
+	return 0;					/* return value does not matter */
+}
+
+void
+errfinish(int dummy,...)
+{
+	const char *path = (const char *) pthread_getspecific(message_file);
+	int			elevel = message_level;
+
+	printf("%s: %s:  %s\n", (path != NULL) ? path : "pg_check_offline",
+		   message_level_name(elevel), message_text);
+
+	if (elevel >= ERROR)
+	{
+		fflush(stdout);
+		exit(2);
+	}
+
+	pthread_mutex_unlock(&message_lock);
+}
+
+/* the same names as in the server log */
+static const char *
+message_level_name(int elevel)
+{
+	if (elevel >= ERROR)
+		return "ERROR";
+	else if (elevel >= WARNING)
+		return "WARNING";
+	else if (elevel >= NOTICE)
+		return "NOTICE";
+	else if (elevel >= INFO)
+		return "INFO";
+	else if (elevel >= LOG)
+		return "LOG";
+
+	return "DEBUG";
+}
@@ -0,0 +1,23 @@
+#ifndef FE_COMPAT_CHECK_H
+#define FE_COMPAT_CHECK_H
+
+#include "postgres.h"
+
+/*
+ * The checks shared with the extension report issues through ereport, so
+ * the offline checker provides its own errstart / errmsg / errfinish,
+ * printing the messages (with the file being checked) to stdout. The
+ * messages of concurrent threads are serialized, so a message is never
+ * interleaved with another one.
+ */
+
+/* Messages below this level are not printed (WARNING by default). */
+extern int	offline_min_messages;
+
+/* Initializes the message reporting (before starting the threads). */
+void offline_messages_init(void);
+
+/* Sets the file checked by this thread (used as a prefix of its messages). */
+void offline_set_file(const char *path);
+
+#endif   /* FE_COMPAT_CHECK_H */
@@ -0,0 +1,540 @@
+/*-------------------------------------------------------------------------
+ *
+ * pg_check_offline.c
+ *	  Checks relation files directly, without a running server.
+ *
+ * The files (segments of the main fork of tables and b-tree indexes) are
+ * read in large chunks, bypassing shared buffers, and checked by the same
+ * page and tuple checks as in the extension. That's useful for checking
+ * a base backup, or a stopped cluster, at the full speed of the storage.
+ *
+ * Without access to the catalog, the kind of the relation is determined
+ * from the pages (heap pages have no special space, b-tree pages have the
+ * b-tree opaque data), segments of other relations are skipped. For the
+ * same reason, the attributes of the tuples are not checked.
+ *
+ * The segments are checked by several threads (-j), the largest first.
+ * The reads are sequential (posix_fadvise), and the pages are dropped
+ * from the page cache once checked, unless reading with O_DIRECT (-d).
+ *
+ * Running this on the data directory of a running server may report
+ * issues on pages that are just being written.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "access/nbtree.h"
+#include "common/fe_memutils.h"
+#include "portability/instr_time.h"
+#include "storage/bufpage.h"
+
+#include "common.h"
+#include "fe-compat.h"
+#include "heap.h"
+#include "index.h"
+#include "stats.h"
+
+/* number of blocks read at once (1MB with 8kB pages) */
+#define OFFLINE_CHUNK_BLOCKS	128
+
+/* alignment of the read buffer (needed by O_DIRECT) */
+#define OFFLINE_BUFFER_ALIGN	4096
+
+#define OFFLINE_MAX_THREADS		128
+
+/* kind of relation the segment belongs to */
+typedef enum
+{
+	SEGMENT_UNKNOWN,			/* not known yet */
+	SEGMENT_OTHER,				/* not a heap / b-tree (not checked) */
+	SEGMENT_HEAP,
+	SEGMENT_BTREE
+} SegmentKind;
+
+/* segment file to check */
+typedef struct offline_segment
+{
+	char	   *path;
+	BlockNumber	first_block;	/* number of the first block (segno * RELSEG_SIZE) */
+	off_t		size;
+} offline_segment;
+
+/* results of a thread */
+typedef struct offline_result
+{
+	uint64		nerrs;			/* issues found */
+	uint64		nblocks;		/* blocks checked */
+	uint64		nempty;			/* new (empty) pages, not checked */
+	uint64		nskipped;		/* pages of unknown relations, not checked */
+	int			nfailed;		/* files that could not be read */
+	check_stats	stats;			/* counters of the checks (of this thread) */
+} offline_result;
+
+static const char *progname = "pg_check_offline";
+
+static offline_segment *segments = NULL;
+static int	nsegments = 0;
+static int	maxsegments = 0;
+
+/* next segment to check (protected by segment_lock) */
+static int	next_segment = 0;
+static pthread_mutex_t segment_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool	use_direct_io = false;
+
+/* message levels for the number of -v options */
+static const int verbosity_levels[] = {
+	WARNING, NOTICE, DEBUG1, DEBUG2, DEBUG3, DEBUG4, DEBUG5
+};
+
+static void usage(void);
+static void add_path(const char *path);
+static void add_directory(const char *path);
+static void add_segment(const char *path, const char *name, off_t size, bool explicit);
+static int	segment_cmp(const void *a, const void *b);
+static void *check_thread(void *arg);
+static void check_segment(offline_segment *segment, char *buffer, offline_result *result);
+static SegmentKind page_kind(PageHeader header);
+static uint32 check_page(SegmentKind kind, char *page, BlockNumber blkno);
+
+int
+main(int argc, char **argv)
+{
+	int			nthreads = 1;
+	pthread_t	threads[OFFLINE_MAX_THREADS];
+	offline_result results[OFFLINE_MAX_THREADS];
+	offline_result total;
+	instr_time	start;
+	instr_time	duration;
+	double		seconds;
+	int			verbosity = 0;
+	int			c;
+	int			i;
+
+	while ((c = getopt(argc, argv, "dhj:v")) != -1)
+	{
+		switch (c)
+		{
+			case 'd':
+#ifdef O_DIRECT
+				use_direct_io = true;
+#else
+				fprintf(stderr, "%s: O_DIRECT is not supported on this platform\n", progname);
+				exit(2);
+#endif
+				break;
+
+			case 'j':
+				nthreads = atoi(optarg);
+				if (nthreads < 1 || nthreads > OFFLINE_MAX_THREADS)
+				{
+					fprintf(stderr, "%s: invalid number of threads \"%s\" (1 .. %d)\n",
+							progname, optarg, OFFLINE_MAX_THREADS);
+					exit(2);
+				}
+				break;
+
+			case 'v':
+				/* each -v shows more details (NOTICE, DEBUG1, DEBUG2, ...) */
+				if (verbosity < lengthof(verbosity_levels) - 1)
+					offline_min_messages = verbosity_levels[++verbosity];
+				break;
+
+			case 'h':
+				usage();
+				exit(0);
+
+			default:
+				usage();
+				exit(2);
+		}
+	}
+
+	if (optind >= argc)
+	{
+		usage();
+		exit(2);
+	}
+
+	for (i = optind; i < argc; i++)
+		add_path(argv[i]);
+
+	/* the largest segments first, so that the threads finish together */
+	qsort(segments, nsegments, sizeof(offline_segment), segment_cmp);
+
+	offline_messages_init();
+
+	INSTR_TIME_SET_CURRENT(start);
+
+	nthreads = Min(nthreads, Max(nsegments, 1));
+
+	memset(results, 0, sizeof(results));
+
+	for (i = 0; i < nthreads; i++)
+	{
+		if (pthread_create(&threads[i], NULL, check_thread, &results[i]) != 0)
+		{
+			fprintf(stderr, "%s: could not create thread: %s\n", progname, strerror(errno));
+			exit(2);
+		}
+	}
+
+	memset(&total, 0, sizeof(total));
+
+	for (i = 0; i < nthreads; i++)
+	{
+		pthread_join(threads[i], NULL);
+
+		total.nerrs += results[i].nerrs;
+		total.nblocks += results[i].nblocks;
+		total.nempty += results[i].nempty;
+		total.nskipped += results[i].nskipped;
+		total.nfailed += results[i].nfailed;
+
+		total.stats.pages += results[i].stats.pages;
+		total.stats.tuples += results[i].stats.tuples;
+		total.stats.attributes += results[i].stats.attributes;
+	}
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, start);
+	seconds = INSTR_TIME_GET_DOUBLE(duration);
+
+	printf("checked %d files, " UINT64_FORMAT " blocks (" UINT64_FORMAT " empty and "
+		   UINT64_FORMAT " of unknown relations skipped), " UINT64_FORMAT " tuples, "
+		   UINT64_FORMAT " issues found",
+		   nsegments - total.nfailed, total.nblocks, total.nempty, total.nskipped,
+		   total.stats.tuples, total.nerrs);
+
+	if (seconds > 0)
+		printf(", %.1f MB/s", (double) (total.nblocks + total.nempty + total.nskipped) *
+			   BLCKSZ / (1024.0 * 1024.0) / seconds);
+
+	printf("\n");
+
+	if (total.nfailed > 0)
+		exit(2);
+
+	return (total.nerrs > 0) ? 1 : 0;
+}
+
+static void
+usage(void)
+{
+	printf("%s checks PostgreSQL relation files (tables and b-tree indexes) offline.\n\n", progname);
+	printf("Usage:\n");
+	printf("  %s [OPTION]... PATH...\n\n", progname);
+	printf("PATH is a relation segment file (e.g. base/16384/16385.1), or a directory\n");
+	printf("with relation files (e.g. base/16384).\n\n");
+	printf("Options:\n");
+	printf("  -d       read the files with O_DIRECT\n");
+	printf("  -j NUM   check the files using NUM threads (default 1)\n");
+	printf("  -v       print more details (may be repeated)\n");
+	printf("  -h       show this help, then exit\n\n");
+	printf("Exit status is 0 when no issues were found, 1 when some were found, and 2\n");
+	printf("when some of the files could not be checked.\n");
+}
+
+/* a file or a directory with relation files */
+static void
+add_path(const char *path)
+{
+	struct stat st;
+
+	if (stat(path, &st) < 0)
+	{
+		fprintf(stderr, "%s: could not stat \"%s\": %s\n", progname, path, strerror(errno));
+		exit(2);
+	}
+
+	if (S_ISDIR(st.st_mode))
+		add_directory(path);
+	else if (S_ISREG(st.st_mode))
+		add_segment(path, last_dir_separator(path) ? last_dir_separator(path) + 1 : path,
+					st.st_size, true);
+	else
+	{
+		fprintf(stderr, "%s: \"%s\" is not a file or a directory\n", progname, path);
+		exit(2);
+	}
+}
+
+/* main fork segments in the directory (named relfilenode[.segno]) */
+static void
+add_directory(const char *path)
+{
+	DIR		   *dir;
+	struct dirent *de;
+
+	if ((dir = opendir(path)) == NULL)
+	{
+		fprintf(stderr, "%s: could not open directory \"%s\": %s\n", progname, path, strerror(errno));
+		exit(2);
+	}
+
+	while ((de = readdir(dir)) != NULL)
+	{
+		char		file[MAXPGPATH];
+		struct stat st;
+
+		if (strspn(de->d_name, "0123456789.") != strlen(de->d_name) ||
+			!isdigit((unsigned char) de->d_name[0]))
+			continue;
+
+		snprintf(file, sizeof(file), "%s/%s", path, de->d_name);
+
+		if (stat(file, &st) < 0 || !S_ISREG(st.st_mode))
+			continue;
+
+		add_segment(file, de->d_name, st.st_size, false);
+	}
+
+	closedir(dir);
+}
+
+/* add the segment, with the segment number from the name (16385.1 etc.) */
+static void
+add_segment(const char *path, const char *name, off_t size, bool explicit)
+{
+	const char *dot = strchr(name, '.');
+	unsigned long segno = 0;
+
+	if (dot != NULL)
+	{
+		char	   *end;
+
+		segno = strtoul(dot + 1, &end, 10);
+
+		if (*end != '\0')
+		{
+			/* explicitly listed files are checked anyway (as segment 0) */
+			if (!explicit)
+				return;
+			segno = 0;
+		}
+	}
+
+	if (nsegments == maxsegments)
+	{
+		maxsegments = Max(1024, maxsegments * 2);
+		segments = (offline_segment *) pg_realloc(segments, sizeof(offline_segment) * maxsegments);
+	}
+
+	segments[nsegments].path = pg_strdup(path);
+	segments[nsegments].first_block = (BlockNumber) (segno * RELSEG_SIZE);
+	segments[nsegments].size = size;
+	nsegments++;
+}
+
+/* largest segments first */
+static int
+segment_cmp(const void *a, const void *b)
+{
+	const offline_segment *sa = (const offline_segment *) a;
+	const offline_segment *sb = (const offline_segment *) b;
+
+	if (sa->size != sb->size)
+		return (sa->size > sb->size) ? -1 : 1;
+
+	return strcmp(sa->path, sb->path);
+}
+
+/* grab segments and check them, until there are none left */
+static void *
+check_thread(void *arg)
+{
+	offline_result *result = (offline_result *) arg;
+	char	   *raw_buffer;
+	char	   *buffer;
+
+	raw_buffer = (char *) pg_malloc(OFFLINE_CHUNK_BLOCKS * BLCKSZ + OFFLINE_BUFFER_ALIGN);
+	buffer = (char *) TYPEALIGN(OFFLINE_BUFFER_ALIGN, raw_buffer);
+
+	for (;;)
+	{
+		offline_segment *segment = NULL;
+
+		pthread_mutex_lock(&segment_lock);
+		if (next_segment < nsegments)
+			segment = &segments[next_segment++];
+		pthread_mutex_unlock(&segment_lock);
+
+		if (segment == NULL)
+			break;
+
+		check_segment(segment, buffer, result);
+	}
+
+	pg_free(raw_buffer);
+
+	/* the counters are per thread, summed by the main thread */
+	result->stats = pgcheck_stats;
+
+	return NULL;
+}
+
+/* read the segment in chunks and check the pages */
+static void
+check_segment(offline_segment *segment, char *buffer, offline_result *result)
+{
+	int			fd;
+	int			flags = O_RDONLY | PG_BINARY;
+	off_t		offset = 0;
+	SegmentKind	kind = SEGMENT_UNKNOWN;
+
+	offline_set_file(segment->path);
+
+#ifdef O_DIRECT
+	if (use_direct_io)
+		flags |= O_DIRECT;
+#endif
+
+	if ((fd = open(segment->path, flags, 0)) < 0)
+	{
+		ereport(WARNING,
+				(errmsg("could not open file: %s", strerror(errno))));
+		result->nfailed++;
+		return;
+	}
+
+#ifdef USE_POSIX_FADVISE
+	(void) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	for (;;)
+	{
+		ssize_t		nread;
+		int			nblocks;
+		int			i;
+
+		nread = pread(fd, buffer, OFFLINE_CHUNK_BLOCKS * BLCKSZ, offset);
+
+		if (nread < 0)
+		{
+			ereport(WARNING,
+					(errmsg("could not read block %u: %s",
+							segment->first_block + (BlockNumber) (offset / BLCKSZ),
+							strerror(errno))));
+			result->nfailed++;
+			break;
+		}
+
+		if (nread == 0)
+			break;
+
+		nblocks = nread / BLCKSZ;
+
+		/* a partial block at the end of the file */
+		if (nblocks == 0)
+		{
+			ereport(WARNING,
+					(errmsg("[%u] partial block (%d bytes) at the end of the file",
+							segment->first_block + (BlockNumber) (offset / BLCKSZ),
+							(int) nread)));
+			result->nerrs++;
+			break;
+		}
+
+		for (i = 0; i < nblocks; i++)
+		{
+			char	   *page = buffer + (Size) i * BLCKSZ;
+			BlockNumber	blkno = segment->first_block + (BlockNumber) (offset / BLCKSZ) + i;
+
+			/* new pages are valid (e.g. after the relation was extended) */
+			if (PageIsNew(page))
+			{
+				result->nempty++;
+				continue;
+			}
+
+			/*
+			 * All pages of the segment are then checked as this kind. A page
+			 * with an invalid header says nothing about the kind, so it's
+			 * reported and the kind is determined from the next page.
+			 */
+			if (kind == SEGMENT_UNKNOWN)
+			{
+				if (!page_header_clean((PageHeader) page))
+				{
+					ereport(WARNING,
+							(errmsg("[%u] invalid page header (lower %d, upper %d, special %d), can't determine the kind of relation",
+									blkno, ((PageHeader) page)->pd_lower,
+									((PageHeader) page)->pd_upper,
+									((PageHeader) page)->pd_special)));
+					result->nerrs++;
+					result->nskipped++;
+					continue;
+				}
+
+				kind = page_kind((PageHeader) page);
+			}
+
+			if (kind == SEGMENT_OTHER)
+			{
+				result->nskipped++;
+				continue;
+			}
+
+			result->nerrs += check_page(kind, page, blkno);
+			result->nblocks++;
+		}
+
+		/* don't keep the checked pages in page cache */
+#ifdef USE_POSIX_FADVISE
+		if (!use_direct_io)
+			(void) posix_fadvise(fd, offset, (off_t) nblocks * BLCKSZ, POSIX_FADV_DONTNEED);
+#endif
+
+		offset += (off_t) nblocks * BLCKSZ;
+	}
+
+	close(fd);
+
+	offline_set_file(NULL);
+}
+
+/* guess the kind of relation from the special space of the page */
+static SegmentKind
+page_kind(PageHeader header)
+{
+	if (header->pd_special == BLCKSZ)
+		return SEGMENT_HEAP;
+
+	/* the other index AMs with the same size use page ids > MAX_BT_CYCLE_ID */
+	if (header->pd_special == BLCKSZ - MAXALIGN(sizeof(BTPageOpaqueData)) &&
+		((BTPageOpaque) ((char *) header + header->pd_special))->btpo_cycleid <= MAX_BT_CYCLE_ID)
+		return SEGMENT_BTREE;
+
+	return SEGMENT_OTHER;
+}
+
+/* the same checks as pg_check_table / pg_check_index do for each page */
+static uint32
+check_page(SegmentKind kind, char *page, BlockNumber blkno)
+{
+	PageHeader	header = (PageHeader) page;
+	uint32		nerrs = 0;
+
+	if (kind == SEGMENT_HEAP)
+	{
+		nerrs += check_page_header(header, blkno);
+		nerrs += check_heap_tuples(NULL, NULL, header, page, blkno);
+	}
+	else
+	{
+		nerrs += check_index_page(NULL, header, page, blkno);
+
+		if (blkno > 0)
+			nerrs += check_index_tuples(NULL, header, page, blkno);
+	}
+
+	return nerrs;
+}
@@ -0,0 +1,120 @@
+-- Adjust this setting to control where the objects get created.
+SET search_path = public;
+
+--
+-- pg_check_table()
+--
+
+CREATE OR REPLACE FUNCTION pg_check_table(table_relation regclass, check_indexes bool, cross_check bool, workers int4 DEFAULT 0, incremental bool DEFAULT false)
+RETURNS int4
+AS '$libdir/pg_check', 'pg_check_table'
+LANGUAGE C STRICT;
+
+COMMENT ON FUNCTION pg_check_table(regclass, bool, bool, int4, bool) IS 'checks consistency of the whole table (and optionally all indexes on it)';
+
+CREATE OR REPLACE FUNCTION pg_check_table(table_relation regclass, block_start bigint, block_end bigint)
+RETURNS int4
+AS '$libdir/pg_check', 'pg_check_table_pages'
+LANGUAGE C STRICT;
+
+COMMENT ON FUNCTION pg_check_table(regclass, bigint, bigint) IS 'checks consistency of a part of the table (range of pages)';
+
+--
+-- pg_check_index()
+--
+
+CREATE OR REPLACE FUNCTION pg_check_index(index_relation regclass, check_structure bool DEFAULT false)
+RETURNS int4
+AS '$libdir/pg_check', 'pg_check_index'
+LANGUAGE C STRICT;
+
+COMMENT ON FUNCTION pg_check_index(regclass, bool) IS 'checks consistency of the whole index (and optionally the tree structure)';
+
+CREATE OR REPLACE FUNCTION pg_check_index(index_relation regclass, block_start bigint, block_end bigint)
+RETURNS int4
+AS '$libdir/pg_check', 'pg_check_index_pages'
+LANGUAGE C STRICT;
+
+COMMENT ON FUNCTION pg_check_index(regclass, bigint, bigint) IS 'checks consistency of a part of the index (range of pages)';
+
+--
+-- pg_check_resume()
+--
+
+CREATE OR REPLACE FUNCTION pg_check_resume(relation regclass)
+RETURNS int4
+AS '$libdir/pg_check', 'pg_check_resume'
+LANGUAGE C STRICT;
+
+COMMENT ON FUNCTION pg_check_resume(regclass) IS 'continues an interrupted check of a table or an index (see pg_check.checkpoint_blocks)';
+
+--
+-- pg_check_database()
+--
+
+CREATE OR REPLACE FUNCTION pg_check_database(workers int4 DEFAULT 0, check_indexes bool DEFAULT true, cross_check bool DEFAULT false, incremental bool DEFAULT false)
+RETURNS int4
+AS '$libdir/pg_check', 'pg_check_database'
+LANGUAGE C STRICT;
+
+COMMENT ON FUNCTION pg_check_database(int4, bool, bool, bool) IS 'checks consistency of all tables (and optionally all indexes) in the current database';
+
+--
+-- pg_check_table_report(), pg_check_index_report()
+--
+
+CREATE OR REPLACE FUNCTION pg_check_table_report(table_relation regclass, check_indexes bool DEFAULT false, cross_check bool DEFAULT false,
+                                                 OUT relid regclass, OUT index_relid regclass, OUT blkno bigint, OUT offnum int4,
+                                                 OUT check_code text, OUT severity text, OUT detail text)
+RETURNS SETOF record
+AS '$libdir/pg_check', 'pg_check_table_report'
+LANGUAGE C STRICT;
+
+COMMENT ON FUNCTION pg_check_table_report(regclass, bool, bool) IS 'checks consistency of the whole table (and optionally all indexes on it), returns the issues found';
+
+CREATE OR REPLACE FUNCTION pg_check_index_report(index_relation regclass,
+                                                 OUT relid regclass, OUT index_relid regclass, OUT blkno bigint, OUT offnum int4,
+                                                 OUT check_code text, OUT severity text, OUT detail text)
+RETURNS SETOF record
+AS '$libdir/pg_check', 'pg_check_index_report'
+LANGUAGE C STRICT;
+
+COMMENT ON FUNCTION pg_check_index_report(regclass) IS 'checks consistency of the whole index, returns the issues found';
+
+--
+-- pg_check_progress(), pg_stat_progress_check
+--
+
+CREATE OR REPLACE FUNCTION pg_check_progress(OUT pid int4, OUT datid oid, OUT relid oid, OUT phase text,
+                                             OUT index_relid oid, OUT indexes_total int4, OUT indexes_done int4,
+                                             OUT blocks_total bigint, OUT blocks_done bigint, OUT errors bigint,
+                                             OUT start_time timestamptz, OUT phase_start timestamptz)
+RETURNS SETOF record
+AS '$libdir/pg_check', 'pg_check_progress'
+LANGUAGE C STRICT;
+
+COMMENT ON FUNCTION pg_check_progress() IS 'returns progress of the running checks (requires pg_check in shared_preload_libraries)';
+
+CREATE VIEW pg_stat_progress_check AS
+    SELECT p.pid, p.datid, d.datname, p.relid::regclass AS relid, p.phase,
+           p.index_relid::regclass AS index_relid, p.indexes_total, p.indexes_done,
+           p.blocks_total, p.blocks_done, p.errors, p.start_time, p.phase_start,
+           round((p.blocks_done * current_setting('block_size')::bigint / 1048576.0 /
+                  nullif(extract(epoch FROM now() - p.phase_start), 0))::numeric, 2) AS phase_mbps
+      FROM pg_check_progress() p LEFT JOIN pg_database d ON (d.oid = p.datid);
+
+--
+-- pg_check_stats()
+--
+
+CREATE OR REPLACE FUNCTION pg_check_stats(OUT pages bigint, OUT tuples bigint, OUT attributes bigint,
+                                          OUT buffer_hits bigint, OUT buffer_misses bigint, OUT total_time float8,
+                                          OUT read_time float8, OUT copy_time float8, OUT header_time float8,
+                                          OUT tuple_time float8, OUT index_time float8,
+                                          OUT bitmap_build_time float8, OUT bitmap_compare_time float8,
+                                          OUT checksum_time float8)
+RETURNS record
+AS '$libdir/pg_check', 'pg_check_stats'
+LANGUAGE C STRICT;
+
+COMMENT ON FUNCTION pg_check_stats() IS 'returns counters and timing (in milliseconds) of the last check in this session';
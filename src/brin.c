@@ -0,0 +1,187 @@
+#include "index.h"
+#include "common.h"
+
+#if (PG_VERSION_NUM >= 90500)
+
+#include "access/brin.h"
+#include "access/brin_page.h"
+#include "access/brin_tuple.h"
+
+/* limit of the pages_per_range option */
+#define BRIN_MAX_RANGE_PAGES	131072
+
+static bool brin_special_valid(PageHeader header);
+static uint32 check_brin_meta(char *buffer, int block);
+static uint32 check_brin_revmap(char *buffer, int block);
+
+/* checks the page header, special space, page type and the metapage */
+uint32 check_brin_page(Relation rel, PageHeader header, char *buffer, int block) {
+
+	uint32 nerrs = 0;
+	uint16 type;
+
+	nerrs += check_page_header(header, block);
+
+	if (!brin_special_valid(header)) {
+		check_report(WARNING, block, 0, "index_special",
+					 "special space size %d does not match BRIN page (%d)",
+					 BLCKSZ - header->pd_special, (int) MAXALIGN(sizeof(BrinSpecialSpace)));
+		return ++nerrs;
+	}
+
+	type = BrinPageType(buffer);
+
+	if ((type != BRIN_PAGETYPE_META) && (type != BRIN_PAGETYPE_REVMAP) &&
+		(type != BRIN_PAGETYPE_REGULAR)) {
+		check_report(WARNING, block, 0, "brin_page_type", "page has invalid type 0x%04x", type);
+		return ++nerrs;
+	}
+
+	/* the metapage is always the first block */
+	if ((block == BRIN_METAPAGE_BLKNO) != (type == BRIN_PAGETYPE_META)) {
+		check_report(WARNING, block, 0, "brin_meta",
+					 (block == BRIN_METAPAGE_BLKNO) ? "block is not a metapage" : "unexpected metapage");
+		nerrs++;
+	} else if (block == BRIN_METAPAGE_BLKNO) {
+		nerrs += check_brin_meta(buffer, block);
+	}
+
+	return nerrs;
+
+}
+
+/* checks the summary tuples on regular pages, and the pointers to them on
+ * the range map pages */
+uint32 check_brin_tuples(Relation rel, PageHeader header, char *buffer, int block) {
+
+	uint32 nerrs = 0;
+	int ntuples;
+	OffsetNumber offnum;
+	BlockNumber pagesPerRange = (rel != NULL) ? BrinGetPagesPerRange(rel) : 0;
+
+	if (!brin_special_valid(header)) {
+		return 0;
+	}
+
+	if (BrinPageType(buffer) == BRIN_PAGETYPE_REVMAP) {
+		return check_brin_revmap(buffer, block);
+	}
+
+	if (BrinPageType(buffer) != BRIN_PAGETYPE_REGULAR) {
+		return 0;
+	}
+
+	ntuples = Min(PageGetMaxOffsetNumber(buffer), MaxIndexTuplesPerPage);
+
+	for (offnum = FirstOffsetNumber; offnum <= ntuples; offnum++) {
+
+		BrinTuple *tuple;
+		int len;
+
+		if (!check_index_item(header, block, offnum, SizeOfBrinTuple, &nerrs)) {
+			continue;
+		}
+
+		tuple = (BrinTuple *) PageGetItem(buffer, PageGetItemId(buffer, offnum));
+		len = ItemIdGetLength(PageGetItemId(buffer, offnum));
+
+		if (BrinTupleDataOffset(tuple) > len) {
+			check_report(WARNING, block, offnum, "brin_tuple_offset",
+						 "data offset %d exceeds the tuple length %d", (int) BrinTupleDataOffset(tuple), len);
+			nerrs++;
+		}
+
+		/* each range starts at a multiple of pages_per_range */
+		if ((pagesPerRange > 0) && (tuple->bt_blkno % pagesPerRange != 0)) {
+			check_report(WARNING, block, offnum, "brin_range_start",
+						 "range starts at block %u, not a multiple of pages_per_range %u",
+						 tuple->bt_blkno, pagesPerRange);
+			nerrs++;
+		}
+	}
+
+	/* check intersection of the tuples (all at once) */
+	nerrs += check_item_overlaps(header, block, ntuples);
+
+	if (nerrs > 0) {
+		check_report(WARNING, block, 0, "page_corrupted", "is probably corrupted, there were %d errors reported", nerrs);
+	}
+
+	return nerrs;
+
+}
+
+/* the special space has the size of the BRIN special space */
+static bool brin_special_valid(PageHeader header) {
+
+	return (header->pd_special == BLCKSZ - MAXALIGN(sizeof(BrinSpecialSpace)));
+
+}
+
+/* magic, version, and the size of the ranges */
+static uint32 check_brin_meta(char *buffer, int block) {
+
+	uint32 nerrs = 0;
+	BrinMetaPageData *meta = (BrinMetaPageData *) PageGetContents(buffer);
+
+	if (meta->brinMagic != BRIN_META_MAGIC) {
+		check_report(WARNING, block, 0, "meta_magic", "metapage contains invalid magic number %d (should be %d)", meta->brinMagic, BRIN_META_MAGIC);
+		nerrs++;
+	}
+
+	if (meta->brinVersion != BRIN_CURRENT_VERSION) {
+		check_report(WARNING, block, 0, "meta_version", "metapage contains invalid version %d (should be %d)", meta->brinVersion, BRIN_CURRENT_VERSION);
+		nerrs++;
+	}
+
+	if ((meta->pagesPerRange < 1) || (meta->pagesPerRange > BRIN_MAX_RANGE_PAGES)) {
+		check_report(WARNING, block, 0, "brin_pages_per_range",
+					 "metapage contains invalid pages_per_range %u (should be between 1 and %d)",
+					 meta->pagesPerRange, BRIN_MAX_RANGE_PAGES);
+		nerrs++;
+	}
+
+	/* the range map follows the metapage */
+	if (meta->lastRevmapPage == BRIN_METAPAGE_BLKNO) {
+		check_report(WARNING, block, 0, "brin_revmap", "the last range map page is the metapage");
+		nerrs++;
+	}
+
+	return nerrs;
+
+}
+
+/* the pointers to the summary tuples (the range map) */
+static uint32 check_brin_revmap(char *buffer, int block) {
+
+	uint32 nerrs = 0;
+	RevmapContents *contents = (RevmapContents *) PageGetContents(buffer);
+	int i;
+
+	for (i = 0; i < REVMAP_PAGE_MAXITEMS; i++) {
+
+		ItemPointer tid = &contents->rm_tids[i];
+
+		/* range not summarized (zeroed, or reset by a desummarization) */
+		if ((IndexTidOffset(tid) == InvalidOffsetNumber) &&
+			((IndexTidBlock(tid) == 0) ||
+			 (IndexTidBlock(tid) == InvalidBlockNumber))) {
+			continue;
+		}
+
+		if ((IndexTidBlock(tid) == BRIN_METAPAGE_BLKNO) ||
+			(IndexTidBlock(tid) == InvalidBlockNumber) ||
+			(IndexTidOffset(tid) < FirstOffsetNumber) ||
+			(IndexTidOffset(tid) > MaxIndexTuplesPerPage)) {
+			check_report(WARNING, block, 0, "brin_revmap",
+						 "range map entry %d points to an invalid item (%u,%u)", i,
+						 IndexTidBlock(tid), IndexTidOffset(tid));
+			nerrs++;
+		}
+	}
+
+	return nerrs;
+
+}
+
+#endif
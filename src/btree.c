@@ -0,0 +1,498 @@
+#include "btree.h"
+#include "common.h"
+#include "index.h"
+#include "pg_check.h"
+#include "progress.h"
+#include "scan.h"
+
+#include "access/nbtree.h"
+#include "utils/memutils.h"
+
+/* number of key attributes, and the downlink (INCLUDE columns in 11) */
+#if (PG_VERSION_NUM >= 110000)
+#define BTREE_NKEYATTS(rel)		IndexRelationGetNumberOfKeyAttributes(rel)
+#define BTREE_DOWNLINK(itup)	BTreeInnerTupleGetDownLink(itup)
+#else
+#define BTREE_NKEYATTS(rel)		RelationGetNumberOfAttributes(rel)
+#define BTREE_DOWNLINK(itup)	ItemPointerGetBlockNumber(&(itup)->t_tid)
+#endif
+
+/* a split not finished yet (the right half has no downlink) */
+#if (PG_VERSION_NUM >= 90400)
+#define BTREE_INCOMPLETE_SPLIT(opaque)	P_INCOMPLETE_SPLIT(opaque)
+#else
+#define BTREE_INCOMPLETE_SPLIT(opaque)	false
+#endif
+
+#define BTREE_ITEM(page, off)	((IndexTuple) PageGetItem((page), PageGetItemId((page), (off))))
+
+/* state of the walk */
+typedef struct btree_walk {
+
+	Relation	rel;
+	BlockNumber	nblocks;		/* size of the index */
+	int			nkeyatts;		/* number of key attributes */
+	block_scan	scan;			/* reads (and throttles) the pages */
+	MemoryContext cxt;			/* scan keys etc. (reset after each page) */
+	uint32		nerrs;
+
+	/* the parent level (page with the next downlink) */
+	char	   *parent;			/* copy of the parent page */
+	BlockNumber	parent_blkno;
+	OffsetNumber parent_off;	/* next downlink on the parent page */
+	OffsetNumber prefetched;	/* downlinks prefetched up to this one */
+
+	/* the level being checked */
+	char	   *page;			/* copy of the current page */
+	IndexTuple	left_hikey;		/* high key of the left sibling (leaf level) */
+
+} btree_walk;
+
+static bool btree_read(btree_walk *walk, BlockNumber blkno, char *page);
+static bool btree_page_valid(btree_walk *walk, char *page, BlockNumber blkno);
+static BlockNumber btree_walk_level(btree_walk *walk, BlockNumber parent_leftmost, uint32 level);
+static BlockNumber btree_next_downlink(btree_walk *walk, IndexTuple *key);
+static void btree_prefetch_downlinks(btree_walk *walk);
+static void btree_check_keys(btree_walk *walk, char *page, BlockNumber blkno);
+static bool btree_key_above(btree_walk *walk, IndexTuple key, char *page, OffsetNumber off);
+
+/* walk the tree from the root, level by level */
+uint32 check_btree_structure(Relation rel, BufferAccessStrategy strategy) {
+
+	btree_walk	walk;
+	BTMetaPageData *metad;
+	BTPageOpaque opaque;
+	BlockNumber	root;
+	BlockNumber	leftmost;
+	uint32		level;
+
+	memset(&walk, 0, sizeof(btree_walk));
+
+	walk.rel = rel;
+	walk.nblocks = RelationGetNumberOfBlocks(rel);
+	walk.nkeyatts = BTREE_NKEYATTS(rel);
+	walk.page = (char *) palloc(BLCKSZ);
+	walk.parent = (char *) palloc(BLCKSZ);
+	walk.cxt = AllocSetContextCreate(CurrentMemoryContext,
+									 "pg_check btree walk",
+									 ALLOCSET_DEFAULT_MINSIZE,
+									 ALLOCSET_DEFAULT_INITSIZE,
+									 ALLOCSET_DEFAULT_MAXSIZE);
+
+	/* the pages are not read sequentially, the downlinks are prefetched instead */
+	block_scan_init(&walk.scan, rel, MAIN_FORKNUM, 0, walk.nblocks, strategy);
+	walk.scan.distance = 0;
+
+	/* the metapage (the magic and version were checked by check_index_page) */
+	if ((walk.nblocks == 0) || !btree_read(&walk, BTREE_METAPAGE, walk.page) ||
+		!btree_page_valid(&walk, walk.page, BTREE_METAPAGE)) {
+		goto done;
+	}
+
+	metad = BTPageGetMeta(walk.page);
+
+	/* (already reported as an issue, but say why the structure is not checked) */
+	if ((metad->btm_magic != BTREE_MAGIC) || (metad->btm_version != BTREE_VERSION)) {
+		elog(NOTICE, "skipping the structure check of index \"%s\" (metapage magic %x, version %u, expected %x, %u)",
+			 RelationGetRelationName(rel), metad->btm_magic, metad->btm_version,
+			 BTREE_MAGIC, BTREE_VERSION);
+		goto done;
+	}
+
+	root = metad->btm_root;
+	level = metad->btm_level;
+
+	if ((metad->btm_fastroot >= walk.nblocks) || (metad->btm_fastlevel > level)) {
+		check_report(WARNING, BTREE_METAPAGE, 0, "meta_fastroot",
+					 "fast root %u at level %u is not valid (root %u at level %u, %u blocks)",
+					 metad->btm_fastroot, metad->btm_fastlevel, root, level, walk.nblocks);
+		walk.nerrs++;
+	}
+
+	/* empty index */
+	if (root == P_NONE) {
+		goto done;
+	}
+
+	if (root >= walk.nblocks) {
+		check_report(WARNING, BTREE_METAPAGE, 0, "meta_root",
+					 "root %u is beyond the end of the index (%u blocks)",
+					 root, walk.nblocks);
+		walk.nerrs++;
+		goto done;
+	}
+
+	/* the root is the only page on its level */
+	if (!btree_read(&walk, root, walk.page) || !btree_page_valid(&walk, walk.page, root)) {
+		goto done;
+	}
+
+	opaque = (BTPageOpaque) PageGetSpecialPointer(walk.page);
+
+	if (!P_ISROOT(opaque) || !P_LEFTMOST(opaque) || !P_RIGHTMOST(opaque)) {
+		check_report(WARNING, root, 0, "root_flags",
+					 "root page is not marked as root, or has siblings (flags %d, prev %u, next %u)",
+					 opaque->btpo_flags, opaque->btpo_prev, opaque->btpo_next);
+		walk.nerrs++;
+	}
+
+	if (opaque->btpo.level != level) {
+		check_report(WARNING, root, 0, "root_level",
+					 "root page is at level %u, but the metapage says %u",
+					 opaque->btpo.level, level);
+		walk.nerrs++;
+		goto done;
+	}
+
+	btree_check_keys(&walk, walk.page, root);
+
+	/* each level is walked together with the level above it */
+	for (leftmost = root; (level > 0) && (leftmost != P_NONE); level--) {
+		leftmost = btree_walk_level(&walk, leftmost, level);
+	}
+
+done:
+	if (walk.left_hikey != NULL) {
+		pfree(walk.left_hikey);
+	}
+
+	MemoryContextDelete(walk.cxt);
+
+	pfree(walk.page);
+	pfree(walk.parent);
+
+	return walk.nerrs;
+
+}
+
+/*
+ * walk the level below the parent level, following the right-links from
+ * the first downlink of the leftmost parent page, and the downlinks at the
+ * same time - returns the leftmost page of the level (P_NONE on failure)
+ */
+static BlockNumber btree_walk_level(btree_walk *walk, BlockNumber parent_leftmost, uint32 level) {
+
+	BlockNumber	leftmost;
+	BlockNumber	blkno;
+	BlockNumber	prev = P_NONE;
+	BlockNumber	npages = 0;
+	bool		prev_incomplete = false;
+	bool		downlinks = true;	/* the downlinks match the pages so far */
+	IndexTuple	key;
+
+	/* the leftmost parent page (checked already, as the level above) */
+	if (!btree_read(walk, parent_leftmost, walk->parent)) {
+		return P_NONE;
+	}
+
+	walk->parent_blkno = parent_leftmost;
+	walk->parent_off = P_FIRSTDATAKEY((BTPageOpaque) PageGetSpecialPointer(walk->parent));
+	walk->prefetched = InvalidOffsetNumber;
+
+	leftmost = btree_next_downlink(walk, &key);
+
+	if (leftmost == P_NONE) {
+		check_report(WARNING, parent_leftmost, 0, "no_downlinks",
+					 "internal page at level %u has no downlinks", level);
+		walk->nerrs++;
+		return P_NONE;
+	}
+
+	/* the leftmost page is the target of the first downlink, so consume it */
+	blkno = leftmost;
+
+	while (blkno != P_NONE) {
+
+		BTPageOpaque opaque;
+		bool		has_downlink;
+
+		if (blkno >= walk->nblocks) {
+			check_report(WARNING, prev, 0, "sibling_beyond_end",
+						 "right sibling %u is beyond the end of the index (%u blocks)",
+						 blkno, walk->nblocks);
+			walk->nerrs++;
+			break;
+		}
+
+		/* a corrupted right-link might create a cycle */
+		if (++npages > walk->nblocks) {
+			check_report(WARNING, blkno, 0, "sibling_cycle",
+						 "cycle in the right-links at level %u", level - 1);
+			walk->nerrs++;
+			break;
+		}
+
+		if (!btree_read(walk, blkno, walk->page) || !btree_page_valid(walk, walk->page, blkno)) {
+			break;
+		}
+
+		progress_blocks(1);
+
+		opaque = (BTPageOpaque) PageGetSpecialPointer(walk->page);
+
+		/* deleted pages are unlinked from the siblings first */
+		if (P_ISDELETED(opaque)) {
+			check_report(WARNING, blkno, 0, "sibling_deleted",
+						 "deleted page at level %u is linked from page %u",
+						 level - 1, prev);
+			walk->nerrs++;
+			prev = blkno;
+			blkno = P_RIGHTMOST(opaque) ? P_NONE : opaque->btpo_next;
+			continue;
+		}
+
+		if (opaque->btpo.level != level - 1) {
+			check_report(WARNING, blkno, 0, "level",
+						 "page is at level %u, but the level above is %u",
+						 opaque->btpo.level, level);
+			walk->nerrs++;
+		}
+
+		if (opaque->btpo_prev != prev) {
+			check_report(WARNING, blkno, 0, "sibling_prev",
+						 "left sibling is %u, but the page is linked from %u",
+						 opaque->btpo_prev, prev);
+			walk->nerrs++;
+		}
+
+		/* the right half of an incomplete split, and the half-dead pages
+		 * (removed from the parent first) have no downlink */
+		has_downlink = !prev_incomplete && !P_ISHALFDEAD(opaque);
+
+		if (has_downlink && downlinks && (blkno != leftmost)) {
+
+			BlockNumber	target = btree_next_downlink(walk, &key);
+
+			/* after the first mismatch the rest would not match either */
+			if (target != blkno) {
+				check_report(WARNING, blkno, 0, "downlink_missing",
+							 "page at level %u is not the target of the next downlink (pointing to %u on page %u)",
+							 level - 1, target, walk->parent_blkno);
+				walk->nerrs++;
+				downlinks = false;
+				key = NULL;
+			}
+		}
+
+		/* the items on the leaf page may not be lower than the downlink key
+		 * (on internal pages the first item is "minus infinity") */
+		if (has_downlink && downlinks && (key != NULL) && P_ISLEAF(opaque) &&
+			(P_FIRSTDATAKEY(opaque) <= PageGetMaxOffsetNumber(walk->page)) &&
+			btree_key_above(walk, key, walk->page, P_FIRSTDATAKEY(opaque))) {
+			check_report(WARNING, blkno, P_FIRSTDATAKEY(opaque), "item_below_downlink",
+						 "item is lower than the downlink key on page %u",
+						 walk->parent_blkno);
+			walk->nerrs++;
+		}
+
+		key = NULL;
+
+		btree_check_keys(walk, walk->page, blkno);
+
+		/* the items may not be lower than the high key of the left sibling
+		 * (with duplicates, the items may be equal) */
+		if (P_ISLEAF(opaque) && (walk->left_hikey != NULL) &&
+			(P_FIRSTDATAKEY(opaque) <= PageGetMaxOffsetNumber(walk->page)) &&
+			btree_key_above(walk, walk->left_hikey, walk->page, P_FIRSTDATAKEY(opaque))) {
+			check_report(WARNING, blkno, P_FIRSTDATAKEY(opaque), "item_below_left_high_key",
+						 "item is lower than the high key of the left sibling %u", prev);
+			walk->nerrs++;
+		}
+
+		if (walk->left_hikey != NULL) {
+			pfree(walk->left_hikey);
+			walk->left_hikey = NULL;
+		}
+
+		if (P_ISLEAF(opaque) && !P_RIGHTMOST(opaque)) {
+			walk->left_hikey = CopyIndexTuple(BTREE_ITEM(walk->page, P_HIKEY));
+		}
+
+		prev_incomplete = BTREE_INCOMPLETE_SPLIT(opaque);
+
+		prev = blkno;
+		blkno = P_RIGHTMOST(opaque) ? P_NONE : opaque->btpo_next;
+
+		MemoryContextReset(walk->cxt);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	/* all the downlinks should have been reached by the right-links */
+	if (downlinks) {
+
+		BlockNumber	target = btree_next_downlink(walk, &key);
+
+		if (target != P_NONE) {
+			check_report(WARNING, walk->parent_blkno, 0, "downlink_unreachable",
+						 "downlink to page %u is not reachable from the leftmost page at level %u",
+						 target, level - 1);
+			walk->nerrs++;
+		}
+	}
+
+	if (walk->left_hikey != NULL) {
+		pfree(walk->left_hikey);
+		walk->left_hikey = NULL;
+	}
+
+	return leftmost;
+
+}
+
+/*
+ * the next downlink from the parent level (moving to the right sibling of
+ * the parent page when needed), with the key (NULL for the first downlink
+ * of a page, which is "minus infinity") - P_NONE when there are no more
+ */
+static BlockNumber btree_next_downlink(btree_walk *walk, IndexTuple *key) {
+
+	BTPageOpaque opaque = (BTPageOpaque) PageGetSpecialPointer(walk->parent);
+	BlockNumber	downlink;
+
+	*key = NULL;
+
+	while (walk->parent_off > PageGetMaxOffsetNumber(walk->parent)) {
+
+		BlockNumber	next = opaque->btpo_next;
+
+		/* the parent level was checked already, only stop on a broken page */
+		if (P_RIGHTMOST(opaque) || (next >= walk->nblocks) ||
+			!btree_read(walk, next, walk->parent) ||
+			!btree_page_valid(walk, walk->parent, next)) {
+			return P_NONE;
+		}
+
+		opaque = (BTPageOpaque) PageGetSpecialPointer(walk->parent);
+
+		walk->parent_blkno = next;
+		walk->parent_off = P_FIRSTDATAKEY(opaque);
+		walk->prefetched = InvalidOffsetNumber;
+	}
+
+	downlink = BTREE_DOWNLINK(BTREE_ITEM(walk->parent, walk->parent_off));
+
+	if (walk->parent_off > P_FIRSTDATAKEY(opaque)) {
+		*key = BTREE_ITEM(walk->parent, walk->parent_off);
+	}
+
+	walk->parent_off++;
+
+	btree_prefetch_downlinks(walk);
+
+	return downlink;
+
+}
+
+/* keep prefetching the next few children of the parent page (the pages
+ * on a level are usually not in the physical order) */
+static void btree_prefetch_downlinks(btree_walk *walk) {
+
+	OffsetNumber maxoff = PageGetMaxOffsetNumber(walk->parent);
+	OffsetNumber off;
+
+	if (pgcheck_prefetch_distance == 0) {
+		return;
+	}
+
+	off = Max(walk->prefetched + 1, walk->parent_off);
+
+	for (; (off <= maxoff) && (off < walk->parent_off + pgcheck_prefetch_distance); off++) {
+
+		BlockNumber	child = BTREE_DOWNLINK(BTREE_ITEM(walk->parent, off));
+
+		if (child < walk->nblocks) {
+			PrefetchBuffer(walk->rel, MAIN_FORKNUM, child);
+		}
+
+		walk->prefetched = off;
+	}
+
+}
+
+/* items on the page in order, and not above the high key */
+static void btree_check_keys(btree_walk *walk, char *page, BlockNumber blkno) {
+
+	BTPageOpaque opaque = (BTPageOpaque) PageGetSpecialPointer(page);
+	OffsetNumber maxoff = PageGetMaxOffsetNumber(page);
+	OffsetNumber off;
+	MemoryContext oldcxt = MemoryContextSwitchTo(walk->cxt);
+
+	/* on internal pages the first data item has no key */
+	off = P_ISLEAF(opaque) ? P_FIRSTDATAKEY(opaque) : P_FIRSTDATAKEY(opaque) + 1;
+
+	for (; off < maxoff; off++) {
+		if (btree_key_above(walk, BTREE_ITEM(page, off), page, off + 1)) {
+			check_report(WARNING, blkno, off, "item_order",
+						 "item is greater than the next item %d", off + 1);
+			walk->nerrs++;
+		}
+	}
+
+	/* the last item vs. the high key (the rightmost page has none) */
+	if (!P_RIGHTMOST(opaque) && (maxoff >= P_FIRSTDATAKEY(opaque)) &&
+		(P_ISLEAF(opaque) || (maxoff > P_FIRSTDATAKEY(opaque))) &&
+		btree_key_above(walk, BTREE_ITEM(page, maxoff), page, P_HIKEY)) {
+		check_report(WARNING, blkno, maxoff, "item_above_high_key",
+					 "item is greater than the high key");
+		walk->nerrs++;
+	}
+
+	MemoryContextSwitchTo(oldcxt);
+
+}
+
+/* is the key greater than the item on the page? */
+static bool btree_key_above(btree_walk *walk, IndexTuple key, char *page, OffsetNumber off) {
+
+	MemoryContext oldcxt = MemoryContextSwitchTo(walk->cxt);
+	ScanKey		skey = _bt_mkscankey(walk->rel, key);
+	int32		cmp = _bt_compare(walk->rel, walk->nkeyatts, skey, (Page) page, off);
+
+	MemoryContextSwitchTo(oldcxt);
+
+	return (cmp > 0);
+
+}
+
+/* read a copy of the page */
+static bool btree_read(btree_walk *walk, BlockNumber blkno, char *page) {
+
+	Buffer	buf;
+
+	if (blkno >= walk->nblocks) {
+		return false;
+	}
+
+	buf = block_scan_read(&walk->scan, blkno);
+	LockBuffer(buf, BUFFER_LOCK_SHARE);
+
+	memcpy(page, BufferGetPage(buf), BLCKSZ);
+
+	LockBuffer(buf, BUFFER_LOCK_UNLOCK);
+	ReleaseBuffer(buf);
+
+	return true;
+
+}
+
+/* the page passes the regular checks (reported when checking the pages),
+ * so it's safe to look at the items */
+static bool btree_page_valid(btree_walk *walk, char *page, BlockNumber blkno) {
+
+	bool	quiet = pgcheck_quiet;
+	uint32	nerrs;
+
+	pgcheck_quiet = true;
+
+	nerrs = check_index_page(walk->rel, (PageHeader) page, page, blkno);
+
+	if ((nerrs == 0) && (blkno != BTREE_METAPAGE)) {
+		nerrs += check_index_tuples(walk->rel, (PageHeader) page, page, blkno);
+	}
+
+	pgcheck_quiet = quiet;
+
+	return (nerrs == 0);
+
+}
@@ -0,0 +1,35 @@
+#ifndef BTREE_CHECK_H
+#define BTREE_CHECK_H
+
+#include "postgres.h"
+#include "storage/bufmgr.h"
+#include "utils/rel.h"
+
+/* Checks the structure of the b-tree index, walking it level by level from
+ * the root (as found in the metapage) down to the leaf level.
+ *
+ * - rel : b-tree index (locked by the caller, at least in ShareLock mode so
+ *         that there are no concurrent page splits)
+ * - strategy : buffer access strategy used to read the pages
+ *
+ * Each level is walked from the leftmost page using the right-links, and
+ * the pages are checked to be at the expected level, with left-links
+ * matching the walk, keys in order (within the page, and with respect to
+ * the high key and the high key of the left sibling). The level above is
+ * walked at the same time, and each page is checked to be the target of
+ * the next downlink (except for the right halves of incomplete splits and
+ * half-dead pages), at the leaf level also that the items are not lower
+ * than the downlink key.
+ *
+ * Only a single page of each of the two levels is kept in memory, and the
+ * children of the current parent page are prefetched (with
+ * pg_check.prefetch_distance).
+ *
+ * Pages failing the regular page checks are not walked (the issues are
+ * reported by check_index_page, which should be done first).
+ *
+ * Returns number of issues found.
+ */
+uint32 check_btree_structure(Relation rel, BufferAccessStrategy strategy);
+
+#endif   /* BTREE_CHECK_H */
@@ -1,5 +1,154 @@
 #include "common.h"
 
+#ifndef FRONTEND
+#include "progress.h"
+#include "stats.h"
+
+#include "lib/stringinfo.h"
+#include "utils/builtins.h"
+#endif
+
+bool	pgcheck_quiet = false;
+
+check_findings *pgcheck_findings = NULL;
+
+/* maximum number of line pointers on a page (even a corrupted one) */
+#define MAX_PAGE_ITEMS	(BLCKSZ / sizeof(ItemIdData))
+
+/* item extent, sorted by check_item_overlaps */
+typedef struct item_extent {
+	uint16	start;		/* lp_off */
+	uint16	end;		/* lp_off + lp_len */
+	uint16	item;		/* offset number (1-based) */
+} item_extent;
+
+#ifndef FRONTEND
+static const char * check_severity(int elevel);
+#endif
+static int item_extent_cmp(const void *a, const void *b);
+
+/* report the issue as a message, or add it to the findings */
+void check_report(int elevel, BlockNumber block, int offnum, const char *code,
+				  const char *fmt, ...) {
+
+#ifndef FRONTEND
+	StringInfoData detail;
+	va_list		args;
+
+	/* in quiet mode the issues are only counted, don't even format them */
+	if (pgcheck_quiet)
+		return;
+
+	if (elevel >= WARNING) {
+		check_count_issue();
+	}
+
+	initStringInfo(&detail);
+
+	for (;;) {
+#if (PG_VERSION_NUM >= 90400)
+		int		needed;
+
+		va_start(args, fmt);
+		needed = appendStringInfoVA(&detail, fmt, args);
+		va_end(args);
+
+		if (needed == 0)
+			break;
+
+		enlargeStringInfo(&detail, needed);
+#else
+		bool	done;
+
+		va_start(args, fmt);
+		done = appendStringInfoVA(&detail, fmt, args);
+		va_end(args);
+
+		if (done)
+			break;
+
+		enlargeStringInfo(&detail, detail.maxlen);
+#endif
+	}
+
+	if (pgcheck_findings != NULL) {
+
+		Datum	values[7];
+		bool	nulls[7];
+
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = ObjectIdGetDatum(pgcheck_findings->relid);
+		values[1] = ObjectIdGetDatum(pgcheck_findings->indexrelid);
+		values[2] = Int64GetDatum((int64) block);
+		values[3] = Int32GetDatum(offnum);
+		values[4] = CStringGetTextDatum(code);
+		values[5] = CStringGetTextDatum(check_severity(elevel));
+		values[6] = CStringGetTextDatum(detail.data);
+
+		/* not a difference between a table and an index */
+		nulls[1] = !OidIsValid(pgcheck_findings->indexrelid);
+
+		/* the whole page (no item) */
+		nulls[3] = (offnum == 0);
+
+		tuplestore_putvalues(pgcheck_findings->tupstore, pgcheck_findings->tupdesc,
+							 values, nulls);
+
+		pgcheck_findings->nfindings++;
+
+	} else if (offnum != 0) {
+		ereport(elevel, (errmsg("[%u:%d] %s", block, offnum, detail.data)));
+	} else {
+		ereport(elevel, (errmsg("[%u] %s", block, detail.data)));
+	}
+
+	pfree(detail.data);
+#else
+	/* offline checks (no StringInfo in frontend code, the details are short) */
+	char		detail[1024];
+	va_list		args;
+
+	if (pgcheck_quiet)
+		return;
+
+	va_start(args, fmt);
+	vsnprintf(detail, sizeof(detail), fmt, args);
+	va_end(args);
+
+	if (offnum != 0) {
+		ereport(elevel, (errmsg("[%u:%d] %s", block, offnum, detail)));
+	} else {
+		ereport(elevel, (errmsg("[%u] %s", block, detail)));
+	}
+#endif
+
+}
+
+#ifndef FRONTEND
+/* count an issue (for pg_check.max_errors and the progress view) */
+void check_count_issue(void) {
+
+	progress_error();
+	pgcheck_stats.issues++;
+
+}
+
+/* severity of the issue (for the findings) */
+static const char * check_severity(int elevel) {
+
+	if (elevel >= ERROR)
+		return "error";
+	else if (elevel >= WARNING)
+		return "warning";
+	else if (elevel >= NOTICE)
+		return "notice";
+
+	return "info";
+
+}
+#endif
+
 /*
 FIXME Check all the values for a page.
 
@@ -15,8 +164,8 @@ FIXME Check all the values for a page.
 
 /* FIXME Check size of the page (should be equal to BLCKSZ, see PageGetPageSize and PageSizeIsValid macros (bufpage.h)) */
 /* FIXME Full page (lower == upper) should have PD_PAGE_FULL in pd_flags. */
-/* global checks (mostly info from the PageHeader) */
-uint32 check_page_header(PageHeader header, int block) {
+/* global checks (mostly info from the PageHeader), see check_page_header */
+uint32 check_page_header_detail(PageHeader header, int block) {
 	
 	uint32 nerrs = 0;
 	
@@ -24,9 +173,9 @@ uint32 check_page_header(PageHeader header, int block) {
 	
 	/* check the page size (should be BLCKSZ) */
 	if (PageGetPageSize(header) != BLCKSZ) {
-		ereport(WARNING,
-				(errmsg("[%d] invalid page size %d (%d)", block,
-						(int) PageGetPageSize(header), BLCKSZ)));
+		check_report(WARNING, block, 0, "page_size",
+					 "invalid page size %d (%d)",
+					 (int) PageGetPageSize(header), BLCKSZ);
 		++nerrs;
 	}
 	
@@ -34,7 +183,7 @@ uint32 check_page_header(PageHeader header, int block) {
 	   depend on the format, so this should compare to PG_PAGE_LAYOUT_VERSION and continue only
 	   if it's equal */
 	if ((PageGetPageLayoutVersion(header) < 0) || (PageGetPageLayoutVersion(header) > 4)) {
-		ereport(WARNING,(errmsg("[%d] invalid page layout version %d", block, PageGetPageLayoutVersion(header))));
+		check_report(WARNING, block, 0, "page_layout_version", "invalid page layout version %d", PageGetPageLayoutVersion(header));
 		++nerrs;
 	}
 	
@@ -42,41 +191,111 @@ uint32 check_page_header(PageHeader header, int block) {
 
 	/* all the pointers should be positive (greater than PageHeaderData) and less than BLCKSZ */
 	if ((header->pd_lower < offsetof(PageHeaderData, pd_linp)) ||  (header->pd_lower > BLCKSZ)) {
-		ereport(WARNING,
-				(errmsg("[%d] lower %d not between %d and %d", block,
-						header->pd_lower,
-						(int) offsetof(PageHeaderData, pd_linp), BLCKSZ)));
+		check_report(WARNING, block, 0, "page_lower",
+					 "lower %d not between %d and %d",
+					 header->pd_lower,
+					 (int) offsetof(PageHeaderData, pd_linp), BLCKSZ);
 		++nerrs;
 	}
 	
 	if ((header->pd_upper < offsetof(PageHeaderData, pd_linp)) ||  (header->pd_upper > BLCKSZ)) {
-		ereport(WARNING,
-				(errmsg("[%d] upper %d not between %d and %d", block,
-						header->pd_upper,
-						(int) offsetof(PageHeaderData, pd_linp), BLCKSZ)));
+		check_report(WARNING, block, 0, "page_upper",
+					 "upper %d not between %d and %d",
+					 header->pd_upper,
+					 (int) offsetof(PageHeaderData, pd_linp), BLCKSZ);
 		++nerrs;
 	}
 	
 	if ((header->pd_special < offsetof(PageHeaderData, pd_linp)) ||  (header->pd_special > BLCKSZ)) {
-		ereport(WARNING,
-				(errmsg("[%d] special %d not between %d and %d", block,
-						header->pd_special,
-						(int) offsetof(PageHeaderData, pd_linp), BLCKSZ)));
+		check_report(WARNING, block, 0, "page_special",
+					 "special %d not between %d and %d",
+					 header->pd_special,
+					 (int) offsetof(PageHeaderData, pd_linp), BLCKSZ);
 		++nerrs;
 	}
 	
 	/* upper should be >= lower */
 	if (header->pd_lower > header->pd_upper) {
-		ereport(WARNING,(errmsg("[%d] lower > upper (%d > %d)", block, header->pd_lower, header->pd_upper)));
+		check_report(WARNING, block, 0, "page_lower_upper", "lower > upper (%d > %d)", header->pd_lower, header->pd_upper);
 		++nerrs;
 	}
 
 	/* special should be >= upper */
 	if (header->pd_upper > header->pd_special) {
-		ereport(WARNING,(errmsg("[%d] upper > special (%d > %d)", block, header->pd_upper, header->pd_special)));
+		check_report(WARNING, block, 0, "page_upper_special", "upper > special (%d > %d)", header->pd_upper, header->pd_special);
 		++nerrs;
 	}
 	
 	return nerrs;
   
 }
+
+/* sort the items by offset, and look for items starting before the end
+ * of the preceding item (with the largest end, so all overlaps are found) */
+uint32 check_item_overlaps(PageHeader header, int block, int ntuples) {
+
+	item_extent	items[MAX_PAGE_ITEMS];
+	int		nitems = 0;
+	int		i, last;
+	bool	sorted = true;
+	uint32	nerrs = 0;
+
+	/* corrupted pd_lower, the other checks complain about that */
+	if (ntuples > MAX_PAGE_ITEMS)
+		ntuples = MAX_PAGE_ITEMS;
+
+	/* the tuples are usually added from the end of the page, so walking
+	 * the line pointers backwards gives items (almost) sorted by offset */
+	for (i = ntuples - 1; i >= 0; i--) {
+
+		ItemId	lp = &header->pd_linp[i];
+
+		/* only LP_NORMAL items have storage */
+		if (lp->lp_flags != LP_NORMAL)
+			continue;
+
+		items[nitems].start = lp->lp_off;
+		items[nitems].end = lp->lp_off + lp->lp_len;
+		items[nitems].item = (i+1);
+
+		if ((nitems > 0) && (item_extent_cmp(&items[nitems-1], &items[nitems]) > 0))
+			sorted = false;
+
+		nitems++;
+	}
+
+	if (!sorted)
+		qsort(items, nitems, sizeof(item_extent), item_extent_cmp);
+
+	/* 'last' is the item with the largest end so far */
+	for (i = 1, last = 0; i < nitems; i++) {
+
+		if (items[i].start < items[last].end) {
+			check_report(WARNING, block, items[i].item, "item_overlap",
+						 "intersects with [%d:%d] (%d,%d) vs. (%d,%d)",
+						 block, items[last].item,
+						 items[i].start, items[i].end,
+						 items[last].start, items[last].end);
+			++nerrs;
+		}
+
+		if (items[i].end > items[last].end)
+			last = i;
+	}
+
+	return nerrs;
+
+}
+
+/* order by start, then by item (so that the order is deterministic) */
+static int item_extent_cmp(const void *a, const void *b) {
+
+	const item_extent *ea = (const item_extent *) a;
+	const item_extent *eb = (const item_extent *) b;
+
+	if (ea->start != eb->start)
+		return (ea->start < eb->start) ? -1 : 1;
+
+	return (ea->item < eb->item) ? -1 : ((ea->item > eb->item) ? 1 : 0);
+
+}
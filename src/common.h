@@ -3,7 +3,120 @@
 
 #include "postgres.h"
 #include "access/heapam.h"
+#include "access/tupdesc.h"
+#include "utils/tuplestore.h"
 
-uint32 check_page_header(PageHeader header, int block);
+#ifndef FRONTEND
+#include "utils/guc.h"
+#endif
 
-#endif
\ No newline at end of file
+/* branch hints (c.h has them since 10) */
+#ifndef likely
+#if defined(__GNUC__) || defined(__clang__)
+#define likely(x)	__builtin_expect((x) != 0, 1)
+#define unlikely(x)	__builtin_expect((x) != 0, 0)
+#else
+#define likely(x)	((x) != 0)
+#define unlikely(x)	((x) != 0)
+#endif
+#endif
+
+/* When true, the checks only count the issues but don't report them. This
+ * is used when checking a page in place (while holding the buffer lock) -
+ * if any issues are found, the page is copied and checked again. */
+extern bool pgcheck_quiet;
+
+/* Destination of the issues found by the checks, when collecting them as
+ * rows (pg_check_table_report etc.) instead of reporting them as messages.
+ * The rows are (relid, index_relid, blkno, offnum, check_code, severity,
+ * detail) - index_relid is set only for the differences between a table
+ * and an index found by the cross-check (relid is the table then). */
+typedef struct check_findings {
+
+	Tuplestorestate *tupstore;	/* rows are stored here */
+	TupleDesc	tupdesc;		/* descriptor of the rows */
+	Oid			relid;			/* relation being checked */
+	Oid			indexrelid;		/* index cross-checked with the table */
+	uint64		nfindings;		/* number of rows added */
+
+} check_findings;
+
+/* When not NULL, the issues are added to the tuplestore and no message
+ * is emitted for them (set only while running the report functions). */
+extern check_findings *pgcheck_findings;
+
+/* Reports an issue found by a check (unless in quiet mode).
+ *
+ * - elevel : level of the message (usually WARNING), also the severity
+ * - block : block the issue was found on
+ * - offnum : item (offset number) on the block, 0 for the whole page
+ * - code : short identifier of the failed check, e.g. "item_overlap"
+ * - fmt : detail of the issue (printf-like format, without block/item)
+ *
+ * The message is "[block:offnum] detail" (or "[block] detail"), with the
+ * findings destination set it's added as a row instead.
+ */
+void check_report(int elevel, BlockNumber block, int offnum, const char *code,
+				  const char *fmt, ...)
+#if (PG_VERSION_NUM >= 90500)
+				  pg_attribute_printf(5, 6)
+#endif
+				  ;
+
+/* Counts an issue reported by other means than check_report (e.g. as
+ * a plain WARNING), so that pg_check.max_errors applies to all issues. */
+#ifndef FRONTEND
+void check_count_issue(void);
+#endif
+
+/* Are the messages at the debug level not printed at all? The fast paths
+ * of the checks skip the debug messages, so they're used only then. */
+#ifndef FRONTEND
+#define check_debug_off(level) \
+	((log_min_messages > (level)) && (client_min_messages > (level)))
+#else
+extern int	offline_min_messages;
+#define check_debug_off(level)	(offline_min_messages > (level))
+#endif
+
+/* Is the page header valid? All the fields are compared at once (without
+ * branching on each of them), and lower <= upper <= special covers all the
+ * individual range checks of check_page_header_detail. */
+static inline bool
+page_header_clean(PageHeader header)
+{
+	return ((header->pd_pagesize_version & 0xFF00) == BLCKSZ) &
+		   ((header->pd_pagesize_version & 0x00FF) <= 4) &
+		   (header->pd_lower >= SizeOfPageHeaderData) &
+		   (header->pd_lower <= header->pd_upper) &
+		   (header->pd_upper <= header->pd_special) &
+		   (header->pd_special <= BLCKSZ);
+}
+
+/* Checks the page header, reporting all the invalid fields. */
+uint32 check_page_header_detail(PageHeader header, int block);
+
+/* Checks the page header - a valid one costs just a few compares, only the
+ * pages failing them get the detailed checks (and the DEBUG1 message). */
+static inline uint32
+check_page_header(PageHeader header, int block)
+{
+	if (likely(page_header_clean(header)) && check_debug_off(DEBUG1))
+		return 0;
+
+	return check_page_header_detail(header, block);
+}
+
+/* Checks that the LP_NORMAL items on the page do not overlap. The items
+ * are sorted by offset and checked in a single sweep, so this is
+ * O(n log n) instead of comparing every pair of items.
+ *
+ * - header : page header
+ * - block : block number (for the messages)
+ * - ntuples : number of line pointers on the page
+ *
+ * Returns number of items overlapping with another item.
+ */
+uint32 check_item_overlaps(PageHeader header, int block, int ntuples);
+
+#endif
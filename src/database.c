@@ -0,0 +1,231 @@
+/*-------------------------------------------------------------------------
+ *
+ * database.c
+ *	  Checks of all the tables in a database.
+ *
+ * The tables (including materialized views and TOAST tables) are selected
+ * from pg_class and sorted by size (relpages, i.e. the estimate from the
+ * last VACUUM or ANALYZE), largest first. Without workers the backend simply checks them
+ * one by one, otherwise they are handed to a pool of background workers
+ * (see parallel.c), with the small tables packed into batches so that the
+ * per-relation overhead does not dominate.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "access/genam.h"
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "access/xact.h"
+#include "catalog/pg_class.h"
+#include "miscadmin.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/resowner.h"
+
+#include "common.h"
+#include "database.h"
+#include "parallel.h"
+#include "pg_check.h"
+#include "scan.h"
+
+static uint32 check_relation_isolated(check_relation *rel, bool checkIndexes,
+									  bool crossCheckIndexes, bool incremental);
+static check_relation *database_relations(int *nrels);
+static int	check_relation_cmp(const void *a, const void *b);
+
+/*
+ * pg_check_database
+ *
+ * Checks all tables in the current database, returns number of warnings
+ * (issues found).
+ */
+PG_FUNCTION_INFO_V1(pg_check_database);
+
+Datum
+pg_check_database(PG_FUNCTION_ARGS)
+{
+	int		nworkers = PG_GETARG_INT32(0);
+	bool	checkIndexes = PG_GETARG_BOOL(1);
+	bool	crossCheckIndexes = PG_GETARG_BOOL(2);
+	bool	incremental = PG_GETARG_BOOL(3);
+	check_relation *rels;
+	int		nrels;
+	uint32	nerrs;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 (errmsg("must be superuser to use pg_check functions"))));
+
+	if (nworkers < 0)
+		ereport(ERROR,
+				(errmsg("invalid number of workers %d", nworkers)));
+
+	/* one I/O budget for all the relations (split between the workers) */
+	scan_budget_reset();
+
+	rels = database_relations(&nrels);
+
+	elog(DEBUG1, "checking %d relations", nrels);
+
+	if (nworkers > 0)
+		nerrs = check_database_parallel(rels, nrels, nworkers, checkIndexes,
+										crossCheckIndexes, incremental);
+	else
+		nerrs = check_relations(rels, nrels, checkIndexes, crossCheckIndexes,
+								incremental);
+
+	pfree(rels);
+
+	PG_RETURN_INT32(nerrs);
+}
+
+/*
+ * check a batch of relations (sharing the strategy and page buffer, with
+ * the memory of each check released right after it, see check_table)
+ */
+uint32
+check_relations(check_relation *rels, int nrels, bool checkIndexes,
+				bool crossCheckIndexes, bool incremental)
+{
+	uint32			nerrs = 0;
+	int				i;
+
+	for (i = 0; i < nrels; i++)
+	{
+		elog(DEBUG1, "checking relation %u (%u pages)",
+			 rels[i].relid, rels[i].relpages);
+
+		nerrs += check_relation_isolated(&rels[i], checkIndexes,
+										 crossCheckIndexes, incremental);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	return nerrs;
+}
+
+/*
+ * check a single relation in a subtransaction, so that an ERROR (e.g. on a
+ * badly corrupted page) is reported as a warning and counted as an issue,
+ * and the remaining relations still get checked (the same as an exception
+ * block in PL/pgSQL) - except when the query gets canceled
+ */
+static uint32
+check_relation_isolated(check_relation *rel, bool checkIndexes,
+						bool crossCheckIndexes, bool incremental)
+{
+	MemoryContext	oldcontext = CurrentMemoryContext;
+	ResourceOwner	oldowner = CurrentResourceOwner;
+	uint32			nerrs;
+
+	BeginInternalSubTransaction(NULL);
+	MemoryContextSwitchTo(oldcontext);
+
+	PG_TRY();
+	{
+		nerrs = check_table_relation(rel->relid, checkIndexes,
+									 crossCheckIndexes, incremental);
+
+		ReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldcontext);
+		CurrentResourceOwner = oldowner;
+	}
+	PG_CATCH();
+	{
+		ErrorData  *edata;
+
+		MemoryContextSwitchTo(oldcontext);
+		edata = CopyErrorData();
+		FlushErrorState();
+
+		RollbackAndReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldcontext);
+		CurrentResourceOwner = oldowner;
+
+		if (edata->sqlerrcode == ERRCODE_QUERY_CANCELED)
+			ReThrowError(edata);
+
+		ereport(WARNING,
+				(errmsg("check of relation %u failed: %s",
+						rel->relid, edata->message)));
+		check_count_issue();
+
+		FreeErrorData(edata);
+
+		nerrs = 1;
+	}
+	PG_END_TRY();
+
+	return nerrs;
+}
+
+/*
+ * tables in the current database (with storage, except for temporary
+ * tables, which can't be read from other backends), largest first
+ */
+static check_relation *
+database_relations(int *nrels)
+{
+	Relation	pg_class;
+	SysScanDesc	scan;
+	HeapTuple	tuple;
+	int			maxrels = 1024;
+	check_relation *rels;
+
+	rels = (check_relation *) palloc(sizeof(check_relation) * maxrels);
+	*nrels = 0;
+
+	pg_class = heap_open(RelationRelationId, AccessShareLock);
+
+	scan = systable_beginscan(pg_class, InvalidOid, false, NULL, 0, NULL);
+
+	while (HeapTupleIsValid(tuple = systable_getnext(scan)))
+	{
+		Form_pg_class	classForm = (Form_pg_class) GETSTRUCT(tuple);
+
+		if (classForm->relkind != RELKIND_RELATION &&
+			classForm->relkind != RELKIND_MATVIEW &&
+			classForm->relkind != RELKIND_TOASTVALUE)
+			continue;
+
+		if (classForm->relpersistence == RELPERSISTENCE_TEMP)
+			continue;
+
+		if (*nrels == maxrels)
+		{
+			maxrels *= 2;
+			rels = (check_relation *) repalloc(rels, sizeof(check_relation) * maxrels);
+		}
+
+		rels[*nrels].relid = HeapTupleGetOid(tuple);
+		rels[*nrels].relpages = (BlockNumber) classForm->relpages;
+		(*nrels)++;
+	}
+
+	systable_endscan(scan);
+
+	heap_close(pg_class, AccessShareLock);
+
+	qsort(rels, *nrels, sizeof(check_relation), check_relation_cmp);
+
+	return rels;
+}
+
+/* largest relations first (and then by OID, to get a stable order) */
+static int
+check_relation_cmp(const void *a, const void *b)
+{
+	const check_relation *ra = (const check_relation *) a;
+	const check_relation *rb = (const check_relation *) b;
+
+	if (ra->relpages != rb->relpages)
+		return (ra->relpages > rb->relpages) ? -1 : 1;
+
+	if (ra->relid != rb->relid)
+		return (ra->relid < rb->relid) ? -1 : 1;
+
+	return 0;
+}
@@ -0,0 +1,38 @@
+#ifndef DATABASE_CHECK_H
+#define DATABASE_CHECK_H
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "storage/block.h"
+
+/* relation to check (as selected from pg_class) */
+typedef struct check_relation
+{
+	Oid			relid;
+	BlockNumber	relpages;		/* size estimate (pg_class.relpages) */
+} check_relation;
+
+/* Checks a batch of relations in the current transaction.
+ *
+ * - rels : relations to check
+ * - nrels : number of relations
+ * - checkIndexes : check all indexes on the tables
+ * - crossCheckIndexes : cross-check the indexes with the tables
+ * - incremental : skip pages not modified since the last check
+ *
+ * The relations share the buffer access strategy and the page buffer, and
+ * the memory used by a check is released right after it. Relations that
+ * were dropped since they were selected are silently skipped. Each check
+ * runs in a subtransaction, so a check failing with an ERROR is reported
+ * as a warning (and counted as an issue), and the other relations still
+ * get checked.
+ *
+ * Returns number of issues found (in all the relations).
+ */
+uint32 check_relations(check_relation *rels, int nrels, bool checkIndexes,
+					   bool crossCheckIndexes, bool incremental);
+
+/* Checks all tables in the current database. */
+Datum pg_check_database(PG_FUNCTION_ARGS);
+
+#endif   /* DATABASE_CHECK_H */
@@ -0,0 +1,538 @@
+#include "forks.h"
+
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "access/visibilitymap.h"
+#include "storage/bufpage.h"
+#include "storage/fsm_internals.h"
+#include "storage/smgr.h"
+
+#include "common.h"
+#include "sample.h"
+
+/* layout of the visibility map (the same as in visibilitymap.c) - 9.6 added
+ * the all-frozen bit, so there are two bits per heap block since then */
+#if (PG_VERSION_NUM >= 90600)
+#define VM_BITS_PER_HEAPBLOCK	2
+#else
+#define VM_BITS_PER_HEAPBLOCK	1
+#endif
+
+#define VM_BIT_VISIBLE			0x01
+#define VM_BIT_FROZEN			0x02
+#define VM_VALID_BITS			((1 << VM_BITS_PER_HEAPBLOCK) - 1)
+
+#define VM_MAPSIZE				(BLCKSZ - MAXALIGN(SizeOfPageHeaderData))
+#define VM_MAP_WORDS			(VM_MAPSIZE / sizeof(uint64))
+#define VM_HEAPBLOCKS_PER_BYTE	(BITS_PER_BYTE / VM_BITS_PER_HEAPBLOCK)
+#define VM_HEAPBLOCKS_PER_WORD	(64 / VM_BITS_PER_HEAPBLOCK)
+#define VM_HEAPBLOCKS_PER_PAGE	(VM_MAPSIZE * VM_HEAPBLOCKS_PER_BYTE)
+
+#define VM_MAPBLOCK(blkno)		((blkno) / VM_HEAPBLOCKS_PER_PAGE)
+
+/* depth of the FSM tree (the same as in freespace.c) */
+#define FSM_TREE_DEPTH			((SlotsPerFSMPage >= 1626) ? 3 : 4)
+
+struct vm_scan {
+
+	Relation	rel;
+	BlockNumber	blockFrom;		/* heap blocks checked by the scan */
+	BlockNumber	blockTo;
+	BlockNumber	nblocks;		/* heap blocks (updated when bits beyond it found) */
+	bool		refreshed;		/* nblocks updated already */
+	bool		check_tail;		/* the scan reaches the end of the table */
+
+	block_scan	scan;			/* of the VM fork */
+	BlockNumber	next;			/* first VM page not loaded yet */
+
+	BlockNumber	first;			/* first VM page of the batch */
+	int			npages;			/* VM pages in the batch */
+
+	Buffer		vmbuffer;		/* VM page pinned by the rechecks */
+
+	uint64		map[VM_BATCH_PAGES * VM_MAP_WORDS];	/* bits of the batch */
+
+};
+
+static uint32 vm_load_batch(vm_scan *vm, BlockNumber mapblock);
+static uint32 vm_check_map(vm_scan *vm, BlockNumber mapblock, Page header, uint64 *words);
+static int vm_page_issues(Page page, int flags);
+static int vm_flags(vm_scan *vm, BlockNumber blkno);
+static bool vm_word_invalid(uint64 word);
+#if (PG_VERSION_NUM >= 90600)
+static bool vm_page_unfrozen(Page page);
+#endif
+static bool fork_page_valid(Page page);
+static void fsm_check_leaf(Relation rel, Page page, BlockNumber leafno, BlockNumber *nblocks);
+static uint32 fsm_count_beyond(FSMPage fsmpage, BlockNumber leafno, BlockNumber nblocks,
+							   BlockNumber *first);
+static BlockNumber fsm_leaf_block(BlockNumber leafno);
+
+/* start checking the VM for the heap blocks (NULL if there's no VM) */
+vm_scan *vm_scan_begin(Relation rel, BlockNumber blockFrom, BlockNumber blockTo,
+					   BufferAccessStrategy strategy) {
+
+	vm_scan	   *vm;
+	BlockNumber	vm_nblocks;
+	BlockNumber	start,
+				end;
+
+	if (!pgcheck_check_vm) {
+		return NULL;
+	}
+
+	RelationOpenSmgr(rel);
+
+	/* created by the first vacuum */
+	if (!smgrexists(rel->rd_smgr, VISIBILITYMAP_FORKNUM)) {
+		return NULL;
+	}
+
+	vm_nblocks = smgrnblocks(rel->rd_smgr, VISIBILITYMAP_FORKNUM);
+
+	vm = (vm_scan *) palloc0(sizeof(vm_scan));
+
+	vm->rel = rel;
+	vm->blockFrom = blockFrom;
+	vm->blockTo = blockTo;
+	vm->nblocks = RelationGetNumberOfBlocks(rel);
+	vm->check_tail = (blockTo >= vm->nblocks);
+	vm->vmbuffer = InvalidBuffer;
+
+	/* the VM pages covering the blocks (and all the following ones, when
+	 * the scan reaches the end of the table) */
+	start = Min(VM_MAPBLOCK(blockFrom), vm_nblocks);
+
+	if (vm->check_tail || (blockTo == 0)) {
+		end = vm_nblocks;
+	} else {
+		end = Min(VM_MAPBLOCK(blockTo - 1) + 1, vm_nblocks);
+	}
+
+	block_scan_init(&vm->scan, rel, VISIBILITYMAP_FORKNUM, start, Max(start, end), strategy);
+
+	vm->next = start;
+	vm->first = start;
+	vm->npages = 0;
+
+	return vm;
+
+}
+
+/* make sure the bits for the heap block are loaded (before locking the page) */
+uint32 vm_scan_load(vm_scan *vm, BlockNumber blkno) {
+
+	BlockNumber	mapblock = VM_MAPBLOCK(blkno);
+
+	if ((mapblock >= vm->first) && (mapblock < vm->first + vm->npages)) {
+		return 0;
+	}
+
+	return vm_load_batch(vm, mapblock);
+
+}
+
+/* compare the bits to the heap page (locked by the caller) */
+int vm_scan_page(vm_scan *vm, BlockNumber blkno, Page page) {
+
+	int		flags = vm_flags(vm, blkno);
+
+	/* nothing set (the most common case on tables being modified) */
+	if ((flags == 0) || (vm_page_issues(page, flags) == 0)) {
+		return 0;
+	}
+
+	/* the copy may be stale - the bits can't change while the page is
+	 * locked, so check the current ones */
+#if (PG_VERSION_NUM >= 90600)
+	flags = visibilitymap_get_status(vm->rel, blkno, &vm->vmbuffer);
+#else
+	flags = visibilitymap_test(vm->rel, blkno, &vm->vmbuffer) ? VM_BIT_VISIBLE : 0;
+#endif
+
+	return vm_page_issues(page, flags);
+
+}
+
+/* report the issues found by vm_scan_page (with the page unlocked) */
+uint32 vm_scan_report(vm_scan *vm, BlockNumber blkno, int issues) {
+
+	uint32	nerrs = 0;
+
+	if (issues & VM_ISSUE_NOT_ALL_VISIBLE) {
+		check_report(WARNING, blkno, 0, "vm_not_all_visible",
+					 "marked as all-visible in the visibility map, but PD_ALL_VISIBLE is not set");
+		++nerrs;
+	}
+
+	if (issues & VM_ISSUE_NOT_FROZEN) {
+		check_report(WARNING, blkno, 0, "vm_not_frozen",
+					 "marked as all-frozen in the visibility map, but has tuples that are not frozen");
+		++nerrs;
+	}
+
+	return nerrs;
+
+}
+
+/* end the scan (the VM pages beyond the end of the table) */
+uint32 vm_scan_end(vm_scan *vm) {
+
+	uint32	nerrs = 0;
+
+	while (vm->check_tail && (vm->next < vm->scan.blockTo) && !check_stop()) {
+		nerrs += vm_load_batch(vm, vm->next);
+	}
+
+	if (BufferIsValid(vm->vmbuffer)) {
+		ReleaseBuffer(vm->vmbuffer);
+	}
+
+	pfree(vm);
+
+	return nerrs;
+
+}
+
+/* check the free space map of the table */
+uint32 check_fsm(Relation rel, BufferAccessStrategy strategy, char *raw_page) {
+
+	uint32		nerrs = 0;
+	BlockNumber	fsm_nblocks;
+	BlockNumber	nblocks;
+	BlockNumber	blkno;
+	BlockNumber	leafno;		/* next leaf page to check the slots on */
+	BlockNumber	leafblk;	/* and its block number */
+	block_scan	scan;
+
+	if (!pgcheck_check_fsm) {
+		return 0;
+	}
+
+	RelationOpenSmgr(rel);
+
+	/* created by the first vacuum (or when the table gets large enough) */
+	if (!smgrexists(rel->rd_smgr, FSM_FORKNUM)) {
+		return 0;
+	}
+
+	fsm_nblocks = smgrnblocks(rel->rd_smgr, FSM_FORKNUM);
+	nblocks = RelationGetNumberOfBlocks(rel);
+
+	/* the first leaf page with slots for blocks beyond the end */
+	leafno = nblocks / SlotsPerFSMPage;
+	leafblk = fsm_leaf_block(leafno);
+
+	block_scan_init(&scan, rel, FSM_FORKNUM, 0, fsm_nblocks, strategy);
+
+	for (blkno = 0; (blkno < fsm_nblocks) && !check_stop(); blkno++) {
+
+		Buffer	buf = block_scan_read(&scan, blkno);
+
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		memcpy(raw_page, BufferGetPage(buf), BLCKSZ);
+		LockBuffer(buf, BUFFER_LOCK_UNLOCK);
+
+		ReleaseBuffer(buf);
+
+		/* pages beyond the used part of the tree are zeroed */
+		if (!PageIsNew(raw_page) && !fork_page_valid(raw_page)) {
+			check_report(WARNING, blkno, 0, "fsm_page_header",
+						 "invalid free space map page (lower %d, upper %d, special %d)",
+						 ((PageHeader) raw_page)->pd_lower, ((PageHeader) raw_page)->pd_upper,
+						 ((PageHeader) raw_page)->pd_special);
+			++nerrs;
+		} else if (blkno == leafblk) {
+			fsm_check_leaf(rel, raw_page, leafno, &nblocks);
+		}
+
+		if (blkno == leafblk) {
+			leafno++;
+			leafblk = fsm_leaf_block(leafno);
+		}
+	}
+
+	return nerrs;
+
+}
+
+/* copy the next batch of VM pages, and check the bits */
+static uint32 vm_load_batch(vm_scan *vm, BlockNumber mapblock) {
+
+	uint32	nerrs = 0;
+	int		i;
+
+	vm->first = mapblock;
+	vm->npages = 0;
+
+	/* nothing is loaded beyond the end of the VM (no bits set there) */
+	for (i = 0; (i < VM_BATCH_PAGES) && (mapblock + i < vm->scan.blockTo); i++) {
+
+		Buffer		buf = block_scan_read(&vm->scan, mapblock + i);
+		PageHeaderData header;
+		uint64	   *words = &vm->map[i * VM_MAP_WORDS];
+
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		memcpy(&header, BufferGetPage(buf), SizeOfPageHeaderData);
+		memcpy(words, PageGetContents(BufferGetPage(buf)), VM_MAPSIZE);
+		LockBuffer(buf, BUFFER_LOCK_UNLOCK);
+
+		ReleaseBuffer(buf);
+
+		vm->npages++;
+
+		nerrs += vm_check_map(vm, mapblock + i, (Page) &header, words);
+	}
+
+	vm->next = Max(vm->next, mapblock + vm->npages);
+
+	return nerrs;
+
+}
+
+/* check the bits of a VM page, a word at a time (only the bits of the heap
+ * blocks of the scan, so that each is checked just once with chunks) */
+static uint32 vm_check_map(vm_scan *vm, BlockNumber mapblock, Page header, uint64 *words) {
+
+	uint32		nerrs = 0;
+	BlockNumber	firstblk = mapblock * VM_HEAPBLOCKS_PER_PAGE;
+	BlockNumber	nbeyond = 0;
+	BlockNumber	firstbeyond = InvalidBlockNumber;
+	int			w;
+
+	/* a broken page - ignore the bits (but report it only once) */
+	if (!PageIsNew(header) && !fork_page_valid(header)) {
+
+		if (firstblk >= vm->blockFrom) {
+			check_report(WARNING, mapblock, 0, "vm_page_header",
+						 "invalid visibility map page (lower %d, upper %d, special %d)",
+						 ((PageHeader) header)->pd_lower, ((PageHeader) header)->pd_upper,
+						 ((PageHeader) header)->pd_special);
+			++nerrs;
+		}
+
+		memset(words, 0, VM_MAPSIZE);
+
+		return nerrs;
+	}
+
+	for (w = 0; w < VM_MAP_WORDS; w++) {
+
+		BlockNumber	blk = firstblk + w * VM_HEAPBLOCKS_PER_WORD;
+		int			j;
+
+		/* nothing set, or just valid bits for blocks in the table */
+		if ((words[w] == 0) ||
+			(!vm_word_invalid(words[w]) && (blk + VM_HEAPBLOCKS_PER_WORD <= vm->nblocks))) {
+			continue;
+		}
+
+		for (j = 0; j < VM_HEAPBLOCKS_PER_WORD; j++) {
+
+			BlockNumber	b = blk + j;
+			int			idx = w * VM_HEAPBLOCKS_PER_WORD + j;
+			int			flags;
+
+			/* checked by scans of the other blocks */
+			if ((b < vm->blockFrom) || ((b >= vm->blockTo) && !(vm->check_tail && (b >= vm->nblocks)))) {
+				continue;
+			}
+
+			flags = (((uint8 *) words)[idx / VM_HEAPBLOCKS_PER_BYTE] >>
+					 ((idx % VM_HEAPBLOCKS_PER_BYTE) * VM_BITS_PER_HEAPBLOCK)) & VM_VALID_BITS;
+
+			if (flags == 0) {
+				continue;
+			}
+
+			/* the table might have been extended since the start */
+			if ((b >= vm->nblocks) && !vm->refreshed) {
+				vm->nblocks = RelationGetNumberOfBlocks(vm->rel);
+				vm->refreshed = true;
+			}
+
+			if (b >= vm->nblocks) {
+				if (nbeyond++ == 0) {
+					firstbeyond = b;
+				}
+				continue;
+			}
+
+			if ((flags & VM_BIT_FROZEN) && !(flags & VM_BIT_VISIBLE)) {
+				check_report(WARNING, b, 0, "vm_frozen_not_visible",
+							 "marked as all-frozen in the visibility map, but not as all-visible");
+				++nerrs;
+			}
+		}
+	}
+
+	if (nbeyond > 0) {
+		check_report(WARNING, firstbeyond, 0, "vm_beyond_end",
+					 "visibility map has bits set for %u blocks beyond the end of the table (%u blocks)",
+					 nbeyond, vm->nblocks);
+		++nerrs;
+	}
+
+	return nerrs;
+
+}
+
+/* issues (VM_ISSUE_*) of the heap page with the VM bits */
+static int vm_page_issues(Page page, int flags) {
+
+	int		issues = 0;
+
+	if ((flags & VM_BIT_VISIBLE) && !PageIsAllVisible(page)) {
+		issues |= VM_ISSUE_NOT_ALL_VISIBLE;
+	}
+
+#if (PG_VERSION_NUM >= 90600)
+	if ((flags & VM_BIT_FROZEN) && vm_page_unfrozen(page)) {
+		issues |= VM_ISSUE_NOT_FROZEN;
+	}
+#endif
+
+	return issues;
+
+}
+
+/* the bits for the heap block (0 when not in the batch) */
+static int vm_flags(vm_scan *vm, BlockNumber blkno) {
+
+	BlockNumber	mapblock = VM_MAPBLOCK(blkno);
+	int			idx = blkno % VM_HEAPBLOCKS_PER_PAGE;
+	uint8	   *bytes;
+
+	if ((mapblock < vm->first) || (mapblock >= vm->first + vm->npages)) {
+		return 0;
+	}
+
+	bytes = (uint8 *) &vm->map[(mapblock - vm->first) * VM_MAP_WORDS];
+
+	return (bytes[idx / VM_HEAPBLOCKS_PER_BYTE] >>
+			((idx % VM_HEAPBLOCKS_PER_BYTE) * VM_BITS_PER_HEAPBLOCK)) & VM_VALID_BITS;
+
+}
+
+/* does the word have all-frozen bits without the all-visible ones? (the
+ * pairs of bits never cross bytes, so this does not depend on endianness) */
+static bool vm_word_invalid(uint64 word) {
+
+#if (PG_VERSION_NUM >= 90600)
+	return ((word >> 1) & ~word & UINT64CONST(0x5555555555555555)) != 0;
+#else
+	return false;
+#endif
+
+}
+
+#if (PG_VERSION_NUM >= 90600)
+/* does the page have tuples that are not frozen? (ignores tuples pointing
+ * outside the page, those are reported by the tuple checks) */
+static bool vm_page_unfrozen(Page page) {
+
+	PageHeader	header = (PageHeader) page;
+	OffsetNumber offnum,
+				maxoff;
+
+	if (PageIsNew(page) || (header->pd_lower < SizeOfPageHeaderData) ||
+		(header->pd_lower > BLCKSZ)) {
+		return false;
+	}
+
+	maxoff = PageGetMaxOffsetNumber(page);
+
+	for (offnum = FirstOffsetNumber; offnum <= maxoff; offnum++) {
+
+		ItemId	lp = PageGetItemId(page, offnum);
+
+		if (!ItemIdIsNormal(lp) || (ItemIdGetOffset(lp) + SizeofHeapTupleHeader > BLCKSZ)) {
+			continue;
+		}
+
+		if (heap_tuple_needs_eventual_freeze((HeapTupleHeader) PageGetItem(page, lp))) {
+			return true;
+		}
+	}
+
+	return false;
+
+}
+#endif
+
+/* VM and FSM pages are initialized with no special space and no items */
+static bool fork_page_valid(Page page) {
+
+	PageHeader	header = (PageHeader) page;
+
+	return (PageGetPageSize(header) == BLCKSZ) &&
+		   (header->pd_lower >= SizeOfPageHeaderData) &&
+		   (header->pd_lower <= header->pd_upper) &&
+		   (header->pd_upper == BLCKSZ) &&
+		   (header->pd_special == BLCKSZ);
+
+}
+
+/* check the slots of a leaf FSM page for blocks beyond the end - the FSM
+ * is not crash-safe and gets fixed when such blocks are returned (e.g. after
+ * a truncation), so this is only a NOTICE and not counted as an issue */
+static void fsm_check_leaf(Relation rel, Page page, BlockNumber leafno, BlockNumber *nblocks) {
+
+	FSMPage		fsmpage = (FSMPage) PageGetContents(page);
+	BlockNumber	first;
+	BlockNumber	nbeyond;
+
+	nbeyond = fsm_count_beyond(fsmpage, leafno, *nblocks, &first);
+
+	/* the table might have been extended since the start */
+	if (nbeyond > 0) {
+		*nblocks = RelationGetNumberOfBlocks(rel);
+		nbeyond = fsm_count_beyond(fsmpage, leafno, *nblocks, &first);
+	}
+
+	if (nbeyond > 0) {
+		check_report(NOTICE, first, 0, "fsm_beyond_end",
+					 "free space map records free space for %u blocks beyond the end of the table (%u blocks)",
+					 nbeyond, *nblocks);
+	}
+
+}
+
+/* number of slots with free space for blocks beyond the end (and the first one) */
+static uint32 fsm_count_beyond(FSMPage fsmpage, BlockNumber leafno, BlockNumber nblocks,
+							   BlockNumber *first) {
+
+	uint64	blk = (uint64) leafno * SlotsPerFSMPage;
+	uint32	nbeyond = 0;
+	int		slot;
+
+	for (slot = 0; slot < SlotsPerFSMPage; slot++, blk++) {
+
+		if ((blk < nblocks) || (fsmpage->fp_nodes[NonLeafNodesPerPage + slot] == 0)) {
+			continue;
+		}
+
+		if (nbeyond++ == 0) {
+			*first = (BlockNumber) blk;
+		}
+	}
+
+	return nbeyond;
+
+}
+
+/* physical block of the leaf FSM page (fsm_logical_to_physical at level 0) */
+static BlockNumber fsm_leaf_block(BlockNumber leafno) {
+
+	BlockNumber	pages = 0;
+	int			l;
+
+	/* the leaf page is preceded by all the upper pages before it */
+	for (l = 0; l < FSM_TREE_DEPTH; l++) {
+		pages += leafno + 1;
+		leafno /= SlotsPerFSMPage;
+	}
+
+	return pages - 1;
+
+}
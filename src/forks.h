@@ -0,0 +1,75 @@
+#ifndef FORKS_CHECK_H
+#define FORKS_CHECK_H
+
+#include "postgres.h"
+#include "storage/bufmgr.h"
+#include "utils/rel.h"
+
+#include "scan.h"
+
+/*
+ * Checks of the visibility map and free space map forks of a table.
+ *
+ * The visibility map is checked as part of the main scan of the heap (no
+ * separate pass over the heap) - the VM pages are copied in batches of
+ * VM_BATCH_PAGES pages ahead of the heap blocks they cover, the bits of
+ * the batch are scanned a word at a time (pages with no bits set, or with
+ * only valid combinations, are skipped quickly), and for each heap page
+ * read by the scan the bits are compared to the page while the buffer is
+ * still locked:
+ *
+ * - all-visible bit set, but the page does not have PD_ALL_VISIBLE
+ * - all-frozen bit set, but the page has tuples that are not frozen (9.6+)
+ * - all-frozen bit set without the all-visible one (9.6+)
+ * - bits set for blocks beyond the end of the table
+ *
+ * The copied bits may be stale, so a mismatch is confirmed by reading the
+ * current bits (while still holding the lock on the heap page, which has
+ * to be locked exclusively to modify the bits and the page flag).
+ *
+ * The free space map is checked after the heap (only when checking the
+ * whole table) - the page headers, and whether free space is recorded for
+ * blocks beyond the end of the table. The FSM is not crash-safe and such
+ * entries get fixed once used (e.g. after a truncation), so they're only
+ * reported as a NOTICE, not counted as issues.
+ */
+
+/* number of VM pages copied at once (each covers ~256MB of the heap) */
+#define VM_BATCH_PAGES		4
+
+/* GUC variables (defined in pg_check.c) */
+extern bool	pgcheck_check_vm;
+extern bool	pgcheck_check_fsm;
+
+/* VM state carried along the scan of heap blocks [blockFrom, blockTo) */
+typedef struct vm_scan vm_scan;
+
+/* Starts checking the VM for heap blocks [blockFrom, blockTo) - returns NULL
+ * if disabled, or when the table has no visibility map. */
+vm_scan *vm_scan_begin(Relation rel, BlockNumber blockFrom, BlockNumber blockTo,
+					   BufferAccessStrategy strategy);
+
+/* Makes sure the VM bits for the heap block are loaded (copies the next
+ * batch of VM pages if needed, and checks the bits). Call before locking
+ * the heap page. Returns the number of issues found. */
+uint32 vm_scan_load(vm_scan *scan, BlockNumber blkno);
+
+/* Compares the bits to the heap page (locked by the caller), returns the
+ * issues (VM_ISSUE_* flags), to be reported once the page is unlocked. */
+int vm_scan_page(vm_scan *scan, BlockNumber blkno, Page page);
+
+#define VM_ISSUE_NOT_ALL_VISIBLE	0x01
+#define VM_ISSUE_NOT_FROZEN			0x02
+
+/* Reports the issues returned by vm_scan_page, returns their number. */
+uint32 vm_scan_report(vm_scan *scan, BlockNumber blkno, int issues);
+
+/* Ends the scan (checks the VM pages beyond the end of the table, when the
+ * scan reached it). Returns the number of issues found. */
+uint32 vm_scan_end(vm_scan *scan);
+
+/* Checks the free space map of the table, using the buffer to copy the
+ * pages into. Returns the number of issues found. */
+uint32 check_fsm(Relation rel, BufferAccessStrategy strategy, char *raw_page);
+
+#endif   /* FORKS_CHECK_H */
@@ -0,0 +1,523 @@
+#include "index.h"
+#include "common.h"
+
+#if (PG_VERSION_NUM >= 90400)
+
+#include "access/gin_private.h"
+
+/* all the page flags (anything else is corruption) */
+#define GIN_KNOWN_FLAGS		(GIN_DATA | GIN_LEAF | GIN_DELETED | GIN_META | GIN_LIST | \
+							 GIN_LIST_FULLROW | GIN_INCOMPLETE_SPLIT | GIN_COMPRESSED)
+
+/* offset and size of the posting list on a compressed leaf data page (the
+ * list follows the right bound) */
+#define GIN_POSTING_LIST_OFFSET		(MAXALIGN(SizeOfPageHeaderData) + MAXALIGN(sizeof(ItemPointerData)))
+#define GIN_POSTING_LIST_SIZE(header)	((int) (header)->pd_lower - (int) GIN_POSTING_LIST_OFFSET)
+
+#define GinPageIsMetaPage(page)	((GinPageGetOpaque(page)->flags & GIN_META) != 0)
+
+/* bits of the offset number in the encoded TIDs of the posting lists (the
+ * same as MaxHeapTuplesPerPageBits in ginpostinglist.c) */
+#define GIN_TID_OFFSET_BITS		11
+
+/* TIDs decoded by the checks (too large for the stack) */
+static ItemPointerData gin_tids[INDEX_MAX_PAGE_TIDS];
+
+static bool gin_special_valid(PageHeader header);
+static uint32 check_gin_meta(char *buffer, int block);
+static uint32 check_gin_data_page(PageHeader header, char *buffer, int block, ItemPointerData *tids);
+static uint32 check_gin_entry_tuple(char *buffer, int block, OffsetNumber offnum, IndexTuple itup,
+									ItemPointerData *tids);
+static uint32 check_gin_tids(ItemPointerData *tids, int ntids, int block, OffsetNumber offnum);
+static int gin_data_leaf_tids(PageHeader header, char *buffer, ItemPointerData *tids, bool *complete);
+static int gin_entry_tids(IndexTuple itup, int len, ItemPointerData *tids, int maxtids, bool *complete);
+static int gin_decode_segments(char *ptr, int len, ItemPointerData *tids, int maxtids, bool *complete);
+static int gin_decode_segment(GinPostingList *segment, ItemPointerData *tids, int maxtids);
+
+/* checks the page header, special space and the metapage */
+uint32 check_gin_page(Relation rel, PageHeader header, char *buffer, int block) {
+
+	uint32 nerrs = 0;
+	GinPageOpaque opaque;
+
+	nerrs += check_page_header(header, block);
+
+	if (!gin_special_valid(header)) {
+		check_report(WARNING, block, 0, "index_special",
+					 "special space size %d does not match GIN page (%d)",
+					 BLCKSZ - header->pd_special, (int) MAXALIGN(sizeof(GinPageOpaqueData)));
+		return ++nerrs;
+	}
+
+	opaque = GinPageGetOpaque(buffer);
+
+	if ((opaque->flags & ~GIN_KNOWN_FLAGS) != 0) {
+		check_report(WARNING, block, 0, "gin_flags", "page has unknown flags 0x%04x",
+					 opaque->flags & ~GIN_KNOWN_FLAGS);
+		nerrs++;
+	}
+
+	if (GinPageIsData(buffer) && GinPageIsList(buffer)) {
+		check_report(WARNING, block, 0, "gin_flags",
+					 "page is both a data page and a pending list page");
+		nerrs++;
+	}
+
+	/* the metapage is always the first block */
+	if ((block == GIN_METAPAGE_BLKNO) != GinPageIsMetaPage(buffer)) {
+		check_report(WARNING, block, 0, "gin_meta",
+					 (block == GIN_METAPAGE_BLKNO) ? "block is not a metapage" : "unexpected metapage");
+		nerrs++;
+	} else if (block == GIN_METAPAGE_BLKNO) {
+		nerrs += check_gin_meta(buffer, block);
+	}
+
+	/* the root of the entry tree is always the second block */
+	if ((block == GIN_ROOT_BLKNO) &&
+		(GinPageIsData(buffer) || GinPageIsList(buffer) || GinPageIsDeleted(buffer))) {
+		check_report(WARNING, block, 0, "gin_root", "root page is not an entry tree page");
+		nerrs++;
+	}
+
+	return nerrs;
+
+}
+
+/* checks the items - entries (keys with posting lists or posting trees), the
+ * posting tree pages and the pending list */
+uint32 check_gin_tuples(Relation rel, PageHeader header, char *buffer, int block) {
+
+	uint32 nerrs = 0;
+	int ntuples;
+	OffsetNumber offnum;
+
+	if (!gin_special_valid(header) || GinPageIsDeleted(buffer) || GinPageIsMetaPage(buffer)) {
+		return 0;
+	}
+
+	if (GinPageIsData(buffer)) {
+		return check_gin_data_page(header, buffer, block, gin_tids);
+	}
+
+	ntuples = Min(PageGetMaxOffsetNumber(buffer), MaxIndexTuplesPerPage);
+
+	for (offnum = FirstOffsetNumber; offnum <= ntuples; offnum++) {
+
+		IndexTuple itup;
+
+		if (!check_index_item(header, block, offnum, sizeof(IndexTupleData), &nerrs)) {
+			continue;
+		}
+
+		itup = (IndexTuple) PageGetItem(buffer, PageGetItemId(buffer, offnum));
+
+		if (IndexTupleSize(itup) > ItemIdGetLength(PageGetItemId(buffer, offnum))) {
+			check_report(WARNING, block, offnum, "index_tuple_size",
+						 "tuple size %d exceeds the item length %d", (int) IndexTupleSize(itup),
+						 ItemIdGetLength(PageGetItemId(buffer, offnum)));
+			nerrs++;
+			continue;
+		}
+
+		/* the pending list has tuples with heap TIDs (like a b-tree) */
+		if (GinPageIsList(buffer)) {
+			nerrs += check_gin_tids(&itup->t_tid, 1, block, offnum);
+		} else {
+			nerrs += check_gin_entry_tuple(buffer, block, offnum, itup, gin_tids);
+		}
+	}
+
+	/* check intersection of the tuples (all at once) */
+	nerrs += check_item_overlaps(header, block, ntuples);
+
+	if (nerrs > 0) {
+		check_report(WARNING, block, 0, "page_corrupted", "is probably corrupted, there were %d errors reported", nerrs);
+	}
+
+	return nerrs;
+
+}
+
+/* heap TIDs on the page - posting lists of entries (leaf pages of the entry
+ * tree), leaf pages of posting trees and the pending list */
+int gin_page_tids(char *buffer, int block, ItemPointerData *tids) {
+
+	PageHeader header = (PageHeader) buffer;
+	int ntids = 0;
+	int ntuples;
+	bool complete;
+	OffsetNumber offnum;
+
+	if ((block == GIN_METAPAGE_BLKNO) || !gin_special_valid(header) ||
+		GinPageIsDeleted(buffer) || GinPageIsMetaPage(buffer)) {
+		return 0;
+	}
+
+	/* the pending list pages have GIN_LIST, but not GIN_LEAF (so check
+	 * them before skipping the non-leaf pages) */
+	if (!GinPageIsList(buffer) && !GinPageIsLeaf(buffer)) {
+		return 0;
+	}
+
+	if (GinPageIsData(buffer)) {
+		return gin_data_leaf_tids(header, buffer, tids, &complete);
+	}
+
+	ntuples = Min(PageGetMaxOffsetNumber(buffer), MaxIndexTuplesPerPage);
+
+	for (offnum = FirstOffsetNumber; offnum <= ntuples; offnum++) {
+
+		ItemId lp = PageGetItemId(buffer, offnum);
+		IndexTuple itup;
+
+		/* invalid items are reported by the checks */
+		if (!INDEX_ITEM_VALID(header, lp, sizeof(IndexTupleData))) {
+			continue;
+		}
+
+		itup = (IndexTuple) PageGetItem(buffer, lp);
+
+		if (GinPageIsList(buffer)) {
+			tids[ntids++] = itup->t_tid;
+		} else if (!GinIsPostingTree(itup)) {
+			/* the posting tree pages are added on their own */
+			ntids += gin_entry_tids(itup, Min(IndexTupleSize(itup), ItemIdGetLength(lp)),
+									&tids[ntids], INDEX_MAX_PAGE_TIDS - ntids, &complete);
+		}
+	}
+
+	return ntids;
+
+}
+
+/* the special space has the size of the GIN opaque data */
+static bool gin_special_valid(PageHeader header) {
+
+	return (header->pd_special == BLCKSZ - MAXALIGN(sizeof(GinPageOpaqueData)));
+
+}
+
+/* version and the pending list */
+static uint32 check_gin_meta(char *buffer, int block) {
+
+	uint32 nerrs = 0;
+	GinMetaPageData *meta = GinPageGetMeta(buffer);
+
+	/* version 1 are indexes upgraded from before 9.4 (uncompressed) */
+	if ((meta->ginVersion < 1) || (meta->ginVersion > GIN_CURRENT_VERSION)) {
+		check_report(WARNING, block, 0, "meta_version",
+					 "metapage contains invalid version %d (should be between 1 and %d)",
+					 meta->ginVersion, GIN_CURRENT_VERSION);
+		nerrs++;
+	}
+
+	if ((meta->head == InvalidBlockNumber) != (meta->tail == InvalidBlockNumber)) {
+		check_report(WARNING, block, 0, "gin_pending_list",
+					 "pending list head %u and tail %u are not both valid (or invalid)",
+					 meta->head, meta->tail);
+		nerrs++;
+	}
+
+	return nerrs;
+
+}
+
+/* posting tree page - posting items (internal pages) or a posting list */
+static uint32 check_gin_data_page(PageHeader header, char *buffer, int block, ItemPointerData *tids) {
+
+	uint32 nerrs = 0;
+	int ntids;
+	bool complete;
+	OffsetNumber i;
+
+	if (!GinPageIsLeaf(buffer)) {
+
+		OffsetNumber maxoff = GinPageGetOpaque(buffer)->maxoff;
+
+		if (maxoff * sizeof(PostingItem) > GinDataPageMaxDataSize) {
+			check_report(WARNING, block, 0, "gin_posting_items",
+						 "%d posting items do not fit on the page", maxoff);
+			return ++nerrs;
+		}
+
+		for (i = FirstOffsetNumber; i <= maxoff; i++) {
+
+			BlockNumber child = PostingItemGetBlockNumber(GinDataPageGetPostingItem(buffer, i));
+
+			if ((child == GIN_METAPAGE_BLKNO) || (child == GIN_ROOT_BLKNO) ||
+				(child == InvalidBlockNumber)) {
+				check_report(WARNING, block, i, "gin_downlink", "downlink to block %u", child);
+				nerrs++;
+			}
+		}
+
+		return nerrs;
+	}
+
+	ntids = gin_data_leaf_tids(header, buffer, tids, &complete);
+
+	if (!complete) {
+		check_report(WARNING, block, 0, "gin_posting_list",
+					 "posting list (size %d) exceeds the page, or has invalid segments",
+					 GinPageIsCompressed(buffer) ? GIN_POSTING_LIST_SIZE(header) :
+					 (int) (GinPageGetOpaque(buffer)->maxoff * sizeof(ItemPointerData)));
+		nerrs++;
+	}
+
+	nerrs += check_gin_tids(tids, ntids, block, 0);
+
+	/* the items are not above the right bound (the items of the right
+	 * sibling are higher) */
+	if (!GinPageRightMost(buffer) && (ntids > 0) &&
+		(ginCompareItemPointers(&tids[ntids - 1], GinDataPageGetRightBound(buffer)) > 0)) {
+		check_report(WARNING, block, 0, "gin_right_bound",
+					 "heap TID (%u,%u) is above the right bound (%u,%u)",
+					 IndexTidBlock(&tids[ntids - 1]),
+					 IndexTidOffset(&tids[ntids - 1]),
+					 IndexTidBlock(GinDataPageGetRightBound(buffer)),
+					 IndexTidOffset(GinDataPageGetRightBound(buffer)));
+		nerrs++;
+	}
+
+	return nerrs;
+
+}
+
+/* entry - downlink (internal pages), posting tree root or posting list */
+static uint32 check_gin_entry_tuple(char *buffer, int block, OffsetNumber offnum, IndexTuple itup,
+									ItemPointerData *tids) {
+
+	uint32 nerrs = 0;
+	int ntids;
+	bool complete;
+
+	if (!GinPageIsLeaf(buffer)) {
+
+		BlockNumber child = GinGetDownlink(itup);
+
+		if ((child == GIN_METAPAGE_BLKNO) || (child == GIN_ROOT_BLKNO) ||
+			(child == InvalidBlockNumber)) {
+			check_report(WARNING, block, offnum, "gin_downlink", "downlink to block %u", child);
+			nerrs++;
+		}
+
+		return nerrs;
+	}
+
+	if (GinIsPostingTree(itup)) {
+
+		BlockNumber root = GinGetPostingTree(itup);
+
+		if ((root == GIN_METAPAGE_BLKNO) || (root == GIN_ROOT_BLKNO) ||
+			(root == InvalidBlockNumber)) {
+			check_report(WARNING, block, offnum, "gin_posting_tree",
+						 "posting tree root at block %u", root);
+			nerrs++;
+		}
+
+		return nerrs;
+	}
+
+	ntids = gin_entry_tids(itup, IndexTupleSize(itup), tids, INDEX_MAX_PAGE_TIDS, &complete);
+
+	if (!complete) {
+		check_report(WARNING, block, offnum, "gin_posting_list",
+					 "posting list (offset %d) exceeds the tuple (size %d)",
+					 (int) GinGetPostingOffset(itup), (int) IndexTupleSize(itup));
+		nerrs++;
+	} else if (ntids != GinGetNPosting(itup)) {
+		check_report(WARNING, block, offnum, "gin_posting_list",
+					 "posting list has %d items (expected %d)", ntids, (int) GinGetNPosting(itup));
+		nerrs++;
+	}
+
+	nerrs += check_gin_tids(tids, ntids, block, offnum);
+
+	return nerrs;
+
+}
+
+/* the heap TIDs are valid and in ascending order (reports the first issue) */
+static uint32 check_gin_tids(ItemPointerData *tids, int ntids, int block, OffsetNumber offnum) {
+
+	int i;
+
+	for (i = 0; i < ntids; i++) {
+
+		OffsetNumber off = IndexTidOffset(&tids[i]);
+
+		if ((off < FirstOffsetNumber) || (off > MaxHeapTuplesPerPage)) {
+			check_report(WARNING, block, offnum, "gin_posting_tid",
+						 "invalid heap TID (%u,%u)", IndexTidBlock(&tids[i]), off);
+			return 1;
+		}
+
+		if ((i > 0) && (ginCompareItemPointers(&tids[i - 1], &tids[i]) >= 0)) {
+			check_report(WARNING, block, offnum, "gin_posting_order",
+						 "heap TIDs not in ascending order ((%u,%u) >= (%u,%u))",
+						 IndexTidBlock(&tids[i - 1]), IndexTidOffset(&tids[i - 1]),
+						 IndexTidBlock(&tids[i]), off);
+			return 1;
+		}
+	}
+
+	return 0;
+
+}
+
+/* TIDs on a posting tree leaf page (compressed, or an array of TIDs in
+ * indexes upgraded from before 9.4) */
+static int gin_data_leaf_tids(PageHeader header, char *buffer, ItemPointerData *tids, bool *complete) {
+
+	int nitems;
+
+	if (GinPageIsCompressed(buffer)) {
+
+		int size = GIN_POSTING_LIST_SIZE(header);
+
+		if ((size < 0) || (size > GinDataPageMaxDataSize)) {
+			*complete = false;
+			return 0;
+		}
+
+		return gin_decode_segments((char *) GinDataLeafPageGetPostingList(buffer), size,
+								   tids, INDEX_MAX_PAGE_TIDS, complete);
+	}
+
+	nitems = GinPageGetOpaque(buffer)->maxoff;
+	*complete = (nitems * sizeof(ItemPointerData) <= GinDataPageMaxDataSize);
+
+	if (!*complete) {
+		nitems = GinDataPageMaxDataSize / sizeof(ItemPointerData);
+	}
+
+	memcpy(tids, GinDataPageGetItemPointer(buffer, FirstOffsetNumber), nitems * sizeof(ItemPointerData));
+
+	return nitems;
+
+}
+
+/* TIDs in the posting list of the entry (len is the size of the tuple) */
+static int gin_entry_tids(IndexTuple itup, int len, ItemPointerData *tids, int maxtids, bool *complete) {
+
+	int offset = GinGetPostingOffset(itup);
+	int nitems = GinGetNPosting(itup);
+
+	*complete = (offset >= (int) sizeof(IndexTupleData)) && (offset <= len);
+
+	if (!*complete) {
+		return 0;
+	}
+
+	/* a single segment */
+	if (GinItupIsCompressed(itup)) {
+
+		GinPostingList *segment = (GinPostingList *) GinGetPosting(itup);
+
+		*complete = (len - offset >= (int) offsetof(GinPostingList, bytes)) &&
+					((int) SizeOfGinPostingList(segment) <= len - offset);
+
+		return (*complete) ? gin_decode_segment(segment, tids, maxtids) : 0;
+	}
+
+	/* uncompressed (from before 9.4) */
+	if (offset + nitems * (int) sizeof(ItemPointerData) > len) {
+		*complete = false;
+		nitems = (len - offset) / sizeof(ItemPointerData);
+	}
+
+	nitems = Min(nitems, maxtids);
+
+	memcpy(tids, GinGetPosting(itup), nitems * sizeof(ItemPointerData));
+
+	return nitems;
+
+}
+
+/* decodes the segments of a posting list (checking that all the segments are
+ * within the list, as the decoding only looks at the segment itself) */
+static int gin_decode_segments(char *ptr, int len, ItemPointerData *tids, int maxtids, bool *complete) {
+
+	char *end = ptr + len;
+	int ntids = 0;
+
+	*complete = true;
+
+	while (ptr < end) {
+
+		GinPostingList *segment = (GinPostingList *) ptr;
+
+		if ((end - ptr < (int) offsetof(GinPostingList, bytes)) ||
+			((int) SizeOfGinPostingList(segment) > end - ptr)) {
+			*complete = false;
+			break;
+		}
+
+		ntids += gin_decode_segment(segment, &tids[ntids], maxtids - ntids);
+
+		ptr += SizeOfGinPostingList(segment);
+	}
+
+	return ntids;
+
+}
+
+/* decodes a single segment (at most maxtids TIDs) straight into the array,
+ * the same way as ginPostingListDecode (which allocates the result, while
+ * this may be called with the buffer locked) - the first TID is stored as
+ * is, followed by the differences encoded as varbyte integers */
+static int gin_decode_segment(GinPostingList *segment, ItemPointerData *tids, int maxtids) {
+
+	unsigned char *ptr = segment->bytes;
+	unsigned char *end = segment->bytes + segment->nbytes;
+	uint64	val;
+	int		ndecoded = 0;
+
+	if (maxtids <= 0) {
+		return 0;
+	}
+
+	tids[ndecoded++] = segment->first;
+
+	val = ((uint64) GinItemPointerGetBlockNumber(&segment->first) << GIN_TID_OFFSET_BITS) |
+		  GinItemPointerGetOffsetNumber(&segment->first);
+
+	while ((ptr < end) && (ndecoded < maxtids)) {
+
+		uint64	delta = 0;
+		int		shift = 0;
+		unsigned char c;
+
+		/* 7 bits per byte (the high bit means more bytes follow), except
+		 * for the last (6th) byte, which has all 8 bits */
+		do {
+
+			/* a value truncated by the end of the segment (corrupted) */
+			if (ptr >= end) {
+				return ndecoded;
+			}
+
+			c = *(ptr++);
+
+			if (shift == 42) {
+				delta |= ((uint64) c) << shift;
+				break;
+			}
+
+			delta |= ((uint64) (c & 0x7F)) << shift;
+			shift += 7;
+
+		} while (c & 0x80);
+
+		val += delta;
+
+		GinItemPointerSetOffsetNumber(&tids[ndecoded], val & ((1 << GIN_TID_OFFSET_BITS) - 1));
+		GinItemPointerSetBlockNumber(&tids[ndecoded], val >> GIN_TID_OFFSET_BITS);
+		ndecoded++;
+	}
+
+	return ndecoded;
+
+}
+
+#endif
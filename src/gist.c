@@ -0,0 +1,163 @@
+#include "index.h"
+#include "common.h"
+
+#include "access/gist_private.h"
+
+/* all the page flags (anything else is corruption) */
+#if (PG_VERSION_NUM >= 90600)
+#define GIST_KNOWN_FLAGS	(F_LEAF | F_DELETED | F_TUPLES_DELETED | F_FOLLOW_RIGHT | F_HAS_GARBAGE)
+#else
+#define GIST_KNOWN_FLAGS	(F_LEAF | F_DELETED | F_TUPLES_DELETED | F_FOLLOW_RIGHT)
+#endif
+
+static bool gist_special_valid(PageHeader header);
+
+/* checks the page header and the special space */
+uint32 check_gist_page(Relation rel, PageHeader header, char *buffer, int block) {
+
+	uint32 nerrs = 0;
+	GISTPageOpaque opaque;
+
+	nerrs += check_page_header(header, block);
+
+	if (!gist_special_valid(header)) {
+		check_report(WARNING, block, 0, "index_special",
+					 "special space size %d does not match GiST page (%d)",
+					 BLCKSZ - header->pd_special, (int) MAXALIGN(sizeof(GISTPageOpaqueData)));
+		return ++nerrs;
+	}
+
+	opaque = GistPageGetOpaque(buffer);
+
+	if (opaque->gist_page_id != GIST_PAGE_ID) {
+		check_report(WARNING, block, 0, "gist_page_id",
+					 "page contains invalid page id 0x%04x (should be 0x%04x)",
+					 opaque->gist_page_id, GIST_PAGE_ID);
+		nerrs++;
+	}
+
+	if ((opaque->flags & ~GIST_KNOWN_FLAGS) != 0) {
+		check_report(WARNING, block, 0, "gist_flags", "page has unknown flags 0x%04x",
+					 opaque->flags & ~GIST_KNOWN_FLAGS);
+		nerrs++;
+	}
+
+	if ((block == GIST_ROOT_BLKNO) && GistPageIsDeleted(buffer)) {
+		check_report(WARNING, block, 0, "gist_root", "root page is deleted");
+		nerrs++;
+	}
+
+	return nerrs;
+
+}
+
+/* checks the items - heap TIDs on leaf pages, downlinks on internal pages,
+ * and the attributes (stored as the opclasses' storage types) */
+uint32 check_gist_tuples(Relation rel, PageHeader header, char *buffer, int block) {
+
+	uint32 nerrs = 0;
+	int ntuples;
+	OffsetNumber offnum;
+
+	if (!gist_special_valid(header) || GistPageIsDeleted(buffer)) {
+		return 0;
+	}
+
+	ntuples = Min(PageGetMaxOffsetNumber(buffer), MaxIndexTuplesPerPage);
+
+	for (offnum = FirstOffsetNumber; offnum <= ntuples; offnum++) {
+
+		IndexTuple itup;
+		int len;
+
+		if (!check_index_item(header, block, offnum, sizeof(IndexTupleData), &nerrs)) {
+			continue;
+		}
+
+		itup = (IndexTuple) PageGetItem(buffer, PageGetItemId(buffer, offnum));
+		len = ItemIdGetLength(PageGetItemId(buffer, offnum));
+
+		if (IndexTupleSize(itup) > len) {
+			check_report(WARNING, block, offnum, "index_tuple_size",
+						 "tuple size %d exceeds the item length %d", (int) IndexTupleSize(itup), len);
+			nerrs++;
+			continue;
+		}
+
+		if (GistPageIsLeaf(buffer)) {
+
+			OffsetNumber off = IndexTidOffset(&itup->t_tid);
+
+			if ((off < FirstOffsetNumber) || (off > MaxHeapTuplesPerPage)) {
+				check_report(WARNING, block, offnum, "gist_heap_tid", "invalid heap TID (%u,%u)",
+							 IndexTidBlock(&itup->t_tid), off);
+				nerrs++;
+			}
+
+		} else {
+
+			/* left by a crash in the middle of a page split before 9.1 */
+			if (GistTupleIsInvalid(itup)) {
+				check_report(WARNING, block, offnum, "gist_invalid_tuple",
+							 "invalid tuple (incomplete split, the index needs to be rebuilt)");
+				nerrs++;
+				continue;
+			}
+
+			if (IndexTidBlock(&itup->t_tid) == GIST_ROOT_BLKNO) {
+				check_report(WARNING, block, offnum, "gist_downlink", "downlink to the root page");
+				nerrs++;
+			}
+		}
+
+		if ((rel != NULL) && ItemIdIsNormal(PageGetItemId(buffer, offnum))) {
+			nerrs += check_index_tuple_attributes(rel, header, block, offnum, buffer,
+												  IndexTupleSize(itup) - IndexInfoFindDataOffset(itup->t_info));
+		}
+	}
+
+	/* check intersection of the tuples (all at once) */
+	nerrs += check_item_overlaps(header, block, ntuples);
+
+	if (nerrs > 0) {
+		check_report(WARNING, block, 0, "page_corrupted", "is probably corrupted, there were %d errors reported", nerrs);
+	}
+
+	return nerrs;
+
+}
+
+/* heap TIDs of the items on a leaf page */
+int gist_page_tids(char *buffer, int block, ItemPointerData *tids) {
+
+	PageHeader header = (PageHeader) buffer;
+	int ntids = 0;
+	int ntuples;
+	OffsetNumber offnum;
+
+	if (!gist_special_valid(header) || GistPageIsDeleted(buffer) || !GistPageIsLeaf(buffer)) {
+		return 0;
+	}
+
+	ntuples = Min(PageGetMaxOffsetNumber(buffer), MaxIndexTuplesPerPage);
+
+	for (offnum = FirstOffsetNumber; offnum <= ntuples; offnum++) {
+
+		ItemId lp = PageGetItemId(buffer, offnum);
+
+		/* invalid items are reported by the checks */
+		if (INDEX_ITEM_VALID(header, lp, sizeof(IndexTupleData))) {
+			tids[ntids++] = ((IndexTuple) PageGetItem(buffer, lp))->t_tid;
+		}
+	}
+
+	return ntids;
+
+}
+
+/* the special space has the size of the GiST opaque data */
+static bool gist_special_valid(PageHeader header) {
+
+	return (header->pd_special == BLCKSZ - MAXALIGN(sizeof(GISTPageOpaqueData)));
+
+}
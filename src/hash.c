@@ -0,0 +1,156 @@
+#include "index.h"
+#include "common.h"
+
+#include "access/hash.h"
+
+/* size of the index tuples (only the hash code is stored) */
+#define HASH_TUPLE_SIZE		MAXALIGN(sizeof(IndexTupleData) + sizeof(uint32))
+
+#define HashPageOpaqueGet(page)	((HashPageOpaque) PageGetSpecialPointer(page))
+
+static bool hash_special_valid(PageHeader header);
+static bool hash_has_tuples(char *buffer);
+
+/* checks the page header, special space, page type and the metapage */
+uint32 check_hash_page(Relation rel, PageHeader header, char *buffer, int block) {
+
+	uint32 nerrs = 0;
+	HashPageOpaque opaque;
+	uint16 type;
+
+	nerrs += check_page_header(header, block);
+
+	if (!hash_special_valid(header)) {
+		check_report(WARNING, block, 0, "index_special",
+					 "special space size %d does not match hash page (%d)",
+					 BLCKSZ - header->pd_special, (int) MAXALIGN(sizeof(HashPageOpaqueData)));
+		return ++nerrs;
+	}
+
+	opaque = HashPageOpaqueGet(buffer);
+	type = opaque->hasho_flag & LH_PAGE_TYPE;
+
+	if (opaque->hasho_page_id != HASHO_PAGE_ID) {
+		check_report(WARNING, block, 0, "hash_page_id",
+					 "page contains invalid page id 0x%04x (should be 0x%04x)",
+					 opaque->hasho_page_id, HASHO_PAGE_ID);
+		nerrs++;
+	}
+
+	/* exactly one of the page types (or an unused overflow page) */
+	if ((type != LH_UNUSED_PAGE) && (type != LH_OVERFLOW_PAGE) && (type != LH_BUCKET_PAGE) &&
+		(type != LH_BITMAP_PAGE) && (type != LH_META_PAGE)) {
+		check_report(WARNING, block, 0, "hash_page_type", "page has invalid type 0x%04x", type);
+		nerrs++;
+	}
+
+	/* the metapage is always the first block */
+	if ((block == HASH_METAPAGE) != (type == LH_META_PAGE)) {
+		check_report(WARNING, block, 0, "hash_meta",
+					 (block == HASH_METAPAGE) ? "block is not a metapage" : "unexpected metapage");
+		nerrs++;
+	} else if (block == HASH_METAPAGE) {
+
+		HashMetaPage meta = HashPageGetMeta(buffer);
+
+		if (meta->hashm_magic != HASH_MAGIC) {
+			check_report(WARNING, block, 0, "meta_magic", "metapage contains invalid magic number %d (should be %d)", meta->hashm_magic, HASH_MAGIC);
+			nerrs++;
+		}
+
+		if (meta->hashm_version != HASH_VERSION) {
+			check_report(WARNING, block, 0, "meta_version", "metapage contains invalid version %d (should be %d)", meta->hashm_version, HASH_VERSION);
+			nerrs++;
+		}
+
+		if (meta->hashm_maxbucket > meta->hashm_highmask) {
+			check_report(WARNING, block, 0, "hash_buckets",
+						 "max bucket %u is above the high mask %u", meta->hashm_maxbucket, meta->hashm_highmask);
+			nerrs++;
+		}
+	}
+
+	return nerrs;
+
+}
+
+/* checks the items on bucket and overflow pages (the tuple size, heap TIDs,
+ * and the order of the hash codes) */
+uint32 check_hash_tuples(Relation rel, PageHeader header, char *buffer, int block) {
+
+	uint32 nerrs = 0;
+	int ntuples;
+	OffsetNumber offnum;
+	uint32 prev = 0;
+
+	if (!hash_special_valid(header) || !hash_has_tuples(buffer)) {
+		return 0;
+	}
+
+	ntuples = Min(PageGetMaxOffsetNumber(buffer), MaxIndexTuplesPerPage);
+
+	for (offnum = FirstOffsetNumber; offnum <= ntuples; offnum++) {
+
+		IndexTuple itup;
+		OffsetNumber off;
+		uint32 hashkey;
+
+		if (!check_index_item(header, block, offnum, HASH_TUPLE_SIZE, &nerrs)) {
+			continue;
+		}
+
+		itup = (IndexTuple) PageGetItem(buffer, PageGetItemId(buffer, offnum));
+		off = IndexTidOffset(&itup->t_tid);
+
+		if (IndexTupleSize(itup) != HASH_TUPLE_SIZE) {
+			check_report(WARNING, block, offnum, "index_tuple_size",
+						 "tuple size %d is not %d (the hash code)", (int) IndexTupleSize(itup),
+						 (int) HASH_TUPLE_SIZE);
+			nerrs++;
+			continue;
+		}
+
+		if ((off < FirstOffsetNumber) || (off > MaxHeapTuplesPerPage)) {
+			check_report(WARNING, block, offnum, "hash_heap_tid", "invalid heap TID (%u,%u)",
+						 IndexTidBlock(&itup->t_tid), off);
+			nerrs++;
+		}
+
+		/* the items on each page are kept sorted by the hash code */
+		hashkey = _hash_get_indextuple_hashkey(itup);
+
+		if ((offnum > FirstOffsetNumber) && (hashkey < prev)) {
+			check_report(WARNING, block, offnum, "hash_key_order",
+						 "hash code %u is lower than the preceding one %u", hashkey, prev);
+			nerrs++;
+		}
+
+		prev = hashkey;
+	}
+
+	/* check intersection of the tuples (all at once) */
+	nerrs += check_item_overlaps(header, block, ntuples);
+
+	if (nerrs > 0) {
+		check_report(WARNING, block, 0, "page_corrupted", "is probably corrupted, there were %d errors reported", nerrs);
+	}
+
+	return nerrs;
+
+}
+
+/* the special space has the size of the hash opaque data */
+static bool hash_special_valid(PageHeader header) {
+
+	return (header->pd_special == BLCKSZ - MAXALIGN(sizeof(HashPageOpaqueData)));
+
+}
+
+/* only bucket and overflow pages have items */
+static bool hash_has_tuples(char *buffer) {
+
+	uint16 type = HashPageOpaqueGet(buffer)->hasho_flag & LH_PAGE_TYPE;
+
+	return (type == LH_BUCKET_PAGE) || (type == LH_OVERFLOW_PAGE);
+
+}
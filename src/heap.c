@@ -1,4 +1,7 @@
 #include "heap.h"
+#include "common.h"
+#include "stats.h"
+#include "toast.h"
 
 #include "postgres.h"
 
@@ -6,13 +9,29 @@
 #include "utils/rel.h"
 
 #include "funcapi.h"
+#include "utils/guc.h"
 
 #if (PG_VERSION_NUM >= 90300)
 #include "access/htup_details.h"
 #endif
 
+/* pointer to a value in the TOAST relation (not in memory, not expanded) */
+#if (PG_VERSION_NUM >= 90400)
+#define HEAP_IS_TOAST_POINTER(ptr)	VARATT_IS_EXTERNAL_ONDISK(ptr)
+#else
+#define HEAP_IS_TOAST_POINTER(ptr)	VARATT_IS_EXTERNAL(ptr)
+#endif
+
+/* the tuple is certainly live (from the hint bits), so the TOAST values
+ * it references can't have been removed by vacuum */
+#define HEAP_TUPLE_KNOWN_LIVE(tup) \
+	(((tup)->t_infomask & HEAP_XMIN_COMMITTED) && \
+	 (((tup)->t_infomask & HEAP_XMAX_INVALID) || HEAP_XMAX_IS_LOCKED_ONLY((tup)->t_infomask)))
+
+static uint32 check_heap_tuples_kernel(Relation rel, heap_layout * layout, PageHeader header, char *buffer, int block, int ntuples);
+
 /* checks heap tuples (table) on the page, one by one */
-uint32 check_heap_tuples(Relation rel, PageHeader header, char *buffer, int block) {
+uint32 check_heap_tuples(Relation rel, heap_layout * layout, PageHeader header, char *buffer, int block) {
 
 	/* tuple checks */
 	int ntuples = PageGetMaxOffsetNumber(buffer);
@@ -20,24 +39,88 @@ uint32 check_heap_tuples(Relation rel, PageHeader header, char *buffer, int bloc
 	uint32 nerrs = 0;
   
 	ereport(DEBUG1, (errmsg("[%d] max number of tuples = %d", block, ntuples)));
-      
-	for (i = 0; i < ntuples; i++) {
-		nerrs += check_heap_tuple(rel, header, block, i, buffer);
+
+	pgcheck_stats.tuples += ntuples;
+
+	/* the common case - valid header, and no messages about each tuple */
+	if ((layout != NULL) && layout->kernel && page_header_clean(header)) {
+		nerrs += check_heap_tuples_kernel(rel, layout, header, buffer, block, ntuples);
+	} else {
+		for (i = 0; i < ntuples; i++) {
+			nerrs += check_heap_tuple(rel, layout, header, block, i, buffer);
+		}
 	}
+
+	/* check intersection of the tuples (all at once) */
+	nerrs += check_item_overlaps(header, block, ntuples);
 	
 	if (nerrs > 0) {
-		ereport(WARNING, (errmsg("[%d] is probably corrupted, there were %d errors reported", block, nerrs)));
+		check_report(WARNING, block, 0, "page_corrupted", "is probably corrupted, there were %d errors reported", nerrs);
 	}
 
 	return nerrs;
   
 }
 
-/* checks that the tuples do not overlap and then the individual attributes */
-uint32 check_heap_tuple(Relation rel, PageHeader header, int block, int i, char *buffer) {
+/* Is the tuple with all attributes fixed-width valid? Without NULLs the
+ * attributes are at the cached offsets, so just the natts and the end of
+ * the prefix need to be checked (the same as check_heap_tuple_attributes,
+ * with the whole attribute loop reduced to a single compare). */
+static inline bool heap_tuple_fixed_clean(heap_layout * layout, char *buffer, ItemId lp) {
+
+	HeapTupleHeader tupheader = (HeapTupleHeader)(buffer + lp->lp_off);
+
+	return !(tupheader->t_infomask & HEAP_HASNULL) &
+		   (HeapTupleHeaderGetNatts(tupheader) == layout->natts) &
+		   (tupheader->t_hoff + layout->fixed_len <= lp->lp_len);
+
+}
+
+/* the tuple checks of a page with a valid header - all the line pointer
+ * checks at once, and only the items failing them get the detailed checks
+ * (and reports) of check_heap_tuple */
+static uint32 check_heap_tuples_kernel(Relation rel, heap_layout * layout, PageHeader header, char *buffer, int block, int ntuples) {
+
+	uint32	nerrs = 0;
+	int		upper = header->pd_upper;
+	int		special = header->pd_special;
+	int		i;
+
+	for (i = 0; i < ntuples; i++) {
+
+		ItemId	lp = &header->pd_linp[i];
+
+		if (lp->lp_flags == LP_NORMAL) {
+
+			/* within the tuple space, and long enough to read the header */
+			if (likely((lp->lp_len >= SizeofHeapTupleHeader) & (lp->lp_off >= upper) &
+					   (lp->lp_off + lp->lp_len <= special))) {
+
+				if (layout->all_fixed && heap_tuple_fixed_clean(layout, buffer, lp)) {
+					pgcheck_stats.attributes += layout->natts;
+					continue;
+				}
+
+				nerrs += check_heap_tuple_attributes(rel, layout, header, block, i, buffer);
+				continue;
+			}
+
+		/* unused and redirect items have no length, dead ones are not checked */
+		} else if (likely((lp->lp_len == 0) | (lp->lp_flags == LP_DEAD))) {
+			continue;
+		}
+
+		nerrs += check_heap_tuple(rel, layout, header, block, i, buffer);
+	}
+
+	return nerrs;
+
+}
+
+/* checks the line pointer and then the individual attributes */
+uint32 check_heap_tuple(Relation rel, heap_layout * layout, PageHeader header, int block, int i, char *buffer) {
   
 	uint32 nerrs = 0;
-	int j, a, b, c, d;
 	
 	/* check length with respect to header->pd_linp[i].lp_flags (unused, normal, redirect, dead) - see page 36 */
 	if (header->pd_linp[i].lp_flags == LP_REDIRECT) {
@@ -47,7 +130,7 @@ uint32 check_heap_tuple(Relation rel, PageHeader header, int block, int i, char
 		/* FIXME check that the LP_REDIRECT target is OK (exists, not empty) to handle HOT tuples properly */
 		/* items with LP_REDIRECT need to be handled differently (lp_off holds the link to the next tuple pointer) */
 		if (header->pd_linp[i].lp_len != 0) {
-			ereport(WARNING,(errmsg("[%d:%d] tuple with LP_REDIRECT and len != 0 (%d)", block, (i+1), header->pd_linp[i].lp_len)));
+			check_report(WARNING, block, (i+1), "redirect_length", "tuple with LP_REDIRECT and len != 0 (%d)", header->pd_linp[i].lp_len);
 			++nerrs;
 		}
 		
@@ -59,7 +142,7 @@ uint32 check_heap_tuple(Relation rel, PageHeader header, int block, int i, char
 	  
 		/* LP_UNUSED => (len = 0) */
 		if (header->pd_linp[i].lp_len != 0) {
-			ereport(WARNING,(errmsg("[%d:%d] tuple with LP_UNUSED and len != 0 (%d)", block, (i+1), header->pd_linp[i].lp_len)));
+			check_report(WARNING, block, (i+1), "unused_length", "tuple with LP_UNUSED and len != 0 (%d)", header->pd_linp[i].lp_len);
 			++nerrs;
 		}
 		
@@ -78,58 +161,113 @@ uint32 check_heap_tuple(Relation rel, PageHeader header, int block, int i, char
 		 * there are some overflow issues (resulting in invalid memory alloc size and a crash). */
 		
 		if (header->pd_linp[i].lp_len <= 0) {
-			ereport(WARNING,(errmsg("[%d:%d] tuple with length <= 0 (%d)", block, (i+1), header->pd_linp[i].lp_len)));
+			check_report(WARNING, block, (i+1), "item_length", "tuple with length <= 0 (%d)", header->pd_linp[i].lp_len);
 			++nerrs;
 		}
 
 		if (header->pd_linp[i].lp_off <= 0) {
-			ereport(WARNING,(errmsg("[%d:%d] tuple with offset <= 0 (%d)", block, (i+1), header->pd_linp[i].lp_off)));
+			check_report(WARNING, block, (i+1), "item_offset", "tuple with offset <= 0 (%d)", header->pd_linp[i].lp_off);
 			++nerrs;
 		}
 
 		/* position on the page */
 		if (header->pd_linp[i].lp_off < header->pd_upper) {
-			ereport(WARNING,(errmsg("[%d:%d] tuple with offset - length < upper (%d - %d < %d)", block, (i+1), header->pd_linp[i].lp_off, header->pd_linp[i].lp_len, header->pd_upper)));
+			check_report(WARNING, block, (i+1), "item_below_upper", "tuple with offset - length < upper (%d - %d < %d)", header->pd_linp[i].lp_off, header->pd_linp[i].lp_len, header->pd_upper);
 			++nerrs;
 		}
 
 		if (header->pd_linp[i].lp_off + header->pd_linp[i].lp_len > header->pd_special) {
-			ereport(WARNING,(errmsg("[%d:%d] tuple with offset > special (%d > %d)", block, (i+1), header->pd_linp[i].lp_off, header->pd_special)));
+			check_report(WARNING, block, (i+1), "item_above_special", "tuple with offset > special (%d > %d)", header->pd_linp[i].lp_off, header->pd_special);
 			++nerrs;
 		}
 		
 	}
 	
-	/* check intersection with other tuples */
-		  
-	/* [A,B] vs [C,D] */
-	a = header->pd_linp[i].lp_off;
-	b = header->pd_linp[i].lp_off + header->pd_linp[i].lp_len;
+	/* without the tuple descriptor (offline checks), only the item itself */
+	if (layout == NULL) {
+		return nerrs;
+	}
+
+	return nerrs + check_heap_tuple_attributes(rel, layout, header, block, i, buffer);
 	
-	for (j = 0; j < i; j++) {
-	  
-		/* FIXME Skip UNUSED/REDIRECT/DEAD tuples (probably shouldn't skip DEAD ones) */
-		if (! (header->pd_linp[i].lp_flags == LP_NORMAL)) {
-			continue;
+}
+
+/* builds the attribute layout of the relation (once per check) */
+heap_layout * heap_layout_build(Relation rel) {
+
+	heap_layout * layout;
+	int		j;
+	int		off = 0;
+	bool	prefix = true;
+
+	layout = (heap_layout *) palloc0(sizeof(heap_layout));
+
+	layout->natts = rel->rd_att->natts;
+	layout->attrs = (heap_attr_layout *) palloc0(sizeof(heap_attr_layout) * Max(layout->natts, 1));
+
+	/* the fast path skips the DEBUG3 messages about the attributes, the
+	 * kernel also the DEBUG2 messages about the items */
+	layout->fast = check_debug_off(DEBUG3);
+	layout->kernel = check_debug_off(DEBUG2);
+
+	for (j = 0; j < layout->natts; j++) {
+
+		Form_pg_attribute att = rel->rd_att->attrs[j];
+		heap_attr_layout *attr = &layout->attrs[j];
+
+		attr->attlen = att->attlen;
+
+		/* copied from src/backend/commands/analyze.c */
+		attr->is_varlena  = (!att->attbyval && att->attlen == -1);
+		attr->is_varwidth = (!att->attbyval && att->attlen < 0); /* thus "len == -2" */
+
+		/* same as att_align_nominal */
+		switch (att->attalign) {
+			case 'i':
+				attr->alignmask = ALIGNOF_INT - 1;
+				break;
+			case 'd':
+				attr->alignmask = ALIGNOF_DOUBLE - 1;
+				break;
+			case 's':
+				attr->alignmask = ALIGNOF_SHORT - 1;
+				break;
+			default:
+				attr->alignmask = 0;
+				break;
 		}
-	  
-		c = header->pd_linp[j].lp_off;
-		d = header->pd_linp[j].lp_off + header->pd_linp[j].lp_len;
 
-		/* [A,C,B] or [A,D,B] or [C,A,D] or [C,B,D] */
-		if (((a < c) && (c < b)) || ((a < d) && (d < b)) ||
-			((c < a) && (a < d)) || ((c < b) && (b < d))) {
-			ereport(WARNING,(errmsg("[%d:%d] intersects with [%d:%d] (%d,%d) vs. (%d,%d)", block, (i+1), block, j, a, b, c, d)));
-			++nerrs;
+		/* fixed-width prefix, the offsets are the same in all tuples without NULLs */
+		prefix = prefix && (att->attlen > 0);
+
+		if (prefix) {
+			off = (off + attr->alignmask) & ~attr->alignmask;
+			attr->cacheoff = off;
+			off += att->attlen;
+
+			layout->nfixed = j + 1;
+			layout->fixed_len = off;
+		} else {
+			attr->cacheoff = -1;
 		}
 	}
-	
-	return nerrs + check_heap_tuple_attributes(rel, header, block, i, buffer);
-	
+
+	layout->all_fixed = (layout->nfixed == layout->natts);
+
+	return layout;
+
+}
+
+/* releases the attribute layout */
+void heap_layout_free(heap_layout * layout) {
+
+	pfree(layout->attrs);
+	pfree(layout);
+
 }
 
 /* checks the individual attributes of the tuple */
-uint32 check_heap_tuple_attributes(Relation rel, PageHeader header, int block, int i, char *buffer) {
+uint32 check_heap_tuple_attributes(Relation rel, heap_layout * layout, PageHeader header, int block, int i, char *buffer) {
 	
 	HeapTupleHeader tupheader;
 	uint32 nerrs = 0;
@@ -145,27 +283,45 @@ uint32 check_heap_tuple_attributes(Relation rel, PageHeader header, int block, i
 	off = header->pd_linp[i].lp_off + tupheader->t_hoff;
 
 	tuplenatts = HeapTupleHeaderGetNatts(tupheader);
-	if (tuplenatts > rel->rd_att->natts) {
-		ereport(WARNING,
-				(errmsg("[%d:%d] tuple has too many attributes. %d found, %d expected",
-						block, (i+1),
-						HeapTupleHeaderGetNatts(tupheader),
-						RelationGetNumberOfAttributes(rel))));
+	if (tuplenatts > layout->natts) {
+		check_report(WARNING, block, (i+1), "heap_natts",
+					"tuple has too many attributes. %d found, %d expected",
+					HeapTupleHeaderGetNatts(tupheader), RelationGetNumberOfAttributes(rel));
 		++nerrs;
 	} else {
-		int	endoff;
+		int	endoff = header->pd_linp[i].lp_off + header->pd_linp[i].lp_len;
 	  
-		ereport(DEBUG3,(errmsg("[%d:%d] tuple has %d attributes (%d in relation)", block, (i+1), tuplenatts, rel->rd_att->natts)));
+		ereport(DEBUG3,(errmsg("[%d:%d] tuple has %d attributes (%d in relation)", block, (i+1), tuplenatts, layout->natts)));
+
+		pgcheck_stats.attributes += tuplenatts;
+
+		j = 0;
+
+		/* without NULLs the fixed-width prefix is at known offsets (just like
+		 * attcacheoff), so skip right to the first variable-width attribute */
+		if (layout->fast && !(tupheader->t_infomask & HEAP_HASNULL)) {
+
+			int	nfixed = Min(layout->nfixed, tuplenatts);
+
+			if (nfixed > 0) {
+
+				heap_attr_layout *attr = &layout->attrs[nfixed - 1];
+
+				/* if the prefix overflows the tuple, walk it to report the attribute */
+				if (off + attr->cacheoff + attr->attlen <= endoff) {
+					off += attr->cacheoff + attr->attlen;
+					j = nfixed;
+				}
+			}
+		}
 	  
-		/* check all the attributes */
-		for (j = 0; j < tuplenatts; j++) {
+		/* check all the (remaining) attributes */
+		for (; j < tuplenatts; j++) {
 		  
+			heap_attr_layout *attr = &layout->attrs[j];
+
 			/* default length of the attribute */
-			int len = rel->rd_att->attrs[j]->attlen;
-			
-			/* copied from src/backend/commands/analyze.c */
-			bool is_varlena  = (!rel->rd_att->attrs[j]->attbyval && len == -1);
-			bool is_varwidth = (!rel->rd_att->attrs[j]->attbyval && len < 0); /* thus "len == -2" */
+			int len = attr->attlen;
 
 			/* if the attribute is marked as NULL (in the tuple header), skip to the next attribute */
 			if ((tupheader->t_infomask & HEAP_HASNULL) && att_isnull(j, tupheader->t_bits)) {
@@ -173,10 +329,12 @@ uint32 check_heap_tuple_attributes(Relation rel, PageHeader header, int block, i
 				continue;
 			}
 
-			/* fix the alignment */
-			off = att_align_pointer(off, rel->rd_att->attrs[j]->attalign, rel->rd_att->attrs[j]->attlen, buffer+off);
+			/* fix the alignment (same as att_align_pointer - short varlena values are not aligned) */
+			if (!(attr->is_varlena && VARATT_NOT_PAD_BYTE(buffer + off))) {
+				off = (off + attr->alignmask) & ~attr->alignmask;
+			}
 			
-			if (is_varlena) { 
+			if (attr->is_varlena) { 
 				/*
 				  other interesting macros (see postgres.h) - should do something about those ...
 				  
@@ -189,7 +347,7 @@ uint32 check_heap_tuple_attributes(Relation rel, PageHeader header, int block, i
 				len = VARSIZE_ANY(buffer + off);
 				
 				if (len < 0) {
-					ereport(WARNING, (errmsg("[%d:%d] attribute '%s' has negative length < 0 (%d)", block, (i+1), rel->rd_att->attrs[j]->attname.data, len)));
+					check_report(WARNING, block, (i+1), "attribute_length", "attribute '%s' has negative length < 0 (%d)", rel->rd_att->attrs[j]->attname.data, len);
 					++nerrs;
 					break;
 				}
@@ -197,15 +355,28 @@ uint32 check_heap_tuple_attributes(Relation rel, PageHeader header, int block, i
 				if (VARATT_IS_COMPRESSED(buffer + off)) {
 					/* the raw length should be less than 1G (and positive) */
 					if ((VARRAWSIZE_4B_C(buffer + off) < 0) || (VARRAWSIZE_4B_C(buffer + off) > 1024*1024)) {
-						ereport(WARNING, (errmsg("[%d:%d]  attribute '%s' has invalid length %d (should be between 0 and 1G)", block, (i+1), rel->rd_att->attrs[j]->attname.data, VARRAWSIZE_4B_C(buffer + off))));
+						check_report(WARNING, block, (i+1), "attribute_raw_length", "attribute '%s' has invalid length %d (should be between 0 and 1G)", rel->rd_att->attrs[j]->attname.data, VARRAWSIZE_4B_C(buffer + off));
 						++nerrs; // ((toast_pointer).va_extsize < (toast_pointer).va_rawsize - VARHDRSZ)
 						/* no break here, this does not break the page structure - we may check the other attributes */
 					}
 				}
 				
-				/* FIXME  Check if the varlena value may be detoasted - see heap_tuple_untoast_attr in backend/access/heap/tuptoaster.c. */
+				/* values in the TOAST relation are verified in batches (see toast.h),
+				 * the pointer has to fit into the tuple though */
+				if ((layout->toast != NULL) && HEAP_IS_TOAST_POINTER(buffer + off) &&
+					(off + len <= endoff) && HEAP_TUPLE_KNOWN_LIVE(tupheader)) {
+
+					struct varatt_external toast_pointer;
+
+					memcpy(&toast_pointer, VARDATA_EXTERNAL(buffer + off), sizeof(toast_pointer));
+
+					if (toast_pointer.va_toastrelid == layout->toast->toastrelid) {
+						toast_refs_add(layout->toast, toast_pointer.va_valueid,
+									   toast_pointer.va_extsize, block, (i+1));
+					}
+				}
 				
-			} else if (is_varwidth) {
+			} else if (attr->is_varwidth) {
 			
 				/* get the C-string length (at most to the end of tuple), +1 as it does not include '\0' at the end */
 				/* if the string is not properly terminated, then this returns 'remaining space + 1' so it's detected */
@@ -216,14 +387,10 @@ uint32 check_heap_tuple_attributes(Relation rel, PageHeader header, int block, i
 			/* Check if the length makes sense (is not negative and does not overflow
 			 * the tuple end, stop validating the other rows (we don't know where to
 			 * continue anyway). */
-			endoff = header->pd_linp[i].lp_off + header->pd_linp[i].lp_len;
 			if (off + len > endoff) {
-				ereport(WARNING,
-						(errmsg("[%d:%d] attribute '%s' (off=%d len=%d) overflows tuple end (off=%d, len=%d)",
-								block, (i+1),
-								rel->rd_att->attrs[j]->attname.data, off, len,
-								header->pd_linp[i].lp_off,
-								header->pd_linp[i].lp_len)));
+				check_report(WARNING, block, (i+1), "attribute_overflow",
+							"attribute '%s' (off=%d len=%d) overflows tuple end (off=%d, len=%d)",
+							rel->rd_att->attrs[j]->attname.data, off, len, header->pd_linp[i].lp_off, header->pd_linp[i].lp_len);
 				++nerrs;
 				break;
 			}
@@ -241,12 +408,10 @@ uint32 check_heap_tuple_attributes(Relation rel, PageHeader header, int block, i
 		 * The end of last attribute should fall within the length given in
 		 * the line pointer.
 		 */
-		endoff = header->pd_linp[i].lp_off + header->pd_linp[i].lp_len;
 		if (off > endoff) {
-			ereport(WARNING,
-					(errmsg("[%d:%d] the last attribute ends at %d but the tuple ends at %d",
-							block, (i+1), off,
-							endoff)));
+			check_report(WARNING, block, (i+1), "attribute_end",
+						"the last attribute ends at %d but the tuple ends at %d",
+						off, endoff);
 			++nerrs;
 		}
 		
@@ -4,8 +4,44 @@
 #include "postgres.h"
 #include "access/heapam.h"
 
-uint32 check_heap_tuples(Relation rel, PageHeader header, char *buffer, int block);
-uint32 check_heap_tuple(Relation rel, PageHeader header, int block, int i, char *buffer);
-uint32 check_heap_tuple_attributes(Relation rel, PageHeader header, int block, int i, char *buffer);
+/* layout of an attribute (derived from the tuple descriptor) */
+typedef struct heap_attr_layout {
+
+	int16	attlen;			/* attlen (-1 varlena, -2 cstring) */
+	bool	is_varlena;		/* varlena attribute */
+	bool	is_varwidth;	/* variable-width attribute (varlena or cstring) */
+	int		alignmask;		/* alignment - 1 (from attalign) */
+	int		cacheoff;		/* offset within tuple data (fixed prefix), or -1 */
+
+} heap_attr_layout;
+
+/* Layout of tuples of a relation, built once per check so that the
+ * attributes don't need to be inspected for each tuple again. */
+typedef struct heap_layout {
+
+	int		natts;			/* number of attributes */
+	int		nfixed;			/* length of the fixed-width prefix (attributes) */
+	bool	fast;			/* may skip the fixed-width prefix (no DEBUG3) */
+
+	/* the page kernel (check_heap_tuples without any DEBUG2 messages) */
+	bool	kernel;			/* may use the kernel */
+	bool	all_fixed;		/* all attributes are fixed-width */
+	int		fixed_len;		/* length of the fixed-width prefix (bytes) */
+
+	heap_attr_layout *attrs;
+
+	/* references to TOAST values to verify (NULL when not checked) */
+	struct toast_refs *toast;
+
+} heap_layout;
+
+heap_layout * heap_layout_build(Relation rel);
+void heap_layout_free(heap_layout * layout);
+
+/* The tuple checks accept rel = NULL and layout = NULL (offline checks,
+ * without access to the catalog), and then skip the attribute checks. */
+uint32 check_heap_tuples(Relation rel, heap_layout * layout, PageHeader header, char *buffer, int block);
+uint32 check_heap_tuple(Relation rel, heap_layout * layout, PageHeader header, int block, int i, char *buffer);
+uint32 check_heap_tuple_attributes(Relation rel, heap_layout * layout, PageHeader header, int block, int i, char *buffer);
 
 #endif   /* HEAP_CHECK_H */
\ No newline at end of file
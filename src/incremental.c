@@ -0,0 +1,242 @@
+#include "incremental.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "access/xlog.h"
+#include "catalog/pg_am.h"
+#include "miscadmin.h"
+#include "storage/fd.h"
+
+#define INCREMENTAL_MAGIC	0x70676c73
+
+/* contents of the file stored for a relation */
+typedef struct incremental_state {
+
+	uint32		magic;			/* INCREMENTAL_MAGIC */
+	Oid			relid;			/* the relation */
+	Oid			relfilenode;	/* to detect rewrites (CLUSTER, VACUUM FULL, ...) */
+	uint64		lsn;			/* WAL insert position at the start of the check */
+
+} incremental_state;
+
+static void incremental_path(Relation rel, char *path);
+static void incremental_fsync_dir(void);
+
+/* can the relation be checked incrementally? */
+bool incremental_supported(Relation rel) {
+
+#if (PG_VERSION_NUM >= 90300)
+#if (PG_VERSION_NUM < 100000)
+	/* hash indexes are not WAL-logged before 10 (no page LSNs) */
+	if (rel->rd_rel->relam == HASH_AM_OID) {
+		return false;
+	}
+#endif
+
+	return RelationNeedsWAL(rel) && !RecoveryInProgress();
+#else
+	return false;
+#endif
+
+}
+
+/* WAL insert position (only meaningful when incremental_supported) */
+uint64 incremental_start(void) {
+
+#if (PG_VERSION_NUM >= 90300)
+	return (uint64) GetXLogInsertRecPtr();
+#else
+	return 0;
+#endif
+
+}
+
+/* read the LSN stored for the relation (0 if none) */
+uint64 incremental_load(Relation rel) {
+
+	char	path[MAXPGPATH];
+	FILE   *file;
+	incremental_state state;
+	bool	valid;
+
+	if (!incremental_supported(rel))
+		return 0;
+
+	incremental_path(rel, path);
+
+	file = AllocateFile(path, PG_BINARY_R);
+
+	if (file == NULL) {
+
+		/* never checked (or the last check found issues) */
+		if (errno == ENOENT)
+			return 0;
+
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\": %m", path)));
+	}
+
+	valid = (fread(&state, sizeof(incremental_state), 1, file) == 1);
+
+	FreeFile(file);
+
+	/* ignore broken files, and states of a different relfilenode */
+	if (!valid || (state.magic != INCREMENTAL_MAGIC) ||
+		(state.relid != RelationGetRelid(rel)) ||
+		(state.relfilenode != rel->rd_node.relNode)) {
+
+		ereport(DEBUG1,
+				(errmsg("no valid previous check of \"%s\", checking all pages",
+						RelationGetRelationName(rel))));
+		return 0;
+	}
+
+	return state.lsn;
+
+}
+
+/* store the LSN for the relation */
+void incremental_save(Relation rel, uint64 lsn) {
+
+	char	path[MAXPGPATH];
+	incremental_state state;
+
+	if (!incremental_supported(rel))
+		return;
+
+	incremental_path(rel, path);
+
+	memset(&state, 0, sizeof(incremental_state));
+
+	state.magic = INCREMENTAL_MAGIC;
+	state.relid = RelationGetRelid(rel);
+	state.relfilenode = rel->rd_node.relNode;
+	state.lsn = lsn;
+
+	incremental_write_file(path, &state, sizeof(incremental_state));
+
+}
+
+/* write the file durably - a temporary file (per backend, so concurrent
+ * checks of the same relation don't clobber it) is written and fsynced,
+ * then renamed and the directory fsynced too */
+void incremental_write_file(const char *path, const void *data, Size len) {
+
+	char	tmppath[MAXPGPATH];
+	FILE   *file;
+
+	snprintf(tmppath, MAXPGPATH, "%s.%d.tmp", path, MyProcPid);
+
+	if ((mkdir(INCREMENTAL_DIR, S_IRWXU) != 0) && (errno != EEXIST))
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not create directory \"%s\": %m", INCREMENTAL_DIR)));
+
+	file = AllocateFile(tmppath, PG_BINARY_W);
+
+	if (file == NULL)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not create file \"%s\": %m", tmppath)));
+
+	if ((fwrite(data, len, 1, file) != 1) || (fflush(file) != 0)) {
+		int		save_errno = errno;
+
+		FreeFile(file);
+		unlink(tmppath);
+		errno = save_errno;
+
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write file \"%s\": %m", tmppath)));
+	}
+
+	if (pg_fsync(fileno(file)) != 0) {
+		int		save_errno = errno;
+
+		FreeFile(file);
+		unlink(tmppath);
+		errno = save_errno;
+
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not fsync file \"%s\": %m", tmppath)));
+	}
+
+	if (FreeFile(file) != 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not close file \"%s\": %m", tmppath)));
+
+	if (rename(tmppath, path) != 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not rename file \"%s\" to \"%s\": %m",
+						tmppath, path)));
+
+	/* make the rename durable (and the directory, when just created) */
+	incremental_fsync_dir();
+
+}
+
+/* remove the LSN stored for the relation (if any) */
+void incremental_forget(Relation rel) {
+
+	char	path[MAXPGPATH];
+
+	if (!incremental_supported(rel))
+		return;
+
+	incremental_path(rel, path);
+
+	if ((unlink(path) != 0) && (errno != ENOENT))
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not remove file \"%s\": %m", path)));
+
+}
+
+/* fsync the directory with the files */
+static void incremental_fsync_dir(void) {
+
+	int		fd;
+
+#if (PG_VERSION_NUM >= 110000)
+	fd = OpenTransientFile(INCREMENTAL_DIR, O_RDONLY | PG_BINARY);
+#else
+	fd = OpenTransientFile(INCREMENTAL_DIR, O_RDONLY | PG_BINARY, 0);
+#endif
+
+	if (fd < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open directory \"%s\": %m", INCREMENTAL_DIR)));
+
+	/* some platforms can't fsync directories (same as fsync_fname) */
+	if ((pg_fsync(fd) != 0) && (errno != EBADF) && (errno != EINVAL)) {
+		int		save_errno = errno;
+
+		CloseTransientFile(fd);
+		errno = save_errno;
+
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not fsync directory \"%s\": %m", INCREMENTAL_DIR)));
+	}
+
+	CloseTransientFile(fd);
+
+}
+
+/* path of the file for the relation (relative to the data directory) - the
+ * file is named after the relfilenode, so a rewritten relation (or a new one
+ * with a reused OID) never picks up a state stored for different files */
+static void incremental_path(Relation rel, char *path) {
+
+	snprintf(path, MAXPGPATH, "%s/%u_%u_%u", INCREMENTAL_DIR,
+			 rel->rd_node.spcNode, rel->rd_node.dbNode, rel->rd_node.relNode);
+
+}
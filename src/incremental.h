@@ -0,0 +1,56 @@
+#ifndef INCREMENTAL_CHECK_H
+#define INCREMENTAL_CHECK_H
+
+#include "postgres.h"
+#include "utils/rel.h"
+
+/*
+ * Incremental checks - after an incremental check of the whole relation
+ * that found no issues, the WAL insert position from the start of the check
+ * is stored (in a small file in the pg_check directory of the data
+ * directory, named after the relfilenode). Pages with an older LSN were not
+ * modified since then, so the next incremental check may skip them (the
+ * pages still need to be read to get the LSN, but the checks themselves are
+ * skipped). Regular checks don't store anything, they only remove the
+ * stored LSN when they find issues.
+ *
+ * The LSN is stored as uint64, as XLogRecPtr is not an integer before 9.3
+ * (the incremental mode is not supported there, so it's always 0).
+ */
+
+/* directory (in the data directory) with the stored LSNs (and the cursors
+ * of resumable checks, see resume.h) */
+#define INCREMENTAL_DIR		"pg_check"
+
+/* Can the relation be checked incrementally? Only WAL-logged relations
+ * (not temporary or unlogged ones), and not during recovery. */
+bool incremental_supported(Relation rel);
+
+/* Current WAL insert position (to be stored after the check). */
+uint64 incremental_start(void);
+
+/* Returns the LSN stored for the relation by the last clean check, or 0
+ * when there's none (or the relation was rewritten since then). */
+uint64 incremental_load(Relation rel);
+
+/* Stores the LSN for the relation (after the check found no issues). */
+void incremental_save(Relation rel, uint64 lsn);
+
+/* Removes the LSN stored for the relation (after the check found issues). */
+void incremental_forget(Relation rel);
+
+/* Writes the file (in INCREMENTAL_DIR) durably - writes a temporary file,
+ * fsyncs and renames it, and then fsyncs the directory. */
+void incremental_write_file(const char *path, const void *data, Size len);
+
+/* Was the page verified by the previous check (LSN older than 'lsn')? Pages
+ * with invalid LSN (e.g. written without WAL) are never skipped. */
+#if (PG_VERSION_NUM >= 90300)
+#define page_is_verified(page, lsn) \
+	(((lsn) != 0) && (PageGetLSN(page) != InvalidXLogRecPtr) && \
+	 (PageGetLSN(page) < (XLogRecPtr) (lsn)))
+#else
+#define page_is_verified(page, lsn)	(false)
+#endif
+
+#endif   /* INCREMENTAL_CHECK_H */
@@ -5,6 +5,7 @@
 
 #include "access/itup.h"
 #include "access/nbtree.h"
+#include "catalog/pg_am.h"
 #include "funcapi.h"
 #include "utils/rel.h"
 
@@ -18,9 +19,125 @@
 /* FIXME Check number of valid items in an index (should be the same as in the relation). */
 /* FIXME Check basic XID assumptions (xmax >= xmin, ...). */
 /* FIXME Check that there are no duplicate tuples in the index and that all the table tuples are referenced (need to count tuples). */
-/* FIXME This does not check that the tree structure is valid, just individual pages. This might check that there are no cycles in the index, that all the pages are actually used in the tree. */
+/* The tree structure (siblings, levels, downlinks, key order) is checked in btree.c, this only checks individual pages. */
 /* FIXME Does not check (tid) referenced in the leaf-nodes, in the data section. */
 
+#ifndef FRONTEND
+
+static uint32 check_btree_tuples(Relation rel, PageHeader header, char *buffer, int block);
+static int btree_page_tids(char *buffer, int block, ItemPointerData *tids);
+
+/* the supported access methods (GIN posting lists are decoded in the 9.4
+ * format, BRIN is available since 9.5) */
+static const index_am_check index_am_checks[] = {
+	{BTREE_AM_OID, "btree", true, check_index_page, check_btree_tuples, btree_page_tids},
+#if (PG_VERSION_NUM >= 90400)
+	{GIN_AM_OID, "gin", true, check_gin_page, check_gin_tuples, gin_page_tids},
+#endif
+	{GIST_AM_OID, "gist", true, check_gist_page, check_gist_tuples, gist_page_tids},
+	{HASH_AM_OID, "hash", false, check_hash_page, check_hash_tuples, NULL},
+#if (PG_VERSION_NUM >= 90500)
+	{BRIN_AM_OID, "brin", false, check_brin_page, check_brin_tuples, NULL},
+#endif
+};
+
+/* checks for the access method (NULL when not supported) */
+const index_am_check * index_am_lookup(Oid amoid) {
+
+	int i;
+
+	for (i = 0; i < lengthof(index_am_checks); i++) {
+		if (index_am_checks[i].amoid == amoid) {
+			return &index_am_checks[i];
+		}
+	}
+
+	return NULL;
+
+}
+
+/* the metapage has no items */
+static uint32 check_btree_tuples(Relation rel, PageHeader header, char *buffer, int block) {
+
+	if (block == BTREE_METAPAGE) {
+		return 0;
+	}
+
+	return check_index_tuples(rel, header, buffer, block);
+
+}
+
+/* heap TIDs of all items on a leaf page */
+static int btree_page_tids(char *buffer, int block, ItemPointerData *tids) {
+
+	PageHeader header = (PageHeader) buffer;
+	int ntuples = PageGetMaxOffsetNumber(buffer);
+	int ntids = 0;
+	int item;
+
+	if ((block == BTREE_METAPAGE) || PageIsNew(buffer) ||
+		(header->pd_special > BLCKSZ - MAXALIGN(sizeof(BTPageOpaqueData))) ||
+		!P_ISLEAF((BTPageOpaque)(buffer + header->pd_special))) {
+		return 0;
+	}
+
+	/* a corrupted page can't have more items than possible (the page
+	 * checks report that) */
+	ntuples = Min(ntuples, (int) MaxIndexTuplesPerPage);
+
+	for (item = 0; item < ntuples; item++) {
+
+		IndexTuple itup = (IndexTuple)(buffer + header->pd_linp[item].lp_off);
+
+		/* don't read beyond the end of the page (reported by the checks) */
+		if (header->pd_linp[item].lp_off > BLCKSZ - sizeof(IndexTupleData)) {
+			continue;
+		}
+
+		tids[ntids++] = itup->t_tid;
+	}
+
+	return ntids;
+
+}
+
+#endif
+
+/* is the item within the tuple space of the page (so that it may be read)? */
+bool check_index_item(PageHeader header, int block, OffsetNumber offnum, Size minlen, uint32 *nerrs) {
+
+	ItemId lp = &header->pd_linp[offnum - 1];
+
+	if (!ItemIdHasStorage(lp)) {
+		return false;
+	}
+
+	if (lp->lp_off < header->pd_upper) {
+		check_report(WARNING, block, offnum, "item_below_upper",
+					 "item with offset < upper (%d < %d)", lp->lp_off, header->pd_upper);
+		(*nerrs)++;
+		return false;
+	}
+
+	if (lp->lp_off + lp->lp_len > header->pd_special) {
+		check_report(WARNING, block, offnum, "item_above_special",
+					 "item with offset + length > special (%d + %d > %d)",
+					 lp->lp_off, lp->lp_len, header->pd_special);
+		(*nerrs)++;
+		return false;
+	}
+
+	if (lp->lp_len < minlen) {
+		check_report(WARNING, block, offnum, "item_length",
+					 "item length %d is less than %d", lp->lp_len, (int) minlen);
+		(*nerrs)++;
+		return false;
+	}
+
+	return true;
+
+}
+
 uint32 check_index_page(Relation rel, PageHeader header, char *buffer, int block) {
   
 	uint32 nerrs = 0;
@@ -37,17 +154,16 @@ uint32 check_index_page(Relation rel, PageHeader header, char *buffer, int block
 		ereport(DEBUG2, (errmsg("[%d] is a meta-page [magic=%d, version=%d]", block, mpdata->btm_magic, mpdata->btm_version)));
 		
 		if (mpdata->btm_magic != BTREE_MAGIC) {
-			ereport(WARNING,(errmsg("[%d] metapage contains invalid magic number %d (should be %d)", block, mpdata->btm_magic, BTREE_MAGIC)));
+			check_report(WARNING, block, 0, "meta_magic", "metapage contains invalid magic number %d (should be %d)", mpdata->btm_magic, BTREE_MAGIC);
 			nerrs++;
 		}
 		
 		if (mpdata->btm_version != BTREE_VERSION) {
-			ereport(WARNING,(errmsg("[%d] metapage contains invalid version %d (should be %d)", block, mpdata->btm_version, BTREE_VERSION)));
+			check_report(WARNING, block, 0, "meta_version", "metapage contains invalid version %d (should be %d)", mpdata->btm_version, BTREE_VERSION);
 			nerrs++;
 		}
 		
-		/* FIXME Check that the btm_root/btm_fastroot is between 1 and number of index blocks */
-		/* FIXME Check that the btm_level/btm_fastlevel is equal to the level fo the root block */
+		/* btm_root/btm_fastroot and btm_level/btm_fastlevel are checked in btree.c */
 		
 	} else {
 	  
@@ -55,11 +171,9 @@ uint32 check_index_page(Relation rel, PageHeader header, char *buffer, int block
 	
 		/* check there's enough space for index-relevant data */
 		if (header->pd_special > BLCKSZ - sizeof(BTPageOpaque)) {
-			ereport(WARNING,
-					(errmsg("[%d] there's not enough special space for index data (%d > %d)",
-							block,
-							(int) sizeof(BTPageOpaque),
-							BLCKSZ - header->pd_special)));
+			check_report(WARNING, block, 0, "index_special",
+						"there's not enough special space for index data (%d > %d)",
+						(int) sizeof(BTPageOpaque), BLCKSZ - header->pd_special);
 			nerrs++;
 		}
 		
@@ -73,18 +187,16 @@ uint32 check_index_page(Relation rel, PageHeader header, char *buffer, int block
 			if (P_ISLEAF(opaque))
 			{
 				if (opaque-> btpo.level != 0) {
-					ereport(WARNING,
-							(errmsg("[%d] is leaf page, but level %d is not zero",
-									block, opaque->btpo.level)));
+					check_report(WARNING, block, 0, "leaf_level",
+								"is leaf page, but level %d is not zero",
+								opaque->btpo.level);
 					nerrs++;
 				}
 			}
 			else
 			{
 				if (opaque-> btpo.level == 0) {
-					ereport(WARNING,
-							(errmsg("[%d] is a non-leaf page, but level is zero",
-									block)));
+					check_report(WARNING, block, 0, "nonleaf_level", "is a non-leaf page, but level is zero");
 					nerrs++;
 				}
 			}
@@ -94,6 +206,81 @@ uint32 check_index_page(Relation rel, PageHeader header, char *buffer, int block
 	return nerrs;
 }
 
+/* length of the index attributes when all are fixed-width (-1 otherwise),
+ * with the same alignment as in check_index_tuple_attributes */
+static int index_fixed_len(Relation rel) {
+
+	int j;
+	int off = 0;
+
+	for (j = 0; j < rel->rd_att->natts; j++) {
+
+		if (rel->rd_att->attrs[j]->attlen <= 0) {
+			return -1;
+		}
+
+		off = att_align_nominal(off, rel->rd_att->attrs[j]->attalign) + rel->rd_att->attrs[j]->attlen;
+	}
+
+	return off;
+
+}
+
+/* Is the index tuple (all attributes fixed-width) valid? Without NULLs, and
+ * with the tuple at an aligned offset, the attributes are at fixed offsets,
+ * so just the end of the last one needs to be checked. */
+static inline bool index_tuple_fixed_clean(PageHeader header, char *buffer, ItemId lp, int fixed_len) {
+
+	IndexTuple itup;
+	int		dataoff = MAXALIGN(sizeof(IndexTupleData));
+
+	if (!INDEX_ITEM_VALID(header, lp, sizeof(IndexTupleData))) {
+		return false;
+	}
+
+	itup = (IndexTuple)(buffer + lp->lp_off);
+
+	return !IndexTupleHasNulls(itup) &
+		   ((lp->lp_off & (MAXIMUM_ALIGNOF - 1)) == 0) &
+		   (IndexTupleSize(itup) > dataoff) &
+		   (MAXALIGN(dataoff + fixed_len) <= lp->lp_len);
+
+}
+
+/* the tuple checks of a page with a valid header - only the LP_NORMAL items
+ * failing the quick check get the detailed checks of check_index_tuple
+ * (without the tuple descriptor those don't check anything) */
+static uint32 check_index_tuples_kernel(Relation rel, PageHeader header, char *buffer, int block, int ntuples) {
+
+	uint32	nerrs = 0;
+	int		fixed_len;
+	int		i;
+
+	if (rel == NULL) {
+		return 0;
+	}
+
+	fixed_len = index_fixed_len(rel);
+
+	for (i = 0; i < ntuples; i++) {
+
+		ItemId	lp = &header->pd_linp[i];
+
+		if (lp->lp_flags != LP_NORMAL) {
+			continue;
+		}
+
+		if ((fixed_len >= 0) && likely(index_tuple_fixed_clean(header, buffer, lp, fixed_len))) {
+			continue;
+		}
+
+		nerrs += check_index_tuple(rel, header, block, i, buffer);
+	}
+
+	return nerrs;
+
+}
+
 /* checks index tuples on the page, one by one */
 uint32 check_index_tuples(Relation rel, PageHeader header, char *buffer, int block) {
 
@@ -107,67 +294,72 @@ uint32 check_index_tuples(Relation rel, PageHeader header, char *buffer, int blo
 	/* FIXME check btpo_flags (BTP_LEAF, BTP_ROOT, BTP_DELETED, BTP_META, BTP_HALF_DEAD,
 	 *       BTP_SPLIT_END and BTP_HAS_GARBAGE) and act accordingly */
 	
-	for (i = 0; i < ntuples; i++) {
-		/* FIXME this should check lp_flags, just as the heap check */
-		nerrs += check_index_tuple(rel, header, block, i, buffer);
+	/* the common case - valid header, and no messages about each tuple */
+	if (check_debug_off(DEBUG2) && page_header_clean(header)) {
+		nerrs += check_index_tuples_kernel(rel, header, buffer, block, ntuples);
+	} else {
+		for (i = 0; i < ntuples; i++) {
+			/* FIXME this should check lp_flags, just as the heap check */
+			nerrs += check_index_tuple(rel, header, block, i, buffer);
+		}
 	}
+
+	/* check intersection of the tuples (all at once) */
+	nerrs += check_item_overlaps(header, block, ntuples);
 	
 	if (nerrs > 0) {
-		ereport(WARNING, (errmsg("[%d] is probably corrupted, there were %d errors reported", block, nerrs)));
+		check_report(WARNING, block, 0, "page_corrupted", "is probably corrupted, there were %d errors reported", nerrs);
 	}
 	
 	return nerrs;
   
 }
 
-/* checks that the tuples do not overlap and then the individual attributes */
+/* checks the tuple (attributes of LP_NORMAL tuples) */
 /* FIXME This should do exactly the same checks of lp_flags as in heap.c */
 uint32 check_index_tuple(Relation rel, PageHeader header, int block, int i, char *buffer) {
   
 	uint32 nerrs = 0;
-	int j, a, b, c, d;
-	
-	IndexTuple itup = (IndexTuple)(buffer + header->pd_linp[i].lp_off);
+	BTPageOpaque opaque;
+	IndexTuple itup;
+	int dlen;
+
+	/* don't read beyond the end of the page (reported by the other checks) */
+	if (header->pd_linp[i].lp_off > BLCKSZ - sizeof(IndexTupleData)) {
+		return nerrs;
+	}
+
+	itup = (IndexTuple)(buffer + header->pd_linp[i].lp_off);
 	
 	/* FIXME This is used when checking overflowing attributes, but it's not clear what
 	 * exactly this means / how it works. Needs a bit more investigation and maybe a review
 	 * from soneone who really knows the b-tree implementation. */
-	int dlen = IndexTupleSize(itup) - IndexInfoFindDataOffset(itup->t_info);
+	dlen = IndexTupleSize(itup) - IndexInfoFindDataOffset(itup->t_info);
 	
 	ereport(DEBUG2,(errmsg("[%d:%d] off=%d len=%d tid=(%d,%d)", block, (i+1),
 						   header->pd_linp[i].lp_off, header->pd_linp[i].lp_len,
 						   BlockIdGetBlockNumber(&(itup->t_tid.ip_blkid)),
 						   itup->t_tid.ip_posid )));
 	
-	/* check intersection with other tuples */
-		  
-	/* [A,B] vs [C,D] */
-	a = header->pd_linp[i].lp_off;
-	b = header->pd_linp[i].lp_off + header->pd_linp[i].lp_len;
-	
-	ereport(DEBUG2,(errmsg("[%d:%d] checking intersection with other tuples", block, (i+1))));
-	
-	for (j = 0; j < i; j++) {
-	  
-		/* FIXME Skip UNUSED/REDIRECT/DEAD tuples */
-		if (! (header->pd_linp[i].lp_flags == LP_NORMAL)) {
-			ereport(DEBUG3,(errmsg("[%d:%d] skipped (not LP_NORMAL)", block, (j+1))));
-			continue;
-		}
-	  
-		c = header->pd_linp[j].lp_off;
-		d = header->pd_linp[j].lp_off + header->pd_linp[j].lp_len;
+	/* For non-leaf pages, the first data tuple may or may not actually have any
+	   data. See src/backend/access/nbtree/README, "Notes About Data
+	   Representation".
+	*/
+	/* only with a valid special space (an invalid one is reported by
+	 * check_index_page, and the tuple is then checked as any other) */
+	if (header->pd_special <= BLCKSZ - MAXALIGN(sizeof(BTPageOpaqueData))) {
 
-		/* [A,C,B] or [A,D,B] or [C,A,D] or [C,B,D] */
-		if (((a < c) && (c < b)) || ((a < d) && (d < b)) ||
-			((c < a) && (a < d)) || ((c < b) && (b < d))) {
-			ereport(WARNING,(errmsg("[%d:%d] intersects with [%d:%d] (%d,%d) vs. (%d,%d)", block, (i+1), block, j, a, b, c, d)));
-			++nerrs;
+		opaque = (BTPageOpaque)(buffer + header->pd_special);
+
+		if (!P_ISLEAF(opaque) && (i + 1) == P_FIRSTDATAKEY(opaque) && dlen == 0) {
+			ereport(DEBUG3, (errmsg("[%d:%d] first data key tuple on non-leaf block => no data, skipping", block, (i+1))));
+			return nerrs;
 		}
 	}
-	
-	/* check attributes only for tuples with (lp_flags==LP_NORMAL) */
-	if (header->pd_linp[i].lp_flags == LP_NORMAL) {
+
+	/* check attributes only for tuples with (lp_flags==LP_NORMAL), and only
+	 * when the tuple descriptor is known (not in offline checks) */
+	if ((rel != NULL) && (header->pd_linp[i].lp_flags == LP_NORMAL)) {
 		nerrs += check_index_tuple_attributes(rel, header, block, i + 1, buffer, dlen);
 	}
 	
@@ -183,7 +375,6 @@ uint32 check_index_tuple_attributes(Relation rel, PageHeader header, int block,
 	int j, off;
 	
 	bits8 * bitmap;
-	BTPageOpaque opaque;
 	ItemId	linp;
 
 	ereport(DEBUG2,(errmsg("[%d:%d] checking attributes for the tuple", block, offnum)));
@@ -191,7 +382,6 @@ uint32 check_index_tuple_attributes(Relation rel, PageHeader header, int block,
 	/* get the index tuple and info about the page */
 	linp = &header->pd_linp[offnum - 1];
 	tuple = (IndexTuple)(buffer + linp->lp_off);
-	opaque = (BTPageOpaque)(buffer + header->pd_special);
 	
 	/* current attribute offset - always starts at (buffer + off) */
 	off = linp->lp_off + IndexInfoFindDataOffset(tuple->t_info);
@@ -204,15 +394,6 @@ uint32 check_index_tuple_attributes(Relation rel, PageHeader header, int block,
 	/* TODO This is mostly copy'n'paste from check_heap_tuple_attributes,
 	   so maybe it could be refactored to share the code. */
 
-	/* For non-leaf pages, the first data tuple may or may not actually have any
-	   data. See src/backend/access/nbtree/README, "Notes About Data
-	   Representation".
-	*/
-	if (!P_ISLEAF(opaque) && offnum == P_FIRSTDATAKEY(opaque) && dlen == 0) {
-		ereport(DEBUG3, (errmsg("[%d:%d] first data key tuple on non-leaf block => no data, skipping", block, offnum)));
-		return nerrs;
-	}
-
 	/* check all the index attributes */
 	for (j = 0; j < rel->rd_att->natts; j++) {
 		
@@ -246,7 +427,7 @@ uint32 check_index_tuple_attributes(Relation rel, PageHeader header, int block,
 			len = VARSIZE_ANY(buffer + off);
 			
 			if (len < 0) {
-				ereport(WARNING, (errmsg("[%d:%d] attribute '%s' has negative length < 0 (%d)", block, offnum, rel->rd_att->attrs[j]->attname.data, len)));
+				check_report(WARNING, block, offnum, "attribute_length", "attribute '%s' has negative length < 0 (%d)", rel->rd_att->attrs[j]->attname.data, len);
 				++nerrs;
 				break;
 			}
@@ -254,7 +435,7 @@ uint32 check_index_tuple_attributes(Relation rel, PageHeader header, int block,
 			if (VARATT_IS_COMPRESSED(buffer + off)) {
 				/* the raw length should be less than 1G (and positive) */
 				if ((VARRAWSIZE_4B_C(buffer + off) < 0) || (VARRAWSIZE_4B_C(buffer + off) > 1024*1024)) {
-					ereport(WARNING, (errmsg("[%d:%d]  attribute '%s' has invalid length %d (should be between 0 and 1G)", block, offnum, rel->rd_att->attrs[j]->attname.data, VARRAWSIZE_4B_C(buffer + off))));
+					check_report(WARNING, block, offnum, "attribute_raw_length", "attribute '%s' has invalid length %d (should be between 0 and 1G)", rel->rd_att->attrs[j]->attname.data, VARRAWSIZE_4B_C(buffer + off));
 					++nerrs;
 					/* no break here, this does not break the page structure - we may check the other attributes */
 				}
@@ -275,10 +456,9 @@ uint32 check_index_tuple_attributes(Relation rel, PageHeader header, int block,
 		 * continue anyway). */
 		
 		if ((dlen > 0) && (off + len > (linp->lp_off + linp->lp_len))) {
-			ereport(WARNING,
-					(errmsg("[%d:%d] attribute '%s' (off=%d len=%d) overflows tuple end (off=%d, len=%d)",
-							block, offnum, rel->rd_att->attrs[j]->attname.data,
-							off, len, linp->lp_off, linp->lp_len)));
+			check_report(WARNING, block, offnum, "attribute_overflow",
+						"attribute '%s' (off=%d len=%d) overflows tuple end (off=%d, len=%d)",
+						rel->rd_att->attrs[j]->attname.data, off, len, linp->lp_off, linp->lp_len);
 			++nerrs;
 			break;
 		}
@@ -295,9 +475,9 @@ uint32 check_index_tuple_attributes(Relation rel, PageHeader header, int block,
 	
 	/* after the last attribute, the offset should be less than the end of the tuple */
 	if (MAXALIGN(off) > linp->lp_off + linp->lp_len) {
-		ereport(WARNING,
-				(errmsg("[%d:%d] the last attribute ends at %d but the tuple ends at %d",
-						block, offnum, off, linp->lp_off + linp->lp_len)));
+		check_report(WARNING, block, offnum, "attribute_end",
+					"the last attribute ends at %d but the tuple ends at %d",
+					off, linp->lp_off + linp->lp_len);
 		++nerrs;
 	}
 	
@@ -5,10 +5,89 @@
 #include "access/heapam.h"
 #include "heap.h"
 
-/* btree index checks */
+/* max. number of heap TIDs referenced from a single index page (a GIN
+ * posting list needs at least one byte per TID) */
+#define INDEX_MAX_PAGE_TIDS		BLCKSZ
+
+/* btree index checks (rel may be NULL in offline checks, the attributes
+ * of the tuples are not checked then) */
 uint32 check_index_page(Relation rel, PageHeader header, char *buffer, int block);
 uint32 check_index_tuples(Relation rel, PageHeader header, char *buffer, int block);
 uint32 check_index_tuple(Relation rel, PageHeader header, int block, int i, char *buffer);
 uint32 check_index_tuple_attributes(Relation rel, PageHeader header, int block, OffsetNumber offnum, char *buffer, int dlen);
 
+/* block and offset of a TID (without the asserts, the TID may be invalid) */
+#define IndexTidBlock(tid)		BlockIdGetBlockNumber(&(tid)->ip_blkid)
+#define IndexTidOffset(tid)		((tid)->ip_posid)
+
+/* Is the item (with storage) within the tuple space of the page, and at
+ * least minlen long? (i.e. may it be read, without reporting anything) */
+#define INDEX_ITEM_VALID(header, lp, minlen) \
+	(ItemIdHasStorage(lp) && ((lp)->lp_off >= (header)->pd_upper) && \
+	 ((lp)->lp_off + (lp)->lp_len <= (header)->pd_special) && ((lp)->lp_len >= (minlen)))
+
+/* Checks that the item (with storage) is within the tuple space of the page
+ * and at least minlen long, so that it may be read. Returns false for items
+ * without storage and invalid items (those are reported, and counted in
+ * nerrs). */
+bool check_index_item(PageHeader header, int block, OffsetNumber offnum, Size minlen, uint32 *nerrs);
+
+#ifndef FRONTEND
+
+/*
+ * Checks of an index access method.
+ *
+ * The pages are checked one by one and in any order (so the same checks
+ * work for block ranges, sampling and incremental checks) - first the page
+ * itself (check_page_header, special space, metapage), then the items on
+ * it. For the cross-check, page_tids returns all the heap TIDs referenced
+ * from the page at once (e.g. the whole GIN posting list or posting tree
+ * leaf), which are then added to the bitmap (or sort) in bulk.
+ *
+ * Only access methods indexing all the heap tuples (including NULLs) may
+ * be cross-checked - hash indexes skip NULL values, BRIN indexes have no
+ * heap pointers at all.
+ */
+typedef struct index_am_check {
+
+	Oid			amoid;			/* pg_am OID */
+	const char *name;			/* name of the access method */
+	bool		cross_check;	/* all heap tuples are indexed */
+
+	/* checks the page (header, special space, metapage) */
+	uint32	  (*check_page) (Relation rel, PageHeader header, char *buffer, int block);
+
+	/* checks the items on the page (after check_page) */
+	uint32	  (*check_tuples) (Relation rel, PageHeader header, char *buffer, int block);
+
+	/* heap TIDs referenced from the page (at most INDEX_MAX_PAGE_TIDS),
+	 * NULL when the index has no heap pointers - called with the buffer
+	 * locked, so it must not allocate memory or report anything */
+	int		  (*page_tids) (char *buffer, int block, ItemPointerData *tids);
+
+} index_am_check;
+
+/* Checks for the access method (NULL when not supported). */
+const index_am_check * index_am_lookup(Oid amoid);
+
+/* GIN checks (gin.c) */
+uint32 check_gin_page(Relation rel, PageHeader header, char *buffer, int block);
+uint32 check_gin_tuples(Relation rel, PageHeader header, char *buffer, int block);
+int gin_page_tids(char *buffer, int block, ItemPointerData *tids);
+
+/* GiST checks (gist.c) */
+uint32 check_gist_page(Relation rel, PageHeader header, char *buffer, int block);
+uint32 check_gist_tuples(Relation rel, PageHeader header, char *buffer, int block);
+int gist_page_tids(char *buffer, int block, ItemPointerData *tids);
+
+/* hash checks (hash.c) */
+uint32 check_hash_page(Relation rel, PageHeader header, char *buffer, int block);
+uint32 check_hash_tuples(Relation rel, PageHeader header, char *buffer, int block);
+
+/* BRIN checks (brin.c) */
+uint32 check_brin_page(Relation rel, PageHeader header, char *buffer, int block);
+uint32 check_brin_tuples(Relation rel, PageHeader header, char *buffer, int block);
+
+#endif
+
 #endif
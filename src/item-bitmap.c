@@ -1,368 +1,792 @@
 #include "item-bitmap.h"
 
 #include <unistd.h>
-#include <assert.h>
 
 #include "access/itup.h"
 
-#if (PG_VERSION_NUM >= 90300)
-#include <math.h>
-#include "access/htup_details.h"
-#endif
+#include "common.h"
+#include "popcount.h"
 
-/* allocate the memory in 1kB chunks - this needs to be large enough
- * to hold items for one page (8k ~ 290 bits, ie 32k ~ 1200 bits, so
- * this needs to be at least 150B)
- */
-#define PALLOC_CHUNK 1024
+#include "lib/stringinfo.h"
+#include "utils/memutils.h"
+
+/* bytes of the bitmap encoded per message (a multiple of 3, so that the
+ * base64 chunks concatenate), and page sums per message */
+#define BITMAP_PRINT_BYTES	3072
+#define BITMAP_PRINT_PAGES	1024
+
+/* the arrays may exceed 1GB on very large relations */
+#if (PG_VERSION_NUM >= 90400)
+#define bitmap_alloc(size)	MemoryContextAllocHuge(CurrentMemoryContext, (size))
+#else
+#define bitmap_alloc(size)	palloc(size)
+#endif
 
-static int count_digits(int values[], int n);
-static char * itoa(int value, char * str, int maxlen);
-static char * hex(const char * data, int n);
-static char * binary(const char * data, int n);
-static char * base64(const char * data, int n);
+static uint64 bitmap_index(item_bitmap * bitmap, BlockNumber page, int item);
+static int bitmap_page_items(item_bitmap * bitmap, BlockNumber page);
+static bool bitmap_check_range(item_bitmap * bitmap, BlockNumber page, int item);
+static uint64 * bitmap_get_word(item_bitmap * bitmap, uint64 idx, bool allocate);
+static void bitmap_or_page(item_bitmap * bitmap, BlockNumber page, const uint64 * mask, int items);
+static int bitmap_tids_index(item_bitmap * bitmap, ItemPointerData * tids, int ntids,
+							 uint64 * idx, int * nerrs);
+static void bitmap_set_indexes(item_bitmap * bitmap, uint64 * idx, int n);
+static void bitmap_get_bytes(item_bitmap * bitmap, uint64 from, uint64 nbytes, char * bytes);
+static void bitmap_locate(item_bitmap * bitmap, uint64 idx, BlockNumber *page, int *item);
+static uint64 bitmap_report_diffs(item_bitmap * bitmap_a, uint64 * seg_a, uint64 * seg_b, int segno,
+								  int from, int to, bitmap_diff_callback callback, void *arg);
+static uint64 bitmap_diff_words(uint64 * seg_a, uint64 * seg_b, int from, int nwords);
+static uint64 hex(const char * data, uint64 n, char * result);
+static uint64 binary(const char * data, uint64 n, char * result);
+static uint64 base64(const char * data, uint64 n, char * result);
 
 /* init the bitmap (allocate, set default values) */
-item_bitmap * bitmap_init(int npages) {
-	
+item_bitmap * bitmap_init(BlockNumber npages) {
+
 	item_bitmap * bitmap;
+	uint64	maxbits;
+
+	/* with 32kB pages, a group may have 32 * 1163 items, still fits into uint16 */
+	StaticAssertStmt(BITMAP_GROUP_PAGES * MaxHeapTuplesPerPage <= 0xFFFF,
+					 "BITMAP_GROUP_PAGES too large for the block size");
+
+	bitmap = (item_bitmap*)palloc0(sizeof(item_bitmap));
 
-	/* sanity check */
-	assert(npages >= 0);
-	
-	bitmap = (item_bitmap*)palloc(sizeof(item_bitmap));
-	
-	memset(bitmap, 0, sizeof(item_bitmap));
-	
 	bitmap->npages = npages;
-	bitmap->pages = (int*)palloc(sizeof(int)*npages);
-	
-	bitmap->nbytes = 0;
-	bitmap->maxBytes = PALLOC_CHUNK * (npages / PALLOC_CHUNK / 8 + 1);
-	bitmap->data = (char*)palloc(bitmap->maxBytes);
-	
-	memset(bitmap->data, 0, bitmap->maxBytes);
-	
+	bitmap->nadded = 0;
+	bitmap->nbits = 0;
+
+	/* the page directory (at least one group, so that it's never empty) */
+	bitmap->ngroups = npages / BITMAP_GROUP_PAGES + 1;
+	bitmap->groups = (bitmap_group*)bitmap_alloc(sizeof(bitmap_group) * bitmap->ngroups);
+	bitmap->owns_groups = true;
+
+	/* segments for the maximum possible number of items (not allocated yet) */
+	maxbits = (uint64) npages * MaxHeapTuplesPerPage;
+
+	bitmap->nsegments = (maxbits >> BITMAP_SEGMENT_SHIFT) + 1;
+	bitmap->segments = (uint64**)palloc0(sizeof(uint64*) * bitmap->nsegments);
+
 	return bitmap;
-	
+
 }
 
 /* copy the bitmap (except the actual bitmap data, keep zeroes) */
 item_bitmap * bitmap_copy(item_bitmap * src) {
-	
+
 	item_bitmap * bitmap;
-	
+
 	/* sanity check */
-	assert(src != NULL);
-	
-	bitmap = (item_bitmap*)palloc(sizeof(item_bitmap));
-	
+	Assert(src != NULL);
+
+	bitmap = (item_bitmap*)palloc0(sizeof(item_bitmap));
+
 	bitmap->npages = src->npages;
-	
-	bitmap->nbytes = src->nbytes;
-	bitmap->maxBytes = src->maxBytes;
+	bitmap->nadded = src->nadded;
+	bitmap->nbits = src->nbits;
+
+	/* the directory does not change any more, so just share it */
+	bitmap->ngroups = src->ngroups;
+	bitmap->groups = src->groups;
+	bitmap->owns_groups = false;
+
+	bitmap->nsegments = src->nsegments;
+	bitmap->segments = (uint64**)palloc0(sizeof(uint64*) * src->nsegments);
 
-	bitmap->pages = (int*)palloc(sizeof(int)*src->npages);
-	memcpy(bitmap->pages, src->pages, sizeof(int)*src->npages);
-	
-	bitmap->data = (char*)palloc(src->maxBytes);
-	memset(bitmap->data, 0, src->maxBytes);
-	
 	return bitmap;
-	
+
 }
 
 /* reset the bitmap data (not the page counts etc.) */
 void bitmap_reset(item_bitmap* bitmap) {
-	memset(bitmap->data, 0, bitmap->maxBytes);
+
+	int i;
+
+	/* release the segments, they'll be allocated again when needed */
+	for (i = 0; i < bitmap->nsegments; i++) {
+		if (bitmap->segments[i] != NULL) {
+			pfree(bitmap->segments[i]);
+			bitmap->segments[i] = NULL;
+		}
+	}
+
+	bitmap->noutside = 0;
+
 }
 
 /* free the allocated resources */
 void bitmap_free(item_bitmap* bitmap) {
-	
-	assert(bitmap != NULL);
-	
-	pfree(bitmap->pages);
-	pfree(bitmap->data);
+
+	Assert(bitmap != NULL);
+
+	bitmap_reset(bitmap);
+
+	if (bitmap->owns_groups) {
+		pfree(bitmap->groups);
+	}
+
+	if (bitmap->outside != NULL) {
+		pfree(bitmap->outside);
+	}
+
+	pfree(bitmap->segments);
 	pfree(bitmap);
 }
 
 /* needs to be called for paged 0,1,2,3,...npages (not randomly) */
 /* extends the bitmap to handle another page */
-void bitmap_add_page(item_bitmap * bitmap, int page, int items) {
+void bitmap_add_page(item_bitmap * bitmap, BlockNumber page, int items) {
 
-	/* sanity checks */
-	assert(page >= 0);
-	assert(page < bitmap->npages);
-	assert(items >= 0);
-	assert(items <= MaxHeapTuplesPerPage);
+	bitmap_group * group = &bitmap->groups[page / BITMAP_GROUP_PAGES];
+	int		idx = page % BITMAP_GROUP_PAGES;
 
-	bitmap->pages[page] = (page == 0) ? items : (items + bitmap->pages[page-1]);
-	
-	/* if needed more bytes than already allocated, extend the bitmap */
-	bitmap->nbytes = ((bitmap->pages[page] + 7) / 8);
-	if (bitmap->nbytes > bitmap->maxBytes) {
-		int len = bitmap->maxBytes; /* keep so that we can zero the new chunk */
-		bitmap->maxBytes += PALLOC_CHUNK;
-		bitmap->data = (char*)repalloc(bitmap->data, bitmap->maxBytes);
-		memset(bitmap->data + len, 0, PALLOC_CHUNK);
+	/* sanity checks */
+	Assert(bitmap->owns_groups);
+	Assert(page == bitmap->nadded);
+	Assert(page < bitmap->npages);
+	Assert((items >= 0) && (items <= MaxHeapTuplesPerPage));
+
+	/* first page of a group */
+	if (idx == 0) {
+		group->base = bitmap->nbits;
+		group->offsets[0] = 0;
 	}
 
+	group->offsets[idx + 1] = group->offsets[idx] + items;
+
+	bitmap->nbits += items;
+	bitmap->nadded++;
+
 }
 
 /* update the bitmap bith all items from a page (tracks number of items) */
-int bitmap_add_heap_items(item_bitmap * bitmap, PageHeader header, char *raw_page, int page) {
+int bitmap_add_heap_items(item_bitmap * bitmap, PageHeader header, char *raw_page, BlockNumber page) {
+
+	uint64	roots[BITMAP_PAGE_WORDS];
+	int		ntuples = bitmap_heap_roots(header, raw_page, roots);
+
+	return bitmap_add_heap_roots(bitmap, page, roots, ntuples);
+
+}
+
+/* collects the items referenced by the indexes into the mask (no allocations
+ * or messages, so that it may be called while holding the buffer lock) */
+int bitmap_heap_roots(PageHeader header, char *raw_page, uint64 * roots) {
 
-	/* tuple checks */
-	int nerrs = 0;
 	int ntuples = PageGetMaxOffsetNumber(raw_page);
+	int nitems = Min(ntuples, (int) MaxHeapTuplesPerPage);
 	int item;
-	
-	bitmap_add_page(bitmap, page, ntuples);
-	
-	/* by default set all LP_REDIRECT / LP_NORMAL items to '1' (we'll remove the HOT chains in the second pass) */
-	/* FIXME what if there is a HOT chain and then an index is created? */
-	for (item = 0; item < ntuples; item++) {
-		if (ItemIdIsUsed(&header->pd_linp[item])) {
-			if (! bitmap_set_item(bitmap, page, item, true)) {
-				nerrs++;
-			}
+
+	/*
+	 * The index items point to the roots of the HOT chains - an LP_REDIRECT
+	 * item, or a tuple that is not heap-only (which is also the case for a
+	 * tuple not updated at all). The other members of the chains are heap-only
+	 * tuples, reachable only from the root, so with a single pass over the
+	 * line pointers we get the roots without walking the chains (which may be
+	 * long, and the items in any order). Dead items may still be referenced
+	 * by the index (until vacuumed), so those are included too.
+	 *
+	 * The roots are collected in a mask, and merged into the bitmap a word
+	 * at a time (by bitmap_add_heap_roots).
+	 */
+	memset(roots, 0, sizeof(uint64) * BITMAP_PAGE_WORDS);
+
+	for (item = 0; item < nitems; item++) {
+
+		ItemId	lp = &header->pd_linp[item];
+
+		if (! ItemIdIsUsed(lp)) {
+			continue;
 		}
-	}
-	
-	/* second pass - remove the HOT chains */
-	for (item = 0; item < ntuples; item++) {
-		
-		Page p = (Page)raw_page;
-		HeapTupleHeader htup = (HeapTupleHeader) PageGetItem(p, &header->pd_linp[item]);
-		
-		if (HeapTupleHeaderIsHeapOnly(htup)) {
-			/* walk only if not walked this HOT chain yet (skip the first item in the chain) */
-			if (bitmap_get_item(bitmap, page, item)) {
-				if (! bitmap_set_item(bitmap, page, item, false)) {
-					/* FIXME this is incorrect, IMHO - the chain might be longer and the items may be
-					 * processed out of order */
-					nerrs++;
-				}
-			}
+
+		/* (items outside the page are reported by the heap checks) */
+		if (ItemIdIsNormal(lp) &&
+			(ItemIdGetOffset(lp) <= BLCKSZ - SizeofHeapTupleHeader) &&
+			HeapTupleHeaderIsHeapOnly((HeapTupleHeader) PageGetItem((Page) raw_page, lp))) {
+			continue;
 		}
-		
+
+		roots[item / 64] |= ((uint64) 1 << (item % 64));
 	}
-	
-	return nerrs;
+
+	return ntuples;
 
 }
 
-/* checks index tuples on the page, one by one */
-int bitmap_add_index_items(item_bitmap * bitmap, PageHeader header, char *raw_page, int page) {
+/* update the bitmap with the mask collected by bitmap_heap_roots */
+int bitmap_add_heap_roots(item_bitmap * bitmap, BlockNumber page, const uint64 * roots, int ntuples) {
 
-	/* tuple checks */
 	int nerrs = 0;
-	int ntuples = PageGetMaxOffsetNumber(raw_page);
-	int item;
-	
-	for (item = 0; item < ntuples; item++) {
 
-		IndexTuple itup = (IndexTuple)(raw_page + header->pd_linp[item].lp_off);
-		if (! bitmap_set_item(bitmap, BlockIdGetBlockNumber(&(itup->t_tid.ip_blkid)), (itup->t_tid.ip_posid-1), true)) {
-			nerrs++;
-		}
-		
+	/* a corrupted page can't have more items than possible */
+	if (ntuples > MaxHeapTuplesPerPage) {
+		check_report(WARNING, page, 0, "bitmap_too_many_items",
+					 "too many items for the bitmap (%d > %d)",
+					 ntuples, (int) MaxHeapTuplesPerPage);
+		ntuples = MaxHeapTuplesPerPage;
+		nerrs++;
 	}
-	
+
+	bitmap_add_page(bitmap, page, ntuples);
+
+	bitmap_or_page(bitmap, page, roots, ntuples);
+
 	return nerrs;
-  
+
 }
 
-/* mark the (page,item) as occupied */
-bool bitmap_set_item(item_bitmap * bitmap, int page, int item, bool state) {
+/* sets the bits for the TIDs, in batches (validate, then set the bits) */
+int bitmap_add_tids(item_bitmap * bitmap, ItemPointerData * tids, int ntids) {
 
-	int byteIdx = (GetBitmapIndex(bitmap, page, item)) / 8;
-	int bitIdx  = (GetBitmapIndex(bitmap, page, item)) % 8;
-	
-	if (page >= bitmap->npages) {
-		elog(WARNING, "invalid page %d (max page %d)", page, bitmap->npages-1);
-		return false;
+	int		nerrs = 0;
+	int		i;
+	uint64	idx[BITMAP_TIDS_BATCH];
+
+	for (i = 0; i < ntids; i += BITMAP_TIDS_BATCH) {
+
+		int		n = Min(ntids - i, BITMAP_TIDS_BATCH);
+
+		n = bitmap_tids_index(bitmap, &tids[i], n, idx, &nerrs);
+
+		bitmap_set_indexes(bitmap, idx, n);
 	}
-	
-	if (byteIdx > bitmap->nbytes) {
-		elog(WARNING, "invalid byte %d (max byte %d)", byteIdx, bitmap->nbytes);
-		return false;
+
+	return nerrs;
+
+}
+
+/*
+ * Translates the TIDs to bit indexes, and checks them (separately from
+ * setting the bits). The TIDs from a leaf page are mostly sorted when the
+ * index is correlated with the table, so the position of the heap page in
+ * the bitmap is looked up only when the page changes. TIDs outside of the
+ * bitmap are collected (with collect_outside) or reported, and left out.
+ *
+ * Returns the number of valid indexes.
+ */
+static int bitmap_tids_index(item_bitmap * bitmap, ItemPointerData * tids, int ntids,
+							 uint64 * idx, int * nerrs) {
+
+	BlockNumber	page = InvalidBlockNumber;
+	uint64	base = 0;		/* first bit of the page */
+	int		nitems = 0;		/* items on the page (0 when not in the bitmap) */
+	int		nvalid = 0;
+	int		i;
+
+	for (i = 0; i < ntids; i++) {
+
+		BlockNumber	blkno = BlockIdGetBlockNumber(&(tids[i].ip_blkid));
+		int		item = (int) tids[i].ip_posid - 1;
+
+		if (blkno != page) {
+			page = blkno;
+			nitems = (page < bitmap->nadded) ? bitmap_page_items(bitmap, page) : 0;
+			base = (page < bitmap->nadded) ? bitmap_index(bitmap, page, 0) : 0;
+		}
+
+		if ((item >= 0) && (item < nitems)) {
+			idx[nvalid++] = base + item;
+			continue;
+		}
+
+		/* points to a heap item added after the heap was scanned (probably) */
+		if (bitmap->collect_outside) {
+
+			if (bitmap->noutside == bitmap->maxoutside) {
+				bitmap->maxoutside = Max(1024, 2 * bitmap->maxoutside);
+				bitmap->outside = (bitmap->outside == NULL) ?
+					(ItemPointerData *) palloc(sizeof(ItemPointerData) * bitmap->maxoutside) :
+					(ItemPointerData *) repalloc(bitmap->outside, sizeof(ItemPointerData) * bitmap->maxoutside);
+			}
+
+			bitmap->outside[bitmap->noutside++] = tids[i];
+			continue;
+		}
+
+		/* the same messages as bitmap_check_range */
+		(void) bitmap_check_range(bitmap, blkno, item);
+		(*nerrs)++;
 	}
-	
-	if (item >= bitmap->pages[page]) {
-		elog(WARNING, "item %d out of range, page has only %d items", item, bitmap->pages[page]);
+
+	return nvalid;
+
+}
+
+/* sets the bits, merging the runs of bits in the same word (so that each
+ * word is looked up and written only once for sorted indexes) */
+static void bitmap_set_indexes(item_bitmap * bitmap, uint64 * idx, int n) {
+
+	uint64	wordno = 0;
+	uint64	bits = 0;
+	int		i;
+
+	for (i = 0; i < n; i++) {
+
+		if ((bits != 0) && (idx[i] / 64 != wordno)) {
+			*bitmap_get_word(bitmap, wordno * 64, true) |= bits;
+			bits = 0;
+		}
+
+		wordno = idx[i] / 64;
+		bits |= ((uint64) 1 << (idx[i] % 64));
+	}
+
+	if (bits != 0) {
+		*bitmap_get_word(bitmap, wordno * 64, true) |= bits;
+	}
+
+}
+
+/* mark the (page,item) as occupied */
+bool bitmap_set_item(item_bitmap * bitmap, BlockNumber page, int item, bool state) {
+
+	uint64	idx;
+	uint64 *word;
+
+	if (! bitmap_check_range(bitmap, page, item)) {
 		return false;
 	}
 
+	idx = bitmap_index(bitmap, page, item);
+
 	/* FIXME check whether the item is aleady set or not (and return false if it is) */
-	
+
 	if (state) {
 		/* set the bit (OR) */
-		bitmap->data[byteIdx] |= (1 << bitIdx);
+		word = bitmap_get_word(bitmap, idx, true);
+		*word |= ((uint64) 1 << (idx % 64));
 	} else {
-		/* remove the bit (XOR) */
-		bitmap->data[byteIdx] &= ~(1 << bitIdx);
+		/* remove the bit (XOR), nothing to do if the segment is empty */
+		word = bitmap_get_word(bitmap, idx, false);
+		if (word != NULL) {
+			*word &= ~((uint64) 1 << (idx % 64));
+		}
 	}
-	
+
 	return true;
 
 }
 
 /* check if the (page,item) is occupied */
-bool bitmap_get_item(item_bitmap * bitmap, int page, int item) {
+bool bitmap_get_item(item_bitmap * bitmap, BlockNumber page, int item) {
 
-	int byteIdx = (GetBitmapIndex(bitmap, page, item)) / 8;
-	int bitIdx  = (GetBitmapIndex(bitmap, page, item)) % 8;
-	
-	if (page >= bitmap->npages) {
-		elog(WARNING, "invalid page %d (max page %d)", page, bitmap->npages-1);
-		return false;
-	}
-	
-	if (byteIdx > bitmap->nbytes) {
-		elog(WARNING, "invalid byte %d (max byte %d)", byteIdx, bitmap->nbytes);
-		return false;
-	}
-	
-	if (item >= bitmap->pages[page]) {
-		elog(WARNING, "item %d out of range, page has only %d items", item, bitmap->pages[page]);
+	uint64	idx;
+	uint64 *word;
+
+	if (! bitmap_check_range(bitmap, page, item)) {
 		return false;
 	}
 
-	return (bitmap->data[byteIdx] && (1 << bitIdx));
+	idx = bitmap_index(bitmap, page, item);
+	word = bitmap_get_word(bitmap, idx, false);
+
+	return (word != NULL) && ((*word & ((uint64) 1 << (idx % 64))) != 0);
 
 }
 
 /* counts bits set to 1 in the bitmap */
-long bitmap_count(item_bitmap * bitmap) {
+uint64 bitmap_count(item_bitmap * bitmap) {
 
-	long i, j, items = 0;
-	
-	for (i = 0; i < bitmap->nbytes; i++) {
-		for (j = 0; j < 8; j++) {
-			if (bitmap->data[i] & (1 << j)) {
-				items++;
-			}
+	int		i;
+	uint64	items = 0;
+
+	for (i = 0; i < bitmap->nsegments; i++) {
+
+		/* empty segment */
+		if (bitmap->segments[i] == NULL) {
+			continue;
 		}
+
+		items += words_popcount(bitmap->segments[i], BITMAP_SEGMENT_WORDS);
 	}
-	
+
 	return items;
-	
+
 }
 
 /* compare bitmaps, returns number of differences */
-long bitmap_compare(item_bitmap * bitmap_a, item_bitmap * bitmap_b) {
+uint64 bitmap_compare(item_bitmap * bitmap_a, item_bitmap * bitmap_b,
+					  bitmap_diff_callback callback, void *arg) {
 
-	long i, j, ndiff = 0;
-	char diff = 0;
+	int		i;
+	uint64	ndiff = 0;
 
 	/* compare number of pages and total items */
 	/* FIXME this rather a sanity check, because these values are copied by bitmap_prealloc */
-	if (bitmap_a->npages != bitmap_b->npages) {
-		elog(WARNING, "bitmaps do not track the same number of pages (%d != %d)",
-			 bitmap_a->npages, bitmap_b->npages);
-		return MAX(bitmap_a->pages[bitmap_a->npages-1],
-				   bitmap_b->pages[bitmap_b->npages-1]);
-	} else if (bitmap_a->pages[bitmap_a->npages-1] != bitmap_b->pages[bitmap_b->npages-1]) {
-		elog(WARNING, "bitmaps do not track the same number of pages (%d != %d)",
-			 bitmap_a->pages[bitmap_a->npages-1], bitmap_b->pages[bitmap_b->npages-1]);
+	if (bitmap_a->nadded != bitmap_b->nadded) {
+		elog(WARNING, "bitmaps do not track the same number of pages (%u != %u)",
+			 bitmap_a->nadded, bitmap_b->nadded);
+		check_count_issue();
+		return MAX(bitmap_a->nbits, bitmap_b->nbits);
+	} else if (bitmap_a->nbits != bitmap_b->nbits) {
+		elog(WARNING, "bitmaps do not track the same number of items (" UINT64_FORMAT " != " UINT64_FORMAT ")",
+			 bitmap_a->nbits, bitmap_b->nbits);
+		check_count_issue();
 	}
-	
-	/* the actual check, compares the bits one by one */
-	for (i = 0; i < bitmap_a->nbytes; i++) {
-		diff = (bitmap_a->data[i] ^ bitmap_b->data[i]);
-		if (diff != 0) {
-			for (j = 0; j < 8; j++) {
-				if (diff & (1 << j)) {
-					ndiff++;
+
+	/* the actual check, compares the segments (empty ones are all zeroes) */
+	for (i = 0; i < Min(bitmap_a->nsegments, bitmap_b->nsegments); i++) {
+
+		uint64 * seg_a = bitmap_a->segments[i];
+		uint64 * seg_b = bitmap_b->segments[i];
+		uint64	 segdiff;
+
+		segdiff = bitmap_diff_words(seg_a, seg_b, 0, BITMAP_SEGMENT_WORDS);
+
+		/* only walk the words of segments that actually differ */
+		if ((segdiff > 0) && (callback != NULL)) {
+			segdiff = bitmap_report_diffs(bitmap_a, seg_a, seg_b, i, 0, BITMAP_SEGMENT_WORDS,
+										  callback, arg);
+		}
+
+		ndiff += segdiff;
+	}
+
+	return ndiff;
+
+}
+
+/* compare one bitmap with many bitmaps (sharing the directory) at once */
+void bitmap_compare_multi(item_bitmap * bitmap, item_bitmap ** others, int nothers,
+						  uint64 * ndiffs, bitmap_diff_callback callback, void ** args) {
+
+	int		i, j, k;
+
+	for (k = 0; k < nothers; k++) {
+
+		ndiffs[k] = 0;
+
+		/* same sanity check as in bitmap_compare (mark the bitmap as skipped) */
+		if (bitmap->nadded != others[k]->nadded) {
+			elog(WARNING, "bitmaps do not track the same number of pages (%u != %u)",
+				 bitmap->nadded, others[k]->nadded);
+			check_count_issue();
+			ndiffs[k] = MAX(bitmap->nbits, others[k]->nbits);
+		} else if (bitmap->nbits != others[k]->nbits) {
+			elog(WARNING, "bitmaps do not track the same number of items (" UINT64_FORMAT " != " UINT64_FORMAT ")",
+				 bitmap->nbits, others[k]->nbits);
+			check_count_issue();
+		}
+	}
+
+	/* walk the segments in blocks small enough to stay in L1, and compare
+	 * each block with all the other bitmaps before moving to the next one */
+	for (i = 0; i < bitmap->nsegments; i++) {
+
+		uint64 * seg = bitmap->segments[i];
+
+		for (j = 0; j < BITMAP_SEGMENT_WORDS; j += BITMAP_COMPARE_WORDS) {
+
+			for (k = 0; k < nothers; k++) {
+
+				uint64 * seg_b;
+				uint64	 diff;
+
+				/* skipped (incompatible bitmap) */
+				if ((bitmap->nadded != others[k]->nadded) || (i >= others[k]->nsegments)) {
+					continue;
 				}
+
+				seg_b = others[k]->segments[i];
+				diff = bitmap_diff_words(seg, seg_b, j, BITMAP_COMPARE_WORDS);
+
+				if ((diff > 0) && (callback != NULL)) {
+					diff = bitmap_report_diffs(bitmap, seg, seg_b, i, j, j + BITMAP_COMPARE_WORDS,
+											   callback, args[k]);
+				}
+
+				ndiffs[k] += diff;
 			}
 		}
 	}
-	
-	return ndiff;
-	
+
 }
 
-/* Prints the info about the bitmap and the data as a series of 0/1. */
-/* TODO print details about differences (items missing in heap, items missing in index) */
-void bitmap_print(item_bitmap * bitmap, BitmapFormat format) {
-	
-	int i = 0;
-	int len = count_digits(bitmap->pages, bitmap->npages) + bitmap->npages;
-	char pages[len];
-	char *ptr = pages;
-	char *data = NULL;
-	
-	ptr[0] = '\0';
-	for (i = 0; i < bitmap->npages; i++) {
-		ptr = itoa(bitmap->pages[i], ptr, len - (ptr - pages));
-		*(ptr++) = ',';
+/* number of differing bits in words [from, from+nwords) of two segments */
+static uint64 bitmap_diff_words(uint64 * seg_a, uint64 * seg_b, int from, int nwords) {
+
+	if ((seg_a == NULL) && (seg_b == NULL)) {
+		return 0;
+	} else if (seg_a == NULL) {
+		return words_popcount(seg_b + from, nwords);
+	} else if (seg_b == NULL) {
+		return words_popcount(seg_a + from, nwords);
 	}
-	*(--ptr) = '\0';
-	
-	/* encode as binary or hex */
-	if (format == BITMAP_BINARY) {
-		data = binary(bitmap->data, bitmap->nbytes);
-	} else if (format == BITMAP_BASE64) {
-		data = base64(bitmap->data, bitmap->nbytes);
-	} else if (format == BITMAP_HEX) {
-		data = hex(bitmap->data, bitmap->nbytes);
-	} else if (format == BITMAP_NONE) {
-		data = palloc(1);
-		data[0] = '\0';
+
+	return words_xor_popcount(seg_a + from, seg_b + from, nwords);
+
+}
+
+/* Prints the info about the bitmap and the data, in chunks (so that neither
+ * the page sums nor the encoded data have to be built in memory at once). */
+void bitmap_print(item_bitmap * bitmap, BitmapFormat format) {
+
+	BlockNumber		i;
+	StringInfoData	pages;
+	uint64			nbytes = (bitmap->nbits + 7) / 8;
+	uint64			nitems = 0;
+	uint64			offset;
+	char			bytes[BITMAP_PRINT_BYTES];
+	char		   *data;
+
+	elog(WARNING, "bitmap nbytes=" UINT64_FORMAT " nbits=" UINT64_FORMAT " npages=%u",
+		 nbytes, bitmap_count(bitmap), bitmap->nadded);
+
+	/* running sums of items, just like before */
+	initStringInfo(&pages);
+	for (i = 0; i < bitmap->nadded; i++) {
+
+		nitems += bitmap_page_items(bitmap, i);
+		appendStringInfo(&pages, (i % BITMAP_PRINT_PAGES == 0) ? UINT64_FORMAT : "," UINT64_FORMAT, nitems);
+
+		if ((i % BITMAP_PRINT_PAGES == BITMAP_PRINT_PAGES - 1) || (i == bitmap->nadded - 1)) {
+			elog(WARNING, "bitmap pages %u-%u=[%s]",
+				 i - (i % BITMAP_PRINT_PAGES), i, pages.data);
+			resetStringInfo(&pages);
+		}
 	}
-	
+
+	pfree(pages.data);
+
 	if (format == BITMAP_NONE) {
-		elog(WARNING, "bitmap nbytes=%d nbits=%ld npages=%d pages=[%s]",
-			bitmap->nbytes, bitmap_count(bitmap), bitmap->npages, pages);
-	} else {
-		elog(WARNING, "bitmap nbytes=%d nbits=%ld npages=%d pages=[%s] data=[%s]",
-			bitmap->nbytes, bitmap_count(bitmap), bitmap->npages, pages, data);
+		return;
 	}
-	
+
+	/* large enough for a chunk in any of the formats (binary is the largest) */
+	data = palloc(BITMAP_PRINT_BYTES * 8 + 1);
+
+	/* encode as binary, base64 or hex */
+	for (offset = 0; offset < nbytes; offset += BITMAP_PRINT_BYTES) {
+
+		uint64	n = Min(BITMAP_PRINT_BYTES, nbytes - offset);
+		uint64	len;
+
+		bitmap_get_bytes(bitmap, offset, n, bytes);
+
+		if (format == BITMAP_BINARY) {
+			len = binary(bytes, n, data);
+		} else if (format == BITMAP_BASE64) {
+			len = base64(bytes, n, data);
+		} else {
+			len = hex(bytes, n, data);
+		}
+
+		data[len] = '\0';
+
+		elog(WARNING, "bitmap data " UINT64_FORMAT "-" UINT64_FORMAT "=[%s]",
+			 offset, offset + n - 1, data);
+	}
+
 	pfree(data);
-	
+
 }
 
-/* count digits to print the array (in ASCII) */
-int count_digits(int values[], int n) {
-	int i, digits = 0;
-	for (i = 0; i < n; i++) {
-		digits += (int)ceil(log(values[i]) / log(10));
+/* index of the bit for the (page,item) */
+static uint64 bitmap_index(item_bitmap * bitmap, BlockNumber page, int item) {
+
+	bitmap_group * group = &bitmap->groups[page / BITMAP_GROUP_PAGES];
+
+	return group->base + group->offsets[page % BITMAP_GROUP_PAGES] + item;
+
+}
+
+/* number of items on the page */
+static int bitmap_page_items(item_bitmap * bitmap, BlockNumber page) {
+
+	bitmap_group * group = &bitmap->groups[page / BITMAP_GROUP_PAGES];
+	int		idx = page % BITMAP_GROUP_PAGES;
+
+	return group->offsets[idx + 1] - group->offsets[idx];
+
+}
+
+/* is the (page,item) tracked by the bitmap? */
+bool bitmap_contains(item_bitmap * bitmap, BlockNumber page, int item) {
+
+	return (page < bitmap->nadded) &&
+		   (item >= 0) && (item < bitmap_page_items(bitmap, page));
+
+}
+
+/* checks that the (page,item) is tracked by the bitmap */
+static bool bitmap_check_range(item_bitmap * bitmap, BlockNumber page, int item) {
+
+	if (page >= bitmap->nadded) {
+		check_report(WARNING, page, item + 1, "tid_out_of_range",
+					 "invalid page %u (max page %d)", page, (int) bitmap->nadded - 1);
+		return false;
+	}
+
+	if ((item < 0) || (item >= bitmap_page_items(bitmap, page))) {
+		check_report(WARNING, page, item + 1, "tid_out_of_range",
+					 "item %d out of range, page has only %d items", item, bitmap_page_items(bitmap, page));
+		return false;
+	}
+
+	return true;
+
+}
+
+/* returns the word with the bit (allocates the segment if needed, or NULL) */
+static uint64 * bitmap_get_word(item_bitmap * bitmap, uint64 idx, bool allocate) {
+
+	uint64	segno = (idx >> BITMAP_SEGMENT_SHIFT);
+
+	Assert(segno < bitmap->nsegments);
+
+	if (bitmap->segments[segno] == NULL) {
+
+		if (! allocate) {
+			return NULL;
+		}
+
+		bitmap->segments[segno] = (uint64*)palloc0(BITMAP_SEGMENT_WORDS * sizeof(uint64));
 	}
-	return digits;
+
+	return &bitmap->segments[segno][(idx % BITMAP_SEGMENT_BITS) / 64];
+
 }
 
-/* utility to fill an integer value in a given value */
-char * itoa(int value, char * str, int maxlen) {
-	return str + snprintf(str, maxlen, "%d", value);
+/* sets the bits of the page from the mask (bit N of the mask is item N),
+ * the page does not start at a word boundary, so each word of the mask
+ * is split into two words of the bitmap */
+static void bitmap_or_page(item_bitmap * bitmap, BlockNumber page, const uint64 * mask, int items) {
+
+	uint64	idx = bitmap_index(bitmap, page, 0);
+	int		shift = (idx % 64);
+	int		nwords = (items + 63) / 64;
+	int		i;
+
+	for (i = 0; i < nwords; i++) {
+
+		uint64	bits = mask[i];
+		uint64	start = idx + (uint64) i * 64;
+
+		if (bits == 0) {
+			continue;
+		}
+
+		*bitmap_get_word(bitmap, start, true) |= (bits << shift);
+
+		/* the rest goes to the next word (the bits above the last item of the
+		 * page are not set in the mask, so this stays within the page) */
+		if ((shift > 0) && ((bits >> (64 - shift)) != 0)) {
+			*bitmap_get_word(bitmap, start + 64, true) |= (bits >> (64 - shift));
+		}
+	}
+
 }
 
-/* encode data to hex */
-static 
-char * hex(const char * data, int n) {
+/* copies nbytes of the bitmap (starting at byte from) into the buffer (bit N
+ * of the bitmap is bit (N % 8) of byte (N / 8), regardless of endianness) */
+static void bitmap_get_bytes(item_bitmap * bitmap, uint64 from, uint64 nbytes, char * bytes) {
+
+	uint64	i;
+
+	for (i = 0; i < nbytes; i++) {
+
+		uint64	byte = from + i;
+		uint64 * segment = bitmap->segments[(byte * 8) >> BITMAP_SEGMENT_SHIFT];
+		uint64	word;
+
+		if (segment == NULL) {
+			bytes[i] = 0;
+			continue;
+		}
+
+		word = segment[((byte * 8) % BITMAP_SEGMENT_BITS) / 64];
+		bytes[i] = (char)((word >> (8 * (byte % 8))) & 0xFF);
+	}
+
+}
+
+/* translates the index of a bit to (page,item) */
+static void bitmap_locate(item_bitmap * bitmap, uint64 idx, BlockNumber *page, int *item) {
+
+	int		lo = 0,
+			hi = (bitmap->nadded - 1) / BITMAP_GROUP_PAGES;
+	int		i;
+	bitmap_group * group;
+
+	/* the last group with base <= idx (empty pages make the bases repeat) */
+	while (lo < hi) {
+		int mid = lo + (hi - lo + 1) / 2;
+
+		if (bitmap->groups[mid].base <= idx) {
+			lo = mid;
+		} else {
+			hi = mid - 1;
+		}
+	}
+
+	group = &bitmap->groups[lo];
+
+	/* the last page of the group starting at or before the bit */
+	for (i = 0; i < BITMAP_GROUP_PAGES - 1; i++) {
+		BlockNumber next = (BlockNumber) lo * BITMAP_GROUP_PAGES + i + 1;
+
+		if ((next >= bitmap->nadded) || (group->base + group->offsets[i + 1] > idx)) {
+			break;
+		}
+	}
+
+	*page = (BlockNumber) lo * BITMAP_GROUP_PAGES + i;
+	*item = (int) (idx - group->base - group->offsets[i]);
+
+}
+
+/* walks the differing words of a segment, passes the items to the callback */
+static uint64 bitmap_report_diffs(item_bitmap * bitmap_a, uint64 * seg_a, uint64 * seg_b, int segno,
+								  int from, int to, bitmap_diff_callback callback, void *arg) {
+
+	int		j;
+	uint64	ndiff = 0;
+
+	for (j = from; j < to; j++) {
+
+		uint64	word_a = (seg_a != NULL) ? seg_a[j] : 0;
+		uint64	word_b = (seg_b != NULL) ? seg_b[j] : 0;
+		uint64	diff = word_a ^ word_b;
+
+		while (diff != 0) {
+
+			int		bit = lowest_bit64(diff);
+			uint64	idx = ((uint64) segno << BITMAP_SEGMENT_SHIFT) + (uint64) j * 64 + bit;
+			BlockNumber page;
+			int		item;
+
+			bitmap_locate(bitmap_a, idx, &page, &item);
+
+			if (callback(page, item, ((word_a >> bit) & 1) != 0, arg)) {
+				ndiff++;
+			}
+
+			diff &= (diff - 1);
+		}
+	}
+
+	return ndiff;
+
+}
+
+/* encode data to hex (returns the length, without the terminator) */
+static uint64 hex(const char * data, uint64 n, char * result) {
 	
-	int i, w = 0;
+	uint64 i, w = 0;
 	static const char hex[] = "0123456789abcdef";
-	char * result = palloc(n*2+1);
 	
 	for (i = 0; i < n; i++) {
 		result[w++] = hex[(data[i] >> 4) & 0x0F];
 		result[w++] = hex[data[i] & 0x0F];
 	}
 	
-	result[w] = '\0';
-	
-	return result;
+	return w;
 	
 }
 
-static char * binary(const char * data, int n) {
+/* encode data as a series of 0/1 (returns the length) */
+static uint64 binary(const char * data, uint64 n, char * result) {
 
-	int i, j, k = 0;
-	char *result = palloc(n*8+10);
+	uint64 i, j, k = 0;
 	
 	for (i = 0; i < n; i++) {
 		for (j = 0; j < 8; j++) {
@@ -373,18 +797,16 @@ static char * binary(const char * data, int n) {
 			}
 		}
 	}
-	result[k] = '\0';
 	
-	return result;
+	return k;
 	
 }
 
-/* encode data to base64 */
-static char * base64(const char * data, int n) {
+/* encode data to base64 (returns the length) */
+static uint64 base64(const char * data, uint64 n, char * result) {
 	
-	int i, k = 0;
+	uint64 i, k = 0;
 	static const char	_base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-	char 			   *result = palloc(4*((n+2)/3) + 1);
 	uint32				buf = 0;
 	int					pos = 2;
 	
@@ -409,11 +831,11 @@ static char * base64(const char * data, int n) {
 	if (pos != 2) {
 		result[k++] = _base64[(buf >> 18) & 0x3f];
 		result[k++] = _base64[(buf >> 12) & 0x3f];
-		result[k++] = (pos == 0) ? _base64[(buf >> 6) & 0x3f] : '\0';
+		if (pos == 0) {
+			result[k++] = _base64[(buf >> 6) & 0x3f];
+		}
 	}
 	
-	result[k] = '\0';
-	
-	return result;
+	return k;
 	
 }
@@ -4,11 +4,34 @@
 #include "postgres.h"
 #include "access/heapam.h"
 
-#define GetBitmapIndex(bmap, page, item) \
-	((page == 0) ? (item) : (bmap->pages[page-1] + item))
+#if (PG_VERSION_NUM >= 90300)
+#include "access/htup_details.h"
+#endif
 
 #define MAX(a,b) ((a > b) ? a : b)
 
+/* Number of pages in a group of the page directory. The offsets within
+ * a group are 16-bit, so this has to be small enough for all the items
+ * of the group to fit (32 * 1163 items even with 32kB pages). */
+#define BITMAP_GROUP_PAGES		32
+
+/* The bits are stored in segments of 2^23 bits (1MB), allocated only
+ * when a bit in the segment is set (so empty parts take no memory). */
+#define BITMAP_SEGMENT_SHIFT	23
+#define BITMAP_SEGMENT_BITS		((uint64) 1 << BITMAP_SEGMENT_SHIFT)
+#define BITMAP_SEGMENT_WORDS	(BITMAP_SEGMENT_BITS / 64)
+
+/* Number of words compared at once by bitmap_compare_multi (4kB, so that
+ * the block of the first bitmap stays in L1 while compared to the others). */
+#define BITMAP_COMPARE_WORDS	512
+
+/* Words needed for the items of a single heap page. */
+#define BITMAP_PAGE_WORDS	((MaxHeapTuplesPerPage + 63) / 64)
+
+/* Number of TIDs validated at once by bitmap_add_tids, before setting the
+ * bits (enough for a leaf page with 8kB pages). */
+#define BITMAP_TIDS_BATCH		512
+
 /* bitmap format */
 typedef enum
 {
@@ -18,42 +41,67 @@ typedef enum
         BITMAP_NONE
 }       BitmapFormat;
 
+/* directory entry for a group of BITMAP_GROUP_PAGES pages */
+typedef struct bitmap_group {
+
+	/* index of the first bit of the group (items on all preceding pages) */
+	uint64	base;
+
+	/* running sum of items within the group, i.e. offsets[i] is the first
+	 * bit of the i-th page (relative to base), offsets[i+1] - offsets[i]
+	 * is the number of items on the page */
+	uint16	offsets[BITMAP_GROUP_PAGES + 1];
+
+} bitmap_group;
+
 /* bitmap, used to cross-check heap and indexes */
 typedef struct item_bitmap {
-	
-	/* current number of tracked pages */
-	int npages;
-	
-	int nbytes;		/* used bytes */
-	int maxBytes;	/* allocated bytes */
-	
-	/* running sum of items on a page, e.g. [10, 20, 30] if
-	   there are three pages and there are 10 items on each */
-	int * pages;
-	
-	/* data of the bitmap (0/1 for each item) */
-	char * data;
-	
+
+	/* number of pages (known in advance) and pages already added */
+	BlockNumber npages;
+	BlockNumber nadded;
+
+	/* total number of items (bits) on the added pages */
+	uint64	nbits;
+
+	/* page directory (shared by copies of the bitmap) */
+	int		ngroups;
+	bitmap_group * groups;
+	bool	owns_groups;
+
+	/* data of the bitmap (0/1 for each item), NULL segments are all 0 */
+	int		nsegments;
+	uint64 ** segments;
+
+	/* index items pointing outside the bitmap (pages or items added to the
+	 * heap after it was scanned), collected only when collect_outside */
+	bool	collect_outside;
+	int		noutside;
+	int		maxoutside;
+	ItemPointerData * outside;
+
 } item_bitmap;
 
 
 /* Allocates new item bitmap, sized for n pages.
- * 
+ *
  * - npages : number of pages of the relation (needs to be known in advance)
- * 
- * Prepares space for at least one item on each page, rounded to multiples
- * of PALLOC_CHUNK (1kB by default). So for example a 100-page table needs
- * at least 100 bits, so 1kB will be allocated, but a table with 100.000
- * pages (~800MB) will allocate 13kB initially.
- * 
+ *
+ * The page directory is allocated for all the pages (about 2.5B per page),
+ * and the array of segments is sized for MaxHeapTuplesPerPage items on
+ * each page. The segments themselves are allocated only when needed, so
+ * the memory used for bits is proportional to the actual number of items.
+ *
  * Returns the allocated bitmap.
  */
-item_bitmap * bitmap_init(int npages);
+item_bitmap * bitmap_init(BlockNumber npages);
 
 /* Copies the item bitmap (except the actual bitmap data, keeps zeroes).
  *
  * This is used to prepare a bitmap for index, matching the heap bitmap.
- * 
+ * The copy shares the page directory with the source bitmap, so the
+ * source has to be kept until the copy is released.
+ *
  * Returns the new bitmap. */
 item_bitmap * bitmap_copy(item_bitmap* src); /* preallocate empty bitmap */
 
@@ -65,16 +113,16 @@ void bitmap_free(item_bitmap* bitmap);
 void bitmap_reset(item_bitmap* bitmap);
 
 /* Prepares the bitmap to accept data from another page - this only sets
- * the running item counts etc. and extends the internal structures.
- * 
+ * the running item counts in the page directory.
+ *
  * - bitmap : bitmap to update
  * - page : the next page to update (0, 1, 2, ... , npages-1)
- * - items : number of items on the page
- * 
+ * - items : number of items on the page (at most MaxHeapTuplesPerPage)
+ *
  * This needs to be called for a sequence of pages, starting with 0 and
  * increased by 1. Adding pages randomly will produce invalid bitmap.
  */
-void bitmap_add_page(item_bitmap * bitmap, int page, int items);
+void bitmap_add_page(item_bitmap * bitmap, BlockNumber page, int items);
 
 /* Updates the bitmap with all items from the heap page.
  *
@@ -82,21 +130,33 @@ void bitmap_add_page(item_bitmap * bitmap, int page, int items);
  * - header : page header
  * - raw_page : raw page data
  * - page : number of the page (0, 1, 2, ...)
- * 
+ *
  * Returns number of issues (already set items).
  */
-int bitmap_add_heap_items(item_bitmap * bitmap, PageHeader header, char *raw_page, int page);
+int bitmap_add_heap_items(item_bitmap * bitmap, PageHeader header, char *raw_page, BlockNumber page);
 
-/* Updates the bitmap with all items from the index (b-tree leaf) page.
+/* The same in two steps - first collects the items of the heap page into
+ * a mask of BITMAP_PAGE_WORDS words, without allocating memory or
+ * reporting anything (so that it may be called while the buffer is locked),
+ * and returns the number of items on the page. Then the mask is added to
+ * the bitmap (once the buffer is unlocked), returning number of issues.
+ */
+int bitmap_heap_roots(PageHeader header, char *raw_page, uint64 * roots);
+int bitmap_add_heap_roots(item_bitmap * bitmap, BlockNumber page, const uint64 * roots, int ntuples);
+
+/* Updates the bitmap with a batch of TIDs (e.g. all items of a leaf page).
  *
  * - bitmap : bitmap to update
- * - header : page header
- * - raw_page : raw page data
- * - page : number of the page (0, 1, 2, ...)
- * 
- * Returns number of issues (already set items in the bitmap).
+ * - tids : heap TIDs (ideally sorted, as in a correlated index)
+ * - ntids : number of TIDs
+ *
+ * The TIDs are first checked against the bitmap (TIDs outside it are
+ * collected with collect_outside, reported otherwise), and then the bits
+ * are set, each word only once for a run of TIDs in the same word.
+ *
+ * Returns number of issues (TIDs outside the bitmap).
  */
-int bitmap_add_index_items(item_bitmap * bitmap, PageHeader header, char *raw_page, int page);
+int bitmap_add_tids(item_bitmap * bitmap, ItemPointerData * tids, int ntids);
 
 /* Updates the bitmap so that the item (page,item) is either 0 or 1,
  * depending on the 'state' value (true => 1, false => 0).
@@ -105,13 +165,17 @@ int bitmap_add_index_items(item_bitmap * bitmap, PageHeader header, char *raw_pa
  * - page : page number (where the item is, between 0 ...npages-1)
  * - item : position of the item on the page (0 .. max items)
  * - state : set or unset the item
- * 
+ *
  * Returns false when the (page,item) is out of acceptable range or
  * when the bit is already set to the new value. Otherwise the
  * method returns true.
- * 
+ *
  */
-bool bitmap_set_item(item_bitmap * bitmap, int page, int item, bool state);
+bool bitmap_set_item(item_bitmap * bitmap, BlockNumber page, int item, bool state);
+
+/* Returns true if the (page,item) is tracked by the bitmap, i.e. the page
+ * was added to the bitmap and had at least (item+1) items. */
+bool bitmap_contains(item_bitmap * bitmap, BlockNumber page, int item);
 
 /* Returns current bit value for the item (page,item).
  *
@@ -121,32 +185,66 @@ bool bitmap_set_item(item_bitmap * bitmap, int page, int item, bool state);
  *
  * Returns false when the (page,item) is out of acceptable range.
  * Otherwise the bit value is returned.
- * 
+ *
  * FIXME It's impossible to distinguish error and bit set to 0.
  *
  */
-bool bitmap_get_item(item_bitmap * bitmap, int page, int item);
+bool bitmap_get_item(item_bitmap * bitmap, BlockNumber page, int item);
 
 /* Counts the bits set to 1 in the bitmap
  *
  * - bitmap : bitmap to count
- * 
+ *
  * Returns number of bits set to 1.
  */
-long bitmap_count(item_bitmap * bitmap);
+uint64 bitmap_count(item_bitmap * bitmap);
+
+/* Callback for differences found by bitmap_compare.
+ *
+ * - page : page of the differing item
+ * - item : position of the item on the page (0 .. max items)
+ * - in_a : true if the item is set in bitmap_a (and not in bitmap_b)
+ * - arg : argument passed to bitmap_compare
+ *
+ * Returns true if the difference should be counted.
+ */
+typedef bool (*bitmap_diff_callback) (BlockNumber page, int item, bool in_a, void *arg);
 
 /* Compares two bitmaps, returns number of differences.
  *
  * - bitmap_a : input bitmap
  * - bitmap_b : input bitmap
- * 
+ * - callback : called for each difference (may be NULL)
+ * - arg : passed to the callback
+ *
  * Returns number of differences, i.e. bits set to 0 in bitmap_a
- * and 1 in bitmap_b, or vice versa.
- * 
+ * and 1 in bitmap_b, or vice versa. The segments are compared using
+ * vectorized XOR/popcount, and only segments with differences are
+ * walked word by word to pass the items to the callback.
+ *
+ */
+uint64 bitmap_compare(item_bitmap * bitmap_a, item_bitmap * bitmap_b,
+					  bitmap_diff_callback callback, void *arg);
+
+/* Compares a bitmap to several other bitmaps in a single pass.
+ *
+ * - bitmap : input bitmap (e.g. the heap bitmap)
+ * - others : bitmaps to compare with (copies of 'bitmap', e.g. indexes)
+ * - nothers : number of bitmaps in 'others'
+ * - ndiffs : output array, number of differences for each bitmap
+ * - callback : called for each difference (may be NULL)
+ * - args : array of arguments passed to the callback (one per bitmap)
+ *
+ * Equivalent to calling bitmap_compare for each of the bitmaps, but the
+ * data of 'bitmap' are read only once - each block of BITMAP_COMPARE_WORDS
+ * words is compared to all the other bitmaps before moving to the next one.
  */
-long bitmap_compare(item_bitmap * bitmap_a, item_bitmap * bitmap_b);
+void bitmap_compare_multi(item_bitmap * bitmap, item_bitmap ** others, int nothers,
+						  uint64 * ndiffs, bitmap_diff_callback callback, void ** args);
 
-/* Prints the info about the bitmap and the data as a series of 0/1. */
+/* Prints the info about the bitmap, the running sums of items per page and
+ * the data (in the requested format), each as a series of messages with
+ * fixed-size chunks. */
 void bitmap_print(item_bitmap * bitmap, BitmapFormat format);
 
-#endif   /* HEAP_CHECK_H */
\ No newline at end of file
+#endif   /* HEAP_CHECK_H */
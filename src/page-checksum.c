@@ -0,0 +1,129 @@
+#include "page-checksum.h"
+#include "common.h"
+
+#include "access/xlog.h"
+#include "miscadmin.h"
+#include "storage/buf_internals.h"
+#include "storage/bufpage.h"
+#include "storage/checksum.h"
+#include "storage/smgr.h"
+
+/* reads of the page from disk to get a stable mismatch (when the page keeps
+ * changing, the checksum is not verified at all) */
+#define CHECKSUM_READ_ATTEMPTS	5
+
+static bool checksum_matches(char *page, BlockNumber blkno, uint16 *computed);
+
+/* with data checksums disabled there's nothing to verify */
+bool checksum_enabled(void) {
+
+	return pgcheck_verify_checksums && DataChecksumsEnabled();
+
+}
+
+bool checksum_partial(void) {
+
+	return checksum_enabled() && (pgcheck_checksum_depth < CHECK_DEPTH_FULL);
+
+}
+
+/* the checksum is only updated when writing the buffer out */
+bool checksum_buffer_dirty(Buffer buf) {
+
+	BufferDesc *desc;
+
+	/* local buffers (temporary relations) */
+	if (BufferIsLocal(buf)) {
+		return true;
+	}
+
+#if (PG_VERSION_NUM >= 90500)
+	desc = GetBufferDescriptor(buf - 1);
+#else
+	desc = &BufferDescriptors[buf - 1];
+#endif
+
+#if (PG_VERSION_NUM >= 90600)
+	return (pg_atomic_read_u32(&desc->state) & BM_DIRTY) != 0;
+#else
+	return (desc->flags & BM_DIRTY) != 0;
+#endif
+
+}
+
+/* verifies the checksum (of a private copy of the page) */
+int checksum_verify(Relation rel, ForkNumber forknum, char *page, BlockNumber blkno,
+					bool dirty) {
+
+	uint16		computed;
+	char	   *ondisk;
+	char	   *previous;
+	bool		ok;
+	bool		stable = false;
+	int			attempt;
+	int			result;
+
+	/* new pages have no checksum */
+	if (!checksum_enabled() || dirty || PageIsNew((Page) page)) {
+		return CHECKSUM_UNKNOWN;
+	}
+
+	if (checksum_matches(page, blkno, &computed)) {
+		return CHECKSUM_OK;
+	}
+
+	/* the page may have hint bits not written out yet, so check the page
+	 * on disk (which is what the checksum is for) */
+	ondisk = (char *) palloc(BLCKSZ);
+	previous = (char *) palloc(BLCKSZ);
+
+	RelationOpenSmgr(rel);
+
+	/* the read is not synchronized with writes of the buffer, so it may
+	 * see a page being written out - report only a mismatch that is the
+	 * same on two consecutive reads */
+	for (attempt = 0; attempt < CHECKSUM_READ_ATTEMPTS; attempt++) {
+
+		smgrread(rel->rd_smgr, forknum, blkno, ondisk);
+
+		ok = PageIsNew((Page) ondisk) || checksum_matches(ondisk, blkno, &computed);
+
+		stable = (attempt > 0) && (memcmp(ondisk, previous, BLCKSZ) == 0);
+
+		if (ok || stable) {
+			break;
+		}
+
+		memcpy(previous, ondisk, BLCKSZ);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	if (ok) {
+		result = CHECKSUM_OK;
+	} else if (stable) {
+		check_report(WARNING, blkno, 0, "checksum",
+					 "page checksum %u does not match the computed checksum %u",
+					 ((PageHeader) ondisk)->pd_checksum, computed);
+		result = CHECKSUM_FAILED;
+	} else {
+		ereport(DEBUG1,
+				(errmsg("[%u] page keeps changing on disk, checksum not verified", blkno)));
+		result = CHECKSUM_UNKNOWN;
+	}
+
+	pfree(ondisk);
+	pfree(previous);
+
+	return result;
+
+}
+
+/* does the checksum on the page match? */
+static bool checksum_matches(char *page, BlockNumber blkno, uint16 *computed) {
+
+	*computed = pg_checksum_page(page, blkno);
+
+	return (*computed == ((PageHeader) page)->pd_checksum);
+
+}
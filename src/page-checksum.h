@@ -0,0 +1,66 @@
+#ifndef PAGE_CHECKSUM_CHECK_H
+#define PAGE_CHECKSUM_CHECK_H
+
+#include "postgres.h"
+#include "storage/bufmgr.h"
+#include "utils/rel.h"
+
+/*
+ * Verification of the page checksums (with data checksums enabled).
+ *
+ * A valid checksum rules out most kinds of corruption of the page on disk
+ * (torn pages, bit rot), and computing it costs about as much as copying
+ * the page. So with pg_check.verify_checksums the checksum is verified
+ * first, and pg_check.checksum_depth determines which of the (much more
+ * expensive) structural checks are done on pages with a valid checksum.
+ * Pages with a checksum failure always get all the checks, and so do the
+ * sampled pages (pg_check.sample_percent) and the pages modified since
+ * the last incremental check.
+ *
+ * The checksum of a page in shared buffers is only updated when the page
+ * is written out, so it can't be verified for dirty buffers (those get
+ * the structural checks instead). A page may also get hint bits without
+ * being marked dirty (e.g. on a standby), so a failure is confirmed by
+ * reading the page from disk directly, before it's reported. That read
+ * may race with the buffer being written out, so only a mismatch seen on
+ * two identical consecutive reads is reported.
+ */
+
+/* depth of the checks (pg_check.checksum_depth) */
+#define CHECK_DEPTH_NONE	0	/* no checks (just the checksum) */
+#define CHECK_DEPTH_HEADER	1	/* the page checks (header, line pointers) */
+#define CHECK_DEPTH_FULL	2	/* all the checks (tuples / items) */
+
+/* result of the checksum verification */
+#define CHECKSUM_UNKNOWN	0	/* not verified (disabled, dirty, new or changing page) */
+#define CHECKSUM_OK			1
+#define CHECKSUM_FAILED		2
+
+/* GUC variables (defined in pg_check.c) */
+extern bool	pgcheck_verify_checksums;
+extern int	pgcheck_checksum_depth;
+
+/* Are the checksums verified (enabled, and the cluster has checksums)? */
+bool checksum_enabled(void);
+
+/* Do the pages with a valid checksum get only some of the checks? */
+bool checksum_partial(void);
+
+/* Is the buffer dirty (or local), i.e. the checksum is not up to date?
+ * Needs to be called while holding a lock on the buffer content. */
+bool checksum_buffer_dirty(Buffer buf);
+
+/* Verifies checksum of a copy of the page, reports a failure.
+ *
+ * - rel : relation the page belongs to
+ * - forknum : fork of the relation
+ * - page : copy of the page (the checksum is computed in place)
+ * - blkno : block number of the page
+ * - dirty : the buffer was dirty (see checksum_buffer_dirty)
+ *
+ * Returns CHECKSUM_OK, CHECKSUM_FAILED or CHECKSUM_UNKNOWN.
+ */
+int checksum_verify(Relation rel, ForkNumber forknum, char *page, BlockNumber blkno,
+					bool dirty);
+
+#endif   /* PAGE_CHECKSUM_CHECK_H */
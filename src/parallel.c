@@ -0,0 +1,777 @@
+/*-------------------------------------------------------------------------
+ *
+ * parallel.c
+ *	  Parallel checks using dynamic background workers.
+ *
+ * The leader creates a DSM segment with a small shared state (relation,
+ * block range and a counter the workers use to grab chunks of blocks, or
+ * a list of relations when checking the whole database), a copy of the
+ * leader's GUC settings and a message queue for each worker. The workers
+ * redirect all their messages (warnings, errors, debug info) into the
+ * queue and the leader re-throws them, so the client gets the same output
+ * as from a serial check (except that the blocks are not reported in
+ * order).
+ *
+ * Requires PostgreSQL 9.5 (message queues as error destination).
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "database.h"
+#include "parallel.h"
+#include "pg_check.h"
+#include "progress.h"
+#include "sample.h"
+#include "scan.h"
+#include "stats.h"
+
+#if (PG_VERSION_NUM >= 90500)
+
+#include "access/heapam.h"
+#include "access/xact.h"
+#include "libpq/pqformat.h"
+#include "libpq/pqmq.h"
+#include "miscadmin.h"
+#include "postmaster/bgworker.h"
+#include "storage/dsm.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/proc.h"
+#include "storage/shm_mq.h"
+#include "storage/shm_toc.h"
+#include "storage/spin.h"
+#include "tcop/tcopprot.h"
+#include "utils/guc.h"
+#include "utils/resowner.h"
+
+#if (PG_VERSION_NUM >= 100000)
+#include "pgstat.h"
+#endif
+
+/* magic number identifying the DSM segment */
+#define PG_CHECK_SHM_MAGIC		0x70676368
+
+/* size of the message queue (for each worker) */
+#define PG_CHECK_QUEUE_SIZE		16384
+
+/* number of blocks handed to a worker at once (1MB with 8kB pages) */
+#define PG_CHECK_CHUNK_BLOCKS	128
+
+/* maximum number of (small) relations handed to a worker at once */
+#define PG_CHECK_BATCH_RELATIONS	64
+
+/* how often the leader checks the workers are still running (ms) */
+#define PG_CHECK_WAIT_TIMEOUT		1000
+
+/* keys in the table of contents (queues use PG_CHECK_KEY_QUEUE + i) */
+#define PG_CHECK_KEY_STATE		0
+#define PG_CHECK_KEY_GUC		1
+#define PG_CHECK_KEY_RELATIONS	2
+#define PG_CHECK_KEY_QUEUE		3
+
+#if (PG_VERSION_NUM >= 100000)
+#define pgcheck_toc_lookup(toc, key)	shm_toc_lookup(toc, key, false)
+#else
+#define pgcheck_toc_lookup(toc, key)	shm_toc_lookup(toc, key)
+#endif
+
+/* what the workers check */
+typedef enum
+{
+	PARALLEL_BLOCKS,			/* chunks of blocks of a single table */
+	PARALLEL_RELATIONS			/* whole relations (of a database) */
+} ParallelMode;
+
+/* state shared by the leader and the workers */
+typedef struct parallel_check_state
+{
+	slock_t		mutex;			/* protects next_block, next_rel, nerrs and stats */
+
+	Oid			database;		/* database to connect to */
+	Oid			userid;			/* user to connect as */
+	int			mode;			/* ParallelMode */
+	int			nworkers;		/* number of workers (sharing the I/O budget) */
+
+	/* PARALLEL_BLOCKS */
+	Oid			relid;			/* relation to check */
+	BlockNumber	blockTo;		/* first block not to check */
+	BlockNumber	next_block;		/* next block to hand out */
+	uint64		skip_lsn;		/* skip pages older than this (incremental) */
+	uint32		sample_seed;	/* the same blocks sampled as by the leader */
+
+	/* PARALLEL_RELATIONS (the relations are in a separate chunk) */
+	int			nrels;			/* number of relations */
+	int			next_rel;		/* next relation to hand out */
+	bool		check_indexes;	/* check indexes on the tables */
+	bool		cross_check;	/* cross-check tables and indexes */
+	bool		incremental;	/* skip pages not modified since the last check */
+
+	uint32		nerrs;			/* errors found by the workers */
+	check_stats	stats;			/* stats of the workers (PARALLEL_BLOCKS) */
+} parallel_check_state;
+
+/* the leader's handle on the workers */
+typedef struct parallel_check_context
+{
+	dsm_segment *seg;
+	parallel_check_state *state;
+	check_relation *rels;		/* relations (PARALLEL_RELATIONS only) */
+	int			nworkers;		/* number of workers requested */
+	int			nlaunched;		/* number of workers actually started */
+	shm_mq_handle **queues;
+	BackgroundWorkerHandle **handles;
+} parallel_check_context;
+
+static void parallel_begin(parallel_check_context *pcxt, int mode, int nworkers, int nrels);
+static void parallel_launch(parallel_check_context *pcxt);
+static void parallel_wait(parallel_check_context *pcxt, BlockNumber blockFrom);
+static void parallel_end(parallel_check_context *pcxt);
+static void worker_check_blocks(parallel_check_state *state);
+static void worker_check_relations(parallel_check_state *state, check_relation *rels);
+static void worker_io_budget(int nworkers);
+static bool next_chunk(parallel_check_state *state, BlockNumber *from, BlockNumber *to);
+static bool next_relations(parallel_check_state *state, check_relation *rels, int *from, int *to);
+static void handle_worker_message(char *data, Size nbytes);
+
+/*
+ * check the blocks using background workers (the leader only passes the
+ * messages to the client, and checks blocks the workers did not get to)
+ */
+uint32
+check_table_parallel(Relation rel, BlockNumber blockFrom, BlockNumber blockTo,
+					 int nworkers, uint64 skip_lsn)
+{
+	parallel_check_context pcxt;
+	parallel_check_state *state;
+	uint32		nerrs;
+	BlockNumber from, to;
+
+	/*
+	 * The workers run in their own transactions, so they can't see
+	 * relations created (or rewritten) by our transaction.
+	 */
+	if (rel->rd_createSubid != InvalidSubTransactionId ||
+		rel->rd_newRelfilenodeSubid != InvalidSubTransactionId)
+	{
+		ereport(NOTICE,
+				(errmsg("relation \"%s\" was created or rewritten in the current transaction, checking it serially",
+						RelationGetRelationName(rel))));
+		nworkers = 0;
+	}
+
+	parallel_begin(&pcxt, PARALLEL_BLOCKS, nworkers, 0);
+
+	state = pcxt.state;
+	state->relid = RelationGetRelid(rel);
+	state->blockTo = blockTo;
+	state->next_block = blockFrom;
+	state->skip_lsn = skip_lsn;
+	state->sample_seed = sample_get_seed();
+
+	parallel_launch(&pcxt);
+	parallel_wait(&pcxt, blockFrom);
+
+	/* all the workers are gone now, so no need for the spinlock */
+	nerrs = state->nerrs;
+
+	/* the work done by the workers is part of the check */
+	stats_add(&pgcheck_stats, &state->stats);
+
+	/* blocks no worker got to (e.g. when the workers failed to start) */
+	if (next_chunk(state, &from, &to))
+	{
+		BufferAccessStrategy strategy = GetAccessStrategy(BAS_BULKREAD);
+		char   *raw_page = (char *) palloc(BLCKSZ);
+
+		if (nworkers > 0 && pcxt.nlaunched == 0)
+			ereport(NOTICE,
+					(errmsg("no background workers started, checking the table serially")));
+
+		do {
+			nerrs += check_table_blocks(rel, from, to, strategy, raw_page, NULL, skip_lsn);
+		} while (next_chunk(state, &from, &to));
+
+		pfree(raw_page);
+		FreeAccessStrategy(strategy);
+	}
+
+	parallel_end(&pcxt);
+
+	return nerrs;
+}
+
+/*
+ * check the relations using background workers (the largest ones first,
+ * the small ones in batches) - relations no worker got to are checked by
+ * the leader
+ */
+uint32
+check_database_parallel(check_relation *rels, int nrels, int nworkers,
+						bool checkIndexes, bool crossCheckIndexes, bool incremental)
+{
+	parallel_check_context pcxt;
+	parallel_check_state *state;
+	uint32		nerrs;
+	int			from, to;
+
+	parallel_begin(&pcxt, PARALLEL_RELATIONS, nworkers, nrels);
+
+	state = pcxt.state;
+	state->nrels = nrels;
+	state->next_rel = 0;
+	state->check_indexes = checkIndexes;
+	state->cross_check = crossCheckIndexes;
+	state->incremental = incremental;
+
+	memcpy(pcxt.rels, rels, sizeof(check_relation) * nrels);
+
+	parallel_launch(&pcxt);
+	parallel_wait(&pcxt, 0);
+
+	/* all the workers are gone now, so no need for the spinlock */
+	nerrs = state->nerrs;
+
+	/* the work done by the workers is part of the check */
+	stats_add(&pgcheck_stats, &state->stats);
+
+	if (next_relations(state, pcxt.rels, &from, &to))
+	{
+		if (pcxt.nlaunched == 0)
+			ereport(NOTICE,
+					(errmsg("no background workers started, checking the database serially")));
+
+		/* there's no point in batching the rest, so check them all at once */
+		nerrs += check_relations(&pcxt.rels[from], nrels - from, checkIndexes,
+								 crossCheckIndexes, incremental);
+	}
+
+	parallel_end(&pcxt);
+
+	return nerrs;
+}
+
+/*
+ * background worker - grabs chunks of blocks (or batches of relations) and
+ * checks them, until there are none left (all messages go to the leader
+ * through the queue)
+ */
+void
+pg_check_worker_main(Datum main_arg)
+{
+	dsm_segment *seg;
+	shm_toc	   *toc;
+	parallel_check_state *state;
+	shm_mq	   *mq;
+	shm_mq_handle *mqh;
+	int			worker;
+
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+	CurrentResourceOwner = ResourceOwnerCreate(NULL, "pg_check worker");
+
+	seg = dsm_attach(DatumGetUInt32(main_arg));
+	if (seg == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("could not map dynamic shared memory segment")));
+
+	toc = shm_toc_attach(PG_CHECK_SHM_MAGIC, dsm_segment_address(seg));
+	if (toc == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("bad magic number in dynamic shared memory segment")));
+
+	state = (parallel_check_state *) pgcheck_toc_lookup(toc, PG_CHECK_KEY_STATE);
+
+	/* redirect all the messages to our queue */
+	memcpy(&worker, MyBgworkerEntry->bgw_extra, sizeof(int));
+
+	mq = (shm_mq *) pgcheck_toc_lookup(toc, PG_CHECK_KEY_QUEUE + worker);
+	shm_mq_set_sender(mq, MyProc);
+	mqh = shm_mq_attach(mq, seg, NULL);
+
+#if (PG_VERSION_NUM >= 90600)
+	pq_redirect_to_shm_mq(seg, mqh);
+#else
+	pq_redirect_to_shm_mq(mq, mqh);
+#endif
+
+#if (PG_VERSION_NUM >= 110000)
+	BackgroundWorkerInitializeConnectionByOid(state->database, state->userid, 0);
+#else
+	BackgroundWorkerInitializeConnectionByOid(state->database, state->userid);
+#endif
+
+	/*
+	 * Use the same settings as the leader (pg_check options, messages sent
+	 * to the client etc.). The GUC check hooks may need catalog access, so
+	 * this has to happen in a transaction (the same as in parallel query).
+	 */
+	StartTransactionCommand();
+	RestoreGUCState(pgcheck_toc_lookup(toc, PG_CHECK_KEY_GUC));
+	CommitTransactionCommand();
+
+	worker_io_budget(state->nworkers);
+	scan_budget_reset();
+
+	if (state->mode == PARALLEL_BLOCKS)
+		worker_check_blocks(state);
+	else
+		worker_check_relations(state,
+							   (check_relation *) pgcheck_toc_lookup(toc, PG_CHECK_KEY_RELATIONS));
+
+	/* this also detaches the queue, which tells the leader we're done */
+	dsm_detach(seg);
+}
+
+/*
+ * create the DSM segment with the shared state, serialized GUCs, the
+ * relations (if any) and a queue for each worker
+ */
+static void
+parallel_begin(parallel_check_context *pcxt, int mode, int nworkers, int nrels)
+{
+	shm_toc_estimator	e;
+	Size		segsize;
+	Size		gucsize;
+	shm_toc	   *toc;
+	parallel_check_state *state;
+	char	   *gucstate;
+	int			i;
+
+	gucsize = EstimateGUCStateSpace();
+
+	shm_toc_initialize_estimator(&e);
+	shm_toc_estimate_chunk(&e, sizeof(parallel_check_state));
+	shm_toc_estimate_chunk(&e, gucsize);
+	shm_toc_estimate_chunk(&e, sizeof(check_relation) * Max(nrels, 1));
+	for (i = 0; i < nworkers; i++)
+		shm_toc_estimate_chunk(&e, PG_CHECK_QUEUE_SIZE);
+	shm_toc_estimate_keys(&e, PG_CHECK_KEY_QUEUE + nworkers);
+	segsize = shm_toc_estimate(&e);
+
+	pcxt->seg = dsm_create(segsize, 0);
+	toc = shm_toc_create(PG_CHECK_SHM_MAGIC, dsm_segment_address(pcxt->seg), segsize);
+
+	/* shared state (the rest is set by the caller) */
+	state = (parallel_check_state *) shm_toc_allocate(toc, sizeof(parallel_check_state));
+	memset(state, 0, sizeof(parallel_check_state));
+
+	SpinLockInit(&state->mutex);
+	state->database = MyDatabaseId;
+	state->userid = GetUserId();
+	state->mode = mode;
+	state->nworkers = nworkers;
+	state->nerrs = 0;
+
+	shm_toc_insert(toc, PG_CHECK_KEY_STATE, state);
+
+	/* so that the workers check (and report) the same way as the leader */
+	gucstate = (char *) shm_toc_allocate(toc, gucsize);
+	SerializeGUCState(gucsize, gucstate);
+	shm_toc_insert(toc, PG_CHECK_KEY_GUC, gucstate);
+
+	pcxt->rels = (check_relation *) shm_toc_allocate(toc, sizeof(check_relation) * Max(nrels, 1));
+	shm_toc_insert(toc, PG_CHECK_KEY_RELATIONS, pcxt->rels);
+
+	/* a message queue for each worker */
+	pcxt->queues = (shm_mq_handle **) palloc0(sizeof(shm_mq_handle *) * Max(nworkers, 1));
+	pcxt->handles = (BackgroundWorkerHandle **) palloc0(sizeof(BackgroundWorkerHandle *) * Max(nworkers, 1));
+
+	for (i = 0; i < nworkers; i++)
+	{
+		shm_mq	   *mq;
+
+		mq = shm_mq_create(shm_toc_allocate(toc, PG_CHECK_QUEUE_SIZE),
+						   PG_CHECK_QUEUE_SIZE);
+		shm_mq_set_receiver(mq, MyProc);
+		shm_toc_insert(toc, PG_CHECK_KEY_QUEUE + i, mq);
+
+		pcxt->queues[i] = shm_mq_attach(mq, pcxt->seg, NULL);
+	}
+
+	pcxt->state = state;
+	pcxt->nworkers = nworkers;
+	pcxt->nlaunched = 0;
+}
+
+/*
+ * start the workers (some of them may not start, that's OK)
+ */
+static void
+parallel_launch(parallel_check_context *pcxt)
+{
+	int			i;
+
+	for (i = 0; i < pcxt->nworkers; i++)
+	{
+		BackgroundWorker worker;
+
+		memset(&worker, 0, sizeof(worker));
+
+		worker.bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+		worker.bgw_start_time = BgWorkerStart_ConsistentState;
+		worker.bgw_restart_time = BGW_NEVER_RESTART;
+		snprintf(worker.bgw_name, BGW_MAXLEN, "pg_check worker %d", i);
+#if (PG_VERSION_NUM >= 110000)
+		snprintf(worker.bgw_type, BGW_MAXLEN, "pg_check worker");
+#endif
+		snprintf(worker.bgw_library_name, BGW_MAXLEN, "pg_check");
+		snprintf(worker.bgw_function_name, BGW_MAXLEN, "pg_check_worker_main");
+		worker.bgw_main_arg = UInt32GetDatum(dsm_segment_handle(pcxt->seg));
+		worker.bgw_notify_pid = MyProcPid;
+
+		/* the worker needs to know which queue to use */
+		memcpy(worker.bgw_extra, &i, sizeof(int));
+
+		if (!RegisterDynamicBackgroundWorker(&worker, &pcxt->handles[pcxt->nlaunched]))
+			break;
+
+		shm_mq_set_handle(pcxt->queues[pcxt->nlaunched], pcxt->handles[pcxt->nlaunched]);
+		pcxt->nlaunched++;
+	}
+
+	if (pcxt->nlaunched < pcxt->nworkers)
+		ereport(NOTICE,
+				(errmsg("started only %d out of %d background workers",
+						pcxt->nlaunched, pcxt->nworkers),
+				 errhint("You might need to increase max_worker_processes.")));
+}
+
+/*
+ * Pass the messages from the workers to the client, until all the workers
+ * detach from the queues. If something fails, make sure the workers don't
+ * keep running.
+ *
+ * When checking blocks of a table, the blocks handed out to the workers are
+ * reported as progress of the leader (the workers checking whole relations
+ * report their own progress).
+ */
+static void
+parallel_wait(parallel_check_context *pcxt, BlockNumber blockFrom)
+{
+	parallel_check_state *state = pcxt->state;
+	BlockNumber	progress_block = blockFrom;	/* blocks reported as done */
+	int			nactive;		/* workers still attached to the queue */
+	int			i;
+
+	PG_TRY();
+	{
+		nactive = pcxt->nlaunched;
+		while (nactive > 0)
+		{
+			bool	received = false;
+
+			for (i = 0; i < pcxt->nlaunched; i++)
+			{
+				shm_mq_result	res;
+				Size			nbytes;
+				void		   *data;
+
+				if (pcxt->queues[i] == NULL)
+					continue;
+
+				res = shm_mq_receive(pcxt->queues[i], &nbytes, &data, true);
+
+				/*
+				 * A worker exiting normally detaches from the queue, so a
+				 * stopped worker with nothing more to receive has died
+				 * without that (and the check is incomplete).
+				 */
+				if (res == SHM_MQ_WOULD_BLOCK)
+				{
+					pid_t	pid;
+
+					if (GetBackgroundWorkerPid(pcxt->handles[i], &pid) != BGWH_STOPPED)
+						continue;
+
+					res = shm_mq_receive(pcxt->queues[i], &nbytes, &data, true);
+
+					if (res == SHM_MQ_WOULD_BLOCK)
+						ereport(ERROR,
+								(errcode(ERRCODE_INTERNAL_ERROR),
+								 errmsg("background worker exited unexpectedly")));
+				}
+
+				if (res == SHM_MQ_DETACHED)
+				{
+					/* worker finished (or failed to start) */
+					pcxt->queues[i] = NULL;
+					nactive--;
+					continue;
+				}
+
+				handle_worker_message((char *) data, nbytes);
+				received = true;
+			}
+
+			/* blocks handed out to the workers so far (close enough) */
+			if (state->mode == PARALLEL_BLOCKS)
+			{
+				BlockNumber	next_block;
+
+				SpinLockAcquire(&state->mutex);
+				next_block = state->next_block;
+				SpinLockRelease(&state->mutex);
+
+				progress_blocks(next_block - progress_block);
+				progress_block = next_block;
+			}
+
+			if (!received && nactive > 0)
+			{
+				int		rc;
+
+				/* the timeout makes sure dead workers get noticed */
+#if (PG_VERSION_NUM >= 100000)
+				rc = WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+							   PG_CHECK_WAIT_TIMEOUT, PG_WAIT_EXTENSION);
+#else
+				rc = WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+							   PG_CHECK_WAIT_TIMEOUT);
+#endif
+
+				/* the workers are gone too, nothing to wait for */
+				if (rc & WL_POSTMASTER_DEATH)
+					proc_exit(1);
+
+				ResetLatch(MyLatch);
+			}
+
+			CHECK_FOR_INTERRUPTS();
+		}
+	}
+	PG_CATCH();
+	{
+		for (i = 0; i < pcxt->nlaunched; i++)
+			TerminateBackgroundWorker(pcxt->handles[i]);
+
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+}
+
+/*
+ * release the DSM segment (the workers are gone at this point)
+ */
+static void
+parallel_end(parallel_check_context *pcxt)
+{
+	dsm_detach(pcxt->seg);
+
+	pfree(pcxt->queues);
+	pfree(pcxt->handles);
+}
+
+/*
+ * worker checking chunks of blocks of a single table
+ */
+static void
+worker_check_blocks(parallel_check_state *state)
+{
+	Relation	rel;
+	BufferAccessStrategy strategy;
+	char	   *raw_page;
+	uint32		nerrs = 0;
+	BlockNumber from, to;
+
+	StartTransactionCommand();
+
+	rel = relation_open(state->relid, AccessShareLock);
+
+	strategy = GetAccessStrategy(BAS_BULKREAD);
+	raw_page = (char *) palloc(BLCKSZ);
+
+	sample_set_seed(state->sample_seed);
+
+	/* the errors are added after each chunk, so that all the workers stop
+	 * once there's pg_check.max_errors of them (see next_chunk) */
+	while (next_chunk(state, &from, &to))
+	{
+		nerrs = check_table_blocks(rel, from, to, strategy, raw_page, NULL,
+								   state->skip_lsn);
+
+		SpinLockAcquire(&state->mutex);
+		state->nerrs += nerrs;
+		SpinLockRelease(&state->mutex);
+	}
+
+	/* publish the stats for the leader (the worker checked nothing else) */
+	SpinLockAcquire(&state->mutex);
+	stats_add(&state->stats, &pgcheck_stats);
+	SpinLockRelease(&state->mutex);
+
+	FreeAccessStrategy(strategy);
+
+	relation_close(rel, AccessShareLock);
+
+	CommitTransactionCommand();
+}
+
+/*
+ * worker checking batches of relations (each batch in a transaction)
+ */
+static void
+worker_check_relations(parallel_check_state *state, check_relation *rels)
+{
+	uint32		nerrs = 0;
+	int			from, to;
+
+	while (next_relations(state, rels, &from, &to))
+	{
+		StartTransactionCommand();
+
+		nerrs += check_relations(&rels[from], to - from, state->check_indexes,
+								 state->cross_check, state->incremental);
+
+		CommitTransactionCommand();
+	}
+
+	SpinLockAcquire(&state->mutex);
+	state->nerrs += nerrs;
+	SpinLockRelease(&state->mutex);
+}
+
+/*
+ * The cost limit and the rate limit are a budget for the whole check,
+ * so each worker gets only a fraction of it (the same as autovacuum
+ * workers balancing the vacuum cost limit). If some of the workers fail
+ * to start, the check is just slower than allowed.
+ */
+static void
+worker_io_budget(int nworkers)
+{
+	if (nworkers <= 1)
+		return;
+
+	pgcheck_cost_limit = Max(pgcheck_cost_limit / nworkers, 1);
+
+	if (pgcheck_max_rate > 0)
+		pgcheck_max_rate = Max(pgcheck_max_rate / nworkers, 1);
+}
+
+/*
+ * get the next chunk of blocks to check, returns false if there are none
+ * (or when the workers found pg_check.max_errors issues already)
+ */
+static bool
+next_chunk(parallel_check_state *state, BlockNumber *from, BlockNumber *to)
+{
+	SpinLockAcquire(&state->mutex);
+
+	if ((pgcheck_max_errors > 0) && (state->nerrs >= (uint32) pgcheck_max_errors))
+		state->next_block = state->blockTo;
+
+	*from = state->next_block;
+
+	if (state->blockTo - *from > PG_CHECK_CHUNK_BLOCKS)
+		*to = *from + PG_CHECK_CHUNK_BLOCKS;
+	else
+		*to = state->blockTo;
+
+	state->next_block = *to;
+
+	SpinLockRelease(&state->mutex);
+
+	return (*from < *to);
+}
+
+/*
+ * get the next batch of relations [from, to) to check, returns false if
+ * there are none - the relations are sorted by size, so the large ones
+ * are handed out one by one, while the small ones are packed into batches
+ * of about PG_CHECK_CHUNK_BLOCKS blocks
+ */
+static bool
+next_relations(parallel_check_state *state, check_relation *rels, int *from, int *to)
+{
+	BlockNumber	nblocks;
+
+	SpinLockAcquire(&state->mutex);
+
+	*from = state->next_rel;
+	*to = *from;
+
+	if (*to < state->nrels)
+	{
+		nblocks = rels[*to].relpages;
+		(*to)++;
+
+		while ((*to < state->nrels) &&
+			   (*to - *from < PG_CHECK_BATCH_RELATIONS) &&
+			   (nblocks + rels[*to].relpages <= PG_CHECK_CHUNK_BLOCKS))
+		{
+			nblocks += rels[*to].relpages;
+			(*to)++;
+		}
+	}
+
+	state->next_rel = *to;
+
+	SpinLockRelease(&state->mutex);
+
+	return (*from < *to);
+}
+
+/* re-throw a message received from a worker */
+static void
+handle_worker_message(char *data, Size nbytes)
+{
+	StringInfoData	msg;
+	char			msgtype;
+
+	msg.data = data;
+	msg.len = nbytes;
+	msg.maxlen = nbytes;
+	msg.cursor = 0;
+
+	msgtype = pq_getmsgbyte(&msg);
+
+	/* ignore anything except errors and notices */
+	if (msgtype == 'E' || msgtype == 'N')
+	{
+		ErrorData	edata;
+
+		pq_parse_errornotice(&msg, &edata);
+
+		/* a FATAL in the worker is just an ERROR for the leader */
+		if (edata.elevel > ERROR)
+			edata.elevel = ERROR;
+
+		ThrowErrorData(&edata);
+	}
+}
+
+#else	/* PG_VERSION_NUM < 90500 */
+
+uint32
+check_table_parallel(Relation rel, BlockNumber blockFrom, BlockNumber blockTo,
+					 int nworkers, uint64 skip_lsn)
+{
+	ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("parallel checks require PostgreSQL 9.5 or newer")));
+
+	return 0;					/* keep compiler quiet */
+}
+
+uint32
+check_database_parallel(check_relation *rels, int nrels, int nworkers,
+						bool checkIndexes, bool crossCheckIndexes, bool incremental)
+{
+	ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("parallel checks require PostgreSQL 9.5 or newer")));
+
+	return 0;					/* keep compiler quiet */
+}
+
+void
+pg_check_worker_main(Datum main_arg)
+{
+	/* never started on older releases */
+}
+
+#endif
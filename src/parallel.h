@@ -0,0 +1,51 @@
+#ifndef PARALLEL_CHECK_H
+#define PARALLEL_CHECK_H
+
+#include "postgres.h"
+#include "utils/rel.h"
+
+#include "database.h"
+
+/* Checks blocks [blockFrom, blockTo) of the heap relation using dynamic
+ * background workers.
+ *
+ * - rel : heap relation (locked by the caller, the workers acquire their
+ *         own AccessShareLock)
+ * - blockFrom : first block to check
+ * - blockTo : first block not to check
+ * - nworkers : number of workers to start
+ * - skip_lsn : skip checks of pages with older LSN (0 to check all pages)
+ *
+ * The block range is split into chunks, handed to the workers one by one
+ * (so that a slow worker does not delay the whole check). Messages from
+ * the workers are passed to the client through the leader.
+ *
+ * Returns number of issues found (by all the workers).
+ */
+uint32 check_table_parallel(Relation rel, BlockNumber blockFrom, BlockNumber blockTo,
+							int nworkers, uint64 skip_lsn);
+
+/* Checks the relations using dynamic background workers.
+ *
+ * - rels : relations to check (sorted by size, largest first)
+ * - nrels : number of relations
+ * - nworkers : number of workers to start
+ * - checkIndexes : check all indexes on the tables
+ * - crossCheckIndexes : cross-check the indexes with the tables
+ * - incremental : skip pages not modified since the last check
+ *
+ * Each worker grabs the next relation, or a batch of small relations
+ * (about PG_CHECK_CHUNK_BLOCKS blocks in total), and checks it the same
+ * way as pg_check_table. The cost and rate limits are shared by all the
+ * workers.
+ *
+ * Returns number of issues found (by all the workers).
+ */
+uint32 check_database_parallel(check_relation *rels, int nrels, int nworkers,
+							   bool checkIndexes, bool crossCheckIndexes,
+							   bool incremental);
+
+/* Entry point of the background workers (needs to be exported). */
+PGDLLEXPORT void pg_check_worker_main(Datum main_arg);
+
+#endif   /* PARALLEL_CHECK_H */
@@ -11,6 +11,12 @@
 
 #include "postgres.h"
 
+#include "access/genam.h"
+
+#if (PG_VERSION_NUM >= 90300)
+#include "access/htup_details.h"
+#endif
+
 #include "access/itup.h"
 #include "access/nbtree.h"
 #include "catalog/namespace.h"
@@ -23,22 +29,37 @@
 #include "funcapi.h"
 #include "miscadmin.h"
 #include "storage/bufmgr.h"
+#include "storage/procarray.h"
 #include "utils/builtins.h"
 #include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/syscache.h"
 #include "utils/rel.h"
 #include "utils/guc.h"
 
+#include "btree.h"
 #include "common.h"
+#include "forks.h"
 #include "index.h"
 #include "heap.h"
+#include "incremental.h"
 #include "item-bitmap.h"
+#include "parallel.h"
+#include "pg_check.h"
+#include "page-checksum.h"
+#include "progress.h"
+#include "result-cache.h"
+#include "resume.h"
+#include "sample.h"
+#include "scan.h"
+#include "stats.h"
+#include "tid-sort.h"
+#include "toast.h"
 
 #ifdef PG_MODULE_MAGIC
 PG_MODULE_MAGIC;
 #endif
 
-#define BTPageGetOpaque(page) ((BTPageOpaque) PageGetSpecialPointer(page))
-
 /* bitmap format (when pg_check.debug = true) */
 static const struct config_enum_entry bitmap_options[] = {
         {"base64", BITMAP_BASE64, false},
@@ -48,10 +69,119 @@ static const struct config_enum_entry bitmap_options[] = {
         {NULL, 0, false}
 };
 
+/* cross-check method */
+static const struct config_enum_entry cross_check_options[] = {
+        {"bitmap", CROSS_CHECK_BITMAP, false},
+        {"sort", CROSS_CHECK_SORT, false},
+        {NULL, 0, false}
+};
+
+/* sampling method */
+static const struct config_enum_entry sample_method_options[] = {
+        {"random", SAMPLE_RANDOM, false},
+        {"stratified", SAMPLE_STRATIFIED, false},
+        {NULL, 0, false}
+};
+
+/* blocks not sampled */
+static const struct config_enum_entry unsampled_pages_options[] = {
+        {"header", UNSAMPLED_HEADER, false},
+        {"skip", UNSAMPLED_SKIP, false},
+        {NULL, 0, false}
+};
+
+/* checks of pages with a valid checksum */
+static const struct config_enum_entry checksum_depth_options[] = {
+        {"full", CHECK_DEPTH_FULL, false},
+        {"header", CHECK_DEPTH_HEADER, false},
+        {"none", CHECK_DEPTH_NONE, false},
+        {NULL, 0, false}
+};
+
+/* number of blocks checked from each index in turn (multi-index cross-check) */
+#define INDEX_CHECK_CHUNK	64
+
+/* state of an index check, so that several indexes may be checked at once */
+typedef struct index_check_state {
+
+	Relation	rel;		/* the index (locked) */
+	const index_am_check *am;	/* checks for the access method */
+	LOCKMODE	lockmode;	/* lock to release at the end */
+	BufferAccessStrategy strategy; /* bulk strategy to avoid polluting cache */
+	block_scan	scan;		/* reads (and prefetches) the blocks */
+	char	   *raw_page;	/* raw data of the page */
+	bool		in_place;	/* check the pages in place (zero-copy) */
+	bool		online;		/* online cross-check (index may grow) */
+
+	BlockNumber	blkno;		/* next block to check */
+	BlockNumber	blockTo;	/* first block not to check */
+
+	item_bitmap *bitmap;	/* bitmap to update (or NULL) */
+	tid_sort   *sort;		/* sort to add the TIDs to (or NULL) */
+	ItemPointerData *tids;	/* heap TIDs of a page (for the bitmap or sort) */
+	uint32		nerrs;		/* number of errors found */
+
+	bool		track_lsn;	/* remember the LSN after the check */
+	uint64		start_lsn;	/* WAL position at the start */
+	uint64		skip_lsn;	/* skip pages older than this */
+
+	bool		cache;		/* use the result cache (see result-cache.h) */
+
+} index_check_state;
+
+/* difference found by the online cross-check (rechecked at the end) */
+typedef struct cross_diff {
+	BlockNumber	page;		/* heap page */
+	OffsetNumber offnum;	/* item on the page (1 .. max items) */
+	bool		in_heap;	/* in the heap, but not in the index */
+	bool		found;		/* found in the index by online_index_lookup */
+	bool		resolved;	/* explained by a concurrent change */
+} cross_diff;
+
+/* index passed to report_bitmap_diff */
+typedef struct bitmap_diff_arg {
+	Oid		heapOid;
+	Oid		indexOid;
+	char   *indexname;
+
+	/* online cross-check - collect the differences instead of reporting */
+	bool		collect;
+	int			ndiffs;
+	int			maxdiffs;
+	cross_diff *diffs;
+} bitmap_diff_arg;
+
 void        _PG_init(void);
 
 bool	pgcheck_debug;
 int		pgcheck_bitmap_format = BITMAP_BINARY;
+bool	pgcheck_zero_copy = false;
+int		pgcheck_prefetch_distance = 0;
+bool	pgcheck_multi_index = false;
+bool	pgcheck_online_cross_check = false;
+int		pgcheck_cross_check_method = CROSS_CHECK_BITMAP;
+int		pgcheck_cost_delay = 0;
+int		pgcheck_cost_limit = 200;
+int		pgcheck_max_rate = 0;
+double	pgcheck_sample_percent = 100.0;
+int		pgcheck_sample_method = SAMPLE_RANDOM;
+int		pgcheck_unsampled_pages = UNSAMPLED_HEADER;
+int		pgcheck_max_errors = 0;
+bool	pgcheck_check_toast = false;
+bool	pgcheck_check_vm = true;
+bool	pgcheck_check_fsm = true;
+bool	pgcheck_verify_checksums = false;
+int		pgcheck_checksum_depth = CHECK_DEPTH_FULL;
+int		pgcheck_checkpoint_blocks = 0;
+int		pgcheck_result_cache_size = 0;
+
+/* scratch buffers reused by all the checks in the backend (the table and
+ * its indexes, all relations of a database), allocated on first use in
+ * TopMemoryContext - the copy of the page being checked, the heap TIDs of
+ * an index page, and the bulk read strategy */
+static char	   *scratch_page = NULL;
+static ItemPointerData *scratch_tids = NULL;
+static BufferAccessStrategy scratch_strategy = NULL;
 
 Datum		pg_check_table(PG_FUNCTION_ARGS);
 Datum		pg_check_table_pages(PG_FUNCTION_ARGS);
@@ -59,11 +189,45 @@ Datum		pg_check_table_pages(PG_FUNCTION_ARGS);
 Datum		pg_check_index(PG_FUNCTION_ARGS);
 Datum		pg_check_index_pages(PG_FUNCTION_ARGS);
 
-static uint32	check_table(Oid relid, bool checkIndexes, bool crossCheckIndexes, BlockNumber blockFrom, BlockNumber blockTo, bool blockRangeGiven);
+Datum		pg_check_resume(PG_FUNCTION_ARGS);
+
+Datum		pg_check_table_report(PG_FUNCTION_ARGS);
+Datum		pg_check_index_report(PG_FUNCTION_ARGS);
+
+static uint32	check_table(Oid relid, bool checkIndexes, bool crossCheckIndexes, BlockNumber blockFrom, BlockNumber blockTo, bool blockRangeGiven, int nworkers, bool incremental, bool missingOk, resume_cursor *cursor);
+
+static uint32	check_index(Oid indexOid, BlockNumber blockFrom, BlockNumber blockTo, bool blockRangeGiven,
+							bool checkStructure, resume_cursor *cursor);
+
+static uint32	check_index_oid(Oid	indexOid, item_bitmap * bitmap, bool incremental, resume_cursor *cursor);
+static uint32	check_indexes_multi(Relation heap, List *indexes, item_bitmap * bitmap_heap, BlockNumber nblocks, bool incremental);
 
-static uint32	check_index(Oid indexOid, BlockNumber blockFrom, BlockNumber blockTo, bool blockRangeGiven);
+static index_check_state *index_check_open(Oid indexOid, item_bitmap * bitmap, tid_sort * sort, bool skipUnknown, bool incremental);
+static void		index_check_range(index_check_state *state, BlockNumber blockFrom, BlockNumber blockTo);
+static bool		index_check_blocks(index_check_state *state, BlockNumber nblocks);
+static void		index_check_run(index_check_state *state, resume_cursor *cursor);
+static int		index_check_page_tids(index_check_state *state, char *page, BlockNumber blkno);
+static void		index_check_add_tids(index_check_state *state, int ntids);
+static uint32	index_check_close(index_check_state *state);
 
-static uint32	check_index_oid(Oid	indexOid, item_bitmap * bitmap);
+static bool		report_bitmap_diff(BlockNumber page, int item, bool in_heap, void *arg);
+
+static void		diff_arg_init(bitmap_diff_arg *diffarg, Oid heapOid, Oid indexOid, char *indexname);
+static uint64	online_recheck(Relation heap, item_bitmap * bitmap_idx, bitmap_diff_arg *diffarg);
+static void		online_index_lookup(bitmap_diff_arg *diffarg);
+static void		cross_diff_add(bitmap_diff_arg *diffarg, BlockNumber page, OffsetNumber offnum, bool in_heap);
+static int		cross_diff_cmp(const void *a, const void *b);
+
+static void		findings_begin(FunctionCallInfo fcinfo, check_findings *findings);
+
+static bool		check_in_place(void);
+static void		check_scratch_init(void);
+static MemoryContext check_context_create(void);
+static int		page_check_depth(Relation rel, char *page, BlockNumber blkno, bool dirty,
+								 bool verified, bool modified, int depth, uint32 *nerrs);
+static uint32	check_heap_page_quiet(Relation rel, heap_layout *layout, char *page, BlockNumber blkno);
+static uint32	check_index_page_quiet(const index_am_check *am, Relation rel, char *page, BlockNumber blkno);
+static bool		index_cross_check_supported(Oid indexOid);
 
 /*
  * pg_check_table
@@ -78,9 +242,34 @@ pg_check_table(PG_FUNCTION_ARGS)
 	Oid		relid	 = PG_GETARG_OID(0);
 	bool	checkIndexes = PG_GETARG_BOOL(1);
 	bool	crossCheckIndexes = PG_GETARG_BOOL(2);
+	/* the extra arguments are missing when called through a 0.1.0
+	 * definition of the function (extension not updated yet) */
+	int		nworkers = (PG_NARGS() > 3) ? PG_GETARG_INT32(3) : 0;
+	bool	incremental = (PG_NARGS() > 4) ? PG_GETARG_BOOL(4) : false;
 	uint32	nerrs;
+	resume_cursor cursor;
+
+	if (nworkers < 0)
+		ereport(ERROR,
+				(errmsg("invalid number of workers %d", nworkers)));
+
+	if (nworkers > 0 && crossCheckIndexes)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("cross-checking is not supported with parallel workers")));
+
+	/* one I/O budget for the whole check */
+	scan_budget_reset();
 
-	nerrs = check_table(relid, checkIndexes, crossCheckIndexes, 0, 0, false);
+	/* the cross-check and the parallel checks can't be resumed (the bitmaps
+	 * and the workers' progress are not saved) */
+	if ((pgcheck_checkpoint_blocks > 0) && !crossCheckIndexes && (nworkers == 0)) {
+		resume_init(&cursor, relid, checkIndexes, incremental);
+
+		nerrs = check_table(relid, checkIndexes, false, 0, 0, false, 0, incremental, false, &cursor);
+	} else {
+		nerrs = check_table(relid, checkIndexes, crossCheckIndexes, 0, 0, false, nworkers, incremental, false, NULL);
+	}
 
 	PG_RETURN_INT32(nerrs);
 }
@@ -108,9 +297,11 @@ pg_check_table_pages(PG_FUNCTION_ARGS)
 		ereport(ERROR,
 				(errmsg("invalid ending block number")));
 
+	scan_budget_reset();
+
 	nerrs = check_table(relid, false, false,
 						(BlockNumber) blkfrom, (BlockNumber) blkto,
-						true);
+						true, 0, false, false, NULL);
 
 	PG_RETURN_INT32(nerrs);
 }
@@ -126,9 +317,21 @@ Datum
 pg_check_index(PG_FUNCTION_ARGS)
 {
 	Oid		relid = PG_GETARG_OID(0);
+	/* missing with the 0.1.0 definition of the function */
+	bool	checkStructure = (PG_NARGS() > 1) ? PG_GETARG_BOOL(1) : false;
 	uint32	nerrs;
+	resume_cursor cursor;
 
-	nerrs = check_index(relid, 0, 0, false);
+	scan_budget_reset();
+
+	/* the walk of the tree structure can't be resumed */
+	if ((pgcheck_checkpoint_blocks > 0) && !checkStructure) {
+		resume_init(&cursor, relid, false, false);
+
+		nerrs = check_index(relid, 0, 0, false, false, &cursor);
+	} else {
+		nerrs = check_index(relid, 0, 0, false, checkStructure, NULL);
+	}
 
 	PG_RETURN_INT32(nerrs);
 }
@@ -156,28 +359,206 @@ pg_check_index_pages(PG_FUNCTION_ARGS)
 		ereport(ERROR,
 				(errmsg("invalid ending block number")));
 
-	nerrs = check_index(relid, (BlockNumber) blkfrom, (BlockNumber) blkto, true);
+	scan_budget_reset();
+
+	nerrs = check_index(relid, (BlockNumber) blkfrom, (BlockNumber) blkto, true, false, NULL);
+
+	PG_RETURN_INT32(nerrs);
+}
+
+/*
+ * pg_check_resume
+ *
+ * Continues an interrupted check of a table (or an index) from the last saved
+ * cursor (see pg_check.checkpoint_blocks), returns number of warnings (issues
+ * found, including those found before the interruption).
+ */
+PG_FUNCTION_INFO_V1(pg_check_resume);
+
+Datum
+pg_check_resume(PG_FUNCTION_ARGS)
+{
+	Oid		relid = PG_GETARG_OID(0);
+	uint32	nerrs;
+	resume_cursor cursor;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 (errmsg("must be superuser to use pg_check functions"))));
+
+	if (!resume_load(relid, &cursor))
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("there is no interrupted check of \"%s\" to resume",
+						get_rel_name(relid))));
+
+	scan_budget_reset();
+
+	if (get_rel_relkind(relid) == RELKIND_INDEX) {
+		nerrs = check_index(relid, 0, 0, false, false, &cursor);
+	} else {
+		nerrs = check_table(relid, cursor.check_indexes, false, 0, 0, false, 0,
+							cursor.incremental, false, &cursor);
+	}
 
 	PG_RETURN_INT32(nerrs);
 }
 
 /*
- * check the table, acquires AccessShareLock
+ * pg_check_table_report
+ *
+ * Checks the selected table (and optionally the indexes), returns the issues
+ * found as rows (instead of reporting them as warnings).
+ */
+PG_FUNCTION_INFO_V1(pg_check_table_report);
+
+Datum
+pg_check_table_report(PG_FUNCTION_ARGS)
+{
+	Oid		relid	 = PG_GETARG_OID(0);
+	bool	checkIndexes = PG_GETARG_BOOL(1);
+	bool	crossCheckIndexes = PG_GETARG_BOOL(2);
+	check_findings findings;
+
+	findings_begin(fcinfo, &findings);
+
+	scan_budget_reset();
+
+	PG_TRY();
+	{
+		pgcheck_findings = &findings;
+
+		check_table(relid, checkIndexes, crossCheckIndexes, 0, 0, false, 0, false, false, NULL);
+	}
+	PG_CATCH();
+	{
+		pgcheck_findings = NULL;
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	pgcheck_findings = NULL;
+
+	return (Datum) 0;
+}
+
+/*
+ * pg_check_index_report
+ *
+ * Checks the selected index, returns the issues found as rows.
+ */
+PG_FUNCTION_INFO_V1(pg_check_index_report);
+
+Datum
+pg_check_index_report(PG_FUNCTION_ARGS)
+{
+	Oid		relid = PG_GETARG_OID(0);
+	check_findings findings;
+
+	findings_begin(fcinfo, &findings);
+
+	scan_budget_reset();
+
+	PG_TRY();
+	{
+		pgcheck_findings = &findings;
+
+		check_index(relid, 0, 0, false, false, NULL);
+	}
+	PG_CATCH();
+	{
+		pgcheck_findings = NULL;
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	pgcheck_findings = NULL;
+
+	return (Datum) 0;
+}
+
+/*
+ * prepare the tuplestore for the findings (materialize mode)
+ */
+static void
+findings_begin(FunctionCallInfo fcinfo, check_findings *findings)
+{
+	ReturnSetInfo  *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext	oldcontext;
+	TupleDesc		tupdesc;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	/* the tuplestore has to live until the end of the query */
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	memset(findings, 0, sizeof(check_findings));
+
+	findings->tupdesc = tupdesc;
+	findings->tupstore = tuplestore_begin_heap(true, false, work_mem);
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = findings->tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+}
+
+/*
+ * check the table, acquires AccessShareLock (ShareRowExclusiveLock when
+ * cross-checking, unless pg_check.online_cross_check is enabled)
+ *
+ * With nworkers > 0 the heap blocks are checked by background workers
+ * (the indexes are still checked by this backend).
+ *
+ * When checking the whole table, the WAL position is remembered if no
+ * issues are found, and with incremental = true pages not modified since
+ * the last such check are skipped (see incremental.h).
+ *
+ * With missingOk = true a relation dropped in the meantime is not an error
+ * (nothing is checked and 0 is returned).
+ *
+ * With a cursor (resumable check, without the cross-check and workers) the
+ * check continues from the cursor, and saves it every checkpoint_blocks
+ * blocks (see resume.h). The cursor is removed once the check completes.
  */
 static uint32
 check_table(Oid relid, bool checkIndexes, bool crossCheckIndexes,
-			BlockNumber blockFrom, BlockNumber blockTo, bool blockRangeGiven)
+			BlockNumber blockFrom, BlockNumber blockTo, bool blockRangeGiven,
+			int nworkers, bool incremental, bool missingOk, resume_cursor *cursor)
 {
 	Relation	rel;       /* relation for the 'relname' */
+	LOCKMODE	lockmode;  /* lock on the relation */
 	char	   *raw_page;  /* raw data of the page */
-	Buffer		buf;       /* buffer the page is read into */
 	uint32		nerrs = 0; /* number of errors found */
-	BlockNumber blkno;     /* current block */
-	PageHeader 	header;    /* page header */
 	BufferAccessStrategy strategy; /* bulk strategy to avoid polluting cache */
+	MemoryContext checkcontext;	/* everything allocated by the check */
+	MemoryContext oldcontext;
+
+	/* incremental checks (only when checking the whole table) */
+	bool		track_lsn = false;	/* remember the LSN after the check */
+	uint64		start_lsn = 0;		/* WAL position at the start */
+	uint64		skip_lsn = 0;		/* skip pages older than this */
+
+	bool		use_cache = false;	/* see result-cache.h */
 	
+	instr_time	start;
+
 	/* used to cross-check heap and indexes */
 	bool		bitmap_build = false;	/* true only when block range not given */
+	bool		sort_merge = false;		/* sorted TIDs instead of bitmaps */
 	item_bitmap *bitmap_heap = NULL;	/* bitmap data */
 	
 	if (!superuser())
@@ -185,115 +566,302 @@ check_table(Oid relid, bool checkIndexes, bool crossCheckIndexes,
 				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
 				 (errmsg("must be superuser to use pg_check functions"))));
 
+	/* might be left set by a check that failed with an ERROR */
+	pgcheck_quiet = false;
+
+	stats_reset();
+	sample_begin();
+
 	if (blockRangeGiven && checkIndexes) /* shouldn't happen */
 		elog(ERROR, "invalid combination of checkIndexes and a block range");
 
-	/* when cross-checking, a more restrictive lock mode is needed */
-	if (crossCheckIndexes) {
-		rel = relation_open(relid, ShareRowExclusiveLock);
+	/* the cross-check needs all the items from the table and the indexes */
+	if (crossCheckIndexes && sample_enabled())
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("cross-check can't be combined with sampling (pg_check.sample_percent)")));
+
+	/* when cross-checking, a more restrictive lock mode is needed (except
+	 * for the online cross-check, rechecking the differences at the end) */
+	if (crossCheckIndexes && !pgcheck_online_cross_check) {
+		lockmode = ShareRowExclusiveLock;
+	} else {
+		lockmode = AccessShareLock;
+	}
+
+	if (missingOk) {
+		rel = try_relation_open(relid, lockmode);
+
+		/* dropped since the caller got the OID */
+		if (rel == NULL) {
+			return 0;
+		}
 	} else {
-		rel = relation_open(relid, AccessShareLock);
+		rel = relation_open(relid, lockmode);
+	}
+
+	/* released at the end, so that checks of many relations (or of all
+	 * indexes of a table) don't accumulate memory */
+	checkcontext = check_context_create();
+	oldcontext = MemoryContextSwitchTo(checkcontext);
+
+	progress_start(relid);
+
+	/* the heap issues are reported for the table */
+	if (pgcheck_findings != NULL) {
+		pgcheck_findings->relid = relid;
 	}
 
 	/* Check that this relation has storage */
 	if (rel->rd_rel->relkind != RELKIND_RELATION &&
+		rel->rd_rel->relkind != RELKIND_MATVIEW &&
 		rel->rd_rel->relkind != RELKIND_TOASTVALUE)
 		ereport(ERROR,
 				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
 				 errmsg("object \"%s\" is not a table",
 						RelationGetRelationName(rel))));
 
-	/* Initialize buffer to copy to */
-	raw_page = (char *) palloc(BLCKSZ);
+	/* rewritten since the interrupted check, so start from the beginning */
+	if ((cursor != NULL) && OidIsValid(cursor->relfilenode) &&
+		(cursor->relfilenode != rel->rd_node.relNode)) {
+		elog(NOTICE, "table \"%s\" was rewritten since the interrupted check, checking all blocks",
+			 RelationGetRelationName(rel));
+		resume_init(cursor, relid, cursor->check_indexes, cursor->incremental);
+	}
+
+	if (cursor != NULL) {
+		cursor->relfilenode = rel->rd_node.relNode;
+	}
+
+	/* the page buffer and strategy are shared with the index checks */
+	check_scratch_init();
+
+	raw_page = scratch_page;
+	strategy = scratch_strategy;
 	
 	if (!blockRangeGiven)
 	{
 		blockFrom = 0;
 		blockTo = RelationGetNumberOfBlocks(rel);
 		
-		/* build the bitmap only when we need to cross-check */
-		if (crossCheckIndexes) {
-			/* FIXME this needs exclusive lock on the relation (and indexes) */
+		/* build the bitmap only when we need to cross-check (the sort method
+		 * reads the heap again when merging with the indexes) */
+		if (crossCheckIndexes && (pgcheck_cross_check_method == CROSS_CHECK_SORT)) {
+			sort_merge = true;
+		} else if (crossCheckIndexes) {
 			bitmap_build = true;
 			bitmap_heap  = bitmap_init(blockTo);
 		}
+
+		/* pages modified later than this may not be skipped next time (only
+		 * for incremental checks, and with sampling not all the pages are
+		 * checked) */
+		track_lsn = incremental && incremental_supported(rel) && !sample_enabled();
+		start_lsn = incremental_start();
+
+		if (incremental) {
+			skip_lsn = incremental_load(rel);
+		}
+
+		/* with only some checks of pages with a valid checksum, only continue
+		 * from an earlier check (the modified pages get all the checks) */
+		if (checksum_partial() && (skip_lsn == 0)) {
+			track_lsn = false;
+		}
+
+		/* continue the interrupted check (with the state of the heap check,
+		 * or skip the heap when the cursor points to an index already) */
+		if ((cursor != NULL) && ((cursor->block > 0) || OidIsValid(cursor->indexid))) {
+
+			if (OidIsValid(cursor->indexid)) {
+				blockFrom = blockTo;
+				track_lsn = false;
+			} else {
+				blockFrom = Min(cursor->block, blockTo);
+				track_lsn = cursor->track_lsn;
+				start_lsn = cursor->start_lsn;
+				skip_lsn = cursor->skip_lsn;
+
+				elog(NOTICE, "resuming check of table \"%s\" at block %u",
+					 RelationGetRelationName(rel), blockFrom);
+			}
+
+			nerrs = cursor->nerrs;
+		}
+
+		/* only the checks of the whole table, without the cross-check */
+		use_cache = (bitmap_heap == NULL) && !sort_merge && (nworkers == 0) &&
+					(blockFrom == 0) && result_cache_enabled(rel);
 	}
 
-	strategy = GetAccessStrategy(BAS_BULKREAD);
-		
-	/* Take a verbatim copy of each page, and check them */
-	for (blkno = blockFrom; blkno < blockTo; blkno++)
-	{
-		buf = ReadBufferExtended(rel, MAIN_FORKNUM, blkno, RBM_NORMAL, strategy);
-		LockBuffer(buf, BUFFER_LOCK_SHARE);
+	/* not modified since the last clean check, nothing to check */
+	if (use_cache && result_cache_valid(rel, strategy)) {
+		blockFrom = blockTo;
+	}
 
-		memcpy(raw_page, BufferGetPage(buf), BLCKSZ);
+	progress_phase(PROGRESS_PHASE_HEAP, InvalidOid, blockTo - blockFrom);
 
-		LockBuffer(buf, BUFFER_LOCK_UNLOCK);
-		ReleaseBuffer(buf);
-		
-		/* Call the 'check' routines - first just the header, then the tuples */
-		
-		header = (PageHeader)raw_page;
-		
-		nerrs += check_page_header(header, blkno);
-		
-		/* FIXME Does that make sense to check the tuples if the page header is corrupted? */
-		nerrs += check_heap_tuples(rel, header, raw_page, blkno);
+	if (nworkers > 0) {
+		nerrs += check_table_parallel(rel, blockFrom, blockTo, nworkers, skip_lsn);
+	} else if (cursor != NULL) {
+		BlockNumber	blkno = blockFrom;
+		BlockNumber	chunk = (pgcheck_checkpoint_blocks > 0) ?
+								pgcheck_checkpoint_blocks : MaxBlockNumber;
 
-		/* update the bitmap with items from this page (but only when needed) */
-		if (bitmap_build) {
-			bitmap_add_heap_items(bitmap_heap, header, raw_page, blkno);
+		Assert(bitmap_heap == NULL);
+
+		/* in chunks, saving the cursor after each one */
+		while ((blkno < blockTo) && !check_stop()) {
+
+			BlockNumber	next = (blockTo - blkno > chunk) ? blkno + chunk : blockTo;
+
+			nerrs += check_table_blocks(rel, blkno, next, strategy, raw_page,
+										NULL, skip_lsn);
+
+			/* stopped in the middle of the chunk, keep the previous cursor */
+			if (check_stop()) {
+				break;
+			}
+
+			blkno = next;
+
+			if (pgcheck_checkpoint_blocks > 0) {
+				cursor->block = blkno;
+				cursor->nerrs = nerrs;
+				cursor->track_lsn = track_lsn;
+				cursor->start_lsn = start_lsn;
+				cursor->skip_lsn = skip_lsn;
+
+				resume_save(cursor);
+			}
+		}
+	} else {
+		nerrs += check_table_blocks(rel, blockFrom, blockTo, strategy, raw_page,
+									bitmap_heap, skip_lsn);
+	}
+
+	/* the free space map (only after checking the whole table) */
+	if (!blockRangeGiven && (blockFrom == 0) && !check_stop()) {
+		nerrs += check_fsm(rel, strategy, raw_page);
+	}
+
+	/* the next incremental check may skip pages verified now (if all OK),
+	 * and any check finding issues invalidates the stored LSN */
+	if (nerrs > 0) {
+		incremental_forget(rel);
+	} else if (track_lsn) {
+		incremental_save(rel, start_lsn);
+	}
+
+	/* the same for the result cache */
+	if (use_cache) {
+		if (nerrs == 0) {
+			result_cache_store(rel, blockTo, start_lsn);
+		} else {
+			result_cache_forget(rel);
 		}
-		
 	}
 	
-	if (pgcheck_debug) {
+	if (pgcheck_debug && bitmap_build) {
 		bitmap_print(bitmap_heap, pgcheck_bitmap_format);
 	}
 	
-	/* check indexes */
-	if (checkIndexes) {
+	/* check indexes (unless the heap check stopped after max_errors issues,
+	 * in which case the cross-check would not make sense either) */
+	if (checkIndexes && !check_stop()) {
 		List	   *list_of_indexes;
 		ListCell   *index;
 		
 		item_bitmap * bitmap_idx = NULL;
 		
-		if (bitmap_build) {
+		if (bitmap_build && !pgcheck_multi_index) {
 			bitmap_idx = bitmap_copy(bitmap_heap);
+			bitmap_idx->collect_outside = pgcheck_online_cross_check;
 		}
 		
 		list_of_indexes = RelationGetIndexList(rel);
+
+		progress_indexes(list_length(list_of_indexes));
 		
-		foreach(index, list_of_indexes) {
+		/* all the indexes at once (single pass over the heap bitmap, or
+		 * a single merge with the heap) */
+		if (sort_merge || (bitmap_build && pgcheck_multi_index)) {
+			nerrs += check_indexes_multi(rel, list_of_indexes, bitmap_heap, blockTo,
+										 incremental);
+		} else {
+			foreach(index, list_of_indexes) {
+
+				if (check_stop()) {
+					break;
+				}
+
+				/* indexes not pointing to all the heap tuples just get
+				 * the index checks */
+				if (bitmap_build && !index_cross_check_supported(lfirst_oid(index))) {
+					nerrs += check_index_oid(lfirst_oid(index), NULL, incremental, NULL);
+					continue;
+				}
+
+				/* resumable check - skip the indexes checked before the
+				 * interruption (the indexes are sorted by OID) */
+				if (cursor != NULL) {
+
+					if (OidIsValid(cursor->indexid) && (lfirst_oid(index) < cursor->indexid)) {
+						continue;
+					}
+
+					cursor->nerrs = nerrs;
+				}
 			
-			/* reset the bitmap (if needed) */
-			if (bitmap_build) {
-				bitmap_reset(bitmap_idx);
-			}
+				/* reset the bitmap (if needed) */
+				if (bitmap_build) {
+					bitmap_reset(bitmap_idx);
+				}
 			
-			nerrs += check_index_oid(lfirst_oid(index), bitmap_idx);
+				nerrs += check_index_oid(lfirst_oid(index), bitmap_idx, incremental, cursor);
 			
-			/* evaluate the bitmap difference (if needed) */
-			if (bitmap_build) {
+				/* evaluate the bitmap difference (if needed, and unless the
+				 * index check stopped after max_errors issues) */
+				if (bitmap_build && !check_stop()) {
+				
+					/* compare the bitmaps (reports the differing items) */
+					bitmap_diff_arg diffarg;
+					uint64 ndiffs;
+
+					diff_arg_init(&diffarg, relid, lfirst_oid(index),
+								  get_rel_name(lfirst_oid(index)));
+
+					progress_phase(PROGRESS_PHASE_COMPARE, lfirst_oid(index), 0);
+
+					stats_start(&start);
+
+					ndiffs = bitmap_compare(bitmap_heap, bitmap_idx,
+											report_bitmap_diff, &diffarg);
+
+					/* check which differences are just concurrent changes */
+					if (diffarg.collect) {
+						ndiffs = online_recheck(rel, bitmap_idx, &diffarg);
+					}
+
+					stats_end(STATS_BITMAP_COMPARE, &start);
 				
-				/* compare the bitmaps */
-				int ndiffs = bitmap_compare(bitmap_heap, bitmap_idx);
+					if (pgcheck_debug) {
+						bitmap_print(bitmap_idx, pgcheck_bitmap_format);
+					}
 				
-				if (pgcheck_debug) {
-					bitmap_print(bitmap_idx, pgcheck_bitmap_format);
-				}
+					if ((ndiffs != 0) && (pgcheck_findings == NULL)) {
+						elog(WARNING, "there are " UINT64_FORMAT " differences between the table and the index", ndiffs);
+					}
+					nerrs += ndiffs;
+
+					pfree(diffarg.indexname);
 				
-				if (ndiffs != 0) {
-					elog(WARNING, "there are %d differences between the table and the index", ndiffs);
 				}
-				nerrs += ndiffs;
 				
 			}
-			
 		}
 		
-		if (bitmap_build) {
+		if (bitmap_idx != NULL) {
 			bitmap_free(bitmap_idx);
 		}
 
@@ -305,223 +873,1699 @@ check_table(Oid relid, bool checkIndexes, bool crossCheckIndexes,
 		bitmap_free(bitmap_heap);
 	}
 
-	FreeAccessStrategy(strategy);
-
-	if (crossCheckIndexes) {
-		relation_close(rel, ShareRowExclusiveLock);
-	} else {
-		relation_close(rel, AccessShareLock);
+	/* the resumable check completed (unless stopped after max_errors) */
+	if ((cursor != NULL) && !check_stop()) {
+		resume_forget(relid);
 	}
 
+	progress_end();
+
+	relation_close(rel, lockmode);
+
+	stats_finish();
+
+	MemoryContextSwitchTo(oldcontext);
+	MemoryContextDelete(checkcontext);
+
 	return nerrs;
 }
 
 /*
- * check the index, acquires AccessShareLock
- *
- * FIXME This shares an awful amount of code with check_index function, refactor.
- *
- * This is called only from check_table, so there is no reason to support of checking
- * only a part of the index.
+ * check the whole table (used when checking many relations, see database.c)
  */
-static uint32
-check_index_oid(Oid	indexOid, item_bitmap * bitmap)
+uint32
+check_table_relation(Oid relid, bool checkIndexes, bool crossCheckIndexes,
+					 bool incremental)
+{
+	return check_table(relid, checkIndexes, crossCheckIndexes, 0, 0, false, 0,
+					   incremental, true, NULL);
+}
+
+/*
+ * check a range of heap blocks (the relation is already locked)
+ */
+uint32
+check_table_blocks(Relation rel, BlockNumber blockFrom, BlockNumber blockTo,
+				   BufferAccessStrategy strategy, char *raw_page,
+				   item_bitmap *bitmap, uint64 skip_lsn)
 {
-	Relation	rel;       /* relation for the 'relname' */
-	char	   *raw_page;  /* raw data of the page */
 	Buffer		buf;       /* buffer the page is read into */
-	uint32      nerrs = 0; /* number of errors found */
+	uint32		nerrs = 0; /* number of errors found */
 	BlockNumber blkno;     /* current block */
-	BlockNumber maxblock;  /* number of blocks of a table */
 	PageHeader 	header;    /* page header */
-	BufferAccessStrategy strategy; /* bulk strategy to avoid polluting cache */
-	
-	if (!superuser())
-		ereport(ERROR,
-				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
-				 (errmsg("must be superuser to use pg_check functions"))));
-	
-	/* FIXME maybe we need more strict lock here */
-	if (bitmap != NULL) {
-		rel = index_open(indexOid, ShareRowExclusiveLock);
-	} else {
-		rel = index_open(indexOid, AccessShareLock);
+	bool		in_place = check_in_place();
+	bool		checksums = checksum_enabled();
+	bool		verified;  /* not modified since the last check */
+	bool		dirty;     /* the checksum is not up to date */
+	int			depth;     /* which checks to do (CHECK_DEPTH_*) */
+	block_scan	scan;
+	heap_layout *layout = heap_layout_build(rel);
+	vm_scan    *vm;        /* VM bits of the blocks (NULL if not checked) */
+	int			vm_issues; /* issues of the page with the VM bits */
+	uint64		roots[BITMAP_PAGE_WORDS];	/* items of a page checked in place */
+	instr_time	start;
+
+	block_scan_init(&scan, rel, MAIN_FORKNUM, blockFrom, blockTo, strategy);
+
+	/* the VM is checked along with the heap pages, see forks.h */
+	vm = vm_scan_begin(rel, blockFrom, blockTo, strategy);
+
+	/* the tuple checks collect the TOAST references, checked in batches */
+	if (pgcheck_check_toast) {
+		layout->toast = toast_refs_begin(rel);
 	}
 
-	/* Check that this relation has storage */
-	if (rel->rd_rel->relkind != RELKIND_INDEX)
-		ereport(ERROR,
-				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
-				 errmsg("object \"%s\" is not an index",
-						RelationGetRelationName(rel))));
-	
-	/* We only know how to check b-tree indexes, so ignore anything else */
-	if (rel->rd_rel->relam != BTREE_AM_OID)
-	{
-		relation_close(rel, AccessShareLock);
-		return 0;
+	/* most blocks are not read at all, so don't prefetch them */
+	if (sample_skip_unsampled()) {
+		scan.distance = 0;
 	}
 
-	elog(NOTICE, "checking index: %s", RelationGetRelationName(rel));
+	/* Take a verbatim copy of each page, and check them */
+	for (blkno = blockFrom; blkno < blockTo; blkno++)
+	{
+		char   *page;
+		bool	sampled = sample_block(blkno);
 
-	/* Initialize buffer to copy to */
-	raw_page = (char *) palloc(BLCKSZ);
+		/* the batch of TOAST references is full (not while holding the
+		 * buffer lock, as that means scanning the TOAST relation) */
+		if ((layout->toast != NULL) && toast_refs_full(layout->toast)) {
+			nerrs += toast_refs_check(layout->toast);
+		}
 
-	strategy = GetAccessStrategy(BAS_BULKREAD);
+		/* room for the references of the page (which may be checked while
+		 * the buffer is locked, without allocating memory) */
+		if (layout->toast != NULL) {
+			toast_refs_reserve(layout->toast);
+		}
 
-	/* Take a verbatim copies of the pages and check them */
-	maxblock = RelationGetNumberOfBlocks(rel);
-	for (blkno = 0; blkno < maxblock; blkno++)
-	{
-		buf = ReadBufferExtended(rel, MAIN_FORKNUM, blkno, RBM_NORMAL, strategy);
+		if (check_stop()) {
+			break;
+		}
+
+		if (!sampled && sample_skip_unsampled()) {
+			progress_blocks(1);
+			continue;
+		}
+
+		pgcheck_stats.pages++;
+
+		/* the VM pages are read in batches, not while holding the lock */
+		if (vm != NULL) {
+			nerrs += vm_scan_load(vm, blkno);
+		}
+
+		buf = block_scan_read(&scan, blkno);
 		LockBuffer(buf, BUFFER_LOCK_SHARE);
 
-		memcpy(raw_page, BufferGetPage(buf), BLCKSZ);
+		page = (char *) BufferGetPage(buf);
+		verified = page_is_verified(page, skip_lsn);
+
+		/* compare the VM bits while the page is locked (even when the page
+		 * itself is not checked), report once it's unlocked */
+		vm_issues = ((vm != NULL) && sampled) ? vm_scan_page(vm, blkno, page) : 0;
+
+		/* page not modified since the last check (or clean page checked
+		 * in place), no need to copy it - unless verifying the checksums,
+		 * which may fail on unmodified pages too */
+		if ((verified && !checksums) ||
+			(in_place && sampled && (check_heap_page_quiet(rel, layout, page, blkno) == 0))) {
+
+			int		ntuples = 0;
+
+			/* only collect the items while the page is locked, the bitmap
+			 * may need to allocate memory (or report an issue) */
+			if (bitmap != NULL) {
+				stats_start(&start);
+				ntuples = bitmap_heap_roots((PageHeader) page, page, roots);
+				stats_end(STATS_BITMAP_BUILD, &start);
+			}
+
+			LockBuffer(buf, BUFFER_LOCK_UNLOCK);
+			ReleaseBuffer(buf);
+
+			if (bitmap != NULL) {
+				stats_start(&start);
+				nerrs += bitmap_add_heap_roots(bitmap, blkno, roots, ntuples);
+				stats_end(STATS_BITMAP_BUILD, &start);
+			}
+
+			if (vm_issues != 0) {
+				nerrs += vm_scan_report(vm, blkno, vm_issues);
+			}
+
+			progress_blocks(1);
+			continue;
+		}
+
+		dirty = checksums && checksum_buffer_dirty(buf);
+
+		stats_start(&start);
+		memcpy(raw_page, page, BLCKSZ);
+		stats_end(STATS_COPY, &start);
 
 		LockBuffer(buf, BUFFER_LOCK_UNLOCK);
 		ReleaseBuffer(buf);
+
+		if (vm_issues != 0) {
+			nerrs += vm_scan_report(vm, blkno, vm_issues);
+		}
+
+		progress_blocks(1);
+
+		/* the tuples only on the sampled pages (all pages without sampling) */
+		depth = sampled ? CHECK_DEPTH_FULL : CHECK_DEPTH_HEADER;
+
+		if (checksums) {
+			depth = page_check_depth(rel, raw_page, blkno, dirty, verified,
+									 (skip_lsn != 0), depth, &nerrs);
+		}
 		
-		/* Call the 'check' routines - first just the header, then the contents. */
+		/* Call the 'check' routines - first just the header, then the tuples */
 		
 		header = (PageHeader)raw_page;
 		
-		nerrs += check_index_page(rel, header, raw_page, blkno);
-		
-		if (blkno > 0) {
-		
-			/* FIXME Does that make sense to check the tuples if the page header is corrupted? */
-			nerrs += check_index_tuples(rel, header, raw_page, blkno);
-			
-			/* if this is a leaf page (containing actual pointers to the heap),
-			   then update the bitmap */
-			if ((bitmap != NULL) && P_ISLEAF(BTPageGetOpaque(raw_page))) {
-				nerrs += bitmap_add_index_items(bitmap, header, raw_page, blkno);
-			}
-			
+		if (depth >= CHECK_DEPTH_HEADER) {
+			stats_start(&start);
+			nerrs += check_page_header(header, blkno);
+			stats_end(STATS_HEADER, &start);
+		}
+
+		/* FIXME Does that make sense to check the tuples if the page header is corrupted? */
+		if (depth == CHECK_DEPTH_FULL) {
+			stats_start(&start);
+			nerrs += check_heap_tuples(rel, layout, header, raw_page, blkno);
+			stats_end(STATS_TUPLES, &start);
+		}
+
+		/* update the bitmap with items from this page (but only when needed) */
+		if (bitmap != NULL) {
+			stats_start(&start);
+			bitmap_add_heap_items(bitmap, header, raw_page, blkno);
+			stats_end(STATS_BITMAP_BUILD, &start);
 		}
 		
 	}
 
-	FreeAccessStrategy(strategy);
+	if (layout->toast != NULL) {
+		nerrs += toast_refs_end(layout->toast);
+	}
 
-	if (bitmap != NULL) {
-		relation_close(rel, ShareRowExclusiveLock);
-	} else {
-		relation_close(rel, AccessShareLock);
+	if (vm != NULL) {
+		nerrs += vm_scan_end(vm);
 	}
 
+	heap_layout_free(layout);
+
 	return nerrs;
 }
 
 /*
- * check the index, acquires AccessShareLock
+ * open the index for checking (the pages are then checked by index_check_blocks)
+ *
+ * With a bitmap (or a sort) the index is locked in ShareRowExclusiveLock mode
+ * (cross-check), otherwise (or in the online cross-check) AccessShareLock is
+ * enough. Returns NULL for indexes we don't know how to check (access methods
+ * without an index_am_check) when skipUnknown is true, otherwise fails with an ERROR.
  */
-static uint32
-check_index(Oid indexOid, BlockNumber blockFrom, BlockNumber blockTo,
-			bool blockRangeGiven)
+static index_check_state *
+index_check_open(Oid indexOid, item_bitmap * bitmap, tid_sort * sort,
+				 bool skipUnknown, bool incremental)
 {
-	Relation	rel;       /* relation for the 'relname' */
-	char	   *raw_page;  /* raw data of the page */
-	Buffer		buf;       /* buffer the page is read into */
-	uint32      nerrs = 0; /* number of errors found */
-	BlockNumber blkno;     /* current block */
-	PageHeader 	header;    /* page header */
-	BufferAccessStrategy strategy; /* bulk strategy to avoid polluting cache */
+	index_check_state *state;
+	Relation	rel;
+	LOCKMODE	lockmode;
+	const index_am_check *am = NULL;
 
 	if (!superuser())
 		ereport(ERROR,
 				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
 				 (errmsg("must be superuser to use pg_check functions"))));
 
-	/* FIXME A more strict lock might be more appropriate. */
-	rel = relation_open(indexOid, AccessShareLock);
+	lockmode = ((bitmap != NULL || sort != NULL) && !pgcheck_online_cross_check) ?
+					ShareRowExclusiveLock : AccessShareLock;
+
+	rel = relation_open(indexOid, lockmode);
 
-	/* Check that this relation is a b-tree index */
-	if ((rel->rd_rel->relkind != RELKIND_INDEX) || (rel->rd_rel->relam != BTREE_AM_OID)) {
+	/* Check that this relation has storage */
+	if (skipUnknown && (rel->rd_rel->relkind != RELKIND_INDEX))
 		ereport(ERROR,
 				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
-				 errmsg("object \"%s\" is not a b-tree index",
+				 errmsg("object \"%s\" is not an index",
 						RelationGetRelationName(rel))));
+
+	if (rel->rd_rel->relkind == RELKIND_INDEX)
+		am = index_am_lookup(rel->rd_rel->relam);
+
+	/* We only know how to check some index types, so ignore anything else */
+	if (am == NULL)
+	{
+		if (!skipUnknown)
+			ereport(ERROR,
+					(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+					 errmsg("object \"%s\" is not a b-tree, GIN, GiST, hash or BRIN index",
+							RelationGetRelationName(rel))));
+
+		relation_close(rel, lockmode);
+		return NULL;
 	}
 
-	/* Initialize buffer to copy to */
-	raw_page = (char *) palloc(BLCKSZ);
-	
-	/* Take a verbatim copies of the pages and check them */
-	if (!blockRangeGiven) {
-		blockFrom = 0;
-		blockTo = RelationGetNumberOfBlocks(rel);
+	/* the following issues are reported for the index */
+	if (pgcheck_findings != NULL) {
+		pgcheck_findings->relid = indexOid;
 	}
 
-	strategy = GetAccessStrategy(BAS_BULKREAD);
+	state = (index_check_state *) palloc0(sizeof(index_check_state));
 
-	for (blkno = blockFrom; blkno < blockTo; blkno++)
+	state->rel = rel;
+	state->am = am;
+	state->lockmode = lockmode;
+	state->bitmap = bitmap;
+	state->sort = sort;
+
+	/* the buffers are shared by all the indexes (even when checking them
+	 * at once, the page and TIDs are used only while checking the page) */
+	check_scratch_init();
+
+	/* the cross-check adds the TIDs of each page at once */
+	if (bitmap != NULL || sort != NULL)
+		state->tids = scratch_tids;
+	state->in_place = check_in_place();
+	state->online = (bitmap != NULL || sort != NULL) && pgcheck_online_cross_check;
+
+	state->raw_page = scratch_page;
+	state->strategy = scratch_strategy;
+
+	/* the whole index by default */
+	index_check_range(state, 0, RelationGetNumberOfBlocks(rel));
+
+	/* pages modified later than this may not be skipped next time (only
+	 * for incremental checks, and with sampling not all the pages are
+	 * checked) */
+	state->track_lsn = incremental && incremental_supported(rel) && !sample_enabled();
+	state->start_lsn = incremental_start();
+
+	if (incremental) {
+		state->skip_lsn = incremental_load(rel);
+	}
+
+	/* with only some checks of pages with a valid checksum, only continue
+	 * from an earlier check (the modified pages get all the checks) */
+	if (checksum_partial() && (state->skip_lsn == 0)) {
+		state->track_lsn = false;
+	}
+
+	/* only the checks of the whole index, without the cross-check */
+	state->cache = (bitmap == NULL) && (sort == NULL) && result_cache_enabled(rel);
+
+	return state;
+}
+
+/*
+ * restrict the check to blocks [blockFrom, blockTo) of the index
+ */
+static void
+index_check_range(index_check_state *state, BlockNumber blockFrom, BlockNumber blockTo)
+{
+	state->blkno = blockFrom;
+	state->blockTo = blockTo;
+
+	/* only checks of the whole index are incremental (and cached) */
+	state->track_lsn = false;
+	state->skip_lsn = 0;
+	state->cache = false;
+
+	block_scan_init(&state->scan, state->rel, MAIN_FORKNUM, blockFrom, blockTo,
+					state->strategy);
+}
+
+/*
+ * check up to nblocks following blocks of the index, returns true if there
+ * are more blocks to check
+ */
+static bool
+index_check_blocks(index_check_state *state, BlockNumber nblocks)
+{
+	Relation	rel = state->rel;
+	const index_am_check *am = state->am;
+	char	   *raw_page = state->raw_page;
+	item_bitmap *bitmap = state->bitmap;
+	Buffer		buf;       /* buffer the page is read into */
+	PageHeader 	header;    /* page header */
+	BlockNumber blkno;     /* current block */
+	BlockNumber blockTo;   /* last block to check in this call */
+	bool		checksums = checksum_enabled();
+	bool		verified;  /* not modified since the last check */
+	bool		dirty;     /* the checksum is not up to date */
+	int			depth;     /* which checks to do (CHECK_DEPTH_*) */
+	instr_time	start;
+
+	if (state->blkno >= state->blockTo)
+		return false;
+
+	/* don't overflow the block number with large nblocks */
+	blockTo = (state->blockTo - state->blkno > nblocks) ?
+					state->blkno + nblocks : state->blockTo;
+
+	/* Take a verbatim copies of the pages and check them */
+	for (blkno = state->blkno; blkno < blockTo; blkno++)
 	{
-		buf = ReadBufferExtended(rel, MAIN_FORKNUM, blkno, RBM_NORMAL, strategy);
+		char   *page;
+		bool	sampled = (blkno == 0) || sample_block(blkno);
+
+		if (check_stop()) {
+			break;
+		}
+
+		if (!sampled && sample_skip_unsampled()) {
+			continue;
+		}
+
+		pgcheck_stats.pages++;
+
+		buf = block_scan_read(&state->scan, blkno);
 		LockBuffer(buf, BUFFER_LOCK_SHARE);
 
-		memcpy(raw_page, BufferGetPage(buf), BLCKSZ);
+		page = (char *) BufferGetPage(buf);
+		verified = page_is_verified(page, state->skip_lsn);
+
+		/* page not modified since the last check (or clean page checked
+		 * in place), no need to copy it - unless verifying the checksums */
+		if ((verified && !checksums) ||
+			(state->in_place && sampled && (check_index_page_quiet(am, rel, page, blkno) == 0))) {
+
+			int		ntids = 0;
+
+			/* only collect the TIDs while the page is locked (into the
+			 * scratch buffer), the bitmap or the sort may need to allocate
+			 * memory (or report an issue) */
+			if (bitmap != NULL || state->sort != NULL) {
+				ntids = index_check_page_tids(state, page, blkno);
+			}
+
+			LockBuffer(buf, BUFFER_LOCK_UNLOCK);
+			ReleaseBuffer(buf);
+
+			if (ntids > 0) {
+				index_check_add_tids(state, ntids);
+			}
+			continue;
+		}
+
+		dirty = checksums && checksum_buffer_dirty(buf);
+
+		stats_start(&start);
+		memcpy(raw_page, page, BLCKSZ);
+		stats_end(STATS_COPY, &start);
 
 		LockBuffer(buf, BUFFER_LOCK_UNLOCK);
 		ReleaseBuffer(buf);
+
+		/* the items only on the sampled pages (all pages without sampling) */
+		depth = sampled ? CHECK_DEPTH_FULL : CHECK_DEPTH_HEADER;
+
+		if (checksums) {
+			depth = page_check_depth(rel, raw_page, blkno, dirty, verified,
+									 (state->skip_lsn != 0), depth, &state->nerrs);
+		}
 		
 		/* Call the 'check' routines - first just the header, then the contents. */
 		
 		header = (PageHeader)raw_page;
 		
-		nerrs += check_index_page(rel, header, raw_page, blkno);
+		if (depth >= CHECK_DEPTH_HEADER) {
+			stats_start(&start);
+			state->nerrs += am->check_page(rel, header, raw_page, blkno);
+			stats_end(STATS_INDEX, &start);
+		}
+		
+		if (sampled) {
 		
-		if (blkno > 0) {
-			
 			/* FIXME Does that make sense to check the tuples if the page header is corrupted? */
-			nerrs += check_index_tuples(rel, header, raw_page, blkno);
+			if (depth == CHECK_DEPTH_FULL) {
+				stats_start(&start);
+				state->nerrs += am->check_tuples(rel, header, raw_page, blkno);
+				stats_end(STATS_INDEX, &start);
+			}
+			
+			/* if this is a leaf page (containing actual pointers to the heap),
+			   then update the bitmap (or the sort) */
+			if (bitmap != NULL || state->sort != NULL) {
+				index_check_add_tids(state, index_check_page_tids(state, raw_page, blkno));
+			}
 			
 		}
 		
 	}
 
-	FreeAccessStrategy(strategy);
+	/* stopped after pg_check.max_errors issues, skip the rest (and don't
+	 * remember the LSN, as not all pages were checked) */
+	if (blkno < blockTo) {
+		state->blockTo = blockTo = blkno;
+		state->track_lsn = false;
+	}
 
-	relation_close(rel, AccessShareLock);
+	progress_blocks(blockTo - state->blkno);
+
+	state->blkno = blockTo;
+
+	/* in the online cross-check, the pages added by concurrent page splits
+	 * (which may contain items moved from pages not checked yet) need to
+	 * be checked too */
+	if (state->online && (state->blkno == state->blockTo) && !check_stop()) {
+
+		BlockNumber	nblocks = RelationGetNumberOfBlocks(rel);
+
+		if (nblocks > state->blockTo) {
+			block_scan_init(&state->scan, rel, MAIN_FORKNUM, state->blockTo, nblocks,
+							state->strategy);
+			state->blockTo = nblocks;
+		}
+	}
+
+	return (state->blkno < state->blockTo);
+}
+
+/*
+ * check all the remaining blocks of the index, in chunks (so that the progress
+ * is updated regularly)
+ *
+ * In a resumable check (cursor not NULL) this continues the interrupted check
+ * of the index (unless it was rebuilt since then), and saves the cursor every
+ * pg_check.checkpoint_blocks blocks. The cursor nerrs are the issues found
+ * before (they're added to the saved cursors, but not modified).
+ */
+static void
+index_check_run(index_check_state *state, resume_cursor *cursor)
+{
+	Oid			indexOid = RelationGetRelid(state->rel);
+	BlockNumber	saved;
+	resume_cursor checkpoint;
+
+	if (cursor != NULL) {
+
+		if ((cursor->indexid == indexOid) &&
+			(cursor->index_relfilenode == state->rel->rd_node.relNode)) {
+
+			if (cursor->block > 0) {
+				elog(NOTICE, "resuming check of index \"%s\" at block %u",
+					 RelationGetRelationName(state->rel), cursor->block);
+			}
+
+			index_check_range(state, Min(cursor->block, state->blockTo), state->blockTo);
+
+			/* reset by index_check_range */
+			state->track_lsn = cursor->track_lsn;
+			state->start_lsn = cursor->start_lsn;
+			state->skip_lsn = cursor->skip_lsn;
+		} else {
+			cursor->indexid = indexOid;
+			cursor->index_relfilenode = state->rel->rd_node.relNode;
+			cursor->block = 0;
+		}
+	}
+
+	saved = state->blkno;
+
+	progress_phase(PROGRESS_PHASE_INDEX, indexOid, state->blockTo - state->blkno);
+
+	/* not modified since the last clean check, nothing to check (the
+	 * check is remembered again, with the current WAL position) */
+	if (state->cache && result_cache_valid(state->rel, state->strategy)) {
+		progress_blocks(state->blockTo - state->blkno);
+		state->blkno = state->blockTo;
+		return;
+	}
+
+	while (index_check_blocks(state, INDEX_CHECK_CHUNK)) {
+
+		if ((cursor != NULL) && (pgcheck_checkpoint_blocks > 0) &&
+			(state->blkno - saved >= pgcheck_checkpoint_blocks)) {
+
+			checkpoint = *cursor;
+
+			checkpoint.block = state->blkno;
+			checkpoint.nerrs += state->nerrs;
+			checkpoint.track_lsn = state->track_lsn;
+			checkpoint.start_lsn = state->start_lsn;
+			checkpoint.skip_lsn = state->skip_lsn;
+
+			resume_save(&checkpoint);
+
+			saved = state->blkno;
+		}
+	}
+}
+
+/*
+ * collect the heap TIDs referenced from the page into state->tids (may be
+ * called while holding the buffer lock), returns the number of TIDs
+ */
+static int
+index_check_page_tids(index_check_state *state, char *page, BlockNumber blkno)
+{
+	int			ntids;
+	instr_time	start;
+
+	stats_start(&start);
+
+	ntids = state->am->page_tids(page, blkno, state->tids);
+
+	stats_end(STATS_BITMAP_BUILD, &start);
+
+	return ntids;
+}
+
+/*
+ * add the heap TIDs collected by index_check_page_tids to the bitmap (or
+ * the sort), all at once
+ */
+static void
+index_check_add_tids(index_check_state *state, int ntids)
+{
+	instr_time	start;
+
+	stats_start(&start);
+
+	if (state->bitmap != NULL) {
+
+		/* TIDs outside the heap bitmap are heap TIDs, so reported for the
+		 * table (the same as the differences found by bitmap_compare) */
+		if (pgcheck_findings != NULL) {
+			pgcheck_findings->relid = state->rel->rd_index->indrelid;
+			pgcheck_findings->indexrelid = RelationGetRelid(state->rel);
+		}
+
+		state->nerrs += bitmap_add_tids(state->bitmap, state->tids, ntids);
+
+		if (pgcheck_findings != NULL) {
+			pgcheck_findings->relid = RelationGetRelid(state->rel);
+			pgcheck_findings->indexrelid = InvalidOid;
+		}
+	}
+
+	if (state->sort != NULL) {
+		tid_sort_add_tids(state->sort, state->tids, ntids);
+	}
+
+	stats_end(STATS_BITMAP_BUILD, &start);
+}
+
+/*
+ * finish the index check (releases the lock), returns number of issues found
+ */
+static uint32
+index_check_close(index_check_state *state)
+{
+	uint32	nerrs = state->nerrs;
+
+	/* the next incremental check may skip pages verified now (if all OK),
+	 * and any check finding issues invalidates the stored LSN */
+	if (nerrs > 0) {
+		incremental_forget(state->rel);
+	} else if (state->track_lsn) {
+		incremental_save(state->rel, state->start_lsn);
+	}
+
+	/* the same for the result cache (only when all the pages were checked) */
+	if (state->cache && (state->blkno == state->blockTo)) {
+		if ((nerrs == 0) && !check_stop()) {
+			result_cache_store(state->rel, state->blockTo, state->start_lsn);
+		} else {
+			result_cache_forget(state->rel);
+		}
+	}
+
+	relation_close(state->rel, state->lockmode);
+
+	pfree(state);
 
 	return nerrs;
 }
 
 /*
- * Module load callback
+ * check the index, acquires AccessShareLock
+ *
+ * This is called only from check_table, so there is no reason to support of checking
+ * only a part of the index (except for continuing a resumable check).
  */
-void
-_PG_init(void)
+static uint32
+check_index_oid(Oid	indexOid, item_bitmap * bitmap, bool incremental, resume_cursor *cursor)
 {
-    
-    /* Define custom GUC variables. */
-    DefineCustomBoolVariable("pg_check.debug",
-                              "print debugging info.",
-                             NULL,
-                             &pgcheck_debug,
-                             false,
-                             PGC_SUSET,
-                             0,
-#if (PG_VERSION_NUM >= 90100)
-                             NULL,
-#endif
-                             NULL,
-                             NULL);
+	index_check_state *state = index_check_open(indexOid, bitmap, NULL, true, incremental);
 
-    DefineCustomEnumVariable("pg_check.bitmap_format",
-                             "how to print bitmap when debugging",
-                             NULL,
-                             &pgcheck_bitmap_format,
-                             BITMAP_BINARY,
-                             bitmap_options,
-                             PGC_SUSET,
-                             0,
-#if (PG_VERSION_NUM >= 90100)
-                             NULL,
-#endif
-                             NULL,
-                             NULL);
+	if (state == NULL)
+		return 0;
 
-    EmitWarningsOnPlaceholders("pg_check");
+	elog(NOTICE, "checking index: %s", RelationGetRelationName(state->rel));
+
+	index_check_run(state, cursor);
+
+	return index_check_close(state);
+}
+
+/*
+ * check and cross-check all the indexes in a single pass
+ *
+ * The indexes are scanned at the same time, INDEX_CHECK_CHUNK blocks from
+ * each index in turn, each one filling its own bitmap. The bitmaps are then
+ * compared to the heap bitmap at once, reading the heap bitmap only once.
+ *
+ * Without the heap bitmap (pg_check.cross_check_method = sort), the TIDs
+ * of each index are sorted instead (sharing maintenance_work_mem, spilling
+ * to disk when needed), and then merged with a single scan of the heap.
+ */
+static uint32
+check_indexes_multi(Relation heap, List *indexes, item_bitmap * bitmap_heap,
+					BlockNumber nblocks, bool incremental)
+{
+	int			nindexes = 0;
+	int			i;
+	bool		pending = true;
+	uint32		nerrs = 0;
+	ListCell   *index;
+	int			sort_mem;
+	BlockNumber	nblocks_indexes = 0;
+	instr_time	start;
+
+	index_check_state **states;
+	item_bitmap	**bitmaps;
+	tid_sort  **sorts;
+	bitmap_diff_arg *diffargs;
+	void	  **args;
+	uint64	   *ndiffs;
+
+	states = (index_check_state **) palloc(sizeof(index_check_state *) * list_length(indexes));
+	bitmaps = (item_bitmap **) palloc0(sizeof(item_bitmap *) * list_length(indexes));
+	sorts = (tid_sort **) palloc0(sizeof(tid_sort *) * list_length(indexes));
+	diffargs = (bitmap_diff_arg *) palloc(sizeof(bitmap_diff_arg) * list_length(indexes));
+	args = (void **) palloc(sizeof(void *) * list_length(indexes));
+	ndiffs = (uint64 *) palloc0(sizeof(uint64) * list_length(indexes));
+
+	/* the sorts share the memory (but at least 64kB each) */
+	sort_mem = Max(64, maintenance_work_mem / Max(1, list_length(indexes)));
+
+	foreach(index, indexes) {
+
+		item_bitmap *bitmap = NULL;
+		tid_sort   *sort = NULL;
+		index_check_state *state;
+
+		/* indexes not pointing to all the heap tuples just get the index
+		 * checks (separately) */
+		if (!index_cross_check_supported(lfirst_oid(index))) {
+			nerrs += check_index_oid(lfirst_oid(index), NULL, incremental, NULL);
+			continue;
+		}
+
+		if (bitmap_heap != NULL) {
+			bitmap = bitmap_copy(bitmap_heap);
+			bitmap->collect_outside = pgcheck_online_cross_check;
+		} else {
+			sort = tid_sort_begin(sort_mem);
+		}
+
+		state = index_check_open(lfirst_oid(index), bitmap, sort, true,
+								 incremental);
+
+		if (state == NULL) {
+			if (bitmap != NULL) {
+				bitmap_free(bitmap);
+			} else {
+				tid_sort_end(sort);
+			}
+			continue;
+		}
+
+		elog(NOTICE, "checking index: %s", RelationGetRelationName(state->rel));
+
+		states[nindexes] = state;
+		bitmaps[nindexes] = bitmap;
+		sorts[nindexes] = sort;
+		diff_arg_init(&diffargs[nindexes], RelationGetRelid(heap), lfirst_oid(index),
+					  pstrdup(RelationGetRelationName(state->rel)));
+		args[nindexes] = &diffargs[nindexes];
+		nindexes++;
+	}
+
+	/* all the indexes at once (so no index OID) */
+	for (i = 0; i < nindexes; i++) {
+		nblocks_indexes += states[i]->blockTo;
+	}
+
+	progress_phase(PROGRESS_PHASE_INDEX, InvalidOid, nblocks_indexes);
+
+	/* interleave the scans, until all the indexes are checked */
+	while (pending) {
+
+		pending = false;
+
+		for (i = 0; i < nindexes; i++) {
+			if (index_check_blocks(states[i], INDEX_CHECK_CHUNK)) {
+				pending = true;
+			}
+		}
+	}
+
+	for (i = 0; i < nindexes; i++) {
+		nerrs += index_check_close(states[i]);
+	}
+
+	/* compare all the bitmaps (or merge all the sorts) at once, reports
+	 * the differing items */
+	progress_phase(PROGRESS_PHASE_COMPARE, InvalidOid,
+				   (bitmap_heap != NULL) ? 0 : nblocks);
+
+	stats_start(&start);
+
+	if ((nindexes == 0) || check_stop()) {
+		/* nothing to compare (or the index checks were stopped) */
+	} else if (bitmap_heap != NULL) {
+		bitmap_compare_multi(bitmap_heap, bitmaps, nindexes, ndiffs,
+							 report_bitmap_diff, args);
+	} else {
+		tid_sort_merge(heap, nblocks, sorts, nindexes, ndiffs,
+					   report_bitmap_diff, args);
+	}
+
+	/* check which differences are just concurrent changes */
+	for (i = 0; i < nindexes; i++) {
+		if (diffargs[i].collect) {
+			/* the unconfirmed differences are not issues */
+			ndiffs[i] = check_stop() ? 0 : online_recheck(heap, bitmaps[i], &diffargs[i]);
+		}
+	}
+
+	stats_end(STATS_BITMAP_COMPARE, &start);
+
+	for (i = 0; i < nindexes; i++) {
+
+		if (pgcheck_debug && (bitmaps[i] != NULL)) {
+			bitmap_print(bitmaps[i], pgcheck_bitmap_format);
+		}
+
+		if ((ndiffs[i] != 0) && (pgcheck_findings == NULL)) {
+			elog(WARNING, "there are " UINT64_FORMAT " differences between the table and the index \"%s\"",
+				 ndiffs[i], diffargs[i].indexname);
+		}
+		nerrs += ndiffs[i];
+
+		if (bitmaps[i] != NULL) {
+			bitmap_free(bitmaps[i]);
+		}
+
+		if (sorts[i] != NULL) {
+			tid_sort_end(sorts[i]);
+		}
+
+		pfree(diffargs[i].indexname);
+	}
+
+	pfree(states);
+	pfree(bitmaps);
+	pfree(sorts);
+	pfree(diffargs);
+	pfree(args);
+	pfree(ndiffs);
+
+	return nerrs;
+}
+
+/*
+ * check the index, acquires AccessShareLock (and ShareLock for the check
+ * of the tree structure, to prevent concurrent page splits)
+ */
+static uint32
+check_index(Oid indexOid, BlockNumber blockFrom, BlockNumber blockTo,
+			bool blockRangeGiven, bool checkStructure, resume_cursor *cursor)
+{
+	index_check_state *state;
+	uint32		nerrs;
+	MemoryContext checkcontext;	/* everything allocated by the check */
+	MemoryContext oldcontext;
+
+	/* might be left set by a check that failed with an ERROR */
+	pgcheck_quiet = false;
+
+	stats_reset();
+	sample_begin();
+
+	checkcontext = check_context_create();
+	oldcontext = MemoryContextSwitchTo(checkcontext);
+
+	/* FIXME A more strict lock might be more appropriate. */
+	state = index_check_open(indexOid, NULL, NULL, false, false);
+
+	if (checkStructure && (state->rel->rd_rel->relam != BTREE_AM_OID))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("structure of \"%s\" can't be checked, only b-tree indexes are supported",
+						RelationGetRelationName(state->rel))));
+
+	if (blockRangeGiven) {
+		index_check_range(state, blockFrom, blockTo);
+	}
+
+	progress_start(indexOid);
+	progress_indexes(1);
+
+	index_check_run(state, cursor);
+
+	/* issues found before the interruption */
+	nerrs = (cursor != NULL) ? cursor->nerrs : 0;
+
+	nerrs += index_check_close(state);
+
+	/* the resumable check completed (unless stopped after max_errors) */
+	if ((cursor != NULL) && !check_stop()) {
+		resume_forget(indexOid);
+	}
+
+	if (checkStructure && !check_stop())
+	{
+		Relation	rel = index_open(indexOid, ShareLock);
+
+		progress_phase(PROGRESS_PHASE_STRUCTURE, InvalidOid,
+					   RelationGetNumberOfBlocks(rel));
+
+		nerrs += check_btree_structure(rel, scratch_strategy);
+
+		index_close(rel, ShareLock);
+	}
+
+	progress_end();
+
+	stats_finish();
+
+	MemoryContextSwitchTo(oldcontext);
+	MemoryContextDelete(checkcontext);
+
+	return nerrs;
+}
+
+/*
+ * report an item that is in the heap but not in the index (or vice versa),
+ * called by bitmap_compare (arg is the bitmap_diff_arg of the index)
+ */
+static bool
+report_bitmap_diff(BlockNumber page, int item, bool in_heap, void *arg)
+{
+	bitmap_diff_arg *diffarg = (bitmap_diff_arg *) arg;
+
+	/* online cross-check, recheck the item first (see online_recheck) */
+	if (diffarg->collect) {
+		cross_diff_add(diffarg, page, (OffsetNumber) (item+1), in_heap);
+		return true;
+	}
+
+	/* the TIDs are heap TIDs, so reported for the table (with the index
+	 * in a separate column) */
+	if (pgcheck_findings != NULL) {
+		pgcheck_findings->relid = diffarg->heapOid;
+		pgcheck_findings->indexrelid = diffarg->indexOid;
+	}
+
+	if (in_heap) {
+		check_report(WARNING, page, (item+1), "missing_in_index",
+					 "item is in the table, but not in the index \"%s\"",
+					 diffarg->indexname);
+	} else {
+		check_report(WARNING, page, (item+1), "missing_in_table",
+					 "item is in the index \"%s\", but not in the table",
+					 diffarg->indexname);
+	}
+
+	if (pgcheck_findings != NULL) {
+		pgcheck_findings->indexrelid = InvalidOid;
+	}
+
+	return true;
+}
+
+/*
+ * prepare the argument for report_bitmap_diff
+ */
+static void
+diff_arg_init(bitmap_diff_arg *diffarg, Oid heapOid, Oid indexOid, char *indexname)
+{
+	memset(diffarg, 0, sizeof(bitmap_diff_arg));
+
+	diffarg->heapOid = heapOid;
+	diffarg->indexOid = indexOid;
+	diffarg->indexname = indexname;
+	diffarg->collect = pgcheck_online_cross_check;
+}
+
+/*
+ * recheck the differences found by the online cross-check, report those
+ * that can't be explained by concurrent changes and return their number
+ *
+ * Without the strict locks, the table and the index may be modified while
+ * being scanned, so some of the differences are expected:
+ *
+ * - items inserted after the heap page was scanned (in the index, but not
+ *   in the heap bitmap, or even pointing outside the bitmap)
+ *
+ * - items pruned (or vacuumed) after the heap page was scanned (in the heap
+ *   bitmap, but the index entries might be gone by the time of index scan)
+ *
+ * - index entries moved by a page split to a page that was already checked
+ *   (in the heap bitmap, but not found in the index)
+ *
+ * - items inserted by transactions still in progress (in the heap, but the
+ *   index entry may not be inserted yet)
+ *
+ * - dead items (LP_DEAD) - a concurrent VACUUM removes the index entries
+ *   first, and marks the heap items unused only after that, so a dead item
+ *   may legitimately have no index entry (in the heap, but not in the index)
+ *
+ * So the current state of each item is rechecked in the heap, and then (if
+ * needed) another pass over the index looks for the remaining items. Each
+ * heap page is read only once, and only the index is read again.
+ */
+static uint64
+online_recheck(Relation heap, item_bitmap * bitmap_idx, bitmap_diff_arg *diffarg)
+{
+	int			i, j;
+	int			nrecheck = 0;
+	uint64		ndiffs = 0;
+	BlockNumber	nblocks = RelationGetNumberOfBlocks(heap);
+	BufferAccessStrategy strategy;
+	Buffer		buf = InvalidBuffer;
+
+	/* index items pointing outside the heap bitmap are differences too
+	 * (none with the sort method, then the bitmap is NULL) */
+	for (i = 0; (bitmap_idx != NULL) && (i < bitmap_idx->noutside); i++) {
+		cross_diff_add(diffarg, ItemPointerGetBlockNumber(&bitmap_idx->outside[i]),
+					   ItemPointerGetOffsetNumber(&bitmap_idx->outside[i]), false);
+	}
+
+	if (diffarg->ndiffs == 0) {
+		return 0;
+	}
+
+	/* sort by TID (so that each heap page is read only once), and remove
+	 * duplicates (items seen twice in the index, thanks to a page split) */
+	qsort(diffarg->diffs, diffarg->ndiffs, sizeof(cross_diff), cross_diff_cmp);
+
+	for (i = 1, j = 0; i < diffarg->ndiffs; i++) {
+		if (cross_diff_cmp(&diffarg->diffs[i], &diffarg->diffs[j]) != 0) {
+			diffarg->diffs[++j] = diffarg->diffs[i];
+		}
+	}
+	diffarg->ndiffs = j + 1;
+
+	strategy = GetAccessStrategy(BAS_BULKREAD);
+
+	for (i = 0; i < diffarg->ndiffs; i++) {
+
+		cross_diff *diff = &diffarg->diffs[i];
+		Page		page;
+		ItemId		lp;
+		bool		root = false;	/* root of a HOT chain (should be indexed) */
+		bool		in_progress = false;	/* inserted by a running transaction */
+		bool		dead = false;	/* dead item (index entry may be vacuumed) */
+
+		/* the page does not exist (yet), so look into the index again */
+		if (diff->page >= nblocks) {
+			nrecheck++;
+			continue;
+		}
+
+		if ((buf == InvalidBuffer) || (BufferGetBlockNumber(buf) != diff->page)) {
+
+			if (buf != InvalidBuffer) {
+				UnlockReleaseBuffer(buf);
+			}
+
+			buf = ReadBufferExtended(heap, MAIN_FORKNUM, diff->page, RBM_NORMAL, strategy);
+			LockBuffer(buf, BUFFER_LOCK_SHARE);
+		}
+
+		page = BufferGetPage(buf);
+
+		if ((diff->offnum >= FirstOffsetNumber) &&
+			(diff->offnum <= PageGetMaxOffsetNumber(page))) {
+
+			lp = PageGetItemId(page, diff->offnum);
+
+			/* redirects and dead items are roots, heap-only tuples are not */
+			root = ItemIdIsUsed(lp);
+			dead = ItemIdIsDead(lp);
+
+			/* (items outside the page are reported by the heap checks) */
+			if (ItemIdIsNormal(lp) &&
+				(ItemIdGetOffset(lp) <= BLCKSZ - SizeofHeapTupleHeader)) {
+
+				HeapTupleHeader tuple = (HeapTupleHeader) PageGetItem(page, lp);
+
+				root = !HeapTupleHeaderIsHeapOnly(tuple);
+				in_progress = TransactionIdIsInProgress(HeapTupleHeaderGetXmin(tuple));
+			}
+		}
+
+		if (diff->in_heap) {
+			/* pruned since, the index entry may not be inserted yet, or
+			 * it may be removed by a concurrent vacuum already */
+			diff->resolved = (!root) || in_progress || dead;
+		} else {
+			/* inserted after the heap page was scanned */
+			diff->resolved = root;
+		}
+
+		if (!diff->resolved) {
+			nrecheck++;
+		}
+	}
+
+	if (buf != InvalidBuffer) {
+		UnlockReleaseBuffer(buf);
+	}
+
+	FreeAccessStrategy(strategy);
+
+	/* look for the remaining items in the index - items missing in the index
+	 * may have been moved, the index entries pointing to removed items may
+	 * have been removed by vacuum */
+	if (nrecheck > 0) {
+
+		online_index_lookup(diffarg);
+
+		for (i = 0; i < diffarg->ndiffs; i++) {
+
+			cross_diff *diff = &diffarg->diffs[i];
+
+			if (!diff->resolved) {
+				diff->resolved = (diff->in_heap == diff->found);
+			}
+		}
+	}
+
+	/* now report the remaining differences for real */
+	diffarg->collect = false;
+
+	for (i = 0; i < diffarg->ndiffs; i++) {
+
+		cross_diff *diff = &diffarg->diffs[i];
+
+		if (!diff->resolved &&
+			report_bitmap_diff(diff->page, diff->offnum - 1, diff->in_heap, diffarg)) {
+			ndiffs++;
+		}
+	}
+
+	pfree(diffarg->diffs);
+	diffarg->diffs = NULL;
+	diffarg->ndiffs = 0;
+	diffarg->maxdiffs = 0;
+
+	return ndiffs;
+}
+
+/*
+ * scan the leaf pages of the index again, and mark the differences found
+ * in the index (the diffs have to be sorted by cross_diff_cmp)
+ */
+static void
+online_index_lookup(bitmap_diff_arg *diffarg)
+{
+	Relation	rel;
+	const index_am_check *am;
+	BlockNumber	blkno;
+	BlockNumber	nblocks;
+	BufferAccessStrategy strategy;
+	block_scan	scan;
+	ItemPointerData *tids;
+
+	rel = relation_open(diffarg->indexOid, AccessShareLock);
+	am = index_am_lookup(rel->rd_rel->relam);
+	nblocks = RelationGetNumberOfBlocks(rel);
+
+	strategy = GetAccessStrategy(BAS_BULKREAD);
+	block_scan_init(&scan, rel, MAIN_FORKNUM, 0, nblocks, strategy);
+
+	tids = (ItemPointerData *) palloc(sizeof(ItemPointerData) * INDEX_MAX_PAGE_TIDS);
+
+	for (blkno = 0; blkno < nblocks; blkno++)
+	{
+		Buffer		buf;
+		Page		page;
+		int			ntids = 0;
+		int			i;
+
+		buf = block_scan_read(&scan, blkno);
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+
+		page = BufferGetPage(buf);
+
+		/* the page TIDs skip the metapage and non-leaf pages */
+		if (!PageIsNew(page)) {
+			ntids = am->page_tids((char *) page, blkno, tids);
+		}
+
+		UnlockReleaseBuffer(buf);
+
+		for (i = 0; i < ntids; i++) {
+
+			cross_diff	key;
+			cross_diff *diff;
+
+			key.page = IndexTidBlock(&tids[i]);
+			key.offnum = IndexTidOffset(&tids[i]);
+
+			diff = (cross_diff *) bsearch(&key, diffarg->diffs, diffarg->ndiffs,
+										  sizeof(cross_diff), cross_diff_cmp);
+
+			if (diff != NULL) {
+				diff->found = true;
+			}
+		}
+	}
+
+	pfree(tids);
+	FreeAccessStrategy(strategy);
+
+	relation_close(rel, AccessShareLock);
+}
+
+/*
+ * remember a difference, to be rechecked by online_recheck
+ */
+static void
+cross_diff_add(bitmap_diff_arg *diffarg, BlockNumber page, OffsetNumber offnum, bool in_heap)
+{
+	cross_diff *diff;
+
+	if (diffarg->ndiffs == diffarg->maxdiffs) {
+		diffarg->maxdiffs = Max(1024, 2 * diffarg->maxdiffs);
+		diffarg->diffs = (diffarg->diffs == NULL) ?
+			(cross_diff *) palloc(sizeof(cross_diff) * diffarg->maxdiffs) :
+			(cross_diff *) repalloc(diffarg->diffs, sizeof(cross_diff) * diffarg->maxdiffs);
+	}
+
+	diff = &diffarg->diffs[diffarg->ndiffs++];
+
+	diff->page = page;
+	diff->offnum = offnum;
+	diff->in_heap = in_heap;
+	diff->found = false;
+	diff->resolved = false;
+}
+
+/*
+ * order the differences by TID
+ */
+static int
+cross_diff_cmp(const void *a, const void *b)
+{
+	const cross_diff *da = (const cross_diff *) a;
+	const cross_diff *db = (const cross_diff *) b;
+
+	if (da->page != db->page)
+		return (da->page < db->page) ? -1 : 1;
+
+	if (da->offnum != db->offnum)
+		return (da->offnum < db->offnum) ? -1 : 1;
+
+	return 0;
+}
+
+/*
+ * allocate the scratch buffers (once per backend, they're never released)
+ */
+static void
+check_scratch_init(void)
+{
+	MemoryContext	oldcontext;
+
+	if (scratch_page != NULL)
+		return;
+
+	oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+
+	scratch_strategy = GetAccessStrategy(BAS_BULKREAD);
+	scratch_tids = (ItemPointerData *) palloc(sizeof(ItemPointerData) * INDEX_MAX_PAGE_TIDS);
+
+	/* last, so that a failure does not leave the buffers half-allocated */
+	scratch_page = (char *) palloc(BLCKSZ);
+
+	MemoryContextSwitchTo(oldcontext);
+}
+
+/*
+ * memory context of a check of a relation, deleted at the end of the check
+ * (or with the parent context, when the check fails with an ERROR)
+ */
+static MemoryContext
+check_context_create(void)
+{
+	return AllocSetContextCreate(CurrentMemoryContext,
+								 "pg_check relation",
+								 ALLOCSET_DEFAULT_MINSIZE,
+								 ALLOCSET_DEFAULT_INITSIZE,
+								 ALLOCSET_DEFAULT_MAXSIZE);
+}
+
+/*
+ * Should the pages be checked in place (while holding the buffer lock)?
+ *
+ * Only in the zero-copy mode, and only when no debug messages are printed,
+ * as those are not suppressed by the quiet mode.
+ */
+static bool
+check_in_place(void)
+{
+	return pgcheck_zero_copy && !checksum_enabled() &&
+		   (log_min_messages > DEBUG1) && (client_min_messages > DEBUG1);
+}
+
+/*
+ * Which checks to do on the page (a copy), after verifying the checksum.
+ *
+ * Pages with a checksum failure get all the checks, pages not modified since
+ * the last check none at all. Pages with a valid checksum get only the checks
+ * requested by pg_check.checksum_depth, unless modified since the last
+ * incremental check. Otherwise (dirty buffers etc.) the depth is unchanged.
+ */
+static int
+page_check_depth(Relation rel, char *page, BlockNumber blkno, bool dirty,
+				 bool verified, bool modified, int depth, uint32 *nerrs)
+{
+	int			result;
+	instr_time	start;
+
+	stats_start(&start);
+	result = checksum_verify(rel, MAIN_FORKNUM, page, blkno, dirty);
+	stats_end(STATS_CHECKSUM, &start);
+
+	if (result == CHECKSUM_FAILED)
+	{
+		(*nerrs)++;
+		return CHECK_DEPTH_FULL;
+	}
+
+	if (verified)
+		return CHECK_DEPTH_NONE;
+
+	if ((result == CHECKSUM_OK) && !modified)
+		return Min(depth, pgcheck_checksum_depth);
+
+	return depth;
+}
+
+/*
+ * check the heap page in the buffer (without reporting the issues)
+ */
+static uint32
+check_heap_page_quiet(Relation rel, heap_layout *layout, char *page, BlockNumber blkno)
+{
+	uint32	nerrs;
+	instr_time	start;
+
+	pgcheck_quiet = true;
+
+	stats_start(&start);
+	nerrs = check_page_header((PageHeader) page, blkno);
+	stats_end(STATS_HEADER, &start);
+
+	stats_start(&start);
+	nerrs += check_heap_tuples(rel, layout, (PageHeader) page, page, blkno);
+	stats_end(STATS_TUPLES, &start);
+
+	pgcheck_quiet = false;
+
+	return nerrs;
+}
+
+/*
+ * can the index be cross-checked with the table (do the index pages point
+ * to all the heap tuples)? unsupported indexes are skipped by
+ * index_check_open anyway
+ */
+static bool
+index_cross_check_supported(Oid indexOid)
+{
+	HeapTuple	tuple;
+	const index_am_check *am;
+
+	tuple = SearchSysCache1(RELOID, ObjectIdGetDatum(indexOid));
+
+	if (!HeapTupleIsValid(tuple))
+		elog(ERROR, "cache lookup failed for relation %u", indexOid);
+
+	am = index_am_lookup(((Form_pg_class) GETSTRUCT(tuple))->relam);
+
+	ReleaseSysCache(tuple);
+
+	return (am == NULL) || am->cross_check;
+}
+
+/*
+ * check the index page in the buffer (without reporting the issues)
+ */
+static uint32
+check_index_page_quiet(const index_am_check *am, Relation rel, char *page, BlockNumber blkno)
+{
+	uint32	nerrs;
+	instr_time	start;
+
+	pgcheck_quiet = true;
+
+	stats_start(&start);
+
+	nerrs = am->check_page(rel, (PageHeader) page, page, blkno);
+	nerrs += am->check_tuples(rel, (PageHeader) page, page, blkno);
+
+	stats_end(STATS_INDEX, &start);
+
+	pgcheck_quiet = false;
+
+	return nerrs;
+}
+
+/*
+ * Module load callback
+ */
+void
+_PG_init(void)
+{
+    
+    /* Define custom GUC variables. */
+    DefineCustomBoolVariable("pg_check.debug",
+                              "print debugging info.",
+                             NULL,
+                             &pgcheck_debug,
+                             false,
+                             PGC_SUSET,
+                             0,
+#if (PG_VERSION_NUM >= 90100)
+                             NULL,
+#endif
+                             NULL,
+                             NULL);
+
+    DefineCustomEnumVariable("pg_check.bitmap_format",
+                             "how to print bitmap when debugging",
+                             NULL,
+                             &pgcheck_bitmap_format,
+                             BITMAP_BINARY,
+                             bitmap_options,
+                             PGC_SUSET,
+                             0,
+#if (PG_VERSION_NUM >= 90100)
+                             NULL,
+#endif
+                             NULL,
+                             NULL);
+
+    DefineCustomBoolVariable("pg_check.zero_copy",
+                             "check pages in shared buffers, copy only pages with issues.",
+                             NULL,
+                             &pgcheck_zero_copy,
+                             false,
+                             PGC_SUSET,
+                             0,
+#if (PG_VERSION_NUM >= 90100)
+                             NULL,
+#endif
+                             NULL,
+                             NULL);
+
+    DefineCustomIntVariable("pg_check.prefetch_distance",
+                            "number of blocks to prefetch ahead of the block being checked.",
+                            NULL,
+                            &pgcheck_prefetch_distance,
+                            0,
+                            0,
+                            1000,
+                            PGC_SUSET,
+                            0,
+#if (PG_VERSION_NUM >= 90100)
+                            NULL,
+#endif
+                            NULL,
+                            NULL);
+
+    DefineCustomBoolVariable("pg_check.multi_index",
+                             "cross-check all indexes of a table in a single pass.",
+                             NULL,
+                             &pgcheck_multi_index,
+                             false,
+                             PGC_SUSET,
+                             0,
+#if (PG_VERSION_NUM >= 90100)
+                             NULL,
+#endif
+                             NULL,
+                             NULL);
+
+    DefineCustomBoolVariable("pg_check.online_cross_check",
+                             "cross-check without blocking writes, recheck the differences at the end.",
+                             NULL,
+                             &pgcheck_online_cross_check,
+                             false,
+                             PGC_SUSET,
+                             0,
+#if (PG_VERSION_NUM >= 90100)
+                             NULL,
+#endif
+                             NULL,
+                             NULL);
+
+    DefineCustomEnumVariable("pg_check.cross_check_method",
+                             "how to cross-check the table and indexes (bitmap or sort).",
+                             NULL,
+                             &pgcheck_cross_check_method,
+                             CROSS_CHECK_BITMAP,
+                             cross_check_options,
+                             PGC_SUSET,
+                             0,
+#if (PG_VERSION_NUM >= 90100)
+                             NULL,
+#endif
+                             NULL,
+                             NULL);
+
+    DefineCustomIntVariable("pg_check.cost_delay",
+                            "cost delay in milliseconds (0 disables the cost-based delay).",
+                            NULL,
+                            &pgcheck_cost_delay,
+                            0,
+                            0,
+                            100,
+                            PGC_SUSET,
+                            GUC_UNIT_MS,
+#if (PG_VERSION_NUM >= 90100)
+                            NULL,
+#endif
+                            NULL,
+                            NULL);
+
+    DefineCustomIntVariable("pg_check.cost_limit",
+                            "cost amount available before sleeping (vacuum_cost_page_* costs).",
+                            NULL,
+                            &pgcheck_cost_limit,
+                            200,
+                            1,
+                            10000,
+                            PGC_SUSET,
+                            0,
+#if (PG_VERSION_NUM >= 90100)
+                            NULL,
+#endif
+                            NULL,
+                            NULL);
+
+    DefineCustomIntVariable("pg_check.max_rate",
+                            "maximum rate of blocks read from disk in MB/s (0 means unlimited).",
+                            NULL,
+                            &pgcheck_max_rate,
+                            0,
+                            0,
+                            10000,
+                            PGC_SUSET,
+                            0,
+#if (PG_VERSION_NUM >= 90100)
+                            NULL,
+#endif
+                            NULL,
+                            NULL);
+
+    DefineCustomBoolVariable("pg_check.track_timing",
+                             "collect timing of the check phases (see pg_check_stats).",
+                             NULL,
+                             &pgcheck_track_timing,
+                             false,
+                             PGC_SUSET,
+                             0,
+#if (PG_VERSION_NUM >= 90100)
+                             NULL,
+#endif
+                             NULL,
+                             NULL);
+
+    DefineCustomRealVariable("pg_check.sample_percent",
+                             "percentage of blocks to check fully (tuples and items).",
+                             NULL,
+                             &pgcheck_sample_percent,
+                             100.0,
+                             0.0,
+                             100.0,
+                             PGC_SUSET,
+                             0,
+#if (PG_VERSION_NUM >= 90100)
+                             NULL,
+#endif
+                             NULL,
+                             NULL);
+
+    DefineCustomEnumVariable("pg_check.sample_method",
+                             "how to sample the blocks (random or stratified).",
+                             NULL,
+                             &pgcheck_sample_method,
+                             SAMPLE_RANDOM,
+                             sample_method_options,
+                             PGC_SUSET,
+                             0,
+#if (PG_VERSION_NUM >= 90100)
+                             NULL,
+#endif
+                             NULL,
+                             NULL);
+
+    DefineCustomEnumVariable("pg_check.unsampled_pages",
+                             "what to do with blocks not sampled (check the page header, or skip).",
+                             NULL,
+                             &pgcheck_unsampled_pages,
+                             UNSAMPLED_HEADER,
+                             unsampled_pages_options,
+                             PGC_SUSET,
+                             0,
+#if (PG_VERSION_NUM >= 90100)
+                             NULL,
+#endif
+                             NULL,
+                             NULL);
+
+    DefineCustomIntVariable("pg_check.max_errors",
+                            "stop checking a relation after this many issues (0 means unlimited).",
+                            NULL,
+                            &pgcheck_max_errors,
+                            0,
+                            0,
+                            INT_MAX,
+                            PGC_SUSET,
+                            0,
+#if (PG_VERSION_NUM >= 90100)
+                            NULL,
+#endif
+                            NULL,
+                            NULL);
+
+    DefineCustomIntVariable("pg_check.result_cache_size",
+                            "number of clean checks of relations remembered in shared memory (0 disables the cache).",
+                            NULL,
+                            &pgcheck_result_cache_size,
+                            0,
+                            0,
+                            INT_MAX / 2,
+                            PGC_POSTMASTER,
+                            0,
+#if (PG_VERSION_NUM >= 90100)
+                            NULL,
+#endif
+                            NULL,
+                            NULL);
+
+    DefineCustomIntVariable("pg_check.checkpoint_blocks",
+                            "save the position of a check every this many blocks, so that it can be resumed (0 means never).",
+                            NULL,
+                            &pgcheck_checkpoint_blocks,
+                            0,
+                            0,
+                            INT_MAX,
+                            PGC_SUSET,
+                            0,
+#if (PG_VERSION_NUM >= 90100)
+                            NULL,
+#endif
+                            NULL,
+                            NULL);
+
+    DefineCustomBoolVariable("pg_check.check_toast",
+                             "verify the TOAST values referenced by the table (in batches).",
+                             NULL,
+                             &pgcheck_check_toast,
+                             false,
+                             PGC_SUSET,
+                             0,
+#if (PG_VERSION_NUM >= 90100)
+                             NULL,
+#endif
+                             NULL,
+                             NULL);
+
+    DefineCustomBoolVariable("pg_check.check_visibility_map",
+                             "compare the visibility map to the heap pages (during the heap scan).",
+                             NULL,
+                             &pgcheck_check_vm,
+                             true,
+                             PGC_SUSET,
+                             0,
+#if (PG_VERSION_NUM >= 90100)
+                             NULL,
+#endif
+                             NULL,
+                             NULL);
+
+    DefineCustomBoolVariable("pg_check.check_free_space_map",
+                             "check the free space map (after checking the whole table).",
+                             NULL,
+                             &pgcheck_check_fsm,
+                             true,
+                             PGC_SUSET,
+                             0,
+#if (PG_VERSION_NUM >= 90100)
+                             NULL,
+#endif
+                             NULL,
+                             NULL);
+
+    DefineCustomBoolVariable("pg_check.verify_checksums",
+                             "verify the page checksums first (with data checksums enabled).",
+                             NULL,
+                             &pgcheck_verify_checksums,
+                             false,
+                             PGC_SUSET,
+                             0,
+#if (PG_VERSION_NUM >= 90100)
+                             NULL,
+#endif
+                             NULL,
+                             NULL);
+
+    DefineCustomEnumVariable("pg_check.checksum_depth",
+                             "checks done on pages with a valid checksum (full, header, none).",
+                             NULL,
+                             &pgcheck_checksum_depth,
+                             CHECK_DEPTH_FULL,
+                             checksum_depth_options,
+                             PGC_SUSET,
+                             0,
+#if (PG_VERSION_NUM >= 90100)
+                             NULL,
+#endif
+                             NULL,
+                             NULL);
+
+    EmitWarningsOnPlaceholders("pg_check");
+
+    /* progress reporting and the result cache need shared memory */
+    if (process_shared_preload_libraries_in_progress)
+    {
+        progress_shmem_request();
+        result_cache_shmem_request();
+    }
+
+    result_cache_register();
 
 }
@@ -0,0 +1,57 @@
+#ifndef PG_CHECK_H
+#define PG_CHECK_H
+
+#include "postgres.h"
+#include "storage/bufmgr.h"
+#include "utils/rel.h"
+
+#include "item-bitmap.h"
+
+/* GUC variables (defined in pg_check.c) */
+extern bool	pgcheck_debug;
+extern int	pgcheck_bitmap_format;
+extern bool	pgcheck_zero_copy;
+extern int	pgcheck_prefetch_distance;
+extern bool	pgcheck_multi_index;
+extern bool	pgcheck_online_cross_check;
+extern int	pgcheck_cross_check_method;
+extern int	pgcheck_cost_delay;
+extern int	pgcheck_cost_limit;
+extern int	pgcheck_max_rate;
+
+/* Checks a range of heap blocks [blockFrom, blockTo), optionally adding
+ * the items to the bitmap (may be NULL).
+ *
+ * - rel : heap relation (locked by the caller)
+ * - blockFrom : first block to check
+ * - blockTo : first block not to check
+ * - strategy : buffer access strategy used to read the blocks
+ * - raw_page : BLCKSZ buffer the pages are copied into
+ * - bitmap : bitmap to update with the heap items (or NULL)
+ * - skip_lsn : skip checks of pages with older LSN (0 to check all pages)
+ *
+ * Returns number of issues found.
+ */
+uint32 check_table_blocks(Relation rel, BlockNumber blockFrom, BlockNumber blockTo,
+						  BufferAccessStrategy strategy, char *raw_page,
+						  item_bitmap *bitmap, uint64 skip_lsn);
+
+/* Checks the whole table (and optionally the indexes), the same way as
+ * pg_check_table without workers.
+ *
+ * - relid : the table to check (the check is skipped if it does not exist
+ *           anymore, e.g. when dropped since it was selected for the check)
+ * - checkIndexes : check all indexes on the table
+ * - crossCheckIndexes : cross-check the indexes with the table
+ * - incremental : skip pages not modified since the last check
+ *
+ * The memory allocated by the check is released at the end (the page
+ * buffer and the strategy are shared by all the checks in the backend),
+ * so checking many relations does not accumulate memory.
+ *
+ * Returns number of issues found.
+ */
+uint32 check_table_relation(Oid relid, bool checkIndexes, bool crossCheckIndexes,
+							bool incremental);
+
+#endif   /* PG_CHECK_H */
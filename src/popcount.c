@@ -0,0 +1,250 @@
+/*-------------------------------------------------------------------------
+ *
+ * popcount.c
+ *	  Counting bits in arrays of words (used to compare item bitmaps).
+ *
+ * The portable version relies on the compiler builtin, which without any
+ * special flags is often compiled into a table lookup. So on x86-64 there
+ * are variants compiled for the POPCNT instruction and for AVX2 (using
+ * the nibble lookup table with PSHUFB and PSADBW to sum the counts), and
+ * the best one supported by the CPU is picked on the first call. On ARM64
+ * the NEON variant (CNT instruction) is always available.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "popcount.h"
+
+#if defined(__x86_64__) && (defined(__clang__) || (defined(__GNUC__) && (__GNUC__ >= 5)))
+#define USE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__)
+#define USE_NEON_KERNELS
+#include <arm_neon.h>
+#endif
+
+static uint64 words_popcount_choose(const uint64 *words, int nwords);
+static uint64 words_xor_popcount_choose(const uint64 *a, const uint64 *b, int nwords);
+
+uint64 (*words_popcount) (const uint64 *words, int nwords) = words_popcount_choose;
+uint64 (*words_xor_popcount) (const uint64 *a, const uint64 *b, int nwords) = words_xor_popcount_choose;
+
+/* portable versions */
+
+static uint64
+words_popcount_slow(const uint64 *words, int nwords)
+{
+	int		i;
+	uint64	count = 0;
+
+	for (i = 0; i < nwords; i++)
+		count += popcount64(words[i]);
+
+	return count;
+}
+
+static uint64
+words_xor_popcount_slow(const uint64 *a, const uint64 *b, int nwords)
+{
+	int		i;
+	uint64	count = 0;
+
+	for (i = 0; i < nwords; i++)
+		count += popcount64(a[i] ^ b[i]);
+
+	return count;
+}
+
+#ifdef USE_X86_KERNELS
+
+/* the same loops, but with the builtin compiled to the POPCNT instruction */
+
+__attribute__((target("popcnt")))
+static uint64
+words_popcount_popcnt(const uint64 *words, int nwords)
+{
+	int		i;
+	uint64	count = 0;
+
+	for (i = 0; i < nwords; i++)
+		count += __builtin_popcountll(words[i]);
+
+	return count;
+}
+
+__attribute__((target("popcnt")))
+static uint64
+words_xor_popcount_popcnt(const uint64 *a, const uint64 *b, int nwords)
+{
+	int		i;
+	uint64	count = 0;
+
+	for (i = 0; i < nwords; i++)
+		count += __builtin_popcountll(a[i] ^ b[i]);
+
+	return count;
+}
+
+/* bit counts for 32 bytes, summed into four 64-bit lanes */
+__attribute__((target("avx2")))
+static inline __m256i
+popcount256(__m256i v)
+{
+	const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+											0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i mask = _mm256_set1_epi8(0x0f);
+	__m256i		lo = _mm256_and_si256(v, mask);
+	__m256i		hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), mask);
+	__m256i		cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+									  _mm256_shuffle_epi8(lookup, hi));
+
+	return _mm256_sad_epu8(cnt, _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2")))
+static uint64
+sum256(__m256i acc)
+{
+	return (uint64) _mm256_extract_epi64(acc, 0) + (uint64) _mm256_extract_epi64(acc, 1) +
+		   (uint64) _mm256_extract_epi64(acc, 2) + (uint64) _mm256_extract_epi64(acc, 3);
+}
+
+__attribute__((target("avx2,popcnt")))
+static uint64
+words_popcount_avx2(const uint64 *words, int nwords)
+{
+	int		i;
+	__m256i	acc = _mm256_setzero_si256();
+	uint64	count;
+
+	for (i = 0; i + 4 <= nwords; i += 4)
+		acc = _mm256_add_epi64(acc, popcount256(_mm256_loadu_si256((const __m256i *) &words[i])));
+
+	count = sum256(acc);
+
+	for (; i < nwords; i++)
+		count += __builtin_popcountll(words[i]);
+
+	return count;
+}
+
+__attribute__((target("avx2,popcnt")))
+static uint64
+words_xor_popcount_avx2(const uint64 *a, const uint64 *b, int nwords)
+{
+	int		i;
+	__m256i	acc = _mm256_setzero_si256();
+	uint64	count;
+
+	for (i = 0; i + 4 <= nwords; i += 4)
+	{
+		__m256i	diff = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) &a[i]),
+										_mm256_loadu_si256((const __m256i *) &b[i]));
+
+		acc = _mm256_add_epi64(acc, popcount256(diff));
+	}
+
+	count = sum256(acc);
+
+	for (; i < nwords; i++)
+		count += __builtin_popcountll(a[i] ^ b[i]);
+
+	return count;
+}
+
+#endif   /* USE_X86_KERNELS */
+
+#ifdef USE_NEON_KERNELS
+
+static uint64
+words_popcount_neon(const uint64 *words, int nwords)
+{
+	int			i;
+	uint64x2_t	acc = vdupq_n_u64(0);
+	uint64		count;
+
+	for (i = 0; i + 2 <= nwords; i += 2)
+	{
+		uint8x16_t	cnt = vcntq_u8(vreinterpretq_u8_u64(vld1q_u64(&words[i])));
+
+		acc = vpadalq_u32(acc, vpaddlq_u16(vpaddlq_u8(cnt)));
+	}
+
+	count = vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1);
+
+	for (; i < nwords; i++)
+		count += popcount64(words[i]);
+
+	return count;
+}
+
+static uint64
+words_xor_popcount_neon(const uint64 *a, const uint64 *b, int nwords)
+{
+	int			i;
+	uint64x2_t	acc = vdupq_n_u64(0);
+	uint64		count;
+
+	for (i = 0; i + 2 <= nwords; i += 2)
+	{
+		uint64x2_t	diff = veorq_u64(vld1q_u64(&a[i]), vld1q_u64(&b[i]));
+		uint8x16_t	cnt = vcntq_u8(vreinterpretq_u8_u64(diff));
+
+		acc = vpadalq_u32(acc, vpaddlq_u16(vpaddlq_u8(cnt)));
+	}
+
+	count = vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1);
+
+	for (; i < nwords; i++)
+		count += popcount64(a[i] ^ b[i]);
+
+	return count;
+}
+
+#endif   /* USE_NEON_KERNELS */
+
+/* pick the best implementation for this CPU (on the first call) */
+static void
+choose_kernels(void)
+{
+#if defined(USE_X86_KERNELS)
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+	{
+		words_popcount = words_popcount_avx2;
+		words_xor_popcount = words_xor_popcount_avx2;
+	}
+	else if (__builtin_cpu_supports("popcnt"))
+	{
+		words_popcount = words_popcount_popcnt;
+		words_xor_popcount = words_xor_popcount_popcnt;
+	}
+	else
+	{
+		words_popcount = words_popcount_slow;
+		words_xor_popcount = words_xor_popcount_slow;
+	}
+#elif defined(USE_NEON_KERNELS)
+	words_popcount = words_popcount_neon;
+	words_xor_popcount = words_xor_popcount_neon;
+#else
+	words_popcount = words_popcount_slow;
+	words_xor_popcount = words_xor_popcount_slow;
+#endif
+}
+
+static uint64
+words_popcount_choose(const uint64 *words, int nwords)
+{
+	choose_kernels();
+	return words_popcount(words, nwords);
+}
+
+static uint64
+words_xor_popcount_choose(const uint64 *a, const uint64 *b, int nwords)
+{
+	choose_kernels();
+	return words_xor_popcount(a, b, nwords);
+}
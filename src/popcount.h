@@ -0,0 +1,56 @@
+#ifndef POPCOUNT_CHECK_H
+#define POPCOUNT_CHECK_H
+
+#include "postgres.h"
+
+/* Counts bits set in an array of words.
+ *
+ * - words : the words to count
+ * - nwords : number of words
+ *
+ * The implementation (AVX2, hardware popcount, NEON or portable) is
+ * selected at runtime, on the first call.
+ */
+extern uint64 (*words_popcount) (const uint64 *words, int nwords);
+
+/* Counts bits set in (a XOR b), i.e. number of differing bits.
+ *
+ * - a, b : the words to compare
+ * - nwords : number of words (in each array)
+ */
+extern uint64 (*words_xor_popcount) (const uint64 *a, const uint64 *b, int nwords);
+
+/* number of bits set in a single word */
+static inline int
+popcount64(uint64 word)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_popcountll(word);
+#else
+	word = word - ((word >> 1) & UINT64CONST(0x5555555555555555));
+	word = (word & UINT64CONST(0x3333333333333333)) + ((word >> 2) & UINT64CONST(0x3333333333333333));
+	word = (word + (word >> 4)) & UINT64CONST(0x0F0F0F0F0F0F0F0F);
+	return (int) ((word * UINT64CONST(0x0101010101010101)) >> 56);
+#endif
+}
+
+/* index of the lowest bit set in the word (the word must not be 0) */
+static inline int
+lowest_bit64(uint64 word)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_ctzll(word);
+#else
+	int		bit = 0;
+
+	while ((word & 1) == 0)
+	{
+		word >>= 1;
+		bit++;
+	}
+
+	return bit;
+#endif
+}
+
+#endif   /* POPCOUNT_CHECK_H */
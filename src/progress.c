@@ -0,0 +1,343 @@
+#include "progress.h"
+
+#include "access/xact.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "postmaster/autovacuum.h"
+#include "storage/backendid.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+
+#if (PG_VERSION_NUM >= 90500)
+#include "port/atomics.h"
+#else
+#include "storage/barrier.h"
+#endif
+
+/* number of columns returned by pg_check_progress */
+#define PROGRESS_COLUMNS	12
+
+/* progress of a check running in a backend */
+typedef struct progress_slot {
+
+	uint32		changecount;	/* odd while the slot is being updated */
+
+	int			pid;			/* backend running the check (0 if none) */
+	Oid			dbid;			/* database of the relation */
+	Oid			relid;			/* relation being checked */
+
+	int			phase;			/* ProgressPhase */
+	Oid			indexrelid;		/* index being checked */
+	int			indexes_total;	/* number of indexes to check */
+	int			indexes_done;	/* indexes checked (including the current one) */
+
+	BlockNumber	blocks_total;	/* blocks to check in this phase */
+	BlockNumber	blocks_done;	/* blocks checked in this phase */
+	uint64		errors;			/* issues found so far */
+
+	TimestampTz	start_time;		/* start of the check */
+	TimestampTz	phase_start;	/* start of the current phase */
+
+} progress_slot;
+
+/* updates of the slot (by the owning backend) */
+#define PROGRESS_BEGIN_WRITE(slot) \
+	do { (slot)->changecount++; pg_write_barrier(); } while (0)
+
+#define PROGRESS_END_WRITE(slot) \
+	do { pg_write_barrier(); (slot)->changecount++; } while (0)
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+/* slots in shared memory (NULL when not loaded in shared_preload_libraries) */
+static progress_slot *progress_slots = NULL;
+
+/* slot of this backend (only while reporting progress) */
+static progress_slot *my_slot = NULL;
+
+static bool xact_callback_registered = false;
+
+static int progress_nslots(void);
+static void progress_shmem_startup(void);
+static void progress_xact_callback(XactEvent event, void *arg);
+static const char *progress_phase_name(int phase);
+
+/* request the shared memory (only while loading shared_preload_libraries) */
+void progress_shmem_request(void) {
+
+	RequestAddinShmemSpace(mul_size(progress_nslots(), sizeof(progress_slot)));
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = progress_shmem_startup;
+
+}
+
+/* start reporting progress of the check */
+void progress_start(Oid relid) {
+
+	if (progress_slots == NULL) {
+		return;
+	}
+
+	/* only regular backends (as that's what the slots are sized for) */
+	if ((MyBackendId == InvalidBackendId) || (MyBackendId > progress_nslots())) {
+		return;
+	}
+
+	/* clear the slot at the end of transaction (even on ERROR) */
+	if (! xact_callback_registered) {
+		RegisterXactCallback(progress_xact_callback, NULL);
+		xact_callback_registered = true;
+	}
+
+	my_slot = &progress_slots[MyBackendId - 1];
+
+	PROGRESS_BEGIN_WRITE(my_slot);
+
+	my_slot->pid = MyProcPid;
+	my_slot->dbid = MyDatabaseId;
+	my_slot->relid = relid;
+	my_slot->phase = PROGRESS_PHASE_NONE;
+	my_slot->indexrelid = InvalidOid;
+	my_slot->indexes_total = 0;
+	my_slot->indexes_done = 0;
+	my_slot->blocks_total = 0;
+	my_slot->blocks_done = 0;
+	my_slot->errors = 0;
+	my_slot->start_time = GetCurrentTimestamp();
+	my_slot->phase_start = my_slot->start_time;
+
+	PROGRESS_END_WRITE(my_slot);
+
+}
+
+/* number of indexes to check */
+void progress_indexes(int nindexes) {
+
+	if (my_slot == NULL) {
+		return;
+	}
+
+	PROGRESS_BEGIN_WRITE(my_slot);
+	my_slot->indexes_total = nindexes;
+	PROGRESS_END_WRITE(my_slot);
+
+}
+
+/* start the next phase */
+void progress_phase(ProgressPhase phase, Oid indexrelid, BlockNumber nblocks) {
+
+	if (my_slot == NULL) {
+		return;
+	}
+
+	PROGRESS_BEGIN_WRITE(my_slot);
+
+	my_slot->phase = phase;
+	my_slot->indexrelid = indexrelid;
+	my_slot->blocks_total = nblocks;
+	my_slot->blocks_done = 0;
+	my_slot->phase_start = GetCurrentTimestamp();
+
+	if ((phase == PROGRESS_PHASE_INDEX) && OidIsValid(indexrelid)) {
+		my_slot->indexes_done++;
+	}
+
+	PROGRESS_END_WRITE(my_slot);
+
+}
+
+/* more blocks checked in the current phase */
+void progress_blocks(BlockNumber nblocks) {
+
+	if (my_slot == NULL) {
+		return;
+	}
+
+	PROGRESS_BEGIN_WRITE(my_slot);
+	my_slot->blocks_done += nblocks;
+	PROGRESS_END_WRITE(my_slot);
+
+}
+
+/* another issue found */
+void progress_error(void) {
+
+	if (my_slot == NULL) {
+		return;
+	}
+
+	PROGRESS_BEGIN_WRITE(my_slot);
+	my_slot->errors++;
+	PROGRESS_END_WRITE(my_slot);
+
+}
+
+/* the check is done */
+void progress_end(void) {
+
+	if (my_slot == NULL) {
+		return;
+	}
+
+	PROGRESS_BEGIN_WRITE(my_slot);
+	my_slot->pid = 0;
+	PROGRESS_END_WRITE(my_slot);
+
+	my_slot = NULL;
+
+}
+
+/*
+ * pg_check_progress
+ *
+ * Returns progress of the checks running in all the backends.
+ */
+PG_FUNCTION_INFO_V1(pg_check_progress);
+
+Datum
+pg_check_progress(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo  *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext	oldcontext;
+	TupleDesc		tupdesc;
+	Tuplestorestate *tupstore;
+	int				i;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	for (i = 0; (progress_slots != NULL) && (i < progress_nslots()); i++)
+	{
+		volatile progress_slot *slot = &progress_slots[i];
+		progress_slot	local;
+		Datum			values[PROGRESS_COLUMNS];
+		bool			nulls[PROGRESS_COLUMNS];
+
+		/* get a consistent copy of the slot (not being updated) */
+		for (;;)
+		{
+			uint32	before = slot->changecount;
+
+			pg_read_barrier();
+
+			memcpy(&local, (progress_slot *) slot, sizeof(progress_slot));
+
+			pg_read_barrier();
+
+			if ((before == slot->changecount) && ((before & 1) == 0))
+				break;
+
+			CHECK_FOR_INTERRUPTS();
+		}
+
+		if (local.pid == 0)
+			continue;
+
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = Int32GetDatum(local.pid);
+		values[1] = ObjectIdGetDatum(local.dbid);
+		values[2] = ObjectIdGetDatum(local.relid);
+		values[3] = CStringGetTextDatum(progress_phase_name(local.phase));
+		values[4] = ObjectIdGetDatum(local.indexrelid);
+		nulls[4] = !OidIsValid(local.indexrelid);
+		values[5] = Int32GetDatum(local.indexes_total);
+		values[6] = Int32GetDatum(local.indexes_done);
+		values[7] = Int64GetDatum((int64) local.blocks_total);
+		values[8] = Int64GetDatum((int64) local.blocks_done);
+		values[9] = Int64GetDatum((int64) local.errors);
+		values[10] = TimestampTzGetDatum(local.start_time);
+		values[11] = TimestampTzGetDatum(local.phase_start);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	return (Datum) 0;
+}
+
+/* number of slots (the same as MaxBackends, which is not set yet while
+ * loading the shared_preload_libraries) */
+static int progress_nslots(void) {
+
+	return MaxConnections + autovacuum_max_workers + 1
+#if (PG_VERSION_NUM >= 90400)
+		   + max_worker_processes
+#endif
+		   ;
+
+}
+
+/* allocate (or attach to) the slots */
+static void progress_shmem_startup(void) {
+
+	bool	found;
+
+	if (prev_shmem_startup_hook) {
+		prev_shmem_startup_hook();
+	}
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	progress_slots = (progress_slot *) ShmemInitStruct("pg_check progress",
+													   mul_size(progress_nslots(), sizeof(progress_slot)),
+													   &found);
+
+	if (! found) {
+		memset(progress_slots, 0, mul_size(progress_nslots(), sizeof(progress_slot)));
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+
+}
+
+/* clear the slot at the end of the transaction */
+static void progress_xact_callback(XactEvent event, void *arg) {
+
+	if ((event == XACT_EVENT_COMMIT) || (event == XACT_EVENT_ABORT)) {
+		progress_end();
+	}
+
+}
+
+/* name of the phase (in the view) */
+static const char *progress_phase_name(int phase) {
+
+	switch (phase) {
+		case PROGRESS_PHASE_HEAP:
+			return "checking table";
+		case PROGRESS_PHASE_INDEX:
+			return "checking index";
+		case PROGRESS_PHASE_COMPARE:
+			return "cross-checking";
+		case PROGRESS_PHASE_STRUCTURE:
+			return "checking index structure";
+		default:
+			return "initializing";
+	}
+
+}
@@ -0,0 +1,66 @@
+#ifndef PROGRESS_CHECK_H
+#define PROGRESS_CHECK_H
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "storage/block.h"
+
+/*
+ * Progress reporting - each backend running a check publishes the current
+ * phase, number of blocks checked etc. in its slot in shared memory,
+ * and the pg_stat_progress_check view shows the slots of all backends.
+ *
+ * The shared memory is allocated only when the library is loaded through
+ * shared_preload_libraries, otherwise all the functions do nothing (and
+ * the view is empty). The slots are updated by the owning backend only,
+ * and read using a change counter (the same as PgBackendStatus), so no
+ * locks are needed.
+ */
+
+/* phase of the check */
+typedef enum
+{
+        PROGRESS_PHASE_NONE,
+        PROGRESS_PHASE_HEAP,		/* checking the table */
+        PROGRESS_PHASE_INDEX,		/* checking an index (or all with multi_index) */
+        PROGRESS_PHASE_COMPARE,		/* comparing the table and the indexes */
+        PROGRESS_PHASE_STRUCTURE	/* checking the b-tree structure */
+}       ProgressPhase;
+
+/* Requests the shared memory and installs the shmem hook (called from
+ * _PG_init while loading the shared_preload_libraries). */
+void progress_shmem_request(void);
+
+/* Starts reporting progress of a check of the relation (and clears the
+ * previous one). The slot is also cleared at the end of the transaction,
+ * so that a check failing with an ERROR does not stay in the view. */
+void progress_start(Oid relid);
+
+/* Sets the number of indexes to check (after the table). */
+void progress_indexes(int nindexes);
+
+/* Starts a new phase of the check.
+ *
+ * - phase : the new phase
+ * - indexrelid : index being checked (InvalidOid when not checking an
+ *                index, or when checking all of them at once)
+ * - nblocks : number of blocks to check in this phase (0 if not known)
+ *
+ * Each PROGRESS_PHASE_INDEX phase with a valid index increments the number
+ * of indexes done.
+ */
+void progress_phase(ProgressPhase phase, Oid indexrelid, BlockNumber nblocks);
+
+/* Adds blocks to the number of blocks checked in the current phase. */
+void progress_blocks(BlockNumber nblocks);
+
+/* Counts an issue found (called for each reported issue). */
+void progress_error(void);
+
+/* Stops reporting progress (clears the slot). */
+void progress_end(void);
+
+/* Returns the progress of all the running checks. */
+Datum pg_check_progress(PG_FUNCTION_ARGS);
+
+#endif   /* PROGRESS_CHECK_H */
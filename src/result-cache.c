@@ -0,0 +1,268 @@
+#include "result-cache.h"
+
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/inval.h"
+
+#include "incremental.h"
+#include "page-checksum.h"
+#include "sample.h"
+#include "scan.h"
+
+/* name of the shared memory segment (and the LWLock tranche) */
+#define RESULT_CACHE_NAME	"pg_check result cache"
+
+/* a clean check of a relation */
+typedef struct cache_entry {
+
+	Oid			dbid;			/* database of the relation (InvalidOid if unused) */
+	Oid			relid;			/* the relation */
+	Oid			relfilenode;	/* to detect rewrites */
+	BlockNumber	nblocks;		/* to detect truncation (and growth) */
+	uint64		lsn;			/* WAL insert position at the start of the check */
+	uint64		stored;			/* when stored (to evict the oldest entry) */
+
+} cache_entry;
+
+typedef struct result_cache {
+
+#if (PG_VERSION_NUM >= 90400)
+	LWLock	   *lock;			/* protects the entries */
+#else
+	LWLockId	lock;
+#endif
+	uint64		counter;		/* number of entries stored so far */
+	cache_entry	entries[FLEXIBLE_ARRAY_MEMBER];
+
+} result_cache;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+/* the cache in shared memory (NULL when not loaded in shared_preload_libraries) */
+static result_cache *cache = NULL;
+
+static Size result_cache_size(void);
+static void result_cache_shmem_startup(void);
+static void result_cache_invalidate(Datum arg, Oid relid);
+static int result_cache_find(Relation rel);
+
+/* request the shared memory (only while loading shared_preload_libraries) */
+void result_cache_shmem_request(void) {
+
+	if (pgcheck_result_cache_size == 0) {
+		return;
+	}
+
+	RequestAddinShmemSpace(result_cache_size());
+
+#if (PG_VERSION_NUM >= 90600)
+	RequestNamedLWLockTranche(RESULT_CACHE_NAME, 1);
+#else
+	RequestAddinLWLocks(1);
+#endif
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = result_cache_shmem_startup;
+
+}
+
+/* remove the entries on relcache invalidations (in each backend) */
+void result_cache_register(void) {
+
+	CacheRegisterRelcacheCallback(result_cache_invalidate, (Datum) 0);
+
+}
+
+/* may the check of the relation use the cache? */
+bool result_cache_enabled(Relation rel) {
+
+	return (cache != NULL) && !pgcheck_verify_checksums && !sample_enabled() &&
+		   incremental_supported(rel);
+
+}
+
+/* was the relation not modified since the cached check? */
+bool result_cache_valid(Relation rel, BufferAccessStrategy strategy) {
+
+	cache_entry	entry;
+	int			idx;
+	BlockNumber	blkno;
+	block_scan	scan;
+
+	if (!result_cache_enabled(rel)) {
+		return false;
+	}
+
+	LWLockAcquire(cache->lock, LW_SHARED);
+
+	idx = result_cache_find(rel);
+
+	if (idx >= 0) {
+		entry = cache->entries[idx];
+	}
+
+	LWLockRelease(cache->lock);
+
+	/* never checked, or rewritten / truncated / extended since then */
+	if ((idx < 0) || (entry.relfilenode != rel->rd_node.relNode) ||
+		(entry.nblocks != RelationGetNumberOfBlocks(rel))) {
+		return false;
+	}
+
+	/* the page LSNs, until the first page modified since the check */
+	block_scan_init(&scan, rel, MAIN_FORKNUM, 0, entry.nblocks, strategy);
+
+	for (blkno = 0; blkno < entry.nblocks; blkno++) {
+
+		Buffer	buf = block_scan_read(&scan, blkno);
+		bool	verified;
+
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		verified = page_is_verified(BufferGetPage(buf), entry.lsn);
+		LockBuffer(buf, BUFFER_LOCK_UNLOCK);
+
+		ReleaseBuffer(buf);
+
+		if (!verified) {
+			return false;
+		}
+	}
+
+	ereport(DEBUG1,
+			(errmsg("\"%s\" not modified since the last clean check, skipping the checks",
+					RelationGetRelationName(rel))));
+
+	return true;
+
+}
+
+/* remember the clean check (replacing the oldest entry when full) */
+void result_cache_store(Relation rel, BlockNumber nblocks, uint64 lsn) {
+
+	int			idx;
+	int			i;
+	cache_entry *entry;
+
+	if (!result_cache_enabled(rel)) {
+		return;
+	}
+
+	LWLockAcquire(cache->lock, LW_EXCLUSIVE);
+
+	idx = result_cache_find(rel);
+
+	/* an unused entry, or the oldest one */
+	for (i = 0; (idx < 0) && (i < pgcheck_result_cache_size); i++) {
+		if (!OidIsValid(cache->entries[i].dbid)) {
+			idx = i;
+		}
+	}
+
+	for (i = 0; (idx < 0) && (i < pgcheck_result_cache_size); i++) {
+		if ((i == 0) || (cache->entries[i].stored < cache->entries[idx].stored)) {
+			idx = i;
+		}
+	}
+
+	entry = &cache->entries[idx];
+
+	entry->dbid = MyDatabaseId;
+	entry->relid = RelationGetRelid(rel);
+	entry->relfilenode = rel->rd_node.relNode;
+	entry->nblocks = nblocks;
+	entry->lsn = lsn;
+	entry->stored = ++cache->counter;
+
+	LWLockRelease(cache->lock);
+
+}
+
+/* remove the entry for the relation (if any) */
+void result_cache_forget(Relation rel) {
+
+	if (cache == NULL) {
+		return;
+	}
+
+	result_cache_invalidate((Datum) 0, RelationGetRelid(rel));
+
+}
+
+/* size of the shared memory (the entries follow the header) */
+static Size result_cache_size(void) {
+
+	return add_size(offsetof(result_cache, entries),
+					mul_size(pgcheck_result_cache_size, sizeof(cache_entry)));
+
+}
+
+/* allocate (or attach to) the cache */
+static void result_cache_shmem_startup(void) {
+
+	bool	found;
+
+	if (prev_shmem_startup_hook) {
+		prev_shmem_startup_hook();
+	}
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	cache = (result_cache *) ShmemInitStruct(RESULT_CACHE_NAME, result_cache_size(), &found);
+
+	if (! found) {
+		memset(cache, 0, result_cache_size());
+
+#if (PG_VERSION_NUM >= 90600)
+		cache->lock = &(GetNamedLWLockTranche(RESULT_CACHE_NAME))->lock;
+#else
+		cache->lock = LWLockAssign();
+#endif
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+
+}
+
+/* relcache callback - remove the entry for the relation (all the entries
+ * for the database with InvalidOid, e.g. after a sinval queue overflow) */
+static void result_cache_invalidate(Datum arg, Oid relid) {
+
+	int		i;
+
+	if (cache == NULL) {
+		return;
+	}
+
+	LWLockAcquire(cache->lock, LW_EXCLUSIVE);
+
+	for (i = 0; i < pgcheck_result_cache_size; i++) {
+
+		cache_entry *entry = &cache->entries[i];
+
+		if ((entry->dbid == MyDatabaseId) &&
+			(!OidIsValid(relid) || (entry->relid == relid))) {
+			memset(entry, 0, sizeof(cache_entry));
+		}
+	}
+
+	LWLockRelease(cache->lock);
+
+}
+
+/* index of the entry for the relation, -1 if none (the lock has to be held) */
+static int result_cache_find(Relation rel) {
+
+	int		i;
+
+	for (i = 0; i < pgcheck_result_cache_size; i++) {
+		if ((cache->entries[i].dbid == MyDatabaseId) &&
+			(cache->entries[i].relid == RelationGetRelid(rel))) {
+			return i;
+		}
+	}
+
+	return -1;
+
+}
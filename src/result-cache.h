@@ -0,0 +1,55 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include "postgres.h"
+#include "storage/bufmgr.h"
+#include "utils/rel.h"
+
+/*
+ * Result cache - a clean check of a whole relation (no issues found) is
+ * remembered in shared memory, with the relfilenode, the number of blocks
+ * and the WAL insert position from the start of the check. A repeated check
+ * of the relation first only reads the page LSNs (so for small static
+ * relations it's just a pass over shared buffers, without copying and
+ * checking the pages), and when the relation has the same relfilenode and
+ * size, and no page was modified since the cached check, the checks are
+ * skipped. Otherwise the relation is checked as usual.
+ *
+ * Rewrites and truncations are detected by the relfilenode and the number
+ * of blocks, and the entries are also removed by a relcache callback (e.g.
+ * on TRUNCATE, or when the relation gets dropped).
+ *
+ * The shared memory (pg_check.result_cache_size entries) is only allocated
+ * when the library is loaded through shared_preload_libraries, the cache is
+ * disabled otherwise. Only relations with page LSNs may be cached (the same
+ * as for incremental checks), and the cache is not used when verifying the
+ * checksums (which may fail on unmodified pages) or sampling.
+ */
+
+extern int	pgcheck_result_cache_size;
+
+/* Requests the shared memory and installs the shmem hook (called from
+ * _PG_init while loading the shared_preload_libraries). */
+void result_cache_shmem_request(void);
+
+/* Registers the relcache callback removing the entries (called from
+ * _PG_init in each backend). */
+void result_cache_register(void);
+
+/* May the checks of the relation use the cache? */
+bool result_cache_enabled(Relation rel);
+
+/* Was the relation not modified since the cached clean check? Reads the
+ * LSNs of all the pages (stops at the first modified one), so the reads
+ * are the same as for a regular check - pages not in shared buffers are
+ * read from disk, only the copying and checking of the pages is saved. */
+bool result_cache_valid(Relation rel, BufferAccessStrategy strategy);
+
+/* Remembers a clean check of all nblocks blocks of the relation, started
+ * at WAL position lsn. */
+void result_cache_store(Relation rel, BlockNumber nblocks, uint64 lsn);
+
+/* Removes the cached check of the relation (the check found issues). */
+void result_cache_forget(Relation rel);
+
+#endif   /* RESULT_CACHE_H */
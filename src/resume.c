@@ -0,0 +1,86 @@
+#include "resume.h"
+#include "incremental.h"
+
+#include <unistd.h>
+
+#include "miscadmin.h"
+#include "storage/fd.h"
+
+static void resume_path(Oid relid, char *path);
+
+/* cursor at the first block of the relation */
+void resume_init(resume_cursor *cursor, Oid relid, bool check_indexes, bool incremental) {
+
+	memset(cursor, 0, sizeof(resume_cursor));
+
+	cursor->magic = RESUME_MAGIC;
+	cursor->relid = relid;
+	cursor->check_indexes = check_indexes;
+	cursor->incremental = incremental;
+	cursor->indexid = InvalidOid;
+
+}
+
+/* read the cursor stored for the relation (false if none) */
+bool resume_load(Oid relid, resume_cursor *cursor) {
+
+	char	path[MAXPGPATH];
+	FILE   *file;
+	bool	valid;
+
+	resume_path(relid, path);
+
+	file = AllocateFile(path, PG_BINARY_R);
+
+	if (file == NULL) {
+
+		/* never interrupted (or the check completed) */
+		if (errno == ENOENT)
+			return false;
+
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\": %m", path)));
+	}
+
+	valid = (fread(cursor, sizeof(resume_cursor), 1, file) == 1);
+
+	FreeFile(file);
+
+	/* ignore broken files (the relfilenode is checked by the caller) */
+	return valid && (cursor->magic == RESUME_MAGIC) && (cursor->relid == relid);
+
+}
+
+/* store the cursor (durably, the same way as the incremental states) */
+void resume_save(resume_cursor *cursor) {
+
+	char	path[MAXPGPATH];
+
+	resume_path(cursor->relid, path);
+
+	incremental_write_file(path, cursor, sizeof(resume_cursor));
+
+}
+
+/* remove the cursor stored for the relation (if any) */
+void resume_forget(Oid relid) {
+
+	char	path[MAXPGPATH];
+
+	resume_path(relid, path);
+
+	if ((unlink(path) != 0) && (errno != ENOENT))
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not remove file \"%s\": %m", path)));
+
+}
+
+/* path of the file for the relation (relative to the data directory) */
+static void resume_path(Oid relid, char *path) {
+
+	snprintf(path, MAXPGPATH, "%s/%u_%u.resume", INCREMENTAL_DIR,
+			 MyDatabaseId, relid);
+
+}
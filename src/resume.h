@@ -0,0 +1,57 @@
+#ifndef RESUME_CHECK_H
+#define RESUME_CHECK_H
+
+#include "postgres.h"
+#include "storage/block.h"
+
+/*
+ * Resumable checks - a check of a whole table (or index) saves a cursor
+ * every pg_check.checkpoint_blocks blocks (in a small file in the pg_check
+ * directory, next to the incremental states). When the check gets cancelled
+ * or the session disconnects, pg_check_resume() continues from the cursor
+ * instead of starting from block 0 again. The file is removed once the check
+ * completes.
+ *
+ * The cursor is stored for the relation passed to pg_check_table (or
+ * pg_check_index), and tracks the index being checked - the indexes of a
+ * table are checked in the order of OIDs, so the indexes before it were
+ * already checked.
+ */
+
+#define RESUME_MAGIC	0x70677273
+
+typedef struct resume_cursor {
+
+	uint32		magic;			/* RESUME_MAGIC */
+	Oid			relid;			/* the checked relation (table or index) */
+	Oid			relfilenode;	/* to detect rewrites (CLUSTER, VACUUM FULL, ...) */
+	bool		check_indexes;	/* checking the indexes of the table too */
+	bool		incremental;	/* incremental check */
+
+	Oid			indexid;		/* index being checked (InvalidOid for the table) */
+	Oid			index_relfilenode;	/* to detect REINDEX */
+	BlockNumber	block;			/* next block to check */
+	uint32		nerrs;			/* issues found so far */
+
+	/* of the relation being checked (see incremental.h) */
+	bool		track_lsn;		/* remember the LSN after the check */
+	uint64		start_lsn;		/* WAL position at the start */
+	uint64		skip_lsn;		/* skip pages older than this */
+
+} resume_cursor;
+
+/* Initializes a cursor at the start of the check of the relation. */
+void resume_init(resume_cursor *cursor, Oid relid, bool check_indexes, bool incremental);
+
+/* Reads the cursor stored for the relation, returns false when there's none
+ * (no interrupted check, or the file is broken). */
+bool resume_load(Oid relid, resume_cursor *cursor);
+
+/* Stores the cursor (write a temporary file, fsync and rename it, see
+ * incremental_write_file). */
+void resume_save(resume_cursor *cursor);
+
+/* Removes the cursor stored for the relation (the check completed). */
+void resume_forget(Oid relid);
+
+#endif   /* RESUME_CHECK_H */
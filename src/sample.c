@@ -0,0 +1,100 @@
+#include "sample.h"
+#include "stats.h"
+
+#include <math.h>
+
+/* seed of the current check */
+static uint32 sample_seed = 0;
+
+static uint32 sample_hash(uint32 value);
+
+/* new seed for each check, so that repeated checks see different blocks */
+void sample_begin(void) {
+
+	sample_seed = (uint32) random();
+
+}
+
+uint32 sample_get_seed(void) {
+
+	return sample_seed;
+
+}
+
+void sample_set_seed(uint32 seed) {
+
+	sample_seed = seed;
+
+}
+
+bool sample_enabled(void) {
+
+	return (pgcheck_sample_percent < 100.0);
+
+}
+
+bool sample_skip_unsampled(void) {
+
+	return sample_enabled() && (pgcheck_unsampled_pages == UNSAMPLED_SKIP);
+
+}
+
+/* is the block selected for the full checks? */
+bool sample_block(BlockNumber blkno) {
+
+	double		stride;
+	BlockNumber	stratum;
+	BlockNumber	first;
+	BlockNumber	last;
+
+	if (!sample_enabled()) {
+		return true;
+	}
+
+	if (pgcheck_sample_percent <= 0.0) {
+		return false;
+	}
+
+	/* independently, with the probability given by the sample_percent */
+	if (pgcheck_sample_method == SAMPLE_RANDOM) {
+		return (sample_hash(blkno ^ sample_seed) < (pgcheck_sample_percent / 100.0) * PG_UINT32_MAX);
+	}
+
+	/* stratified - the block selected from the stratum, i.e. blocks
+	 * [first, last), by the seed (independent of where the scan starts) */
+	stride = 100.0 / pgcheck_sample_percent;
+	stratum = (BlockNumber) (blkno / stride);
+
+	first = (BlockNumber) ceil(stratum * stride);
+	last = (BlockNumber) ceil((stratum + 1) * stride);
+
+	/* rounding of the stratum boundaries */
+	if (blkno < first) {
+		stratum--;
+		first = (BlockNumber) ceil(stratum * stride);
+		last = (BlockNumber) ceil((stratum + 1) * stride);
+	}
+
+	return (blkno == first + sample_hash(stratum ^ sample_seed) % Max(last - first, 1));
+
+}
+
+/* stop the check after max_errors issues */
+bool check_stop(void) {
+
+	return (pgcheck_max_errors > 0) && (pgcheck_stats.issues >= (uint64) pgcheck_max_errors);
+
+}
+
+/* mixes the bits of the value (finalizer of the 32-bit murmur3 hash) */
+static uint32 sample_hash(uint32 value) {
+
+	value ^= value >> 16;
+	value *= 0x85ebca6b;
+	value ^= value >> 13;
+	value *= 0xc2b2ae35;
+	value ^= value >> 16;
+
+	return value;
+
+}
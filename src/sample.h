@@ -0,0 +1,60 @@
+#ifndef SAMPLE_CHECK_H
+#define SAMPLE_CHECK_H
+
+#include "postgres.h"
+#include "storage/block.h"
+
+/*
+ * Sampling of the checked blocks, and stopping the check early.
+ *
+ * With pg_check.sample_percent < 100 only some of the blocks get the full
+ * (expensive) checks - the tuples and attributes of heap pages, items of
+ * index pages. The other blocks either get just the cheap page checks
+ * (pg_check.unsampled_pages = header), or are not read at all (skip).
+ *
+ * The blocks are selected either independently (random), or one block
+ * from each stratum of 100/sample_percent consecutive blocks (stratified),
+ * which gives an even coverage of the relation. The selection depends only
+ * on the block number and a seed chosen at the start of the check, so the
+ * parallel workers (sharing the seed) select the same blocks as a serial
+ * check would.
+ *
+ * With pg_check.max_errors > 0 the check of a relation stops once that
+ * many issues are reported (the rest of the blocks, the indexes and the
+ * cross-check are skipped).
+ */
+
+/* sampling methods (pg_check.sample_method) */
+#define SAMPLE_RANDOM		0	/* each block with the probability */
+#define SAMPLE_STRATIFIED	1	/* one block from each stratum */
+
+/* what to do with blocks not sampled (pg_check.unsampled_pages) */
+#define UNSAMPLED_HEADER	0	/* only the page checks */
+#define UNSAMPLED_SKIP		1	/* don't read the block at all */
+
+/* GUC variables (defined in pg_check.c) */
+extern double	pgcheck_sample_percent;
+extern int		pgcheck_sample_method;
+extern int		pgcheck_unsampled_pages;
+extern int		pgcheck_max_errors;
+
+/* Starts sampling for a new check (chooses a new seed). */
+void sample_begin(void);
+
+/* The seed of the current check (passed to the parallel workers). */
+uint32 sample_get_seed(void);
+void sample_set_seed(uint32 seed);
+
+/* Are only some of the blocks checked fully? */
+bool sample_enabled(void);
+
+/* Should the block get the full checks? (always true without sampling) */
+bool sample_block(BlockNumber blkno);
+
+/* Should the unsampled blocks be skipped entirely (not even read)? */
+bool sample_skip_unsampled(void);
+
+/* Was the limit of issues (pg_check.max_errors) reached? */
+bool check_stop(void);
+
+#endif   /* SAMPLE_CHECK_H */
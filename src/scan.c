@@ -0,0 +1,146 @@
+#include "scan.h"
+#include "pg_check.h"
+#include "stats.h"
+
+#include "executor/instrument.h"
+#include "miscadmin.h"
+
+/* I/O budget shared by all the scans of a check (see scan_budget_reset) */
+typedef struct scan_budget {
+
+	int			cost_balance;	/* cost accumulated since the last delay */
+	TimestampTz	rate_start;		/* start of the check (for the max_rate) */
+	uint64		rate_bytes;		/* bytes read since the start */
+
+} scan_budget;
+
+static scan_budget budget = {0, 0, 0};
+
+static void block_scan_delay(void);
+
+/* new budget for a top-level check */
+void scan_budget_reset(void) {
+
+	budget.cost_balance = 0;
+	budget.rate_start = GetCurrentTimestamp();
+	budget.rate_bytes = 0;
+
+}
+
+/* prepares the scan (nothing is read or prefetched yet) */
+void block_scan_init(block_scan *scan, Relation rel, ForkNumber forknum,
+					 BlockNumber blockFrom, BlockNumber blockTo,
+					 BufferAccessStrategy strategy) {
+
+	scan->rel = rel;
+	scan->forknum = forknum;
+	scan->strategy = strategy;
+	scan->blockTo = blockTo;
+
+	scan->distance = pgcheck_prefetch_distance;
+	scan->prefetchNext = blockFrom;
+
+}
+
+/* reads the block, keeps the prefetch window ahead of it */
+Buffer block_scan_read(block_scan *scan, BlockNumber blkno) {
+
+	Buffer	buf;
+	long	hits, misses;
+	instr_time	start;
+#if (PG_VERSION_NUM >= 90200)
+	long	dirtied;
+#endif
+
+	/* sleep if we're over the budget (before pinning another buffer) */
+	block_scan_delay();
+
+	/* the prefetch window starts right after the block (if we skipped some blocks) */
+	if (scan->prefetchNext <= blkno) {
+		scan->prefetchNext = blkno + 1;
+	}
+
+	/*
+	 * Request the blocks up to (blkno + distance) - in a steady state this
+	 * is just one new block for each block read, so the number of blocks
+	 * in flight stays at 'distance'.
+	 */
+	while ((scan->prefetchNext < scan->blockTo) &&
+		   (scan->prefetchNext - blkno <= scan->distance)) {
+		PrefetchBuffer(scan->rel, scan->forknum, scan->prefetchNext);
+		scan->prefetchNext++;
+	}
+
+	hits = pgBufferUsage.shared_blks_hit;
+	misses = pgBufferUsage.shared_blks_read;
+#if (PG_VERSION_NUM >= 90200)
+	dirtied = pgBufferUsage.shared_blks_dirtied;
+#endif
+
+	stats_start(&start);
+
+	buf = ReadBufferExtended(scan->rel, scan->forknum, blkno, RBM_NORMAL, scan->strategy);
+
+	stats_end(STATS_READ, &start);
+
+	/* what did the read cost (the same costs as for vacuum) */
+	hits = pgBufferUsage.shared_blks_hit - hits;
+	misses = pgBufferUsage.shared_blks_read - misses;
+
+	pgcheck_stats.buffer_hits += hits;
+	pgcheck_stats.buffer_misses += misses;
+
+	budget.cost_balance += hits * VacuumCostPageHit + misses * VacuumCostPageMiss;
+
+#if (PG_VERSION_NUM >= 90200)
+	/* setting hint bits dirties the page */
+	dirtied = pgBufferUsage.shared_blks_dirtied - dirtied;
+	budget.cost_balance += dirtied * VacuumCostPageDirty;
+#endif
+
+	/* only blocks actually read count towards the max_rate */
+	budget.rate_bytes += misses * BLCKSZ;
+
+	return buf;
+
+}
+
+/* sleeps when the cost limit is exceeded, or when reading faster than max_rate */
+static void block_scan_delay(void) {
+
+	/* cost-based delay, the same formula as vacuum_delay_point */
+	if ((pgcheck_cost_delay > 0) && (budget.cost_balance >= pgcheck_cost_limit)) {
+
+		int msec = pgcheck_cost_delay * budget.cost_balance / pgcheck_cost_limit;
+
+		if (msec > pgcheck_cost_delay * 4) {
+			msec = pgcheck_cost_delay * 4;
+		}
+
+		pg_usleep(msec * 1000L);
+
+		budget.cost_balance = 0;
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	/* rate limit - sleep until the bytes read match the rate */
+	if ((pgcheck_max_rate > 0) && (budget.rate_bytes > 0)) {
+
+		long	secs;
+		int		usecs;
+		int64	elapsed;
+		int64	expected;
+
+		TimestampDifference(budget.rate_start, GetCurrentTimestamp(), &secs, &usecs);
+
+		elapsed = (int64) secs * 1000000L + usecs;
+		expected = (int64) (budget.rate_bytes * 1000000.0 / ((double) pgcheck_max_rate * 1024 * 1024));
+
+		if (expected > elapsed) {
+			pg_usleep((long) (expected - elapsed));
+			CHECK_FOR_INTERRUPTS();
+		}
+	}
+
+}
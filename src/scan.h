@@ -0,0 +1,64 @@
+#ifndef SCAN_CHECK_H
+#define SCAN_CHECK_H
+
+#include "postgres.h"
+#include "storage/bufmgr.h"
+#include "utils/rel.h"
+#include "utils/timestamp.h"
+
+/* sequential scan of a range of blocks of a relation fork */
+typedef struct block_scan {
+
+	Relation	rel;		/* relation to read */
+	ForkNumber	forknum;	/* fork to read */
+	BufferAccessStrategy strategy;	/* bulk read strategy */
+
+	BlockNumber	blockTo;	/* first block not to read (end of range) */
+
+	int			distance;		/* how many blocks to prefetch ahead */
+	BlockNumber	prefetchNext;	/* next block to prefetch */
+
+} block_scan;
+
+/* Starts a new I/O budget (pg_check.cost_limit / pg_check.max_rate). All
+ * the scans share a single budget, so that a top-level check (e.g. of a
+ * table with many indexes, or of a whole database) is throttled as a whole
+ * and not each scan separately. Called at the start of each top-level
+ * check (and by the parallel workers, which get a share of the limits,
+ * see worker_io_budget). */
+void scan_budget_reset(void);
+
+/* Prepares a scan of blocks [blockFrom, blockTo) of a relation fork.
+ *
+ * - scan : the scan to initialize
+ * - rel : relation to read (locked by the caller)
+ * - forknum : relation fork
+ * - blockFrom : first block to read
+ * - blockTo : first block not to read
+ * - strategy : buffer access strategy used to read the blocks
+ *
+ * The prefetch distance is determined by pg_check.prefetch_distance.
+ * The scan is throttled according to pg_check.cost_delay/cost_limit and
+ * pg_check.max_rate (see block_scan_read), using the budget shared by all
+ * the scans of the check (see scan_budget_reset).
+ */
+void block_scan_init(block_scan *scan, Relation rel, ForkNumber forknum,
+					 BlockNumber blockFrom, BlockNumber blockTo,
+					 BufferAccessStrategy strategy);
+
+/* Reads the block into a buffer (pinned, but not locked), and issues
+ * prefetch requests for the following blocks, so that there are always
+ * up to 'distance' blocks requested ahead of the block being checked.
+ *
+ * The blocks are expected to be read in ascending order, but skipping
+ * blocks is fine.
+ *
+ * Before reading the block the scan may sleep, either because the cost
+ * of the preceding reads reached pg_check.cost_limit (the same as for
+ * cost-based vacuum delay, with the vacuum_cost_page_* costs), or to
+ * keep the rate of blocks read from disk under pg_check.max_rate. The
+ * caller should not hold any buffer locks at that point.
+ */
+Buffer block_scan_read(block_scan *scan, BlockNumber blkno);
+
+#endif   /* SCAN_CHECK_H */
@@ -0,0 +1,91 @@
+#include "stats.h"
+
+#include "funcapi.h"
+#include "utils/builtins.h"
+
+#if (PG_VERSION_NUM >= 90300)
+#include "access/htup_details.h"
+#endif
+
+/* number of columns returned by pg_check_stats */
+#define STATS_COLUMNS	(6 + STATS_PHASES)
+
+check_stats pgcheck_stats;
+
+/* pg_check.track_timing (defined in _PG_init, but here so that the stats
+ * work in the benchmark library too) */
+bool	pgcheck_track_timing = false;
+
+/* reset at the start of a check */
+void stats_reset(void) {
+
+	memset(&pgcheck_stats, 0, sizeof(check_stats));
+
+	INSTR_TIME_SET_CURRENT(pgcheck_stats.start);
+
+}
+
+/* total duration of the check */
+void stats_finish(void) {
+
+	INSTR_TIME_SET_CURRENT(pgcheck_stats.total);
+	INSTR_TIME_SUBTRACT(pgcheck_stats.total, pgcheck_stats.start);
+
+}
+
+/* add the stats of a worker (not the start and the total duration) */
+void stats_add(check_stats *stats, const check_stats *other) {
+
+	int		i;
+
+	for (i = 0; i < STATS_PHASES; i++) {
+		INSTR_TIME_ADD(stats->time[i], other->time[i]);
+	}
+
+	stats->pages += other->pages;
+	stats->tuples += other->tuples;
+	stats->attributes += other->attributes;
+	stats->buffer_hits += other->buffer_hits;
+	stats->buffer_misses += other->buffer_misses;
+	stats->issues += other->issues;
+
+}
+
+/*
+ * pg_check_stats
+ *
+ * Returns the counters and durations (in milliseconds) of the last check.
+ */
+PG_FUNCTION_INFO_V1(pg_check_stats);
+
+Datum
+pg_check_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc	tupdesc;
+	Datum		values[STATS_COLUMNS];
+	bool		nulls[STATS_COLUMNS];
+	int			i;
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupdesc = BlessTupleDesc(tupdesc);
+
+	memset(nulls, 0, sizeof(nulls));
+
+	values[0] = Int64GetDatum((int64) pgcheck_stats.pages);
+	values[1] = Int64GetDatum((int64) pgcheck_stats.tuples);
+	values[2] = Int64GetDatum((int64) pgcheck_stats.attributes);
+	values[3] = Int64GetDatum((int64) pgcheck_stats.buffer_hits);
+	values[4] = Int64GetDatum((int64) pgcheck_stats.buffer_misses);
+	values[5] = Float8GetDatum(INSTR_TIME_GET_MILLISEC(pgcheck_stats.total));
+
+	/* the phases are not timed without pg_check.track_timing */
+	for (i = 0; i < STATS_PHASES; i++)
+	{
+		values[6 + i] = Float8GetDatum(INSTR_TIME_GET_MILLISEC(pgcheck_stats.time[i]));
+		nulls[6 + i] = !pgcheck_track_timing;
+	}
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
@@ -0,0 +1,94 @@
+#ifndef STATS_CHECK_H
+#define STATS_CHECK_H
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "portability/instr_time.h"
+
+/*
+ * Instrumentation of the last check in this backend - time spent in the
+ * phases of the check, and counters of pages, tuples etc. The counters
+ * are always updated, the timing only with pg_check.track_timing (as
+ * that means a few clock reads for each page). Reset at the start of each
+ * check (of a table or an index), and returned by pg_check_stats().
+ *
+ * With parallel checks of a table, each worker adds its stats to the
+ * shared state, and the leader includes them in its own (so the phase
+ * durations are summed over all the processes, and may add up to more
+ * than the total duration of the check).
+ */
+
+/* timed phases of the check */
+typedef enum
+{
+        STATS_READ,				/* reading the buffers (incl. I/O) */
+        STATS_COPY,				/* copying the pages (memcpy) */
+        STATS_HEADER,			/* page header checks */
+        STATS_TUPLES,			/* heap tuple (and attribute) checks */
+        STATS_INDEX,			/* index page and tuple checks */
+        STATS_BITMAP_BUILD,		/* adding items to the bitmaps (or sorts) */
+        STATS_BITMAP_COMPARE,	/* comparing the bitmaps (or merging) */
+        STATS_CHECKSUM,			/* verifying the page checksums */
+        STATS_PHASES
+}       StatsPhase;
+
+typedef struct check_stats {
+
+	instr_time	start;						/* start of the check */
+	instr_time	total;						/* duration of the whole check */
+	instr_time	time[STATS_PHASES];			/* duration of the phases */
+
+	uint64		pages;			/* pages checked */
+	uint64		tuples;			/* heap items checked */
+	uint64		attributes;		/* heap attributes checked */
+	uint64		buffer_hits;	/* buffers found in shared buffers */
+	uint64		buffer_misses;	/* buffers read from disk */
+	uint64		issues;			/* issues reported (for pg_check.max_errors) */
+
+} check_stats;
+
+#ifdef FRONTEND
+/* per thread in the offline checker (see fe-compat.c) */
+extern __thread check_stats pgcheck_stats;
+#else
+extern check_stats pgcheck_stats;
+#endif
+
+/* GUC variable (pg_check.track_timing) */
+extern bool	pgcheck_track_timing;
+
+/* Resets the stats at the start of a check. */
+void stats_reset(void);
+
+/* Computes the total duration at the end of a check. */
+void stats_finish(void);
+
+/* Adds the counters and phase durations of another process (a parallel
+ * worker) to the stats. */
+void stats_add(check_stats *stats, const check_stats *other);
+
+/* Returns the stats of the last check. */
+Datum pg_check_stats(PG_FUNCTION_ARGS);
+
+/* Starts timing a phase (does nothing without pg_check.track_timing). */
+static inline void
+stats_start(instr_time *start)
+{
+	if (pgcheck_track_timing)
+		INSTR_TIME_SET_CURRENT(*start);
+}
+
+/* Adds the time since stats_start to the phase. */
+static inline void
+stats_end(StatsPhase phase, instr_time *start)
+{
+	if (pgcheck_track_timing)
+	{
+		instr_time	now;
+
+		INSTR_TIME_SET_CURRENT(now);
+		INSTR_TIME_ACCUM_DIFF(pgcheck_stats.time[phase], now, *start);
+	}
+}
+
+#endif   /* STATS_CHECK_H */
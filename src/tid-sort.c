@@ -0,0 +1,225 @@
+#include "tid-sort.h"
+
+#include "access/itup.h"
+#include "catalog/pg_operator.h"
+#include "catalog/pg_type.h"
+#include "storage/bufmgr.h"
+
+#include "progress.h"
+#include "scan.h"
+
+static uint64 tid_encode(ItemPointer tid);
+static ItemPointer tid_sort_peek(tid_sort * sort);
+static void tid_sort_merge_page(tid_sort * sort, BlockNumber blkno, const uint64 *roots, int ntuples,
+								uint64 * ndiffs, bitmap_diff_callback callback, void *arg);
+static bool tid_sort_is_root(const uint64 *roots, int item);
+static void tid_sort_diff(BlockNumber page, int item, bool in_heap, uint64 * ndiffs,
+						  bitmap_diff_callback callback, void *arg);
+
+/* start the sort (TIDs encoded as int8 values) */
+tid_sort * tid_sort_begin(int workMem) {
+
+	tid_sort * sort = (tid_sort*)palloc0(sizeof(tid_sort));
+
+	sort->sortstate = tuplesort_begin_datum(INT8OID, Int8LessOperator,
+#if (PG_VERSION_NUM >= 90100)
+											InvalidOid,
+#endif
+											false, workMem, false);
+
+	return sort;
+
+}
+
+/* add the TIDs (e.g. from an index page) */
+void tid_sort_add_tids(tid_sort * sort, ItemPointerData * tids, int ntids) {
+
+	int i;
+
+	Assert(! sort->sorted);
+
+	for (i = 0; i < ntids; i++) {
+
+		Datum value = Int64GetDatum((int64) tid_encode(&tids[i]));
+
+		tuplesort_putdatum(sort->sortstate, value, false);
+
+#ifndef USE_FLOAT8_BYVAL
+		/* the sort keeps its own copy */
+		pfree(DatumGetPointer(value));
+#endif
+
+		sort->ntids++;
+	}
+
+}
+
+/* merge the sorted TIDs with the heap, page by page */
+void tid_sort_merge(Relation heap, BlockNumber nblocks, tid_sort ** sorts, int nsorts,
+					uint64 * ndiffs, bitmap_diff_callback callback, void ** args) {
+
+	uint64		roots[BITMAP_PAGE_WORDS];
+	BlockNumber	blkno;
+	BufferAccessStrategy strategy = GetAccessStrategy(BAS_BULKREAD);
+	block_scan	scan;
+	int			i;
+
+	for (i = 0; i < nsorts; i++) {
+		tuplesort_performsort(sorts[i]->sortstate);
+		sorts[i]->sorted = true;
+		ndiffs[i] = 0;
+	}
+
+	block_scan_init(&scan, heap, MAIN_FORKNUM, 0, nblocks, strategy);
+
+	for (blkno = 0; blkno < nblocks; blkno++) {
+
+		Buffer	buf;
+		Page	page;
+		int		ntuples;
+
+		buf = block_scan_read(&scan, blkno);
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+
+		page = BufferGetPage(buf);
+
+		/* items that should be in the indexes (the same as added to the
+		 * bitmap, a corrupted page can't have more items than possible,
+		 * which is reported by the heap checks already) */
+		ntuples = bitmap_heap_roots((PageHeader) page, (char *) page, roots);
+		ntuples = Min(ntuples, MaxHeapTuplesPerPage);
+
+		LockBuffer(buf, BUFFER_LOCK_UNLOCK);
+		ReleaseBuffer(buf);
+
+		progress_blocks(1);
+
+		for (i = 0; i < nsorts; i++) {
+			tid_sort_merge_page(sorts[i], blkno, roots, ntuples, &ndiffs[i],
+								callback, (args != NULL) ? args[i] : NULL);
+		}
+	}
+
+	/* whatever remains points to pages beyond the end of the heap */
+	for (i = 0; i < nsorts; i++) {
+
+		ItemPointer tid;
+
+		while ((tid = tid_sort_peek(sorts[i])) != NULL) {
+			tid_sort_diff(ItemPointerGetBlockNumber(tid), ItemPointerGetOffsetNumber(tid) - 1,
+						  false, &ndiffs[i], callback, (args != NULL) ? args[i] : NULL);
+			sorts[i]->have_next = false;
+		}
+	}
+
+	FreeAccessStrategy(strategy);
+
+}
+
+/* release the sort */
+void tid_sort_end(tid_sort * sort) {
+
+	tuplesort_end(sort->sortstate);
+	pfree(sort);
+
+}
+
+/* merge TIDs of a single heap page (the roots are the items that should be
+ * in the index), the TIDs of the preceding pages are all merged already */
+static void tid_sort_merge_page(tid_sort * sort, BlockNumber blkno, const uint64 *roots, int ntuples,
+								uint64 * ndiffs, bitmap_diff_callback callback, void *arg) {
+
+	ItemPointer tid;
+	int		item = 0;
+
+	while (((tid = tid_sort_peek(sort)) != NULL) && (ItemPointerGetBlockNumber(tid) == blkno)) {
+
+		int	off = (int) ItemPointerGetOffsetNumber(tid) - 1;
+
+		sort->have_next = false;
+
+		/* the same TID repeated in the index (the bitmap does not notice
+		 * that either), but an invalid offset is always a difference */
+		if ((off < item) && (off >= 0)) {
+			continue;
+		}
+
+		/* items skipped by the index */
+		for (; (item < off) && (item < ntuples); item++) {
+			if (tid_sort_is_root(roots, item)) {
+				tid_sort_diff(blkno, item, true, ndiffs, callback, arg);
+			}
+		}
+
+		/* item not in the heap (or not one that should be indexed) */
+		if ((off < 0) || (off >= ntuples) || (! tid_sort_is_root(roots, off))) {
+			tid_sort_diff(blkno, off, false, ndiffs, callback, arg);
+		}
+
+		item = Max(item, off + 1);
+	}
+
+	/* items after the last TID on this page */
+	for (; item < ntuples; item++) {
+		if (tid_sort_is_root(roots, item)) {
+			tid_sort_diff(blkno, item, true, ndiffs, callback, arg);
+		}
+	}
+
+}
+
+/* is the item in the mask of roots (from bitmap_heap_roots)? */
+static bool tid_sort_is_root(const uint64 *roots, int item) {
+
+	return (roots[item / 64] & ((uint64) 1 << (item % 64))) != 0;
+
+}
+
+/* returns the next TID from the sort (or NULL when there are no more),
+ * without consuming it (that's done by resetting have_next) */
+static ItemPointer tid_sort_peek(tid_sort * sort) {
+
+	if (! sort->have_next && ! sort->exhausted) {
+
+		Datum	value;
+		bool	isnull;
+
+		if (tuplesort_getdatum(sort->sortstate, true, &value, &isnull
+#if (PG_VERSION_NUM >= 90500)
+							   , NULL
+#endif
+							   )) {
+
+			uint64	tid = (uint64) DatumGetInt64(value);
+
+			ItemPointerSet(&sort->next, (BlockNumber) (tid >> 16), (OffsetNumber) (tid & 0xFFFF));
+			sort->have_next = true;
+
+#ifndef USE_FLOAT8_BYVAL
+			pfree(DatumGetPointer(value));
+#endif
+		} else {
+			sort->exhausted = true;
+		}
+	}
+
+	return (sort->have_next) ? &sort->next : NULL;
+
+}
+
+/* report the difference (the same way as bitmap_compare) */
+static void tid_sort_diff(BlockNumber page, int item, bool in_heap, uint64 * ndiffs,
+						  bitmap_diff_callback callback, void *arg) {
+
+	if ((callback == NULL) || callback(page, item, in_heap, arg)) {
+		(*ndiffs)++;
+	}
+
+}
+
+/* TID as a 48-bit value, ordered by (block, offset) */
+static uint64 tid_encode(ItemPointer tid) {
+
+	return ((uint64) ItemPointerGetBlockNumber(tid) << 16) | ItemPointerGetOffsetNumber(tid);
+
+}
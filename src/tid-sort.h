@@ -0,0 +1,78 @@
+#ifndef TID_SORT_CHECK_H
+#define TID_SORT_CHECK_H
+
+#include "postgres.h"
+#include "storage/bufpage.h"
+#include "storage/itemptr.h"
+#include "utils/rel.h"
+#include "utils/tuplesort.h"
+
+#include "item-bitmap.h"
+
+/* how to cross-check the table and indexes */
+typedef enum
+{
+        CROSS_CHECK_BITMAP,
+        CROSS_CHECK_SORT
+}       CrossCheckMethod;
+
+/* TIDs of an index, sorted using a tuplesort (may spill to disk) */
+typedef struct tid_sort {
+
+	Tuplesortstate *sortstate;
+
+	/* number of TIDs added to the sort */
+	uint64	ntids;
+
+	/* the sort was performed (no more TIDs may be added) */
+	bool	sorted;
+
+	/* the next TID (already read from the sort, not merged yet) */
+	bool	have_next;
+	bool	exhausted;
+	ItemPointerData	next;
+
+} tid_sort;
+
+/* Starts a new sort of TIDs.
+ *
+ * - workMem : memory for the sort (in kB), the sort spills to disk when
+ *             there are more TIDs
+ *
+ * The TIDs are encoded as int8 values (block << 16 | offset), so that the
+ * order of the values matches the physical order of the heap items.
+ */
+tid_sort * tid_sort_begin(int workMem);
+
+/* Adds a batch of TIDs (e.g. all TIDs from an index leaf page) to the sort.
+ *
+ * - sort : the sort to add the TIDs to
+ * - tids : heap TIDs
+ * - ntids : number of TIDs
+ */
+void tid_sort_add_tids(tid_sort * sort, ItemPointerData * tids, int ntids);
+
+/* Merges the sorted TIDs of the indexes with a sequential scan of the heap.
+ *
+ * - heap : heap relation (locked by the caller)
+ * - nblocks : number of heap blocks to scan
+ * - sorts : the index sorts (at least one, all added to)
+ * - nsorts : number of sorts
+ * - ndiffs : output array, number of differences for each sort
+ * - callback : called for each difference (may be NULL)
+ * - args : array of arguments passed to the callback (one per sort)
+ *
+ * This is a second read of the heap (after the heap check itself), the
+ * price for the bounded memory - but only one, no matter the number of
+ * indexes. For each page the items that should be in the indexes (the
+ * roots collected by bitmap_heap_roots) are compared to the TIDs of the
+ * page from each sort. The callback gets the same arguments as with
+ * bitmap_compare (with the heap as the first bitmap).
+ */
+void tid_sort_merge(Relation heap, BlockNumber nblocks, tid_sort ** sorts, int nsorts,
+					uint64 * ndiffs, bitmap_diff_callback callback, void ** args);
+
+/* Releases the sort (including the temporary files). */
+void tid_sort_end(tid_sort * sort);
+
+#endif   /* TID_SORT_CHECK_H */
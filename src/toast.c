@@ -0,0 +1,287 @@
+#include "toast.h"
+#include "common.h"
+
+#include "access/genam.h"
+#include "access/heapam.h"
+#include "access/nbtree.h"
+#include "access/tuptoaster.h"
+#include "miscadmin.h"
+#include "utils/fmgroids.h"
+#include "utils/rel.h"
+#include "utils/tqual.h"
+
+#if (PG_VERSION_NUM >= 90300)
+#include "access/htup_details.h"
+#endif
+
+/* state of the ordered scan of the TOAST index */
+typedef struct toast_scan {
+
+	Relation	toastrel;
+	Relation	toastidx;
+	IndexScanDesc scan;
+	ScanKeyData	key;
+
+	HeapTuple	tuple;		/* current chunk (NULL at the end) */
+	Oid			valueid;	/* chunk_id of the current chunk */
+	int32		seq;		/* chunk_seq of the current chunk */
+
+} toast_scan;
+
+static void toast_scan_seek(toast_scan *scan, Oid valueid);
+static void toast_scan_next(toast_scan *scan);
+static uint32 toast_check_value(toast_scan *scan, toast_ref *ref);
+static int toast_ref_cmp(const void *a, const void *b);
+
+/* collects the references of the table (if it has a TOAST relation) */
+toast_refs * toast_refs_begin(Relation rel) {
+
+	toast_refs *refs;
+
+	if (!OidIsValid(rel->rd_rel->reltoastrelid)) {
+		return NULL;
+	}
+
+	refs = (toast_refs *) palloc(sizeof(toast_refs));
+
+	refs->toastrelid = rel->rd_rel->reltoastrelid;
+	refs->nrefs = 0;
+	refs->maxrefs = 1024;
+	refs->refs = (toast_ref *) palloc(sizeof(toast_ref) * refs->maxrefs);
+
+	return refs;
+
+}
+
+/* the rest of the values, and release the batch */
+uint32 toast_refs_end(toast_refs *refs) {
+
+	uint32	nerrs = toast_refs_check(refs);
+
+	pfree(refs->refs);
+	pfree(refs);
+
+	return nerrs;
+
+}
+
+/* checks the batch with an ordered scan of the TOAST index */
+uint32 toast_refs_check(toast_refs *refs) {
+
+	toast_scan	scan;
+	List	   *indexes;
+	uint32		nerrs = 0;
+	int			nrefs = 0;
+	int			i;
+
+	if (refs->nrefs == 0) {
+		return 0;
+	}
+
+	/* sort by value ID, and keep only the first reference to each value
+	 * (an updated tuple shares the value with the new version, and a page
+	 * checked in place and then again adds the references twice) */
+	qsort(refs->refs, refs->nrefs, sizeof(toast_ref), toast_ref_cmp);
+
+	for (i = 0; i < refs->nrefs; i++) {
+		if ((nrefs == 0) || (refs->refs[nrefs - 1].valueid != refs->refs[i].valueid)) {
+			refs->refs[nrefs++] = refs->refs[i];
+		}
+	}
+
+	memset(&scan, 0, sizeof(toast_scan));
+
+	scan.toastrel = heap_open(refs->toastrelid, AccessShareLock);
+
+	/* the TOAST relation has a single index (on chunk_id, chunk_seq) */
+	indexes = RelationGetIndexList(scan.toastrel);
+
+	if (indexes == NIL) {
+		elog(ERROR, "no index on TOAST relation \"%s\"",
+			 RelationGetRelationName(scan.toastrel));
+	}
+
+	scan.toastidx = index_open(linitial_oid(indexes), AccessShareLock);
+
+	/*
+	 * All the chunks, not just the visible ones - the referencing tuples
+	 * are committed, so their values are too (and the duplicate chunks of
+	 * values from aborted transactions are ignored).
+	 */
+	ScanKeyInit(&scan.key, (AttrNumber) 1, BTGreaterEqualStrategyNumber,
+				F_OIDGE, ObjectIdGetDatum(refs->refs[0].valueid));
+
+	scan.scan = index_beginscan(scan.toastrel, scan.toastidx, SnapshotAny, 1, 0);
+
+	toast_scan_seek(&scan, refs->refs[0].valueid);
+
+	for (i = 0; i < nrefs; i++) {
+
+		toast_ref  *ref = &refs->refs[i];
+		int			nskipped = 0;
+
+		/* skip the chunks of values not in the batch (reposition the scan
+		 * if there are too many of them) */
+		while ((scan.tuple != NULL) && (scan.valueid < ref->valueid)) {
+
+			if (++nskipped > TOAST_SKIP_CHUNKS) {
+				toast_scan_seek(&scan, ref->valueid);
+				break;
+			}
+
+			toast_scan_next(&scan);
+		}
+
+		nerrs += toast_check_value(&scan, ref);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	index_endscan(scan.scan);
+
+	index_close(scan.toastidx, AccessShareLock);
+	heap_close(scan.toastrel, AccessShareLock);
+
+	list_free(indexes);
+
+	refs->nrefs = 0;
+
+	return nerrs;
+
+}
+
+/* checks the chunks of the value (the scan is at the first chunk with
+ * chunk_id >= valueid, and moves right after the last chunk of the value) */
+static uint32 toast_check_value(toast_scan *scan, toast_ref *ref) {
+
+	uint32	nerrs = 0;
+	int32	nchunks = (ref->extsize - 1) / TOAST_MAX_CHUNK_SIZE + 1;
+	int32	nextseq = 0;
+	bool	found = false;
+
+	for (; (scan->tuple != NULL) && (scan->valueid == ref->valueid); toast_scan_next(scan)) {
+
+		TupleDesc	desc = RelationGetDescr(scan->toastrel);
+		bool		isnull;
+		Pointer		chunk;
+		int32		size;
+		int32		expected;
+
+		found = true;
+
+		/* another copy of a chunk already seen (aborted insert) */
+		if (scan->seq < nextseq) {
+			continue;
+		}
+
+		if (scan->seq > nextseq) {
+			check_report(WARNING, ref->block, ref->offnum, "toast_chunk_missing",
+						 "TOAST value %u is missing chunks %d - %d",
+						 ref->valueid, nextseq, scan->seq - 1);
+			nerrs++;
+		}
+
+		nextseq = scan->seq + 1;
+
+		chunk = DatumGetPointer(heap_getattr(scan->tuple, 3, desc, &isnull));
+
+		if (isnull) {
+			check_report(WARNING, ref->block, ref->offnum, "toast_chunk_null",
+						 "TOAST value %u has NULL chunk %d", ref->valueid, scan->seq);
+			nerrs++;
+			continue;
+		}
+
+		/* the chunk itself is never compressed nor external */
+		if (!VARATT_IS_EXTENDED(chunk)) {
+			size = VARSIZE(chunk) - VARHDRSZ;
+		} else if (VARATT_IS_SHORT(chunk)) {
+			size = VARSIZE_SHORT(chunk) - VARHDRSZ_SHORT;
+		} else {
+			check_report(WARNING, ref->block, ref->offnum, "toast_chunk_format",
+						 "TOAST value %u has compressed or external chunk %d",
+						 ref->valueid, scan->seq);
+			nerrs++;
+			continue;
+		}
+
+		if (scan->seq >= nchunks) {
+			continue;	/* reported at the end */
+		}
+
+		expected = (scan->seq < nchunks - 1) ?
+						TOAST_MAX_CHUNK_SIZE : ref->extsize - (nchunks - 1) * TOAST_MAX_CHUNK_SIZE;
+
+		if (size != expected) {
+			check_report(WARNING, ref->block, ref->offnum, "toast_chunk_size",
+						 "TOAST value %u has chunk %d of size %d (expected %d)",
+						 ref->valueid, scan->seq, size, expected);
+			nerrs++;
+		}
+	}
+
+	if (!found) {
+		check_report(WARNING, ref->block, ref->offnum, "toast_missing",
+					 "TOAST value %u not found in the TOAST relation", ref->valueid);
+		nerrs++;
+	} else if (nextseq < nchunks) {
+		check_report(WARNING, ref->block, ref->offnum, "toast_chunk_missing",
+					 "TOAST value %u is missing chunks %d - %d",
+					 ref->valueid, nextseq, nchunks - 1);
+		nerrs++;
+	} else if (nextseq > nchunks) {
+		check_report(WARNING, ref->block, ref->offnum, "toast_chunks_extra",
+					 "TOAST value %u has %d chunks (expected %d)",
+					 ref->valueid, nextseq, nchunks);
+		nerrs++;
+	}
+
+	return nerrs;
+
+}
+
+/* (re)starts the scan at the first chunk of the value */
+static void toast_scan_seek(toast_scan *scan, Oid valueid) {
+
+	scan->key.sk_argument = ObjectIdGetDatum(valueid);
+
+	index_rescan(scan->scan, &scan->key, 1, NULL, 0);
+
+	toast_scan_next(scan);
+
+}
+
+/* moves to the next chunk (in chunk_id, chunk_seq order) */
+static void toast_scan_next(toast_scan *scan) {
+
+	TupleDesc	desc = RelationGetDescr(scan->toastrel);
+	bool		isnull;
+
+	scan->tuple = index_getnext(scan->scan, ForwardScanDirection);
+
+	if (scan->tuple == NULL) {
+		return;
+	}
+
+	scan->valueid = DatumGetObjectId(heap_getattr(scan->tuple, 1, desc, &isnull));
+	scan->seq = DatumGetInt32(heap_getattr(scan->tuple, 2, desc, &isnull));
+
+}
+
+/* by value ID (and the first reference to each value) */
+static int toast_ref_cmp(const void *a, const void *b) {
+
+	const toast_ref *ra = (const toast_ref *) a;
+	const toast_ref *rb = (const toast_ref *) b;
+
+	if (ra->valueid != rb->valueid) {
+		return (ra->valueid < rb->valueid) ? -1 : 1;
+	}
+
+	if (ra->block != rb->block) {
+		return (ra->block < rb->block) ? -1 : 1;
+	}
+
+	return (ra->offnum < rb->offnum) ? -1 : (ra->offnum > rb->offnum);
+
+}
@@ -0,0 +1,115 @@
+#ifndef TOAST_CHECK_H
+#define TOAST_CHECK_H
+
+#include "postgres.h"
+#include "storage/block.h"
+#include "storage/off.h"
+#include "utils/relcache.h"
+
+/*
+ * Verification of the TOAST values referenced from a table.
+ *
+ * Looking up each value in the TOAST relation would mean a random probe
+ * into the TOAST index (and table) for each value. Instead, the heap checks
+ * only collect the references (value ID and size) into a batch, and when
+ * the batch is full (or at the end of the scan), the batch is sorted and
+ * verified with a single ordered scan of the TOAST index, merged with the
+ * sorted references. The scan is repositioned when it would have to skip
+ * many chunks of values not referenced by the batch.
+ *
+ * For each value the chunks have to be present, numbered from 0 without
+ * gaps, with the expected sizes (TOAST_MAX_CHUNK_SIZE, except for the last
+ * one) adding up to the stored size of the value.
+ *
+ * Only values referenced by tuples known to be live from the hint bits
+ * (inserted by a committed transaction, and not deleted or updated) are
+ * collected, because the TOAST values of dead tuples may be already
+ * removed by a vacuum of the TOAST relation.
+ */
+
+/* reference to a TOAST value from a heap tuple */
+typedef struct toast_ref {
+
+	Oid			valueid;	/* va_valueid */
+	int32		extsize;	/* va_extsize (stored size, maybe compressed) */
+	BlockNumber	block;		/* heap tuple referencing the value */
+	OffsetNumber offnum;
+
+} toast_ref;
+
+/* batch of references to check */
+typedef struct toast_refs {
+
+	Oid			toastrelid;	/* TOAST relation of the table */
+	int			nrefs;
+	int			maxrefs;
+	toast_ref  *refs;
+
+} toast_refs;
+
+/* number of references checked at once (about 1.5MB) */
+#define TOAST_BATCH_REFS	65536
+
+/* chunks of unreferenced values skipped before repositioning the scan */
+#define TOAST_SKIP_CHUNKS	64
+
+/* most references on a single heap page (each one takes at least the
+ * size of an external TOAST pointer) */
+#define TOAST_PAGE_REFS		((int) (BLCKSZ / (VARHDRSZ_EXTERNAL + sizeof(varatt_external))))
+
+/* makes room for the references of a whole heap page, so that adding them
+ * does not allocate memory (call before locking the heap page, the pages
+ * checked in place are checked while locked) */
+static inline void
+toast_refs_reserve(toast_refs *refs)
+{
+	if (refs->nrefs + TOAST_PAGE_REFS > refs->maxrefs)
+	{
+		while (refs->nrefs + TOAST_PAGE_REFS > refs->maxrefs)
+			refs->maxrefs *= 2;
+
+		refs->refs = (toast_ref *) repalloc(refs->refs, sizeof(toast_ref) * refs->maxrefs);
+	}
+}
+
+/* adds a reference to the batch (called by the heap checks, the room has
+ * to be reserved by toast_refs_reserve before checking the page) */
+static inline void
+toast_refs_add(toast_refs *refs, Oid valueid, int32 extsize,
+			   BlockNumber block, OffsetNumber offnum)
+{
+	Assert(refs->nrefs < refs->maxrefs);
+
+	/* more references than fit on a page (can't happen) */
+	if (refs->nrefs == refs->maxrefs)
+		return;
+
+	refs->refs[refs->nrefs].valueid = valueid;
+	refs->refs[refs->nrefs].extsize = extsize;
+	refs->refs[refs->nrefs].block = block;
+	refs->refs[refs->nrefs].offnum = offnum;
+	refs->nrefs++;
+}
+
+#ifndef FRONTEND
+
+/* GUC variable (defined in pg_check.c) */
+extern bool	pgcheck_check_toast;
+
+/* Starts collecting the references for the table (NULL if the table
+ * has no TOAST relation). */
+toast_refs * toast_refs_begin(Relation rel);
+
+/* Is the batch full (i.e. should it be checked now)? */
+#define toast_refs_full(refs)	((refs)->nrefs >= TOAST_BATCH_REFS)
+
+/* Checks the values in the batch, and empties it. Returns number of issues. */
+uint32 toast_refs_check(toast_refs *refs);
+
+/* Checks the remaining values and releases the batch. Returns number of
+ * issues. */
+uint32 toast_refs_end(toast_refs *refs);
+
+#endif
+
+#endif   /* TOAST_CHECK_H */
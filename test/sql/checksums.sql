@@ -0,0 +1,38 @@
+CREATE EXTENSION pg_check;
+
+CREATE TABLE test_table (
+    id      INT,
+    val     TEXT
+);
+
+INSERT INTO test_table SELECT i, md5(i::text) FROM generate_series(1,10000) s(i);
+
+CREATE INDEX test_table_index ON test_table (id);
+
+-- the checksums are verified only on clean pages
+CHECKPOINT;
+
+-- without data checksums the verification is skipped (checksums.out), with
+-- them the checksums of the clean pages are verified (checksums_1.out)
+SELECT current_setting('data_checksums') AS data_checksums;
+
+SET pg_check.verify_checksums = on;
+
+SELECT pg_check_table('test_table', true, true);
+
+SELECT pg_check_index('test_table_index');
+
+-- only the checksums (and all checks on the dirty pages)
+SET pg_check.checksum_depth = none;
+
+SELECT pg_check_table('test_table', true, false);
+
+SELECT pg_check_index('test_table_index');
+
+SET pg_check.checksum_depth = header;
+
+SELECT pg_check_table('test_table', true, false);
+
+DROP TABLE test_table;
+
+DROP EXTENSION pg_check;
@@ -0,0 +1,95 @@
+CREATE EXTENSION pg_check;
+
+-- the cross-check methods and modes on a single table (some of the rows
+-- updated, so that the table has HOT chains for some of the indexes)
+CREATE TABLE test_table (
+    id      INT,
+    id2     INT,
+    val     TEXT
+);
+
+INSERT INTO test_table SELECT i, i, md5(i::text) FROM generate_series(1,10000) s(i);
+
+UPDATE test_table SET id2 = -id2 WHERE id % 10 = 0;
+
+CREATE INDEX test_table_id_index ON test_table (id);
+CREATE INDEX test_table_id2_index ON test_table (id2);
+CREATE INDEX test_table_val_index ON test_table (val);
+
+SELECT pg_check_table('test_table', true, true);
+
+SET pg_check.multi_index = on;
+SELECT pg_check_table('test_table', true, true);
+RESET pg_check.multi_index;
+
+SET pg_check.cross_check_method = sort;
+SELECT pg_check_table('test_table', true, true);
+RESET pg_check.cross_check_method;
+
+SET pg_check.online_cross_check = on;
+SELECT pg_check_table('test_table', true, true);
+RESET pg_check.online_cross_check;
+
+DROP TABLE test_table;
+
+-- an index not matching the table: the index of another table (with the
+-- same rows, except that the first one is not indexed and there is one
+-- more row at the end) is copied over the index of the table - so the
+-- first item is missing in the index, and the index points to an item
+-- not in the table (the index is never read before that, the index
+-- build writes it directly to the file)
+CREATE TABLE test_table (id INT, val TEXT) WITH (autovacuum_enabled = false);
+CREATE TABLE test_table_src (id INT, val TEXT) WITH (autovacuum_enabled = false);
+
+INSERT INTO test_table SELECT i, md5(i::text) FROM generate_series(1,999) s(i);
+INSERT INTO test_table_src SELECT i, md5(i::text) FROM generate_series(1,1000) s(i);
+
+CREATE INDEX test_table_index ON test_table (id);
+CREATE INDEX test_table_src_index ON test_table_src (id) WHERE id <> 1;
+
+DO $$
+DECLARE
+    lo  OID;
+    fd  INT;
+BEGIN
+    lo := lo_create(0);
+    fd := lo_open(lo, 131072);  -- INV_WRITE
+    PERFORM lowrite(fd, pg_read_binary_file(pg_relation_filepath('test_table_src_index')));
+    PERFORM lo_close(fd);
+    PERFORM lo_export(lo, pg_relation_filepath('test_table_index'));
+    PERFORM lo_unlink(lo);
+END;
+$$;
+
+-- the expected differences are the first row, and the row only in the
+-- other table (the TIDs are the same in both tables)
+CREATE TABLE test_expected AS
+    SELECT ctid AS tid FROM test_table_src WHERE id IN (1, 1000);
+
+-- the TID beyond the items of the page is out of range of the bitmap
+SELECT relid, index_relid, check_code, format('(%s,%s)', blkno, offnum)::tid IN (SELECT tid FROM test_expected) AS expected
+  FROM pg_check_table_report('test_table', true, true) ORDER BY blkno, offnum;
+
+-- the same with all the indexes checked at once
+SET pg_check.multi_index = on;
+SELECT relid, index_relid, check_code, format('(%s,%s)', blkno, offnum)::tid IN (SELECT tid FROM test_expected) AS expected
+  FROM pg_check_table_report('test_table', true, true) ORDER BY blkno, offnum;
+RESET pg_check.multi_index;
+
+-- the merge of the sorted TIDs sees both differences on the heap pages
+SET pg_check.cross_check_method = sort;
+SELECT relid, index_relid, check_code, format('(%s,%s)', blkno, offnum)::tid IN (SELECT tid FROM test_expected) AS expected
+  FROM pg_check_table_report('test_table', true, true) ORDER BY blkno, offnum;
+RESET pg_check.cross_check_method;
+
+-- no concurrent changes, so the recheck confirms both differences
+SET pg_check.online_cross_check = on;
+SELECT relid, index_relid, check_code, format('(%s,%s)', blkno, offnum)::tid IN (SELECT tid FROM test_expected) AS expected
+  FROM pg_check_table_report('test_table', true, true) ORDER BY blkno, offnum;
+RESET pg_check.online_cross_check;
+
+DROP TABLE test_expected;
+DROP TABLE test_table_src;
+DROP TABLE test_table;
+
+DROP EXTENSION pg_check;
@@ -0,0 +1,32 @@
+CREATE EXTENSION pg_check;
+
+-- the workers can't see uncommitted tables, so no transaction here
+CREATE TABLE test_table (
+    id      INT,
+    val     TEXT
+);
+
+INSERT INTO test_table SELECT i, md5(i::text) FROM generate_series(1,100000) s(i);
+
+CREATE TABLE test_table_small (
+    id      INT,
+    val     TEXT
+);
+
+INSERT INTO test_table_small SELECT i, md5(i::text) FROM generate_series(1,100) s(i);
+
+ANALYZE test_table;
+ANALYZE test_table_small;
+
+-- only the tables (each index would print a notice)
+SELECT pg_check_database(check_indexes => false);
+SELECT pg_check_database(workers => 2, check_indexes => false);
+SELECT pg_check_database(workers => 4, check_indexes => false, incremental => true);
+
+-- invalid number of workers
+SELECT pg_check_database(workers => -1);
+
+DROP TABLE test_table;
+DROP TABLE test_table_small;
+
+DROP EXTENSION pg_check;
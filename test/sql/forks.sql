@@ -0,0 +1,72 @@
+CREATE EXTENSION pg_check;
+
+CREATE TABLE test_table (
+    id      INT,
+    val     TEXT
+);
+
+INSERT INTO test_table SELECT i, md5(i::text) FROM generate_series(1,10000) s(i);
+
+-- creates the visibility map and the free space map
+VACUUM test_table;
+
+SELECT pg_check_table('test_table', false, false);
+
+-- all-frozen pages (and some of them modified since)
+VACUUM FREEZE test_table;
+
+DELETE FROM test_table WHERE id % 100 = 0;
+
+SELECT pg_check_table('test_table', false, false);
+SELECT pg_check_table('test_table', 0, 10);
+
+-- the vacuum truncates the table (and the VM and FSM with it)
+DELETE FROM test_table WHERE id > 5000;
+VACUUM test_table;
+
+SELECT pg_check_table('test_table', false, false);
+
+-- all-visible bits for pages that are not all-visible (the visibility map
+-- of a vacuumed table copied over the map of a table that was not vacuumed)
+CREATE TABLE test_vm_ok (id INT, val TEXT) WITH (autovacuum_enabled = false);
+CREATE TABLE test_vm_bad (id INT, val TEXT) WITH (autovacuum_enabled = false);
+
+INSERT INTO test_vm_ok SELECT i, md5(i::text) FROM generate_series(1,100) s(i);
+INSERT INTO test_vm_bad SELECT i, md5(i::text) FROM generate_series(1,100) s(i);
+
+VACUUM test_vm_ok;
+CHECKPOINT;
+
+DO $$
+DECLARE
+    lo  OID;
+    fd  INT;
+BEGIN
+    lo := lo_create(0);
+    fd := lo_open(lo, 131072);  -- INV_WRITE
+    PERFORM lowrite(fd, pg_read_binary_file(pg_relation_filepath('test_vm_ok') || '_vm'));
+    PERFORM lo_close(fd);
+    PERFORM lo_export(lo, pg_relation_filepath('test_vm_bad') || '_vm');
+    PERFORM lo_unlink(lo);
+END;
+$$;
+
+SELECT blkno, check_code, severity FROM pg_check_table_report('test_vm_bad');
+
+SET pg_check.check_visibility_map = off;
+
+SELECT pg_check_table('test_vm_bad', false, false);
+
+RESET pg_check.check_visibility_map;
+
+DROP TABLE test_vm_ok;
+DROP TABLE test_vm_bad;
+
+SET pg_check.check_visibility_map = off;
+SET pg_check.check_free_space_map = off;
+
+SELECT pg_check_table('test_table', false, false);
+
+DROP TABLE test_table;
+
+DROP EXTENSION pg_check;
@@ -0,0 +1,24 @@
+CREATE EXTENSION pg_check;
+
+CREATE TABLE test_table (
+    id      INT,
+    val     TEXT
+);
+
+INSERT INTO test_table SELECT i, md5(i::text) FROM generate_series(1,10000) s(i);
+
+CREATE INDEX test_table_index ON test_table (id);
+
+-- the first check has nothing to start from, checks all pages
+SELECT pg_check_table('test_table', true, false, incremental => true);
+
+UPDATE test_table SET val = md5(val) WHERE id % 100 = 0;
+INSERT INTO test_table SELECT i, md5(i::text) FROM generate_series(10001,11000) s(i);
+
+-- checks only the modified pages
+SELECT pg_check_table('test_table', true, false, incremental => true);
+SELECT pg_check_table('test_table', true, true, incremental => true);
+
+DROP TABLE test_table;
+
+DROP EXTENSION pg_check;
@@ -0,0 +1,43 @@
+BEGIN;
+
+CREATE EXTENSION pg_check;
+
+CREATE TABLE test_table (
+    id      INT,
+    arr     INT[],
+    r       INT4RANGE
+);
+
+-- NULLs and empty arrays are indexed by GIN too
+INSERT INTO test_table SELECT i, ARRAY[i % 100, i % 1000, i], int4range(i, i + 10) FROM generate_series(1,50000) s(i);
+INSERT INTO test_table SELECT i, (CASE WHEN i % 2 = 0 THEN '{}'::int[] ELSE NULL END), NULL FROM generate_series(1,1000) s(i);
+
+CREATE INDEX test_gin_index ON test_table USING gin (arr);
+CREATE INDEX test_gist_index ON test_table USING gist (r);
+
+-- hash indexes are not WAL-logged before 10 (WARNING)
+SET client_min_messages = error;
+CREATE INDEX test_hash_index ON test_table USING hash (id);
+RESET client_min_messages;
+
+CREATE INDEX test_brin_index ON test_table USING brin (id);
+
+-- the GIN pending list (fastupdate)
+INSERT INTO test_table SELECT i, ARRAY[i % 10, i], int4range(i, i + 1) FROM generate_series(1,1000) s(i);
+
+SELECT pg_check_index('test_gin_index');
+SELECT pg_check_index('test_gist_index');
+SELECT pg_check_index('test_hash_index');
+SELECT pg_check_index('test_brin_index');
+
+-- only the GIN and GiST indexes are cross-checked
+SELECT pg_check_table('test_table', true, true);
+
+SET pg_check.cross_check_method = sort;
+SELECT pg_check_table('test_table', true, true);
+RESET pg_check.cross_check_method;
+
+-- the structure check supports only b-tree indexes
+SELECT pg_check_index('test_gin_index', true);
+
+ROLLBACK;
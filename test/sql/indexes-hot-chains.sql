@@ -0,0 +1,26 @@
+BEGIN;
+
+CREATE EXTENSION pg_check;
+
+-- enough free space for several HOT updates of each row
+CREATE TABLE test_table (
+    id      INT,
+    id2     INT
+) WITH (fillfactor = 25);
+
+INSERT INTO test_table SELECT i, i FROM generate_series(1,10000) s(i);
+
+CREATE INDEX test_table_index ON test_table (id);
+
+-- long HOT chains, and with some rows updated more often than others
+-- the chain members end up in a different order than the roots
+UPDATE test_table SET id2 = -id2;
+UPDATE test_table SET id2 = -id2 WHERE id % 2 = 0;
+UPDATE test_table SET id2 = -id2 WHERE id % 3 = 0;
+UPDATE test_table SET id2 = -id2;
+
+SELECT pg_check_table('test_table', true, true);
+
+DROP TABLE test_table;
+
+ROLLBACK;
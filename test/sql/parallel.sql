@@ -0,0 +1,23 @@
+CREATE EXTENSION pg_check;
+
+-- the workers can't see uncommitted tables, so no transaction here
+CREATE TABLE test_table (
+    id      INT,
+    val     TEXT
+);
+
+INSERT INTO test_table SELECT i, md5(i::text) FROM generate_series(1,100000) s(i);
+
+CREATE INDEX test_table_index ON test_table (id);
+
+SELECT pg_check_table('test_table', false, false, 4);
+
+-- the stats include the blocks checked by the workers
+SELECT pages = pg_relation_size('test_table') / current_setting('block_size')::int AS all_pages, tuples
+  FROM pg_check_stats();
+SELECT pg_check_table('test_table', true, false, 2);
+SELECT pg_check_table('test_table', true, true, 0);
+
+DROP TABLE test_table;
+
+DROP EXTENSION pg_check;
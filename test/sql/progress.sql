@@ -0,0 +1,27 @@
+-- needs the shared memory (run by "make check-preload")
+CREATE EXTENSION pg_check;
+
+CREATE TABLE test_table (
+    id      INT,
+    val     TEXT
+);
+
+INSERT INTO test_table SELECT i, md5(i::text) FROM generate_series(1,10000) s(i);
+
+CREATE SEQUENCE test_sequence;
+
+-- the slot is cleared once the check completes
+SELECT pg_check_table('test_table', false, false);
+
+SELECT relid, phase FROM pg_stat_progress_check WHERE pid = pg_backend_pid();
+
+-- and when the check fails (at the end of the transaction)
+SELECT pg_check_table('test_sequence', false, false);
+
+SELECT relid, phase FROM pg_stat_progress_check WHERE pid = pg_backend_pid();
+
+DROP SEQUENCE test_sequence;
+
+DROP TABLE test_table;
+
+DROP EXTENSION pg_check;
@@ -0,0 +1,20 @@
+BEGIN;
+
+CREATE EXTENSION pg_check;
+
+CREATE TABLE test_table (
+    id      INT,
+    val     TEXT
+);
+
+INSERT INTO test_table SELECT i, md5(i::text) FROM generate_series(1,10000) s(i);
+
+CREATE INDEX test_table_index ON test_table (id);
+
+SELECT * FROM pg_check_table_report('test_table');
+SELECT * FROM pg_check_table_report('test_table', true, true);
+SELECT * FROM pg_check_index_report('test_table_index');
+
+DROP TABLE test_table;
+
+ROLLBACK;
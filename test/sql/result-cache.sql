@@ -0,0 +1,40 @@
+BEGIN;
+
+CREATE EXTENSION pg_check;
+
+CREATE TABLE test_table (
+    id      INT,
+    val     TEXT
+);
+
+INSERT INTO test_table SELECT i, md5(i::text) FROM generate_series(1,10000) s(i);
+
+CREATE INDEX test_table_index ON test_table (id);
+
+-- the first checks read and check all the pages
+SELECT pg_check_table('test_table', false, false);
+SELECT pages > 0 AS checked FROM pg_check_stats();
+
+SELECT pg_check_index('test_table_index');
+SELECT pages > 0 AS checked FROM pg_check_stats();
+
+-- repeated checks only read the page LSNs (no pages checked)
+SELECT pg_check_table('test_table', false, false);
+SELECT pages = 0 AS cached FROM pg_check_stats();
+
+SELECT pg_check_index('test_table_index');
+SELECT pages = 0 AS cached FROM pg_check_stats();
+
+-- modified (and truncated) relations are checked again
+INSERT INTO test_table SELECT i, md5(i::text) FROM generate_series(1,100) s(i);
+
+SELECT pg_check_table('test_table', false, false);
+SELECT pages > 0 AS checked FROM pg_check_stats();
+
+TRUNCATE test_table;
+
+SELECT pg_check_table('test_table', true, false);
+
+DROP TABLE test_table;
+
+ROLLBACK;
@@ -0,0 +1,61 @@
+BEGIN;
+
+CREATE EXTENSION pg_check;
+
+CREATE TABLE test_table (
+    id      INT,
+    val     TEXT
+);
+
+INSERT INTO test_table SELECT i, md5(i::text) FROM generate_series(1,10000) s(i);
+
+CREATE INDEX test_table_index ON test_table (id);
+
+-- save the position every 10 blocks (removed once the checks complete)
+SET pg_check.checkpoint_blocks = 10;
+
+SELECT pg_check_table('test_table', true, false);
+SELECT pg_check_index('test_table_index');
+
+-- the cross-check is not resumable (but works as usual)
+SELECT pg_check_table('test_table', true, true);
+
+-- nothing to resume after a completed check
+SELECT pg_check_resume('test_table');
+
+ROLLBACK;
+
+-- an interrupted check (throttled, so that the timeout cancels it after a
+-- few blocks, with the position saved every 2 blocks)
+CREATE EXTENSION pg_check;
+
+CREATE TABLE test_resume (
+    id      INT,
+    val     TEXT
+);
+
+INSERT INTO test_resume SELECT i, md5(i::text) FROM generate_series(1,10000) s(i);
+
+SET pg_check.checkpoint_blocks = 2;
+SET pg_check.cost_delay = 100;
+SET pg_check.cost_limit = 1;
+SET statement_timeout = '1s';
+
+SELECT pg_check_table('test_resume', false, false);
+
+RESET statement_timeout;
+RESET pg_check.cost_delay;
+RESET pg_check.cost_limit;
+
+-- continues from the saved position (the block depends on the timing, so
+-- hide the NOTICE)
+SET client_min_messages = warning;
+SELECT pg_check_resume('test_resume');
+RESET client_min_messages;
+
+-- the cursor is removed once the check completes
+SELECT pg_check_resume('test_resume');
+
+DROP TABLE test_resume;
+
+DROP EXTENSION pg_check;
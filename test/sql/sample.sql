@@ -0,0 +1,58 @@
+BEGIN;
+
+CREATE EXTENSION pg_check;
+
+CREATE TABLE test_table (
+    id      INT,
+    val     TEXT
+);
+
+INSERT INTO test_table SELECT i, md5(i::text) FROM generate_series(1,10000) s(i);
+
+CREATE INDEX test_table_index ON test_table (id);
+
+SET pg_check.sample_percent = 10;
+
+-- all pages read, only some get the tuple checks
+SELECT pg_check_table('test_table', false, false);
+
+SELECT pages = pg_relation_size('test_table') / current_setting('block_size')::int AS all_pages,
+       tuples < 10000 AS sampled
+  FROM pg_check_stats();
+
+-- only the sampled pages read
+SET pg_check.unsampled_pages = skip;
+SET pg_check.sample_method = stratified;
+
+SELECT pg_check_table('test_table', false, false);
+
+SELECT pages < pg_relation_size('test_table') / current_setting('block_size')::int AS some_pages
+  FROM pg_check_stats();
+
+SELECT pg_check_index('test_table_index');
+
+-- the cross-check needs all the items
+SELECT pg_check_table('test_table', true, true);
+
+ROLLBACK;
+
+BEGIN;
+
+CREATE EXTENSION pg_check;
+
+CREATE TABLE test_table (
+    id      INT,
+    val     TEXT
+);
+
+INSERT INTO test_table SELECT i, md5(i::text) FROM generate_series(1,10000) s(i);
+
+-- nothing to stop at
+SET pg_check.max_errors = 1;
+
+SELECT pg_check_table('test_table', false, false);
+
+SELECT pages = pg_relation_size('test_table') / current_setting('block_size')::int AS all_pages
+  FROM pg_check_stats();
+
+ROLLBACK;
@@ -0,0 +1,30 @@
+BEGIN;
+
+CREATE EXTENSION pg_check;
+
+CREATE TABLE test_table (
+    id      INT,
+    val     TEXT
+);
+
+INSERT INTO test_table SELECT i, md5(i::text) FROM generate_series(1,10000) s(i);
+
+CREATE INDEX test_table_index ON test_table (id);
+
+SET pg_check.track_timing = on;
+
+SELECT pg_check_table('test_table', true, true);
+
+SELECT pages > 0 AS pages, tuples, attributes, (buffer_hits + buffer_misses) > 0 AS buffers,
+       read_time IS NOT NULL AS timed, bitmap_compare_time >= 0 AS compared
+  FROM pg_check_stats();
+
+SET pg_check.track_timing = off;
+
+SELECT pg_check_index('test_table_index');
+
+SELECT pages > 0 AS pages, tuples, read_time IS NULL AS not_timed FROM pg_check_stats();
+
+DROP TABLE test_table;
+
+ROLLBACK;
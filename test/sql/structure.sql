@@ -0,0 +1,30 @@
+BEGIN;
+
+CREATE EXTENSION pg_check;
+
+CREATE TABLE test_table (
+    id      INT,
+    val     TEXT
+);
+
+-- enough items for a multi-level tree (the inserts below split the pages)
+INSERT INTO test_table SELECT i, md5(i::text) FROM generate_series(1,100000) s(i);
+
+DELETE FROM test_table WHERE id % 3 = 0;
+
+CREATE INDEX test_table_id_index ON test_table (id);
+CREATE INDEX test_table_val_index ON test_table (val);
+
+INSERT INTO test_table SELECT i, md5(i::text) FROM generate_series(1,100000,3) s(i);
+
+SELECT pg_check_index('test_table_id_index', true);
+SELECT pg_check_index('test_table_val_index', true);
+
+-- empty index
+CREATE INDEX test_table_empty_index ON test_table (id) WHERE id < 0;
+
+SELECT pg_check_index('test_table_empty_index', true);
+
+DROP TABLE test_table;
+
+ROLLBACK;
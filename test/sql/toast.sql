@@ -0,0 +1,37 @@
+CREATE EXTENSION pg_check;
+
+-- not compressed, so that each value is stored in several chunks
+CREATE TABLE test_toast (
+    id      INT,
+    val     TEXT
+);
+
+ALTER TABLE test_toast ALTER COLUMN val SET STORAGE EXTERNAL;
+
+INSERT INTO test_toast SELECT i, repeat(md5(i::text), 100 + i % 50) FROM generate_series(1,1000) s(i);
+
+-- the new versions share the TOAST values with the old ones
+UPDATE test_toast SET id = -id WHERE id % 10 = 0;
+
+-- only values of tuples known to be live (from hint bits) are verified
+SELECT COUNT(*) FROM test_toast;
+
+SET pg_check.check_toast = on;
+
+SELECT pg_check_table('test_toast', false, false);
+
+-- remove the first chunk of a value (as superuser), the vacuum makes sure
+-- it's gone even for the SnapshotAny scan of the TOAST index
+SELECT reltoastrelid::regclass AS toast_table FROM pg_class WHERE relname = 'test_toast' \gset
+
+DELETE FROM :toast_table WHERE chunk_seq = 0 AND chunk_id = (SELECT min(chunk_id) FROM :toast_table);
+
+VACUUM :toast_table;
+
+SELECT check_code FROM pg_check_table_report('test_toast');
+
+SET pg_check.check_toast = off;
+
+DROP TABLE test_toast;
+
+DROP EXTENSION pg_check;
@@ -0,0 +1,28 @@
+BEGIN;
+
+-- the old version first (the library is the current one)
+CREATE EXTENSION pg_check VERSION '0.1.0';
+
+CREATE TABLE test_table (
+    id      INT
+);
+
+INSERT INTO test_table SELECT i FROM generate_series(1,10000) s(i);
+
+CREATE INDEX test_table_index ON test_table (id);
+
+-- the 0.1.0 definitions don't pass the new arguments
+SELECT pg_check_table('test_table', true, true);
+SELECT pg_check_index('test_table_index');
+
+ALTER EXTENSION pg_check UPDATE TO '0.2.0';
+
+SELECT pg_check_table('test_table', true, true);
+SELECT pg_check_table('test_table', false, false, 0, false);
+SELECT pg_check_index('test_table_index');
+SELECT pg_check_index('test_table_index', true);
+SELECT count(*) FROM pg_check_table_report('test_table', true, true);
+
+DROP TABLE test_table;
+
+ROLLBACK;